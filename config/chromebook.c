@@ -21,14 +21,20 @@
 struct {
 	struct jailhouse_system ALIGN header;
 	__u64 ALIGN cpus[1];
-	struct jailhouse_memory ALIGN mem_regions[1];
+	struct jailhouse_memory ALIGN mem_regions[3];
 } ALIGN config = {
 	.header = {
 		.hypervisor_memory = {
 			.phys_start = 0xbc000000,
 			.size = 0x4000000,
 		},
+		.flags = JAILHOUSE_SYS_VTD_COMPAT_MSI,
 		.system = {
+			.signature = JAILHOUSE_CELL_DESC_SIGNATURE,
+			.revision = JAILHOUSE_CELL_DESC_REVISION,
+			.total_size = sizeof(config) -
+				sizeof(struct jailhouse_system) +
+				sizeof(struct jailhouse_cell_desc),
 			.name = "Samsung Chromebook",
 
 			.cpu_set_size = sizeof(config.cpus),
@@ -41,16 +47,30 @@ struct {
 	},
 
 	.cpus = {
-		0xf,
+		0x3,
 	},
 
 	.mem_regions = {
 		/* RAM */ {
+			.phys_start = 0x40000000,
+			.virt_start = 0x40000000,
+			.size = 0x7c000000,
+			.access_flags = JAILHOUSE_MEM_READ |
+				JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_EXECUTE,
+		},
+		/* devices up to the GIC distributor */ {
 			.phys_start = 0x0,
 			.virt_start = 0x0,
-			.size = 0x3c000000,
+			.size = 0x10481000,
 			.access_flags = JAILHOUSE_MEM_READ |
-				JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_EXECUTE,
+				JAILHOUSE_MEM_WRITE,
+		},
+		/* devices behind the GIC virtualization extensions */ {
+			.phys_start = 0x10488000,
+			.virt_start = 0x10488000,
+			.size = 0x2fb78000,
+			.access_flags = JAILHOUSE_MEM_READ |
+				JAILHOUSE_MEM_WRITE,
 		},
 	},
 };
@@ -34,7 +34,13 @@ struct {
 			.phys_start = 0xbf7de000,
 			.size = 0x21000,
 		},
+		.flags = JAILHOUSE_SYS_VTD_COMPAT_MSI,
 		.system = {
+			.signature = JAILHOUSE_CELL_DESC_SIGNATURE,
+			.revision = JAILHOUSE_CELL_DESC_REVISION,
+			.total_size = sizeof(config) -
+				sizeof(struct jailhouse_system) +
+				sizeof(struct jailhouse_cell_desc),
 			.name = "Celsius H700",
 
 			.cpu_set_size = sizeof(config.cpus),
@@ -42,6 +48,8 @@ struct {
 			.num_irq_lines = 0,
 			.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 			.num_pci_devices = ARRAY_SIZE(config.pci_devices),
+			.flags = JAILHOUSE_CELL_LAZY_EPT |
+				JAILHOUSE_CELL_PMU_PASSTHROUGH,
 		},
 	},
 
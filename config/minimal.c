@@ -25,6 +25,9 @@ struct {
 	__u8 ALIGN pio_bitmap[0x2000];
 } ALIGN config = {
 	.cell = {
+		.signature = JAILHOUSE_CELL_DESC_SIGNATURE,
+		.revision = JAILHOUSE_CELL_DESC_REVISION,
+		.total_size = sizeof(config),
 		.name = "Minimal",
 
 		.cpu_set_size = sizeof(config.cpus),
@@ -33,6 +36,10 @@ struct {
 		.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 
 		.num_pci_devices = 0,
+
+		/* the demos idle in hlt */
+		.flags = JAILHOUSE_CELL_HLT_EXITING,
+		.idle_mwait_hint = 0x10, /* C2 */
 	},
 
 	.cpus = {
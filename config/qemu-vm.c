@@ -37,7 +37,13 @@ struct {
 			.phys_start = 0x3fffe000,
 			.size = 0x2000,
 		},
+		.flags = JAILHOUSE_SYS_VTD_COMPAT_MSI,
 		.system = {
+			.signature = JAILHOUSE_CELL_DESC_SIGNATURE,
+			.revision = JAILHOUSE_CELL_DESC_REVISION,
+			.total_size = sizeof(config) -
+				sizeof(struct jailhouse_system) +
+				sizeof(struct jailhouse_cell_desc),
 			.name = "QEMU Linux VM",
 
 			.cpu_set_size = sizeof(config.cpus),
@@ -46,6 +52,7 @@ struct {
 			.pio_bitmap_size = ARRAY_SIZE(config.pio_bitmap),
 
 			.num_pci_devices = 0,
+			.flags = JAILHOUSE_CELL_PMU_PASSTHROUGH,
 		},
 	},
 
@@ -0,0 +1,315 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/mcs-lock.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/processor.h>
+#include <asm/bitops.h>
+#include <asm/control.h>
+#include <asm/gic.h>
+#include <asm/mmu_cell.h>
+#include <asm/psci.h>
+
+/* let the target pass through its event processing once */
+void arch_kick_cpu(unsigned int cpu_id)
+{
+	gic_send_sgi(cpu_id, SGI_EVENT);
+}
+
+static void arm_request_stop(unsigned int cpu_id)
+{
+	struct mcs_node node;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+	bool target_stopped;
+
+	mcs_lock(&target_data->control_lock, &node);
+
+	target_data->stop_cpu = true;
+	target_stopped = target_data->cpu_stopped;
+
+	mcs_unlock(&target_data->control_lock, &node);
+
+	if (!target_stopped)
+		arch_kick_cpu(cpu_id);
+}
+
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int cpu;
+
+	/* kick all targets first, then collect their acknowledgements */
+	for_each_cpu_except(cpu, cpu_set, exception)
+		arm_request_stop(cpu);
+
+	for_each_cpu_except(cpu, cpu_set, exception)
+		cpu_wait_while(!per_cpu(cpu)->cpu_stopped,
+			       &per_cpu(cpu)->cpu_stopped);
+}
+
+void arch_resume_cpu(unsigned int cpu_id)
+{
+	/* make any state changes visible before releasing the CPU */
+	memory_barrier();
+
+	per_cpu(cpu_id)->stop_cpu = false;
+}
+
+/* target cpu has to be stopped */
+void arch_reset_cpu(unsigned int cpu_id)
+{
+	struct mcs_node node;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	/* all CPUs of a cell start at the beginning of its image */
+	mcs_lock(&target_data->control_lock, &node);
+	target_data->wait_for_sipi = false;
+	target_data->cpu_on_entry = 0;
+	target_data->cpu_on_context = 0;
+	mcs_unlock(&target_data->control_lock, &node);
+
+	arch_resume_cpu(cpu_id);
+}
+
+/* target cpu has to be stopped */
+void arch_park_cpu(unsigned int cpu_id)
+{
+	struct mcs_node node;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	/* wait for PSCI CPU_ON from the new owner */
+	mcs_lock(&target_data->control_lock, &node);
+	target_data->wait_for_sipi = true;
+	target_data->cpu_on_entry = INVALID_PHYS_ADDR;
+	mcs_unlock(&target_data->control_lock, &node);
+
+	/* drop TLB entries of the former cell before its VMID is reused */
+	target_data->flush_caches = true;
+
+	arch_resume_cpu(cpu_id);
+}
+
+void arch_shutdown_cpus(struct cpu_set *cpu_set)
+{
+	unsigned int cpu;
+
+	arch_suspend_cpus(cpu_set, -1);
+	for_each_cpu(cpu, cpu_set) {
+		per_cpu(cpu)->shutdown_cpu = true;
+		arch_resume_cpu(cpu);
+	}
+}
+
+unsigned int arch_cpu_phys_id(unsigned int cpu_id)
+{
+	return per_cpu(cpu_id)->mpidr & MPIDR_AFF_MASK;
+}
+
+void arch_cell_doorbell(struct per_cpu *cpu_data, struct cell *cell)
+{
+	unsigned int cpu = next_cpu(-1, cell->cpu_set, -1);
+
+	/* the first CPU of a cell receives its doorbells */
+	trace_event(cpu_data, JAILHOUSE_TRACE_DOORBELL, cell->id, cpu);
+	gic_send_sgi(cpu, cell->doorbell_vector);
+}
+
+/* returns the entry address to reset the CPU to, or INVALID_PHYS_ADDR */
+unsigned long arm_handle_events(struct per_cpu *cpu_data)
+{
+	struct mcs_node node;
+	unsigned long entry;
+
+	mcs_lock(&cpu_data->control_lock, &node);
+
+	cpu_data->cpu_stopped = true;
+
+	mcs_unlock(&cpu_data->control_lock, &node);
+
+	cpu_wait_while(cpu_data->wait_for_sipi || cpu_data->stop_cpu,
+		       &cpu_data->stop_cpu);
+
+	if (cpu_data->shutdown_cpu) {
+		gic_cpu_exit(cpu_data);
+		arm_write_sysreg(HCR, 0);
+		/* parked until the hypervisor memory is gone */
+		while (1)
+			asm volatile("wfi");
+	}
+
+	mcs_lock(&cpu_data->control_lock, &node);
+
+	cpu_data->cpu_stopped = false;
+
+	entry = cpu_data->cpu_on_entry;
+	cpu_data->cpu_on_entry = INVALID_PHYS_ADDR;
+
+	mcs_unlock(&cpu_data->control_lock, &node);
+
+	/* the cell assignment may have changed */
+	if (cpu_data->flush_caches) {
+		cpu_data->flush_caches = false;
+		arm_cpu_mmu_update(cpu_data);
+	}
+
+	return entry;
+}
+
+void arm_cpu_off(struct per_cpu *cpu_data)
+{
+	struct mcs_node node;
+
+	mcs_lock(&cpu_data->control_lock, &node);
+	cpu_data->wait_for_sipi = true;
+	mcs_unlock(&cpu_data->control_lock, &node);
+}
+
+static struct per_cpu *arm_cpu_by_mpidr(struct per_cpu *cpu_data,
+					unsigned long mpidr)
+{
+	unsigned int cpu;
+
+	for_each_cpu(cpu, cpu_data->cell->cpu_set)
+		if ((per_cpu(cpu)->mpidr & MPIDR_AFF_MASK) ==
+		    (mpidr & MPIDR_AFF_MASK))
+			return per_cpu(cpu);
+	return NULL;
+}
+
+int arm_cpu_on(struct per_cpu *cpu_data, unsigned long mpidr,
+	       unsigned long entry, unsigned long context)
+{
+	struct mcs_node node;
+	struct per_cpu *target_data = arm_cpu_by_mpidr(cpu_data, mpidr);
+	int result = PSCI_SUCCESS;
+
+	if (!target_data)
+		return PSCI_INVALID_PARAMETERS;
+
+	mcs_lock(&target_data->control_lock, &node);
+	if (target_data->wait_for_sipi) {
+		target_data->cpu_on_entry = entry;
+		target_data->cpu_on_context = context;
+		target_data->wait_for_sipi = false;
+	} else
+		result = PSCI_ALREADY_ON;
+	mcs_unlock(&target_data->control_lock, &node);
+
+	return result;
+}
+
+int arm_cpu_state(struct per_cpu *cpu_data, unsigned long mpidr)
+{
+	struct per_cpu *target_data = arm_cpu_by_mpidr(cpu_data, mpidr);
+
+	if (!target_data)
+		return PSCI_INVALID_PARAMETERS;
+
+	return target_data->wait_for_sipi ? PSCI_AFFINITY_OFF :
+		PSCI_AFFINITY_ON;
+}
+
+int arch_cpu_get_state(unsigned int cpu_id, struct jailhouse_cpu_state *state)
+{
+	return -ENOSYS;
+}
+
+int arch_cpu_set_state(struct per_cpu *cpu_data, unsigned int cpu_id,
+		       const struct jailhouse_cpu_state *state)
+{
+	return -ENOSYS;
+}
+
+int arch_cell_dirty_log(struct per_cpu *cpu_data, struct cell *cell,
+			struct jailhouse_dirty_log *log, u64 *bitmap)
+{
+	return -ENOSYS;
+}
+
+int arch_cell_add_cpu(struct per_cpu *cpu_data, struct cell *cell,
+		      unsigned int cpu_id)
+{
+	return -ENOSYS;
+}
+
+int arch_cell_remove_cpu(struct per_cpu *cpu_data, struct cell *cell,
+			 unsigned int cpu_id)
+{
+	return -ENOSYS;
+}
+
+int arch_profile_set(struct per_cpu *cpu_data, unsigned long period)
+{
+	return -ENOSYS;
+}
+
+long arch_profile_read(unsigned int cpu_id,
+		       struct jailhouse_profile_read *read,
+		       unsigned int max_samples)
+{
+	return -ENOSYS;
+}
+
+/* the root cell is still running, only build the new cell's structures */
+int arch_cell_create(struct per_cpu *cpu_data, struct cell *new_cell,
+		     struct jailhouse_cell_desc *config)
+{
+	int err;
+
+	if (config->doorbell_vector >= SGI_EVENT)
+		return -EINVAL;
+
+	/* registers no more than MMIO regions, released by the caller */
+	err = gic_cell_init(new_cell);
+	if (err)
+		return err;
+
+	return arm_cell_mmu_init(new_cell, config);
+}
+
+/* called for consecutive parts of the regions after arch_cell_create */
+int arch_map_memory_region(struct cell *cell,
+			   const struct jailhouse_memory *mem)
+{
+	return arm_map_memory_region(cell, mem);
+}
+
+/* undoes arch_cell_create, the root cell has not given up anything yet */
+void arch_cell_abort(struct per_cpu *cpu_data, struct cell *cell)
+{
+	arm_cell_mmu_destroy(cell, cell->config);
+}
+
+/* the root cell is suspended, take the resources of the new cell from it */
+void arch_cell_commit(struct per_cpu *cpu_data, struct cell *new_cell,
+		      struct jailhouse_cell_desc *config)
+{
+	arm_cell_mmu_shrink(cpu_data->cell, config);
+	gic_cell_commit(new_cell);
+}
+
+void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell)
+{
+	gic_cell_exit(cell);
+	arm_cell_mmu_exit(cell);
+}
+
+int arch_cell_stop(struct per_cpu *cpu_data, struct cell *cell)
+{
+	return arm_cell_set_loadable(cell);
+}
+
+void arch_cell_start(struct per_cpu *cpu_data, struct cell *cell)
+{
+	arm_cell_clear_loadable(cell);
+}
@@ -0,0 +1,76 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/processor.h>
+#include <asm/platform.h>
+#include <asm/setup.h>
+
+/* Samsung UART */
+#define  UART_UTRSTAT		0x10
+#define  UART_UTRSTAT_TX_EMPTY	0x4
+#define  UART_UTXH		0x20
+
+static void *uart;
+
+/*
+ * The UART is only reachable via the hypervisor page table. Output
+ * produced before, i.e. during setup in SVC mode, is kept until then.
+ */
+static char early_buffer[4096];
+static unsigned int early_len;
+
+void arch_dbg_write_init(void)
+{
+	/* already configured by Linux */
+}
+
+int arm_dbg_write_map(void)
+{
+	uart = arm_map_device(UART_BASE, PAGE_SIZE);
+	return uart ? 0 : -ENOMEM;
+}
+
+static void uart_write(const char *msg)
+{
+	char c;
+
+	while (1) {
+		c = *msg++;
+		if (!c)
+			break;
+		while (!(mmio_read32(uart + UART_UTRSTAT) &
+			 UART_UTRSTAT_TX_EMPTY))
+			cpu_relax();
+		if (panic_in_progress && panic_cpu != phys_processor_id())
+			break;
+		mmio_write32(uart + UART_UTXH, c);
+	}
+}
+
+void arch_dbg_write(const char *msg)
+{
+	if (!uart || !is_hyp_mode()) {
+		while (*msg && early_len < sizeof(early_buffer) - 1)
+			early_buffer[early_len++] = *msg++;
+		return;
+	}
+
+	if (early_len > 0) {
+		early_buffer[early_len] = 0;
+		early_len = 0;
+		uart_write(early_buffer);
+	}
+	uart_write(msg);
+}
@@ -0,0 +1,55 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/printk.h>
+#include <jailhouse/processor.h>
+#include <asm/fault.h>
+#include <asm/sysregs.h>
+
+int phys_processor_id(void)
+{
+	u32 mpidr;
+
+	arm_read_sysreg(MPIDR, mpidr);
+	return mpidr & MPIDR_CPUID_MASK;
+}
+
+void exception_handler(struct registers *regs)
+{
+	unsigned long elr;
+	u32 hsr;
+
+	arm_read_sysreg(HSR, hsr);
+	asm volatile("mrs %0, elr_hyp" : "=r" (elr));
+
+	panic_printk("FATAL: Jailhouse triggered exception, HSR %x\n", hsr);
+	panic_printk("Physical CPU ID: %d\n", phys_processor_id());
+	panic_printk("PC: %p LR: %p\n", elr, regs->usr[13]);
+
+	panic_stop(NULL);
+}
+
+void panic_stop(struct per_cpu *cpu_data)
+{
+	panic_printk("Stopping CPU");
+	if (cpu_data) {
+		panic_printk(" %d", cpu_data->cpu_id);
+		cpu_data->cpu_stopped = true;
+	}
+	panic_printk("\n");
+
+	if (phys_processor_id() == panic_cpu)
+		panic_in_progress = 0;
+
+	asm volatile("1: wfi; b 1b");
+	__builtin_unreachable();
+}
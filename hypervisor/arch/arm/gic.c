@@ -0,0 +1,464 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/printk.h>
+#include <asm/bitops.h>
+#include <asm/gic.h>
+#include <asm/platform.h>
+#include <asm/setup.h>
+#include <asm/spinlock.h>
+
+#define GICH_LR(n)		(GICH_LR_BASE + (n) * 4)
+/* virtual ID and, for SGIs, the source CPU */
+#define GICH_LR_ID_MASK		0x1fff
+
+static void *gicd_base, *gicc_base, *gich_base;
+static unsigned int num_lrs;
+static unsigned int num_irqs;
+
+/* serializes read-modify-write updates of shared distributor registers */
+static DEFINE_SPINLOCK(dist_lock);
+
+int gic_init(void)
+{
+	gicd_base = arm_map_device(GICD_BASE, GICD_SIZE);
+	gicc_base = arm_map_device(GICC_BASE, GICC_SIZE);
+	gich_base = arm_map_device(GICH_BASE, GICH_SIZE);
+	if (!gicd_base || !gicc_base || !gich_base)
+		return -ENOMEM;
+
+	num_irqs = ((mmio_read32(gicd_base + GICD_TYPER) &
+		     GICD_TYPER_LINES_MASK) + 1) * 32;
+	if (num_irqs > GIC_MAX_IRQS)
+		num_irqs = GIC_MAX_IRQS;
+
+	return 0;
+}
+
+static void gic_clear_lrs(struct per_cpu *cpu_data)
+{
+	unsigned int n;
+	u32 lr;
+
+	/* interrupts forwarded in hardware would remain active otherwise */
+	for (n = 0; n < num_lrs; n++) {
+		lr = mmio_read32(gich_base + GICH_LR(n));
+		if (lr & GICH_LR_HW && lr & (GICH_LR_PENDING | GICH_LR_ACTIVE))
+			mmio_write32(gicc_base + GICC_DIR,
+				     (lr >> GICH_LR_PHYS_SHIFT) &
+				     GICH_LR_PHYS_MASK);
+		mmio_write32(gich_base + GICH_LR(n), 0);
+	}
+
+	for (n = 0; n < cpu_data->num_pending_irqs; n++) {
+		lr = cpu_data->pending_irqs[n];
+		if (lr & GICH_LR_HW)
+			mmio_write32(gicc_base + GICC_DIR,
+				     (lr >> GICH_LR_PHYS_SHIFT) &
+				     GICH_LR_PHYS_MASK);
+	}
+	cpu_data->num_pending_irqs = 0;
+}
+
+/* called in HYP mode, takes the CPU interface state over from Linux */
+void gic_cpu_init(struct per_cpu *cpu_data)
+{
+	u32 ctlr, pmr, bpr, vmcr;
+
+	/* the first target register is banked and read-only */
+	cpu_data->gic_cpu_mask =
+		mmio_read32(gicd_base + GICD_ITARGETSR) & 0xff;
+
+	num_lrs = (mmio_read32(gich_base + GICH_VTR) &
+		   GICH_VTR_LISTREGS_MASK) + 1;
+	gic_clear_lrs(cpu_data);
+
+	ctlr = mmio_read32(gicc_base + GICC_CTLR);
+	pmr = mmio_read32(gicc_base + GICC_PMR);
+	bpr = mmio_read32(gicc_base + GICC_BPR);
+
+	vmcr = (pmr >> 3) << GICH_VMCR_PMR_SHIFT;
+	vmcr |= (bpr & 0x7) << GICH_VMCR_BPR_SHIFT;
+	if (ctlr & 1)
+		vmcr |= GICH_VMCR_ENABLE;
+	mmio_write32(gich_base + GICH_VMCR, vmcr);
+	mmio_write32(gich_base + GICH_HCR, GICH_HCR_EN);
+
+	/* priority drop on EOIR, deactivation by the guest or on DIR */
+	mmio_write32(gicc_base + GICC_CTLR, ctlr | GICC_CTLR_EOIMODE);
+
+	mmio_write32(gicd_base + GICD_ISENABLER, 1 << GIC_MAINT_IRQ);
+}
+
+void gic_cpu_reset(struct per_cpu *cpu_data)
+{
+	gic_clear_lrs(cpu_data);
+	mmio_write32(gich_base + GICH_VMCR, 0);
+	mmio_write32(gich_base + GICH_HCR, GICH_HCR_EN);
+}
+
+/* called in HYP mode, hands the CPU interface back to Linux */
+void gic_cpu_exit(struct per_cpu *cpu_data)
+{
+	u32 ctlr, vmcr;
+
+	mmio_write32(gicd_base + GICD_ICENABLER, 1 << GIC_MAINT_IRQ);
+	gic_clear_lrs(cpu_data);
+
+	vmcr = mmio_read32(gich_base + GICH_VMCR);
+	ctlr = mmio_read32(gicc_base + GICC_CTLR) & ~(GICC_CTLR_EOIMODE | 1);
+	if (vmcr & GICH_VMCR_ENABLE)
+		ctlr |= 1;
+
+	mmio_write32(gicc_base + GICC_PMR,
+		     (vmcr >> GICH_VMCR_PMR_SHIFT) << 3);
+	mmio_write32(gicc_base + GICC_BPR, (vmcr >> GICH_VMCR_BPR_SHIFT) & 0x7);
+	mmio_write32(gicc_base + GICC_CTLR, ctlr);
+
+	mmio_write32(gich_base + GICH_HCR, 0);
+}
+
+void gic_send_sgi(unsigned int cpu_id, unsigned int sgi)
+{
+	/* the target has to observe everything written before */
+	asm volatile("dsb ish" : : : "memory");
+	mmio_write32(gicd_base + GICD_SGIR,
+		     (per_cpu(cpu_id)->gic_cpu_mask <<
+		      GICD_SGIR_TARGET_SHIFT) | sgi);
+}
+
+static bool gic_inject(u32 lr)
+{
+	u32 elsr = mmio_read32(gich_base + GICH_ELSR0);
+	unsigned int n, free = num_lrs;
+	u32 cur;
+
+	for (n = 0; n < num_lrs; n++) {
+		if (elsr & (1 << n)) {
+			if (free == num_lrs)
+				free = n;
+			continue;
+		}
+		/* an SGI that is still pending or active is merged */
+		cur = mmio_read32(gich_base + GICH_LR(n));
+		if (!(lr & GICH_LR_HW) &&
+		    (cur & GICH_LR_ID_MASK) == (lr & GICH_LR_ID_MASK)) {
+			mmio_write32(gich_base + GICH_LR(n),
+				     cur | GICH_LR_PENDING);
+			return true;
+		}
+	}
+	if (free == num_lrs)
+		return false;
+
+	mmio_write32(gich_base + GICH_LR(free), lr | GICH_LR_PENDING |
+		     (GIC_INJECT_PRIO >> 3) << GICH_LR_PRIO_SHIFT);
+	return true;
+}
+
+static void gic_queue(struct per_cpu *cpu_data, u32 lr)
+{
+	if (cpu_data->num_pending_irqs == 0 && gic_inject(lr))
+		return;
+
+	if (cpu_data->num_pending_irqs < PERCPU_PENDING_IRQS) {
+		cpu_data->pending_irqs[cpu_data->num_pending_irqs++] = lr;
+		return;
+	}
+
+	/* overflow, drop it but do not leave the line blocked */
+	if (lr & GICH_LR_HW)
+		mmio_write32(gicc_base + GICC_DIR,
+			     (lr >> GICH_LR_PHYS_SHIFT) & GICH_LR_PHYS_MASK);
+}
+
+bool gic_handle_irq(struct per_cpu *cpu_data)
+{
+	bool event = false;
+	u32 iar, irq;
+
+	while (1) {
+		iar = mmio_read32(gicc_base + GICC_IAR);
+		irq = iar & GICC_IAR_IRQ_MASK;
+		if (irq >= GIC_SPURIOUS_IRQ)
+			break;
+
+		mmio_write32(gicc_base + GICC_EOIR, iar);
+
+		if (irq < GIC_NUM_SGIS) {
+			/* virtual SGIs are not linked to the physical ones */
+			mmio_write32(gicc_base + GICC_DIR, iar);
+			if (irq == SGI_EVENT)
+				event = true;
+			else
+				gic_queue(cpu_data, iar & GICH_LR_ID_MASK);
+		} else if (irq == GIC_MAINT_IRQ) {
+			/* list registers ran empty, refilled before entry */
+			mmio_write32(gicc_base + GICC_DIR, iar);
+			mmio_write32(gich_base + GICH_HCR, GICH_HCR_EN);
+		} else if (irq >= GIC_NUM_PRIVATE_IRQS &&
+			   !test_bit(irq, cpu_data->cell->gic.irq_bitmap)) {
+			/* still in flight while being handed over */
+			mmio_write32(gicc_base + GICC_DIR, iar);
+		} else
+			gic_queue(cpu_data, GICH_LR_HW |
+				  (irq << GICH_LR_PHYS_SHIFT) | irq);
+	}
+
+	return event;
+}
+
+void gic_inject_pending(struct per_cpu *cpu_data)
+{
+	u32 *pending = cpu_data->pending_irqs;
+	unsigned int n, injected;
+
+	for (injected = 0; injected < cpu_data->num_pending_irqs; injected++)
+		if (!gic_inject(pending[injected]))
+			break;
+
+	for (n = injected; n < cpu_data->num_pending_irqs; n++)
+		pending[n - injected] = pending[n];
+	cpu_data->num_pending_irqs -= injected;
+
+	/* ask for a maintenance interrupt to inject the rest */
+	if (cpu_data->num_pending_irqs > 0)
+		mmio_write32(gich_base + GICH_HCR, GICH_HCR_EN | GICH_HCR_UIE);
+}
+
+/* the hypervisor's own interrupts are hidden from all cells */
+static bool gic_irq_accessible(struct cell *cell, unsigned int irq)
+{
+	if (irq == SGI_EVENT || irq == GIC_MAINT_IRQ)
+		return false;
+	if (irq < GIC_NUM_PRIVATE_IRQS)
+		return true;
+	return irq < GIC_MAX_IRQS && test_bit(irq, cell->gic.irq_bitmap);
+}
+
+/* bits of a per-interrupt register the cell may access */
+static u32 gic_irq_mask(struct cell *cell, unsigned int first_irq,
+			unsigned int bits_per_irq, unsigned int size)
+{
+	unsigned int n;
+	u32 mask = 0;
+
+	for (n = 0; n < size * 8 / bits_per_irq; n++)
+		if (gic_irq_accessible(cell, first_irq + n))
+			mask |= ((1UL << bits_per_irq) - 1) <<
+				(n * bits_per_irq);
+	return mask;
+}
+
+/* CPU interfaces of the cell, in ITARGETSR and SGIR encoding */
+static u32 gic_cell_targets(struct cell *cell)
+{
+	unsigned int cpu;
+	u32 targets = 0;
+
+	for_each_cpu(cpu, cell->cpu_set)
+		targets |= per_cpu(cpu)->gic_cpu_mask;
+	return targets;
+}
+
+static u32 gic_dist_read(unsigned long offset, unsigned int size)
+{
+	if (size == 1)
+		return mmio_read8(gicd_base + offset);
+	return mmio_read32(gicd_base + offset);
+}
+
+static void gic_dist_write(unsigned long offset, unsigned int size, u32 value)
+{
+	if (size == 1)
+		mmio_write8(gicd_base + offset, value);
+	else
+		mmio_write32(gicd_base + offset, value);
+}
+
+static void gic_handle_sgir(struct per_cpu *cpu_data, u32 value)
+{
+	unsigned int sgi = value & GICD_SGIR_SGI_MASK;
+	u32 targets;
+
+	if (sgi == SGI_EVENT)
+		return;
+
+	switch ((value >> GICD_SGIR_FILTER_SHIFT) & 0x3) {
+	case GICD_SGIR_FILTER_LIST:
+		targets = value >> GICD_SGIR_TARGET_SHIFT;
+		break;
+	case GICD_SGIR_FILTER_OTHERS:
+		targets = ~cpu_data->gic_cpu_mask;
+		break;
+	case GICD_SGIR_FILTER_SELF:
+		targets = cpu_data->gic_cpu_mask;
+		break;
+	default:
+		return;
+	}
+
+	/* only CPUs of the own cell can be reached */
+	targets &= gic_cell_targets(cpu_data->cell) & 0xff;
+	if (targets)
+		mmio_write32(gicd_base + GICD_SGIR,
+			     (targets << GICD_SGIR_TARGET_SHIFT) | sgi);
+}
+
+static bool gic_handle_dist_access(struct per_cpu *cpu_data, void *arg,
+				   unsigned long offset, unsigned int size,
+				   bool is_write, unsigned long *value)
+{
+	unsigned int first_irq, bits_per_irq;
+	u32 mask, targets;
+
+	if ((size != 1 && size != 4) || offset & (size - 1)) {
+		panic_printk("FATAL: Invalid GICD access, offset %x size %d\n",
+			     offset, size);
+		return false;
+	}
+
+	if (offset >= GICD_IGROUPR && offset < GICD_IPRIORITYR) {
+		first_irq = (offset & 0x7f) * 8;
+		bits_per_irq = 1;
+	} else if (offset >= GICD_IPRIORITYR && offset < GICD_ICFGR) {
+		first_irq = offset & 0x3ff;
+		bits_per_irq = 8;
+	} else if (offset >= GICD_ICFGR && offset < GICD_ICFGR_END) {
+		first_irq = (offset & 0xff) * 4;
+		bits_per_irq = 2;
+	} else {
+		/* the distributor is shared and stays configured by us */
+		if (!is_write)
+			*value = gic_dist_read(offset, size);
+		else if (offset == GICD_SGIR && size == 4)
+			gic_handle_sgir(cpu_data, *value);
+		return true;
+	}
+
+	/* only byte-wise accessible are priorities and targets */
+	if (size == 1 && bits_per_irq != 8)
+		return false;
+
+	mask = gic_irq_mask(cpu_data->cell, first_irq, bits_per_irq, size);
+	if (!is_write) {
+		*value = gic_dist_read(offset, size) & mask;
+		return true;
+	}
+
+	if (offset >= GICD_ISENABLER && offset < GICD_IPRIORITYR) {
+		/* set and clear registers, zero bits have no effect */
+		gic_dist_write(offset, size, *value & mask);
+		return true;
+	}
+
+	if (offset >= GICD_ITARGETSR && offset < GICD_ICFGR) {
+		targets = gic_cell_targets(cpu_data->cell) & 0xff;
+		mask &= targets * 0x01010101;
+	}
+
+	spin_lock(&dist_lock);
+	gic_dist_write(offset, size, (gic_dist_read(offset, size) & ~mask) |
+		       (*value & mask));
+	spin_unlock(&dist_lock);
+
+	return true;
+}
+
+/* the root cell starts with all shared interrupts */
+int gic_root_cell_init(struct cell *cell)
+{
+	unsigned int irq;
+
+	if (cell_mem_by_virt(cell, GICD_BASE))
+		return -EINVAL;
+
+	for (irq = GIC_NUM_PRIVATE_IRQS; irq < num_irqs; irq++)
+		set_bit(irq, cell->gic.irq_bitmap);
+
+	return mmio_region_register(cell, GICD_BASE, GICD_SIZE,
+				    gic_handle_dist_access, NULL);
+}
+
+/* the root cell is still running, only validate and record */
+int gic_cell_init(struct cell *cell)
+{
+	struct jailhouse_irq_line *irq_line =
+		jailhouse_cell_irq_lines(cell->config);
+	unsigned int n;
+
+	if (cell_mem_by_virt(cell, GICD_BASE))
+		return -EINVAL;
+
+	for (n = 0; n < cell->config->num_irq_lines; n++, irq_line++) {
+		/* private interrupts are always accessible */
+		if (irq_line->irqchip != 0 ||
+		    irq_line->num < GIC_NUM_PRIVATE_IRQS ||
+		    irq_line->num >= num_irqs ||
+		    !test_bit(irq_line->num, cell_list->gic.irq_bitmap) ||
+		    irq_line->cpu > cell->cpu_set->max_cpu_id ||
+		    !test_bit(irq_line->cpu, cell->cpu_set->bitmap))
+			return -EINVAL;
+		set_bit(irq_line->num, cell->gic.irq_bitmap);
+	}
+
+	return mmio_region_register(cell, GICD_BASE, GICD_SIZE,
+				    gic_handle_dist_access, NULL);
+}
+
+/* the root cell is suspended, take the interrupts from it */
+void gic_cell_commit(struct cell *cell)
+{
+	struct jailhouse_irq_line *irq_line =
+		jailhouse_cell_irq_lines(cell->config);
+	u32 root_targets = gic_cell_targets(cell_list);
+	unsigned int n, irq;
+	u8 targets;
+
+	for (n = 0; n < cell->config->num_irq_lines; n++, irq_line++) {
+		clear_bit(irq_line->num, cell_list->gic.irq_bitmap);
+		/* deliver directly to the CPU handling it in the cell */
+		mmio_write8(gicd_base + GICD_ITARGETSR + irq_line->num,
+			    per_cpu(irq_line->cpu)->gic_cpu_mask);
+	}
+
+	/* move the root cell's interrupts off the CPUs it just lost */
+	for (irq = GIC_NUM_PRIVATE_IRQS; irq < num_irqs; irq++) {
+		if (!test_bit(irq, cell_list->gic.irq_bitmap))
+			continue;
+		targets = mmio_read8(gicd_base + GICD_ITARGETSR + irq);
+		if (!(targets & ~root_targets))
+			continue;
+		targets &= root_targets;
+		if (!targets)
+			targets = root_targets & -root_targets;
+		mmio_write8(gicd_base + GICD_ITARGETSR + irq, targets);
+	}
+}
+
+/* the interrupts return disabled, to be set up by the root cell again */
+void gic_cell_exit(struct cell *cell)
+{
+	struct jailhouse_irq_line *irq_line =
+		jailhouse_cell_irq_lines(cell->config);
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_irq_lines; n++, irq_line++) {
+		mmio_write32(gicd_base + GICD_ICENABLER +
+			     (irq_line->num / 32) * 4,
+			     1 << (irq_line->num % 32));
+		set_bit(irq_line->num, cell_list->gic.irq_bitmap);
+	}
+}
@@ -15,14 +15,45 @@
 
 #include <asm/types.h>
 
+#define BITOP_WORD(nr, addr)	((addr) + (nr) / BITS_PER_LONG)
+#define BITOP_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+/*
+ * The atomic operations are fully ordered, like their lock-prefixed
+ * counterparts on x86.
+ */
+static inline __attribute__((always_inline)) unsigned long
+atomic_update(volatile unsigned long *word, unsigned long set,
+	      unsigned long clear)
+{
+	unsigned long old, new, failed;
+
+	asm volatile("dmb ish" : : : "memory");
+	do {
+		asm volatile(
+			"ldrex %0, [%3]\n\t"
+			"bic %1, %0, %5\n\t"
+			"orr %1, %1, %4\n\t"
+			"strex %2, %1, [%3]"
+			: "=&r" (old), "=&r" (new), "=&r" (failed)
+			: "r" (word), "r" (set), "r" (clear)
+			: "cc", "memory");
+	} while (failed);
+	asm volatile("dmb ish" : : : "memory");
+
+	return old;
+}
+
 static inline __attribute__((always_inline)) void
 clear_bit(int nr, volatile unsigned long *addr)
 {
+	atomic_update(BITOP_WORD(nr, addr), 0, BITOP_MASK(nr));
 }
 
 static inline __attribute__((always_inline)) void
 set_bit(unsigned int nr, volatile unsigned long *addr)
 {
+	atomic_update(BITOP_WORD(nr, addr), BITOP_MASK(nr), 0);
 }
 
 static inline __attribute__((always_inline)) int
@@ -34,7 +65,7 @@ constant_test_bit(unsigned int nr, const volatile unsigned long *addr)
 
 static inline int variable_test_bit(int nr, volatile const unsigned long *addr)
 {
-	return 0;
+	return (*BITOP_WORD(nr, addr) & BITOP_MASK(nr)) != 0;
 }
 
 #define test_bit(nr, addr)			\
@@ -44,12 +75,17 @@ static inline int variable_test_bit(int nr, volatile const unsigned long *addr)
 
 static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
 {
-	return 0;
+	return (atomic_update(BITOP_WORD(nr, addr), BITOP_MASK(nr), 0) &
+		BITOP_MASK(nr)) != 0;
 }
 
 static inline unsigned long ffz(unsigned long word)
 {
-	return 0;
+	unsigned long zeros;
+
+	/* count trailing ones of word via the lowest set bit of ~word */
+	asm("clz %0, %1" : "=r" (zeros) : "r" (~word & (word + 1)));
+	return 31 - zeros;
 }
 
 #endif /* !_JAILHOUSE_ASM_BITOPS_H */
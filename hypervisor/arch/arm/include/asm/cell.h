@@ -17,14 +17,53 @@
 #include <asm/paging.h>
 
 #include <jailhouse/cell-config.h>
+#include <jailhouse/cell-console.h>
+#include <jailhouse/cell-info.h>
+
+/* architectural limit of GICv2 interrupt IDs, rounded up */
+#define GIC_MAX_IRQS		1024
 
 struct cell {
+	struct {
+		/* stage-2 translation, level-1 table of 4 entries */
+		pgd_t *s2_table;
+	} mmu;
+
+	struct {
+		/* shared interrupts the cell may program at the distributor */
+		unsigned long irq_bitmap[GIC_MAX_IRQS / BITS_PER_LONG];
+	} gic;
+
 	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	struct jailhouse_cell_desc *config;
+	/* config->num_memory_regions pointers into the config each, sorted
+	 * by phys_start resp. virt_start, the regions do not overlap */
+	struct jailhouse_memory **mem_by_phys;
+	struct jailhouse_memory **mem_by_virt;
+	/* read-only page for the cell, NULL for the root cell */
+	struct jailhouse_cell_info *info;
+	/* output ring of the cell, NULL for the root cell */
+	struct jailhouse_cell_console *console;
+	/* console bytes already written to the hypervisor's debug output */
+	u32 console_flushed;
+	/* set while a CPU of the cell writes its console out */
+	bool console_flushing;
+	unsigned int id;
 
 	struct cpu_set *cpu_set;
 	struct cpu_set small_cpu_set;
 
 	unsigned long page_offset;
+	/* node the cell's tables are allocated from, or NUMA_NO_NODE */
+	int numa_node;
+
+	/* emulated MMIO, sorted by address */
+	struct mmio_region *mmio_regions;
+	unsigned int num_mmio_regions;
+
+	u32 doorbell_vector;
+	/* CPUs parked, image memory accessible by the root cell */
+	bool stopped;
 
 	struct cell *next;
 };
@@ -0,0 +1,19 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+unsigned long arm_handle_events(struct per_cpu *cpu_data);
+void arm_cpu_off(struct per_cpu *cpu_data);
+int arm_cpu_on(struct per_cpu *cpu_data, unsigned long mpidr,
+	       unsigned long entry, unsigned long context);
+int arm_cpu_state(struct per_cpu *cpu_data, unsigned long mpidr);
@@ -0,0 +1,17 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+void __attribute__((noreturn)) exception_handler(struct registers *regs);
+
+void __attribute__((noreturn)) panic_stop(struct per_cpu *cpu_data);
@@ -0,0 +1,92 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+#define GICD_CTLR		0x000
+#define GICD_TYPER		0x004
+#define  GICD_TYPER_LINES_MASK	0x1f
+#define GICD_IGROUPR		0x080
+#define GICD_ISENABLER		0x100
+#define GICD_ICENABLER		0x180
+#define GICD_IPRIORITYR		0x400
+#define GICD_ITARGETSR		0x800
+#define GICD_ICFGR		0xc00
+#define GICD_ICFGR_END		0xd00
+#define GICD_SGIR		0xf00
+#define  GICD_SGIR_TARGET_SHIFT	16
+#define  GICD_SGIR_FILTER_SHIFT	24
+#define  GICD_SGIR_FILTER_LIST	0
+#define  GICD_SGIR_FILTER_OTHERS	1
+#define  GICD_SGIR_FILTER_SELF	2
+#define  GICD_SGIR_SGI_MASK	0xf
+
+#define GICC_CTLR		0x0000
+#define  GICC_CTLR_EOIMODE	(1 << 9)
+#define GICC_PMR		0x0004
+#define GICC_BPR		0x0008
+#define GICC_IAR		0x000c
+#define GICC_EOIR		0x0010
+#define GICC_DIR		0x1000
+#define  GICC_IAR_IRQ_MASK	0x3ff
+#define  GICC_IAR_CPU_SHIFT	10
+#define  GICC_IAR_CPU_MASK	0x7
+
+#define GICH_HCR		0x000
+#define  GICH_HCR_EN		(1 << 0)
+#define  GICH_HCR_UIE		(1 << 1)
+#define GICH_VTR		0x004
+#define  GICH_VTR_LISTREGS_MASK	0x3f
+#define GICH_VMCR		0x008
+#define  GICH_VMCR_PMR_SHIFT	27
+#define  GICH_VMCR_BPR_SHIFT	21
+#define  GICH_VMCR_ENABLE	(1 << 0)
+#define GICH_ELSR0		0x030
+#define GICH_LR_BASE		0x100
+#define  GICH_LR_VIRT_MASK	0x3ff
+#define  GICH_LR_PHYS_SHIFT	10
+#define  GICH_LR_PHYS_MASK	0x3ff
+#define  GICH_LR_CPU_SHIFT	10
+#define  GICH_LR_PRIO_SHIFT	23
+#define  GICH_LR_PENDING	(1 << 28)
+#define  GICH_LR_ACTIVE		(1 << 29)
+#define  GICH_LR_HW		(1 << 31)
+
+/* IDs 1020..1023 do not signal an interrupt */
+#define GIC_SPURIOUS_IRQ	1020
+#define GIC_NUM_SGIS		16
+/* SGIs and PPIs, banked per CPU */
+#define GIC_NUM_PRIVATE_IRQS	32
+
+/* PPI of the virtual interface, raised when the list registers run empty */
+#define GIC_MAINT_IRQ		25
+
+/* Linux programs this priority for every interrupt */
+#define GIC_INJECT_PRIO		0xa0
+
+/* SGI the hypervisor signals its own events with, hidden from cells */
+#define SGI_EVENT		15
+
+int gic_init(void);
+void gic_cpu_init(struct per_cpu *cpu_data);
+void gic_cpu_reset(struct per_cpu *cpu_data);
+void gic_cpu_exit(struct per_cpu *cpu_data);
+
+int gic_root_cell_init(struct cell *cell);
+int gic_cell_init(struct cell *cell);
+void gic_cell_commit(struct cell *cell);
+void gic_cell_exit(struct cell *cell);
+
+void gic_send_sgi(unsigned int cpu_id, unsigned int sgi);
+/* returns true if SGI_EVENT was received */
+bool gic_handle_irq(struct per_cpu *cpu_data);
+void gic_inject_pending(struct per_cpu *cpu_data);
@@ -10,6 +10,20 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_JAILHOUSE_H
+#define _JAILHOUSE_ASM_JAILHOUSE_H
+
+/* saving and restoring CPUs is not supported yet, only flags are defined */
+struct jailhouse_cpu_state {
+	__u32 flags;
+	__u32 padding;
+};
+
+/* provided by the kernel, only needed outside of it */
+#ifndef __asmeq
+#define __asmeq(x, y)			".ifnc " x "," y " ; .err ; .endif\n\t"
+#endif
+
 #define JAILHOUSE_CALL_INS		".arch_extension virt\n\t" \
 					"hvc #0x4a48"
 #define JAILHOUSE_CALL_NUM_RESULT	"r0"
@@ -110,3 +124,5 @@ static inline __u32 jailhouse_call4(__u32 num, __u32 arg1, __u32 arg2,
 		: "memory");
 	return num_result;
 }
+
+#endif /* !_JAILHOUSE_ASM_JAILHOUSE_H */
@@ -0,0 +1,28 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+int arm_cell_mmu_init(struct cell *cell, struct jailhouse_cell_desc *config);
+int arm_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem);
+void arm_cell_mmu_destroy(struct cell *cell,
+			  struct jailhouse_cell_desc *config);
+int arm_map_trace_rings(struct cell *cell);
+void arm_cell_mmu_shrink(struct cell *cell,
+			 struct jailhouse_cell_desc *config);
+void arm_cell_mmu_exit(struct cell *cell);
+int arm_cell_set_loadable(struct cell *cell);
+void arm_cell_clear_loadable(struct cell *cell);
+
+void arm_s2_tlb_flush(void);
+void arm_cpu_mmu_update(struct per_cpu *cpu_data);
@@ -19,22 +19,41 @@
 #define PAGE_SIZE		4096
 #define PAGE_MASK		~(PAGE_SIZE - 1)
 
-#define PAGE_DIR_LEVELS		4
+#define CACHE_LINE_SIZE		64
+
+/* LPAE long descriptors, 32-bit input addresses start at the 1G level */
+#define PAGE_DIR_LEVELS		3
 
-#define PAGE_TABLE_OFFS_MASK	0x00000ff8UL
 #define PAGE_ADDR_MASK		0xfffff000UL
 #define PAGE_OFFS_MASK		0x00000fffUL
 #define HUGEPAGE_ADDR_MASK	0xffe00000UL
 #define HUGEPAGE_OFFS_MASK	0x001fffffUL
-
-#define PAGE_FLAG_PRESENT	0x01
-#define PAGE_FLAG_RW		0x02
-#define PAGE_FLAG_SUPERVISOR	0x04
-#define PAGE_FLAG_UNCACHED	0x10
-
-#define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_RW | \
-				 PAGE_FLAG_SUPERVISOR)
-#define PAGE_READONLY_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_SUPERVISOR)
+#define HUGEPAGE_SIZE		(HUGEPAGE_OFFS_MASK + 1)
+#define HUGEPAGE_1G_ADDR_MASK	0xc0000000UL
+#define HUGEPAGE_1G_OFFS_MASK	0x3fffffffUL
+#define HUGEPAGE_1G_SIZE	(HUGEPAGE_1G_OFFS_MASK + 1)
+/* there is no 4th level, the generic code never steps by its entries */
+#define PGD_SIZE		HUGEPAGE_1G_SIZE
+
+#define PAGE_FLAG_PRESENT	0x001
+/* table or page descriptor, cleared in block descriptors */
+#define PAGE_FLAG_TABLE		0x002
+/* attribute index 1 of HMAIR0, device memory */
+#define PAGE_FLAG_UNCACHED	0x004
+/* AP[1], should be one for the HYP translation regime */
+#define PAGE_FLAG_AP1		0x040
+#define PAGE_FLAG_RDONLY	0x080
+#define PAGE_FLAG_INNER_SHARED	0x300
+#define PAGE_FLAG_ACCESSED	0x400
+
+/* bits that make a descriptor a valid table or page descriptor, the
+ * attribute bits are ignored in table descriptors */
+#define PAGE_TABLE_FLAGS_MASK	0x003
+
+#define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_TABLE | \
+				 PAGE_FLAG_AP1 | PAGE_FLAG_INNER_SHARED | \
+				 PAGE_FLAG_ACCESSED)
+#define PAGE_READONLY_FLAGS	(PAGE_DEFAULT_FLAGS | PAGE_FLAG_RDONLY)
 
 #define INVALID_PHYS_ADDR	(~0UL)
 
@@ -46,14 +65,20 @@
 
 #ifndef __ASSEMBLY__
 
-typedef unsigned long pgd_t;
-typedef unsigned long pud_t;
-typedef unsigned long pmd_t;
-typedef unsigned long pte_t;
+typedef u64 pgd_t;
+typedef u64 pud_t;
+typedef u64 pmd_t;
+typedef u64 pte_t;
+
+static inline unsigned long table_address(u64 entry)
+{
+	return (unsigned long)entry & PAGE_ADDR_MASK;
+}
 
+/* there is no 4th level, only needed to satisfy the generic code */
 static inline bool pgd_valid(pgd_t *pgd)
 {
-	return *pgd & 1;
+	return false;
 }
 
 static inline pgd_t *pgd_offset(pgd_t *page_table, unsigned long addr)
@@ -63,17 +88,15 @@ static inline pgd_t *pgd_offset(pgd_t *page_table, unsigned long addr)
 
 static inline void set_pgd(pgd_t *pgd, unsigned long addr, unsigned long flags)
 {
-	*pgd = (addr & PAGE_ADDR_MASK) | flags;
 }
 
 static inline void clear_pgd(pgd_t *pgd)
 {
-	*pgd = 0;
 }
 
 static inline bool pud_valid(pud_t *pud)
 {
-	return *pud & 1;
+	return *pud & PAGE_FLAG_PRESENT;
 }
 
 static inline pud_t *pud4l_offset(pgd_t *pgd, unsigned long page_table_offset,
@@ -84,7 +107,12 @@ static inline pud_t *pud4l_offset(pgd_t *pgd, unsigned long page_table_offset,
 
 static inline pud_t *pud3l_offset(pgd_t *page_table, unsigned long addr)
 {
-	return NULL;
+	return page_table + ((addr >> 30) & 0x3);
+}
+
+static inline bool pud_is_hugepage(pud_t *pud)
+{
+	return (*pud & PAGE_TABLE_FLAGS_MASK) == PAGE_FLAG_PRESENT;
 }
 
 static inline void set_pud(pud_t *pud, unsigned long addr, unsigned long flags)
@@ -92,6 +120,12 @@ static inline void set_pud(pud_t *pud, unsigned long addr, unsigned long flags)
 	*pud = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pud_hugepage(pud_t *pud, unsigned long addr,
+				    unsigned long flags)
+{
+	*pud = (addr & HUGEPAGE_1G_ADDR_MASK) | (flags & ~PAGE_FLAG_TABLE);
+}
+
 static inline void clear_pud(pud_t *pud)
 {
 	*pud = 0;
@@ -99,18 +133,19 @@ static inline void clear_pud(pud_t *pud)
 
 static inline bool pmd_valid(pmd_t *pmd)
 {
-	return *pmd & 1;
+	return *pmd & PAGE_FLAG_PRESENT;
 }
 
 static inline bool pmd_is_hugepage(pmd_t *pmd)
 {
-	return *pmd & (1 << 7);
+	return (*pmd & PAGE_TABLE_FLAGS_MASK) == PAGE_FLAG_PRESENT;
 }
 
 static inline pmd_t *pmd_offset(pud_t *pud, unsigned long page_table_offset,
 				unsigned long addr)
 {
-	return NULL;
+	return (pmd_t *)(table_address(*pud) + page_table_offset) +
+		((addr >> 21) & 0x1ff);
 }
 
 static inline void set_pmd(pmd_t *pmd, unsigned long addr, unsigned long flags)
@@ -118,6 +153,12 @@ static inline void set_pmd(pmd_t *pmd, unsigned long addr, unsigned long flags)
 	*pmd = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pmd_hugepage(pmd_t *pmd, unsigned long addr,
+				    unsigned long flags)
+{
+	*pmd = (addr & HUGEPAGE_ADDR_MASK) | (flags & ~PAGE_FLAG_TABLE);
+}
+
 static inline void clear_pmd(pmd_t *pmd)
 {
 	*pmd = 0;
@@ -125,13 +166,14 @@ static inline void clear_pmd(pmd_t *pmd)
 
 static inline bool pte_valid(pte_t *pte)
 {
-	return *pte & 1;
+	return *pte & PAGE_FLAG_PRESENT;
 }
 
 static inline pte_t *pte_offset(pmd_t *pmd, unsigned long page_table_offset,
 				unsigned long addr)
 {
-	return NULL;
+	return (pte_t *)(table_address(*pmd) + page_table_offset) +
+		((addr >> 12) & 0x1ff);
 }
 
 static inline void set_pte(pte_t *pte, unsigned long addr, unsigned long flags)
@@ -146,29 +188,37 @@ static inline void clear_pte(pte_t *pte)
 
 static inline unsigned long phys_address(pte_t *pte, unsigned long addr)
 {
-	return (*pte & PAGE_ADDR_MASK) + (addr & PAGE_OFFS_MASK);
+	return table_address(*pte) + (addr & PAGE_OFFS_MASK);
 }
 
 static inline unsigned long phys_address_hugepage(pmd_t *pmd,
 						  unsigned long addr)
 {
-	return (*pmd & HUGEPAGE_ADDR_MASK) + (addr & HUGEPAGE_OFFS_MASK);
+	return ((unsigned long)*pmd & HUGEPAGE_ADDR_MASK) +
+		(addr & HUGEPAGE_OFFS_MASK);
 }
 
-static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
+static inline unsigned long phys_address_hugepage_1g(pud_t *pud,
+						     unsigned long addr)
 {
-	pud_t *pud = (pud_t *)((*pgd & PAGE_ADDR_MASK) + page_table_offset);
-	int n;
+	return ((unsigned long)*pud & HUGEPAGE_1G_ADDR_MASK) +
+		(addr & HUGEPAGE_1G_OFFS_MASK);
+}
 
-	for (n = 0; n < PAGE_SIZE / sizeof(pud_t); n++, pud++)
-		if (pud_valid(pud))
-			return false;
-	return true;
+/* attributes of a block descriptor as used for page descriptors */
+static inline unsigned long hugepage_flags(pmd_t entry)
+{
+	return ((unsigned long)entry & PAGE_OFFS_MASK) | PAGE_FLAG_TABLE;
+}
+
+static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
+{
+	return false;
 }
 
 static inline bool pmd_empty(pud_t *pud, unsigned long page_table_offset)
 {
-	pmd_t *pmd = (pmd_t *)((*pud & PAGE_ADDR_MASK) + page_table_offset);
+	pmd_t *pmd = (pmd_t *)(table_address(*pud) + page_table_offset);
 	int n;
 
 	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++, pmd++)
@@ -179,7 +229,7 @@ static inline bool pmd_empty(pud_t *pud, unsigned long page_table_offset)
 
 static inline bool pt_empty(pmd_t *pmd, unsigned long page_table_offset)
 {
-	pte_t *pte = (pte_t *)((*pmd & PAGE_ADDR_MASK) + page_table_offset);
+	pte_t *pte = (pte_t *)(table_address(*pmd) + page_table_offset);
 	int n;
 
 	for (n = 0; n < PAGE_SIZE / sizeof(pte_t); n++, pte++)
@@ -188,8 +238,46 @@ static inline bool pt_empty(pmd_t *pmd, unsigned long page_table_offset)
 	return true;
 }
 
+/*
+ * The HYP translation regime is only live once the CPU runs in HYP mode,
+ * maintenance is broadcast to all CPUs sharing hv_page_table.
+ */
 static inline void flush_tlb(void)
 {
+	if (!is_hyp_mode())
+		return;
+	asm volatile("dsb ish" : : : "memory");
+	arm_write_sysreg(TLBIALLHIS, 0);
+	asm volatile("dsb ish; isb" : : : "memory");
+}
+
+static inline void flush_tlb_page(unsigned long addr)
+{
+	if (!is_hyp_mode())
+		return;
+	asm volatile("dsb ish" : : : "memory");
+	arm_write_sysreg(TLBIMVAHIS, addr & PAGE_MASK);
+	asm volatile("dsb ish; isb" : : : "memory");
+}
+
+/* clean to the point of coherency */
+static inline void flush_cache_range(void *addr, unsigned long size)
+{
+	unsigned long line = (unsigned long)addr & ~(CACHE_LINE_SIZE - 1);
+
+	for (; line < (unsigned long)addr + size; line += CACHE_LINE_SIZE)
+		asm volatile("mcr p15, 0, %0, c7, c10, 1"
+			     : : "r" (line) : "memory");
+	asm volatile("dsb ish" : : : "memory");
+}
+
+static inline void clear_page(void *page)
+{
+	unsigned long *word = page;
+	unsigned int n;
+
+	for (n = 0; n < PAGE_SIZE / sizeof(unsigned long); n++)
+		word[n] = 0;
 }
 
 #endif /* !__ASSEMBLY__ */
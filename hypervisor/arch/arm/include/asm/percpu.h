@@ -16,16 +16,26 @@
 #include <asm/types.h>
 #include <asm/paging.h>
 
-#define NUM_ENTRY_REGS			6
+#include <jailhouse/cpu-stats.h>
 
 /* Keep in sync with struct per_cpu! */
-#define PERCPU_SIZE_SHIFT		13
+#define PERCPU_SIZE_SHIFT		14
 #define PERCPU_STACK_END		PAGE_SIZE
 #define PERCPU_LINUX_SP			PERCPU_STACK_END
 #define PERCPU_CPU_ID			(PERCPU_LINUX_SP + 4)
 
+/* r4..r11 as saved by arch_entry, followed by the return address */
+#define NUM_ENTRY_REGS			8
+
+#define PERCPU_TRACE_RING_SIZE		(2 * PAGE_SIZE)
+
+/* interrupts waiting for a free list register */
+#define PERCPU_PENDING_IRQS		16
+
 #ifndef __ASSEMBLY__
 
+#include <jailhouse/mcs-lock.h>
+#include <jailhouse/trace.h>
 #include <asm/cell.h>
 
 struct per_cpu {
@@ -34,20 +44,42 @@ struct per_cpu {
 	unsigned long linux_sp;
 	unsigned int cpu_id;
 
-//	u32 apic_id;
+	/* read-mostly, also by other CPUs, share their line with the above */
+	u32 mpidr;
+	/* bit of this CPU in the target masks of the GIC distributor */
+	u32 gic_cpu_mask;
 	struct cell *cell;
+	enum { HYP_STUB = 0, HYP_INIT, HYP_ACTIVE } hyp_state;
 
-	unsigned long linux_reg[NUM_ENTRY_REGS];
-//	unsigned long linux_ip;
-	bool initialized;
+	/* written by this CPU on every exit */
+	u32 pending_irqs[PERCPU_PENDING_IRQS]
+		__attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned int num_pending_irqs;
+	unsigned long stats[JAILHOUSE_NUM_CPU_STATS];
 
+	/* written by other CPUs to signal events, under control_lock */
+	mcs_lock_t control_lock __attribute__((aligned(CACHE_LINE_SIZE)));
 	volatile bool stop_cpu;
 	volatile bool wait_for_sipi;
 	volatile bool cpu_stopped;
-	bool init_signaled;
-	int sipi_vector;
+	/* reset target on release, INVALID_PHYS_ADDR if none */
+	unsigned long cpu_on_entry;
+	unsigned long cpu_on_context;
 	bool flush_caches;
 	bool shutdown_cpu;
+	/* mapped struct jailhouse_hc_batch to run on the next kick */
+	struct jailhouse_hc_batch *async_batch;
+
+	/* cold, Linux state to resume with once the hypervisor is active */
+	unsigned long linux_reg[NUM_ENTRY_REGS]
+		__attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned long linux_ip;
+	/* HVBAR of the Linux hyp-stub, restored on shutdown */
+	unsigned long linux_hyp_vectors;
+
+	/* struct jailhouse_trace_ring, mapped read-only into the Linux cell */
+	u8 trace_ring[PERCPU_TRACE_RING_SIZE]
+		__attribute__((aligned(PAGE_SIZE)));
 } __attribute__((aligned(PAGE_SIZE)));
 
 static inline struct per_cpu *per_cpu(unsigned int cpu)
@@ -70,6 +102,14 @@ static inline void __check_assumptions(void)
 			 PERCPU_LINUX_SP);
 	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, cpu_id) ==
 			 PERCPU_CPU_ID);
+	/* read-mostly fields fit into the line of linux_sp, sections are
+	 * line-aligned so that they do not share lines */
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, pending_irqs) ==
+			 PERCPU_LINUX_SP + CACHE_LINE_SIZE);
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, control_lock) %
+			 CACHE_LINE_SIZE == 0);
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, linux_reg) %
+			 CACHE_LINE_SIZE == 0);
 }
 #endif /* !__ASSEMBLY__ */
 
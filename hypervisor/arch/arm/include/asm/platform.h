@@ -0,0 +1,29 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_PLATFORM_H
+#define _JAILHOUSE_ASM_PLATFORM_H
+
+/* Samsung Exynos 5250, as found in the Samsung Chromebook */
+
+#define GICD_BASE		0x10481000
+#define GICD_SIZE		0x1000
+#define GICC_BASE		0x10482000
+#define GICC_SIZE		0x2000
+#define GICH_BASE		0x10484000
+#define GICH_SIZE		0x1000
+#define GICV_BASE		0x10486000
+#define GICV_SIZE		0x2000
+
+#define UART_BASE		0x12c30000
+
+#endif /* !_JAILHOUSE_ASM_PLATFORM_H */
@@ -13,17 +13,67 @@
 #ifndef _JAILHOUSE_ASM_PROCESSOR_H
 #define _JAILHOUSE_ASM_PROCESSOR_H
 
+#include <asm/types.h>
+#include <asm/sysregs.h>
+
+#define PSR_MODE_MASK	0x1f
+#define PSR_SVC_MODE	0x13
+#define PSR_HYP_MODE	0x1a
+#define PSR_T_BIT	(1 << 5)
+#define PSR_F_BIT	(1 << 6)
+#define PSR_I_BIT	(1 << 7)
+#define PSR_A_BIT	(1 << 8)
+
+#define EXIT_REASON_TRAP	0
+#define EXIT_REASON_IRQ		1
+
 #ifndef __ASSEMBLY__
 
+/* frame pushed by the HYP vectors, keep in sync with entry.S */
 struct registers {
+	unsigned long exit_reason;
+	/* keeps the frame 8-byte aligned */
+	unsigned long padding;
+	/* r0..r12, lr_usr */
+	unsigned long usr[14];
 };
 
 static inline void cpu_relax(void)
 {
+	asm volatile("yield" : : : "memory");
 }
 
 static inline void memory_barrier(void)
 {
+	asm volatile("dmb ish" : : : "memory");
+}
+
+/* stores do not wake up a waiting CPU, so waiting remains spinning */
+static inline void cpu_monitor(const volatile void *addr)
+{
+}
+
+static inline void cpu_wait(void)
+{
+	cpu_relax();
+}
+
+/* generic timer count, the time base of the exit statistics */
+static inline unsigned long read_tsc(void)
+{
+	u64 count;
+
+	asm volatile("isb");
+	arm_read_sysreg64(CNTPCT, count);
+	return count;
+}
+
+static inline bool is_hyp_mode(void)
+{
+	unsigned long cpsr;
+
+	asm volatile("mrs %0, cpsr" : "=r" (cpsr));
+	return (cpsr & PSR_MODE_MASK) == PSR_HYP_MODE;
 }
 
 #endif /* !__ASSEMBLY__ */
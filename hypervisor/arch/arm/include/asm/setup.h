@@ -0,0 +1,34 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+/* hypervisor-internal calls, issued before the CPU is fully activated */
+#define HYP_CALL_ACTIVATE	0
+#define HYP_CALL_DEACTIVATE	1
+
+/* page executed with the HYP MMU off, mapped 1:1 */
+extern u8 hyp_idmap[], hyp_deactivate[];
+extern u8 hyp_vectors[];
+
+unsigned long arm_hvc(unsigned long r0, unsigned long r1, unsigned long r2,
+		      unsigned long r3);
+void __attribute__((noreturn))
+arm_cpu_deactivate(unsigned long linux_vectors, struct registers *regs,
+		   unsigned long trampoline);
+
+void *arm_map_device(unsigned long phys, unsigned long size);
+int arm_dbg_write_map(void);
+
+void arm_hyp_call(struct per_cpu *cpu_data, struct registers *regs);
+void __attribute__((noreturn))
+arm_cpu_deactivate_vmm(struct per_cpu *cpu_data, struct registers *regs);
@@ -10,23 +10,96 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_SPINLOCK_H
+#define _JAILHOUSE_ASM_SPINLOCK_H
+
+#include <jailhouse/lock-stats.h>
 #include <asm/bitops.h>
 #include <asm/processor.h>
 
+/* ticket lock, CPUs are served in the order they arrived */
 typedef struct {
-	unsigned long state;
+	u16 owner;
+	u16 next;
+	struct lock_stats stats;
 } spinlock_t;
 
 #define DEFINE_SPINLOCK(name)	spinlock_t (name)
 
 static inline void spin_lock(spinlock_t *lock)
 {
-//	while (test_and_set_bit(0, &lock->state))
-//		cpu_relax();
+	unsigned long start = lock_stats_now();
+	unsigned long failed;
+	u16 ticket, next;
+
+	do {
+		asm volatile(
+			"ldrexh %0, [%3]\n\t"
+			"add %1, %0, #1\n\t"
+			"strexh %2, %1, [%3]"
+			: "=&r" (ticket), "=&r" (next), "=&r" (failed)
+			: "r" (&lock->next)
+			: "cc", "memory");
+	} while (failed);
+
+	if (ticket != *(volatile u16 *)&lock->owner) {
+		while (ticket != *(volatile u16 *)&lock->owner)
+			cpu_relax();
+		memory_barrier();
+		lock_stats_acquired(&lock->stats, start, true);
+	} else {
+		memory_barrier();
+		lock_stats_acquired(&lock->stats, start, false);
+	}
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
-//	asm volatile("": : :"memory");
-//	clear_bit(0, &lock->state);
+	lock_stats_release(&lock->stats);
+	memory_barrier();
+	/* only the owner writes this field */
+	*(volatile u16 *)&lock->owner = lock->owner + 1;
+}
+
+/* atomic pointer updates, fully ordered like on x86 */
+static inline void *atomic_xchg_ptr(void **ptr, void *value)
+{
+	unsigned long failed;
+	void *old;
+
+	memory_barrier();
+	do {
+		asm volatile(
+			"ldrex %0, [%2]\n\t"
+			"strex %1, %3, [%2]"
+			: "=&r" (old), "=&r" (failed)
+			: "r" (ptr), "r" (value)
+			: "memory");
+	} while (failed);
+	memory_barrier();
+
+	return old;
+}
+
+static inline void *atomic_cmpxchg_ptr(void **ptr, void *old, void *new)
+{
+	unsigned long failed;
+	void *prev;
+
+	memory_barrier();
+	do {
+		asm volatile(
+			"ldrex %0, [%2]\n\t"
+			"mov %1, #0\n\t"
+			"teq %0, %3\n\t"
+			"strexeq %1, %4, [%2]"
+			: "=&r" (prev), "=&r" (failed)
+			: "r" (ptr), "r" (old), "r" (new)
+			: "cc", "memory");
+	} while (failed);
+	memory_barrier();
+
+	return prev;
 }
+
+#endif /* !_JAILHOUSE_ASM_SPINLOCK_H */
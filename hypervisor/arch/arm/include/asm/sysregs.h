@@ -0,0 +1,133 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_SYSREGS_H
+#define _JAILHOUSE_ASM_SYSREGS_H
+
+/* coprocessor, opc1, CRn, CRm, opc2 of the CP15 registers we use */
+#define MIDR		p15, 0, c0, c0, 0
+#define MPIDR		p15, 0, c0, c0, 5
+#define SCTLR		p15, 0, c1, c0, 0
+#define VBAR		p15, 0, c12, c0, 0
+#define CNTFRQ		p15, 0, c14, c0, 0
+#define VPIDR		p15, 4, c0, c0, 0
+#define VMPIDR		p15, 4, c0, c0, 5
+#define HSCTLR		p15, 4, c1, c0, 0
+#define HCR		p15, 4, c1, c1, 0
+#define HTCR		p15, 4, c2, c0, 2
+#define VTCR		p15, 4, c2, c1, 2
+#define HSR		p15, 4, c5, c2, 0
+#define HDFAR		p15, 4, c6, c0, 0
+#define HPFAR		p15, 4, c6, c0, 4
+#define HMAIR0		p15, 4, c10, c2, 0
+#define HMAIR1		p15, 4, c10, c2, 1
+#define HVBAR		p15, 4, c12, c0, 0
+#define HTPIDR		p15, 4, c13, c0, 2
+
+/* 64-bit registers: coprocessor, opc1, CRm */
+#define CNTPCT		p15, 0, c14
+#define HTTBR		p15, 4, c2
+#define VTTBR		p15, 6, c2
+
+#define TLBIALLH	p15, 4, c8, c7, 0
+#define TLBIALLNSNH	p15, 4, c8, c7, 4
+#define ICIALLU		p15, 0, c7, c5, 0
+
+/* broadcast within the inner shareable domain */
+#define TLBIALLHIS	p15, 4, c8, c3, 0
+#define TLBIMVAHIS	p15, 4, c8, c3, 1
+#define TLBIALLNSNHIS	p15, 4, c8, c3, 4
+
+#define SCTLR_RESET	0x00c50078
+
+#define HSCTLR_M	(1 << 0)
+#define HSCTLR_C	(1 << 2)
+#define HSCTLR_I	(1 << 12)
+#define HSCTLR_RES1	0x30c50830
+
+#define HCR_VM		(1 << 0)
+#define HCR_SWIO	(1 << 1)
+#define HCR_FMO		(1 << 3)
+#define HCR_IMO		(1 << 4)
+#define HCR_AMO		(1 << 5)
+
+/* 32-bit input addresses, walks inner/outer write-back, inner shareable */
+#define TCR_RES1	(1 << 31)
+#define TCR_IRGN0_WBWA	(1 << 8)
+#define TCR_ORGN0_WBWA	(1 << 10)
+#define TCR_SH0_IS	(3 << 12)
+#define HTCR_VAL	(TCR_RES1 | (1 << 23) | TCR_SH0_IS | \
+			 TCR_ORGN0_WBWA | TCR_IRGN0_WBWA)
+/* stage-2 lookups start at level 1 */
+#define VTCR_SL0_L1	(1 << 6)
+#define VTCR_VAL	(TCR_RES1 | TCR_SH0_IS | TCR_ORGN0_WBWA | \
+			 TCR_IRGN0_WBWA | VTCR_SL0_L1)
+
+/* attribute index 0: normal write-back memory, 1: device memory */
+#define HMAIR0_VAL	0x000004ff
+
+#define VTTBR_VMID_SHIFT	48
+
+#define HSR_EC_SHIFT		26
+#define HSR_EC_HVC		0x12
+#define HSR_EC_DABT		0x24
+#define HSR_IL			(1 << 25)
+#define HSR_ISS_MASK		0x01ffffff
+
+#define HSR_DABT_ISV		(1 << 24)
+#define HSR_DABT_SAS_SHIFT	22
+#define HSR_DABT_SSE		(1 << 21)
+#define HSR_DABT_SRT_SHIFT	16
+#define HSR_DABT_WNR		(1 << 6)
+
+#define HPFAR_FIPA_SHIFT	4
+
+#define MPIDR_AFF_MASK		0x00ffffff
+#define MPIDR_CPUID_MASK	0x000000ff
+
+#define __stringify_1(x...)	#x
+#define __stringify(x...)	__stringify_1(x)
+
+#ifndef __ASSEMBLY__
+
+#define arm_write_sysreg(reg, val)					\
+	asm volatile("mcr " __stringify(_arm_cp_rw(reg))		\
+		     : : "r" ((u32)(val)))
+#define arm_read_sysreg(reg, val)					\
+	asm volatile("mrc " __stringify(_arm_cp_rw(reg))		\
+		     : "=r" (val))
+#define _arm_cp_rw(cp, op1, crn, crm, op2)	cp, op1, %0, crn, crm, op2
+
+#define arm_write_sysreg64(reg, val)					\
+	asm volatile("mcrr " __stringify(_arm_cp_rw64(reg))		\
+		     : : "r" ((u32)(val)), "r" ((u32)((u64)(val) >> 32)))
+#define arm_read_sysreg64(reg, val)					\
+	do {								\
+		u32 __lo, __hi;						\
+		asm volatile("mrrc " __stringify(_arm_cp_rw64(reg))	\
+			     : "=r" (__lo), "=r" (__hi));		\
+		(val) = ((u64)__hi << 32) | __lo;			\
+	} while (0)
+#define _arm_cp_rw64(cp, op1, crm)	cp, op1, %0, %1, crm
+
+#else /* __ASSEMBLY__ */
+
+#define arm_write_sysreg(reg, rt)	_arm_mcr(rt, reg)
+#define _arm_mcr(rt, cp, op1, crn, crm, op2)	mcr cp, op1, rt, crn, crm, op2
+#define arm_read_sysreg(reg, rt)	_arm_mrc(rt, reg)
+#define _arm_mrc(rt, cp, op1, crn, crm, op2)	mrc cp, op1, rt, crn, crm, op2
+#define arm_write_sysreg64(reg, lo, hi)	_arm_mcrr(lo, hi, reg)
+#define _arm_mcrr(lo, hi, cp, op1, crm)	mcrr cp, op1, lo, hi, crm
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* !_JAILHOUSE_ASM_SYSREGS_H */
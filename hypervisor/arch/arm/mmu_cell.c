@@ -0,0 +1,251 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <asm/mmu_cell.h>
+#include <asm/platform.h>
+#include <asm/sysregs.h>
+
+/* stage-2 descriptors share the layout of the low bits with stage 1 */
+#define S2_FLAG_VALID		0x001
+#define S2_FLAG_PAGE		0x002
+#define S2_FLAG_NORMAL_WB	0x03c
+#define S2_FLAG_READ		0x040
+#define S2_FLAG_WRITE		0x080
+#define S2_FLAG_INNER_SHARED	0x300
+#define S2_FLAG_ACCESSED	0x400
+
+#define S2_PAGE_FLAGS		(S2_FLAG_VALID | S2_FLAG_PAGE | \
+				 S2_FLAG_NORMAL_WB | S2_FLAG_INNER_SHARED | \
+				 S2_FLAG_ACCESSED)
+#define S2_TABLE_FLAGS		(S2_FLAG_VALID | S2_FLAG_PAGE)
+
+/* stage-2 tables are accounted like EPTs */
+#define S2_MAP_FLAGS(cell)	(PAGE_MAP_USER(JAILHOUSE_POOL_USER_EPT) | \
+				 PAGE_MAP_NODE((cell)->numa_node))
+
+static int arm_map_memory(struct cell *cell, unsigned long phys,
+			  unsigned long size, unsigned long virt,
+			  u64 access_flags)
+{
+	unsigned long page_flags = S2_PAGE_FLAGS;
+
+	if (access_flags & JAILHOUSE_MEM_READ)
+		page_flags |= S2_FLAG_READ;
+	if (access_flags & JAILHOUSE_MEM_WRITE)
+		page_flags |= S2_FLAG_WRITE;
+
+	return page_map_create(cell->mmu.s2_table, phys, size, virt,
+			       page_flags, S2_TABLE_FLAGS, PAGE_DIR_LEVELS,
+			       PAGE_MAP_HUGE_1G | PAGE_MAP_HUGE_2M |
+			       S2_MAP_FLAGS(cell));
+}
+
+static void arm_unmap_memory(struct cell *cell, unsigned long virt,
+			     unsigned long size)
+{
+	page_map_destroy(cell->mmu.s2_table, virt, size, PAGE_DIR_LEVELS,
+			 PAGE_MAP_COHERENT | S2_MAP_FLAGS(cell));
+}
+
+/* the info and console pages are left out if the cell uses their address */
+static bool arm_cell_page_mappable(struct cell *cell, void *page,
+				   unsigned long addr)
+{
+	return page && !cell_mem_by_virt(cell, addr);
+}
+
+/* tears down what arm_cell_mmu_init and arm_map_memory_region built */
+void arm_cell_mmu_destroy(struct cell *cell,
+			  struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	unsigned int n;
+
+	/* regions may only be partially mapped after a failed creation */
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		arm_unmap_memory(cell, mem->virt_start, mem->size);
+	arm_unmap_memory(cell, GICC_BASE, GICV_SIZE);
+	if (arm_cell_page_mappable(cell, cell->info,
+				   JAILHOUSE_CELL_INFO_ADDR))
+		arm_unmap_memory(cell, JAILHOUSE_CELL_INFO_ADDR, PAGE_SIZE);
+	if (arm_cell_page_mappable(cell, cell->console,
+				   JAILHOUSE_CELL_CONSOLE_ADDR))
+		arm_unmap_memory(cell, JAILHOUSE_CELL_CONSOLE_ADDR, PAGE_SIZE);
+	if (cell->console)
+		arm_unmap_memory(cell_list, page_map_hvirt2phys(cell->console),
+				 PAGE_SIZE);
+
+	page_free_node(cell->mmu.s2_table, 1, JAILHOUSE_POOL_USER_EPT);
+	cell->mmu.s2_table = NULL;
+}
+
+/* the memory regions are added separately via arm_map_memory_region */
+int arm_cell_mmu_init(struct cell *cell, struct jailhouse_cell_desc *config)
+{
+	unsigned long ring_phys;
+	int err;
+
+	cell->mmu.s2_table = page_alloc_node(cell->numa_node, 1,
+					     JAILHOUSE_POOL_USER_EPT);
+	if (!cell->mmu.s2_table)
+		return -ENOMEM;
+
+	/* the cell programs the virtual CPU interface as if it was real */
+	err = arm_map_memory(cell, GICV_BASE, GICV_SIZE, GICC_BASE,
+			     JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE);
+	if (err)
+		goto error_destroy;
+
+	if (arm_cell_page_mappable(cell, cell->info,
+				   JAILHOUSE_CELL_INFO_ADDR)) {
+		err = arm_map_memory(cell, page_map_hvirt2phys(cell->info),
+				     PAGE_SIZE, JAILHOUSE_CELL_INFO_ADDR,
+				     JAILHOUSE_MEM_READ);
+		if (err)
+			goto error_destroy;
+	}
+
+	if (arm_cell_page_mappable(cell, cell->console,
+				   JAILHOUSE_CELL_CONSOLE_ADDR)) {
+		err = arm_map_memory(cell, page_map_hvirt2phys(cell->console),
+				     PAGE_SIZE, JAILHOUSE_CELL_CONSOLE_ADDR,
+				     JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE);
+		if (err)
+			goto error_destroy;
+	}
+
+	/* the root cell drains the console, like the trace rings */
+	if (cell->console) {
+		ring_phys = page_map_hvirt2phys(cell->console);
+		err = arm_map_memory(cell_list, ring_phys, PAGE_SIZE,
+				     ring_phys, JAILHOUSE_MEM_READ);
+		if (err)
+			goto error_destroy;
+	}
+
+	return 0;
+
+error_destroy:
+	arm_cell_mmu_destroy(cell, config);
+	return err;
+}
+
+int arm_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem)
+{
+	return arm_map_memory(cell, mem->phys_start, mem->size,
+			      mem->virt_start, mem->access_flags);
+}
+
+int arm_map_trace_rings(struct cell *cell)
+{
+	unsigned long ring_phys;
+	unsigned int cpu;
+	int err;
+
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++) {
+		ring_phys = page_map_hvirt2phys(per_cpu(cpu)->trace_ring);
+		err = arm_map_memory(cell, ring_phys, PERCPU_TRACE_RING_SIZE,
+				     ring_phys, JAILHOUSE_MEM_READ);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int arm_root_cell_unmap(const struct jailhouse_memory *part)
+{
+	arm_unmap_memory(cell_list, part->virt_start, part->size);
+	return 0;
+}
+
+void arm_cell_mmu_shrink(struct cell *cell,
+			 struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	unsigned int n;
+
+	/* unmapped at the root cell's addresses of the regions */
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		/* communication regions remain shared with the donor */
+		if (mem->access_flags & JAILHOUSE_MEM_COMM_REGION)
+			continue;
+		root_cell_remap(mem, arm_root_cell_unmap);
+	}
+
+	arm_s2_tlb_flush();
+}
+
+static int arm_root_cell_map(const struct jailhouse_memory *part)
+{
+	return arm_map_memory(cell_list, part->phys_start, part->size,
+			      part->virt_start, part->access_flags);
+}
+
+void arm_cell_mmu_exit(struct cell *cell)
+{
+	struct jailhouse_memory *mem =
+		jailhouse_cell_mem_regions(cell->config);
+	unsigned int n;
+
+	arm_cell_mmu_destroy(cell, cell->config);
+
+	for (n = 0; n < cell->config->num_memory_regions; n++, mem++) {
+		/* regions still shared with other cells stay with them */
+		if (mem->access_flags & JAILHOUSE_MEM_COMM_REGION ||
+		    non_root_cell_uses_memory(mem))
+			continue;
+		if (root_cell_remap(mem, arm_root_cell_map))
+			printk("WARNING: Failed to return memory %p to root "
+			       "cell\n", mem->phys_start);
+	}
+
+	arm_s2_tlb_flush();
+}
+
+/* the first memory region of a cell holds its image */
+int arm_cell_set_loadable(struct cell *cell)
+{
+	return root_cell_remap(jailhouse_cell_mem_regions(cell->config),
+			       arm_root_cell_map);
+}
+
+void arm_cell_clear_loadable(struct cell *cell)
+{
+	root_cell_remap(jailhouse_cell_mem_regions(cell->config),
+			arm_root_cell_unmap);
+	arm_s2_tlb_flush();
+}
+
+/* stage-2 entries of all VMIDs on all CPUs */
+void arm_s2_tlb_flush(void)
+{
+	asm volatile("dsb ish" : : : "memory");
+	arm_write_sysreg(TLBIALLNSNHIS, 0);
+	asm volatile("dsb ish; isb" : : : "memory");
+}
+
+/* called in HYP mode when the CPU may have changed its cell */
+void arm_cpu_mmu_update(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+
+	arm_write_sysreg64(VTTBR, page_map_hvirt2phys(cell->mmu.s2_table) |
+			   ((u64)cell->id << VTTBR_VMID_SHIFT));
+	asm volatile("isb");
+	arm_write_sysreg(TLBIALLNSNH, 0);
+	asm volatile("dsb; isb" : : : "memory");
+}
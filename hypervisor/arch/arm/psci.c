@@ -0,0 +1,42 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/control.h>
+#include <asm/psci.h>
+#include <asm/traps.h>
+
+/* the CPU power interface the cells use in place of the firmware's */
+void psci_dispatch(struct per_cpu *cpu_data, struct registers *regs)
+{
+	switch (regs->usr[0]) {
+	case PSCI_VERSION:
+		/* 0.2 */
+		regs->usr[0] = 2;
+		break;
+	case PSCI_CPU_OFF:
+		regs->usr[0] = PSCI_SUCCESS;
+		arm_cpu_off(cpu_data);
+		/* returns only after CPU_ON, with a reset register set */
+		arm_cpu_events(cpu_data, regs);
+		break;
+	case PSCI_CPU_ON:
+		regs->usr[0] = arm_cpu_on(cpu_data, regs->usr[1], regs->usr[2],
+					  regs->usr[3]);
+		break;
+	case PSCI_AFFINITY_INFO:
+		regs->usr[0] = arm_cpu_state(cpu_data, regs->usr[1]);
+		break;
+	default:
+		regs->usr[0] = PSCI_NOT_SUPPORTED;
+		break;
+	}
+}
@@ -11,45 +11,210 @@
  */
 
 #include <jailhouse/entry.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/processor.h>
+#include <asm/gic.h>
+#include <asm/mmu_cell.h>
+#include <asm/setup.h>
+#include <asm/sysregs.h>
+
+extern u8 __start[];
+
+void *arm_map_device(unsigned long phys, unsigned long size)
+{
+	void *virt;
+
+	size = PAGE_ALIGN(size);
+	virt = page_alloc(&remap_pool, size / PAGE_SIZE,
+			  JAILHOUSE_POOL_USER_REMAP);
+	if (!virt)
+		return NULL;
+	if (page_map_create(hv_page_table, phys, size, (unsigned long)virt,
+			    PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
+			    PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			    PAGE_MAP_NO_HUGE))
+		return NULL;
+	return virt;
+}
+
+static bool range_overlaps(unsigned long addr, unsigned long start,
+			   unsigned long size)
+{
+	return addr + PAGE_SIZE > start && addr < start + size;
+}
 
 int arch_init_early(struct cell *linux_cell,
 		    struct jailhouse_cell_desc *config)
 {
-	return -ENOSYS;
+	unsigned long idmap = page_map_hvirt2phys(hyp_idmap);
+	struct jailhouse_memory *mem;
+	unsigned int n;
+	u32 cntfrq;
+	int err;
+
+	/* the identity mapping has to fit between our virtual ranges */
+	if (range_overlaps(idmap, (unsigned long)__start,
+			   hypervisor_header.size) ||
+	    range_overlaps(idmap, (unsigned long)remap_pool.base_address,
+			   remap_pool.pages * PAGE_SIZE)) {
+		printk("FATAL: hypervisor located at unusable address %p\n",
+		       idmap);
+		return -EINVAL;
+	}
+
+	/* SGIs are the only doorbells, and SGI_EVENT is ours */
+	if (config->doorbell_vector >= SGI_EVENT)
+		return -EINVAL;
+
+	err = page_map_create(hv_page_table, idmap, PAGE_SIZE, idmap,
+			      PAGE_DEFAULT_FLAGS, PAGE_DEFAULT_FLAGS,
+			      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE);
+	if (err)
+		return err;
+
+	err = arm_dbg_write_map();
+	if (err)
+		return err;
+
+	err = gic_init();
+	if (err)
+		return err;
+
+	err = arm_cell_mmu_init(linux_cell, config);
+	if (err)
+		return err;
+
+	mem = jailhouse_cell_mem_regions(config);
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		err = arm_map_memory_region(linux_cell, mem);
+		if (err)
+			return err;
+	}
+
+	err = arm_map_trace_rings(linux_cell);
+	if (err)
+		return err;
+
+	/* the loader does not know the rate of the generic timer */
+	if (!hypervisor_header.tsc_khz) {
+		arm_read_sysreg(CNTFRQ, cntfrq);
+		hypervisor_header.tsc_khz = cntfrq / 1000;
+	}
+
+	return 0;
 }
 
 int arch_cpu_init(struct per_cpu *cpu_data)
 {
-	return -ENOSYS;
+	int n;
+
+	arm_read_sysreg(MPIDR, cpu_data->mpidr);
+	cpu_data->cpu_on_entry = INVALID_PHYS_ADDR;
+
+	/* read registers to restore on first VM-entry */
+	for (n = 0; n < NUM_ENTRY_REGS; n++)
+		cpu_data->linux_reg[n] =
+			((unsigned long *)cpu_data->linux_sp)[n];
+	cpu_data->linux_ip =
+		((unsigned long *)cpu_data->linux_sp)[NUM_ENTRY_REGS];
+
+	/* take HYP mode over from the Linux hyp-stub */
+	cpu_data->linux_hyp_vectors = arm_hvc(-1, 0, 0, 0);
+	arm_hvc(page_map_hvirt2phys(hyp_idmap), 0, 0, 0);
+	arm_hvc(page_map_hvirt2phys(hv_page_table), (unsigned long)cpu_data,
+		(unsigned long)cpu_data->stack + sizeof(cpu_data->stack),
+		(unsigned long)hyp_vectors);
+	cpu_data->hyp_state = HYP_INIT;
+
+	return 0;
 }
 
 int arch_init_late(struct cell *linux_cell,
 		   struct jailhouse_cell_desc *config)
 {
-	return -ENOSYS;
+	/* needs the memory index of the root cell */
+	return gic_root_cell_init(linux_cell);
+}
+
+/* called in HYP mode, returns to Linux behind arch_entry */
+static void arm_cpu_activate(struct per_cpu *cpu_data, struct registers *regs)
+{
+	unsigned long spsr, elr, sp;
+	u32 midr;
+	int n;
+
+	arm_read_sysreg(MIDR, midr);
+	arm_write_sysreg(VPIDR, midr);
+	arm_write_sysreg(VMPIDR, cpu_data->mpidr);
+
+	arm_write_sysreg(VTCR, VTCR_VAL);
+	arm_cpu_mmu_update(cpu_data);
+
+	gic_cpu_init(cpu_data);
+
+	arm_write_sysreg(HCR, HCR_VM | HCR_SWIO | HCR_FMO | HCR_IMO | HCR_AMO);
+	asm volatile("isb");
+
+	cpu_data->hyp_state = HYP_ACTIVE;
+
+	for (n = 0; n < NUM_ENTRY_REGS; n++)
+		regs->usr[4 + n] = cpu_data->linux_reg[n];
+	regs->usr[0] = 0;
+
+	sp = cpu_data->linux_sp + (NUM_ENTRY_REGS + 1) * sizeof(unsigned long);
+	asm volatile("msr sp_svc, %0" : : "r" (sp));
+
+	asm volatile("mrs %0, spsr" : "=r" (spsr));
+	elr = cpu_data->linux_ip;
+	if (elr & 1) {
+		spsr |= PSR_T_BIT;
+		elr &= ~1UL;
+	}
+	asm volatile("msr spsr_cxsf, %0" : : "r" (spsr));
+	asm volatile("msr elr_hyp, %0" : : "r" (elr));
+}
+
+void arm_cpu_deactivate_vmm(struct per_cpu *cpu_data, struct registers *regs)
+{
+	if (cpu_data->hyp_state == HYP_ACTIVE) {
+		gic_cpu_exit(cpu_data);
+		arm_write_sysreg(HCR, 0);
+		arm_write_sysreg64(VTTBR, 0);
+		asm volatile("isb");
+		arm_write_sysreg(TLBIALLNSNH, 0);
+		asm volatile("dsb; isb" : : : "memory");
+	}
+	cpu_data->hyp_state = HYP_STUB;
+
+	arm_cpu_deactivate(cpu_data->linux_hyp_vectors, regs,
+			   page_map_hvirt2phys(hyp_deactivate));
+}
+
+void arm_hyp_call(struct per_cpu *cpu_data, struct registers *regs)
+{
+	/* the UART is only mapped in HYP mode, flush what was buffered */
+	printk("");
+
+	switch (regs->usr[0]) {
+	case HYP_CALL_ACTIVATE:
+		arm_cpu_activate(cpu_data, regs);
+		break;
+	case HYP_CALL_DEACTIVATE:
+		arm_cpu_deactivate_vmm(cpu_data, regs);
+	}
 }
 
 void arch_cpu_activate_vmm(struct per_cpu *cpu_data)
 {
-	while (1);
+	arm_hvc(HYP_CALL_ACTIVATE, 0, 0, 0);
+	__builtin_unreachable();
 }
 
 void arch_cpu_restore(struct per_cpu *cpu_data)
 {
-}
+	if (cpu_data->hyp_state == HYP_STUB)
+		return;
 
-// catch missing symbols
-#include <jailhouse/printk.h>
-#include <jailhouse/processor.h>
-#include <jailhouse/control.h>
-#include <jailhouse/string.h>
-void arch_dbg_write_init(void) {}
-int phys_processor_id(void) { return 0; }
-void arch_suspend_cpu(unsigned int cpu_id) {}
-void arch_resume_cpu(unsigned int cpu_id) {}
-void arch_reset_cpu(unsigned int cpu_id) {}
-void arch_shutdown_cpu(unsigned int cpu_id) {}
-int arch_cell_create(struct per_cpu *cpu_data, struct cell *new_cell,
-		     struct jailhouse_cell_desc *config) { return -ENOSYS; }
-void *memcpy(void *dest, const void *src, unsigned long n) { return NULL; }
-void arch_dbg_write(const char *msg) {}
+	arm_hvc(HYP_CALL_DEACTIVATE, 0, 0, 0);
+}
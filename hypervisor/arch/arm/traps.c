@@ -0,0 +1,207 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/hypercall.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/printk.h>
+#include <asm/control.h>
+#include <asm/fault.h>
+#include <asm/gic.h>
+#include <asm/mmu_cell.h>
+#include <asm/psci.h>
+#include <asm/setup.h>
+#include <asm/traps.h>
+
+/* immediate of the hvc instruction in JAILHOUSE_CALL_INS */
+#define JAILHOUSE_HVC_IMM	0x4a48
+
+static unsigned long arm_read_elr(void)
+{
+	unsigned long elr;
+
+	asm volatile("mrs %0, elr_hyp" : "=r" (elr));
+	return elr;
+}
+
+static void arm_write_elr(unsigned long elr)
+{
+	asm volatile("msr elr_hyp, %0" : : "r" (elr));
+}
+
+/* like a CPU leaving reset, but entering at entry with r0 = context */
+static void arm_cpu_reset(struct registers *regs, struct per_cpu *cpu_data,
+			  unsigned long entry, unsigned long context)
+{
+	unsigned long spsr = PSR_SVC_MODE | PSR_A_BIT | PSR_I_BIT | PSR_F_BIT;
+	unsigned int n;
+
+	for (n = 0; n < 14; n++)
+		regs->usr[n] = 0;
+	regs->usr[0] = context;
+
+	arm_write_sysreg(SCTLR, SCTLR_RESET);
+	arm_write_sysreg(VBAR, 0);
+
+	if (entry & 1) {
+		spsr |= PSR_T_BIT;
+		entry &= ~1UL;
+	}
+	asm volatile("msr spsr_cxsf, %0" : : "r" (spsr));
+	arm_write_elr(entry);
+
+	arm_cpu_mmu_update(cpu_data);
+	gic_cpu_reset(cpu_data);
+}
+
+void arm_cpu_events(struct per_cpu *cpu_data, struct registers *regs)
+{
+	unsigned long entry;
+
+	entry = arm_handle_events(cpu_data);
+	if (entry != INVALID_PHYS_ADDR) {
+		trace_event(cpu_data, JAILHOUSE_TRACE_SIPI, entry, 0);
+		arm_cpu_reset(regs, cpu_data, entry,
+			      cpu_data->cpu_on_context);
+	}
+	hypercall_run_async(cpu_data);
+}
+
+static void arm_handle_hvc(struct per_cpu *cpu_data, struct registers *regs,
+			   u32 hsr)
+{
+	unsigned long code = regs->usr[0];
+
+	if ((hsr & 0xffff) != JAILHOUSE_HVC_IMM) {
+		psci_dispatch(cpu_data, regs);
+		return;
+	}
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL]++;
+	trace_event(cpu_data, JAILHOUSE_TRACE_HYPERCALL, code, regs->usr[1]);
+
+	if (code == JAILHOUSE_HC_DISABLE) {
+		regs->usr[0] = shutdown(cpu_data);
+		if (regs->usr[0] == 0)
+			arm_cpu_deactivate_vmm(cpu_data, regs);
+		return;
+	}
+
+	regs->usr[0] = hypercall(cpu_data, code, regs->usr[1], regs->usr[2]);
+	if (regs->usr[0] == -ENOSYS)
+		trace_event(cpu_data, JAILHOUSE_TRACE_UNKNOWN_HYPERCALL, code,
+			    arm_read_elr() - 4);
+}
+
+static bool arm_handle_dabt(struct per_cpu *cpu_data, struct registers *regs,
+			    u32 hsr)
+{
+	unsigned int size, reg;
+	struct mmio_region *region;
+	unsigned long addr, value;
+	u32 hpfar, hdfar;
+	bool is_write;
+
+	/* only single-register loads and stores are described in the HSR */
+	if (!(hsr & HSR_DABT_ISV))
+		return false;
+
+	arm_read_sysreg(HPFAR, hpfar);
+	arm_read_sysreg(HDFAR, hdfar);
+	addr = ((hpfar >> HPFAR_FIPA_SHIFT) << 12) | (hdfar & ~PAGE_MASK);
+
+	size = 1 << ((hsr >> HSR_DABT_SAS_SHIFT) & 0x3);
+	reg = (hsr >> HSR_DABT_SRT_SHIFT) & 0xf;
+	is_write = !!(hsr & HSR_DABT_WNR);
+	/* sp, lr and pc are not part of the saved frame */
+	if (reg > 12 || size > 4)
+		return false;
+
+	region = mmio_find_region(cpu_data->cell, addr);
+	if (!region)
+		return false;
+
+	value = is_write ? regs->usr[reg] : 0;
+	if (!region->handler(cpu_data, region->arg, addr - region->start,
+			     size, is_write, &value))
+		return false;
+
+	if (!is_write) {
+		if (hsr & HSR_DABT_SSE && size < 4 &&
+		    value & (1UL << (size * 8 - 1)))
+			value |= ~0UL << (size * 8);
+		regs->usr[reg] = value;
+	}
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
+	arm_write_elr(arm_read_elr() + (hsr & HSR_IL ? 4 : 2));
+	return true;
+}
+
+static void arm_dispatch_exit(struct per_cpu *cpu_data,
+			      struct registers *regs)
+{
+	u32 hsr = 0, ec;
+
+	if (regs->exit_reason == EXIT_REASON_IRQ) {
+		trace_event(cpu_data, JAILHOUSE_TRACE_VMEXIT,
+			    EXIT_REASON_IRQ, arm_read_elr());
+		if (!gic_handle_irq(cpu_data))
+			return;
+		cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
+		arm_cpu_events(cpu_data, regs);
+		return;
+	}
+
+	arm_read_sysreg(HSR, hsr);
+	ec = hsr >> HSR_EC_SHIFT;
+	trace_event(cpu_data, JAILHOUSE_TRACE_VMEXIT, hsr, arm_read_elr());
+
+	switch (ec) {
+	case HSR_EC_HVC:
+		arm_handle_hvc(cpu_data, regs, hsr);
+		return;
+	case HSR_EC_DABT:
+		if (arm_handle_dabt(cpu_data, regs, hsr))
+			return;
+		panic_printk("FATAL: Unhandled data abort, HSR %x\n", hsr);
+		break;
+	default:
+		panic_printk("FATAL: Unhandled trap, HSR %x\n", hsr);
+		break;
+	}
+
+	panic_printk("PC: %p LR: %p\n", arm_read_elr(), regs->usr[13]);
+	panic_stop(cpu_data);
+}
+
+void arch_handle_exit(struct per_cpu *cpu_data, struct registers *regs)
+{
+	unsigned long start;
+
+	if (cpu_data->hyp_state != HYP_ACTIVE) {
+		arm_hyp_call(cpu_data, regs);
+		return;
+	}
+
+	start = read_tsc();
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+
+	arm_dispatch_exit(cpu_data, regs);
+
+	if (cpu_data->num_pending_irqs > 0)
+		gic_inject_pending(cpu_data);
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CYCLES] +=
+		read_tsc() - start;
+}
@@ -14,17 +14,21 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/control.h>
+#include <jailhouse/hypercall.h>
+#include <jailhouse/mcs-lock.h>
 #include <jailhouse/mmio.h>
 #include <asm/apic.h>
 #include <asm/bitops.h>
+#include <asm/cat.h>
 #include <asm/fault.h>
-#include <asm/spinlock.h>
+#include <asm/profile.h>
 #include <asm/vmx.h>
 
+#ifndef CONFIG_X86_X2APIC_ONLY
 bool using_x2apic;
+#endif
 
 static u8 apic_to_cpu_id[] = { [0 ... APIC_MAX_PHYS_ID] = APIC_INVALID_ID };
-static DEFINE_SPINLOCK(wait_lock);
 static void *xapic_page;
 
 static struct {
@@ -88,7 +92,7 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 	unsigned int apic_id = phys_processor_id();
 	unsigned int cpu_id = cpu_data->cpu_id;
 
-	printk("(APIC ID %d) ", apic_id);
+	printk(" CPU %d: APIC ID %d\n", cpu_id, apic_id);
 
 	if (apic_id > APIC_MAX_PHYS_ID)
 		return -ERANGE;
@@ -101,9 +105,45 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 
 	apic_to_cpu_id[apic_id] = cpu_id;
 	cpu_data->apic_id = apic_id;
+	/* CPUs of the root cell come up in parallel */
+	set_bit(apic_id, cpu_data->cell->apic.id_bitmap);
 	return 0;
 }
 
+void apic_cell_init(struct cell *cell)
+{
+	unsigned int cpu;
+
+	for_each_cpu(cpu, cell->cpu_set)
+		set_bit(per_cpu(cpu)->apic_id, cell->apic.id_bitmap);
+}
+
+/* the root cell is suspended */
+void apic_root_cell_shrink(struct cell *new_cell)
+{
+	unsigned int cpu;
+
+	for_each_cpu(cpu, new_cell->cpu_set)
+		clear_bit(per_cpu(cpu)->apic_id, cell_list->apic.id_bitmap);
+}
+
+/* the CPU is stopped and moves from the cell to the other one right after */
+void apic_cell_move_cpu(struct cell *from, struct cell *to,
+			unsigned int cpu_id)
+{
+	clear_bit(per_cpu(cpu_id)->apic_id, from->apic.id_bitmap);
+	set_bit(per_cpu(cpu_id)->apic_id, to->apic.id_bitmap);
+}
+
+/* the CPUs of the cell go back to the root cell right after this */
+void apic_cell_exit(struct cell *cell)
+{
+	unsigned int cpu;
+
+	for_each_cpu(cpu, cell->cpu_set)
+		set_bit(per_cpu(cpu)->apic_id, cell_list->apic.id_bitmap);
+}
+
 int apic_init(void)
 {
 	unsigned long apicbase;
@@ -117,15 +157,20 @@ int apic_init(void)
 		apic_ops.read_id = read_x2apic_id;
 		apic_ops.write = write_x2apic;
 		apic_ops.send_ipi = send_x2apic_ipi;
+#ifndef CONFIG_X86_X2APIC_ONLY
 		using_x2apic = true;
-	} else if (apicbase & APIC_BASE_EN) {
-		xapic_page = page_alloc(&remap_pool, 1);
+#endif
+	} else if (apicbase & APIC_BASE_EN && !using_x2apic) {
+		/* unreachable with CONFIG_X86_X2APIC_ONLY */
+		xapic_page = page_alloc(&remap_pool, 1,
+					 JAILHOUSE_POOL_USER_REMAP);
 		if (!xapic_page)
 			return -ENOMEM;
 		err = page_map_create(hv_page_table, XAPIC_BASE, PAGE_SIZE,
 				      (unsigned long)xapic_page,
 				      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
-				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS);
+				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE);
 		if (err)
 			return err;
 		apic_ops.read = read_xapic;
@@ -140,29 +185,49 @@ int apic_init(void)
 	return 0;
 }
 
-void arch_suspend_cpu(unsigned int cpu_id)
+/* let the target pass through its event processing once */
+void arch_kick_cpu(unsigned int cpu_id)
 {
+	u32 icr_lo = USE_EVENT_VECTOR ?
+		APIC_EVENT_VECTOR | APIC_ICR_DLVR_FIXED : APIC_ICR_DLVR_NMI;
+
+	if (!USE_EVENT_VECTOR)
+		__atomic_fetch_add(&per_cpu(cpu_id)->kicks_pending, 1,
+				   __ATOMIC_SEQ_CST);
+	apic_ops.send_ipi(per_cpu(cpu_id)->apic_id,
+			  icr_lo | APIC_ICR_DEST_PHYSICAL |
+			  APIC_ICR_LV_ASSERT | APIC_ICR_TM_EDGE |
+			  APIC_ICR_SH_NONE);
+}
+
+static void apic_request_stop(unsigned int cpu_id)
+{
+	struct mcs_node node;
 	struct per_cpu *target_data = per_cpu(cpu_id);
 	bool target_stopped;
 
-	spin_lock(&wait_lock);
+	mcs_lock(&target_data->control_lock, &node);
 
 	target_data->stop_cpu = true;
 	target_stopped = target_data->cpu_stopped;
 
-	spin_unlock(&wait_lock);
+	mcs_unlock(&target_data->control_lock, &node);
 
-	if (!target_stopped) {
-		apic_ops.send_ipi(target_data->apic_id,
-				  APIC_ICR_DLVR_NMI |
-				  APIC_ICR_DEST_PHYSICAL |
-				  APIC_ICR_LV_ASSERT |
-				  APIC_ICR_TM_EDGE |
-				  APIC_ICR_SH_NONE);
+	if (!target_stopped)
+		arch_kick_cpu(cpu_id);
+}
 
-		while (!target_data->cpu_stopped)
-			cpu_relax();
-	}
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception)
+{
+	unsigned int cpu;
+
+	/* kick all targets first, then collect their acknowledgements */
+	for_each_cpu_except(cpu, cpu_set, exception)
+		apic_request_stop(cpu);
+
+	for_each_cpu_except(cpu, cpu_set, exception)
+		cpu_wait_while(!per_cpu(cpu)->cpu_stopped,
+			       &per_cpu(cpu)->cpu_stopped);
 }
 
 void arch_resume_cpu(unsigned int cpu_id)
@@ -176,16 +241,52 @@ void arch_resume_cpu(unsigned int cpu_id)
 /* target cpu has to be stopped */
 void arch_reset_cpu(unsigned int cpu_id)
 {
-	per_cpu(cpu_id)->sipi_vector = APIC_BSP_PSEUDO_SIPI;
+	struct mcs_node node;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	mcs_lock(&target_data->control_lock, &node);
+	if (target_data->restore_state) {
+		/* a restored AP goes back to waiting for its SIPI */
+		target_data->wait_for_sipi = target_data->cpu_state.flags &
+			JAILHOUSE_CPU_STATE_WAIT_FOR_SIPI;
+		if (target_data->wait_for_sipi)
+			target_data->restore_state = false;
+	}
+	target_data->sipi_vector = APIC_BSP_PSEUDO_SIPI;
+	mcs_unlock(&target_data->control_lock, &node);
 
 	arch_resume_cpu(cpu_id);
 }
 
-void arch_shutdown_cpu(unsigned int cpu_id)
+/* target cpu has to be stopped */
+void arch_park_cpu(unsigned int cpu_id)
 {
-	arch_suspend_cpu(cpu_id);
-	per_cpu(cpu_id)->shutdown_cpu = true;
+	struct mcs_node node;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	/* wait for INIT/SIPI from the new owner, like a CPU after reset */
+	mcs_lock(&target_data->control_lock, &node);
+	target_data->init_signaled = false;
+	target_data->wait_for_sipi = true;
+	/* a state set for the former cell does not apply to the new one */
+	target_data->restore_state = false;
+	mcs_unlock(&target_data->control_lock, &node);
+
+	/* drop TLB entries of the former cell's EPT before its reuse */
+	target_data->flush_caches = true;
+
 	arch_resume_cpu(cpu_id);
+}
+
+void arch_shutdown_cpus(struct cpu_set *cpu_set)
+{
+	unsigned int cpu;
+
+	arch_suspend_cpus(cpu_set, -1);
+	for_each_cpu(cpu, cpu_set) {
+		per_cpu(cpu)->shutdown_cpu = true;
+		arch_resume_cpu(cpu);
+	}
 	/*
 	 * Note: The caller has to ensure that the target CPU has enough time
 	 * to reach the shutdown position before destroying the code path it
@@ -194,14 +295,72 @@ void arch_shutdown_cpu(unsigned int cpu_id)
 	 */
 }
 
-void apic_nmi_handler(struct per_cpu *cpu_data)
+unsigned int arch_cpu_phys_id(unsigned int cpu_id)
 {
-	vmx_schedule_vmexit(cpu_data);
+	return per_cpu(cpu_id)->apic_id;
+}
+
+void arch_cell_doorbell(struct per_cpu *cpu_data, struct cell *cell)
+{
+	unsigned int cpu = next_cpu(-1, cell->cpu_set, -1);
+
+	/* the first CPU of a cell receives its doorbells */
+	trace_event(cpu_data, JAILHOUSE_TRACE_DOORBELL, cell->id, cpu);
+	apic_ops.send_ipi(per_cpu(cpu)->apic_id,
+			  (cell->doorbell_vector & APIC_ICR_VECTOR_MASK) |
+			  APIC_ICR_DLVR_FIXED | APIC_ICR_DEST_PHYSICAL |
+			  APIC_ICR_LV_ASSERT | APIC_ICR_TM_EDGE |
+			  APIC_ICR_SH_NONE);
+}
+
+/*
+ * Kicks are counted before their NMI is sent, and each NMI consumes at most
+ * one of them, so a kick never turns into a guest NMI. Profiling samples are
+ * claimed by their counter overflow. Any other NMI belongs to the guest, be
+ * it an NMI IPI or the perf or watchdog NMI of its own APIC. NMIs that
+ * coalesce leave a kick counted that then swallows a later guest NMI, like
+ * NMIs that coalesce on real hardware.
+ */
+void apic_nmi_handler(struct per_cpu *cpu_data, unsigned long rip)
+{
+	bool sampled = profile_nmi(cpu_data, rip);
+
+	/* only this CPU decrements, the count cannot drop in between */
+	if (!USE_EVENT_VECTOR &&
+	    __atomic_load_n(&cpu_data->kicks_pending, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_fetch_sub(&cpu_data->kicks_pending, 1,
+				   __ATOMIC_SEQ_CST);
+		vmx_schedule_vmexit(cpu_data);
+	} else if (!sampled)
+		cpu_data->guest_nmi_pending = true;
+}
+
+/* routes counter overflows of this CPU to the NMI handler, or masks them */
+void apic_set_pmi(bool enable)
+{
+	apic_ops.write(APIC_REG_LVTPC,
+		       enable ? APIC_ICR_DLVR_NMI : APIC_LVT_MASKED);
+}
+
+void apic_eoi(void)
+{
+	apic_ops.write(APIC_REG_EOI, 0);
+}
+
+/* retires the highest vector in service and raises it again */
+void apic_resend_irq(unsigned int vector)
+{
+	apic_eoi();
+	apic_ops.send_ipi(0, vector | APIC_ICR_DLVR_FIXED |
+			  APIC_ICR_LV_ASSERT | APIC_ICR_TM_EDGE |
+			  APIC_ICR_SH_SELF);
 }
 
 int apic_handle_events(struct per_cpu *cpu_data)
 {
-	spin_lock(&wait_lock);
+	struct mcs_node node;
+
+	mcs_lock(&cpu_data->control_lock, &node);
 
 	do {
 		if (cpu_data->init_signaled) {
@@ -212,30 +371,38 @@ int apic_handle_events(struct per_cpu *cpu_data)
 
 		cpu_data->cpu_stopped = true;
 
-		spin_unlock(&wait_lock);
+		mcs_unlock(&cpu_data->control_lock, &node);
 
-		while (cpu_data->wait_for_sipi || cpu_data->stop_cpu)
-			cpu_relax();
+		/* both share a cache line, see struct per_cpu */
+		cpu_wait_while(cpu_data->wait_for_sipi || cpu_data->stop_cpu,
+			       &cpu_data->stop_cpu);
 
 		if (cpu_data->shutdown_cpu) {
 			/* disable APIC */
 			apic_ops.write(APIC_REG_SPIV, 0);
+			profile_cpu_exit(cpu_data);
 			vmx_cpu_exit(cpu_data);
 			asm volatile("hlt");
 		}
 
-		spin_lock(&wait_lock);
+		mcs_lock(&cpu_data->control_lock, &node);
 
 		cpu_data->cpu_stopped = false;
 	} while (cpu_data->init_signaled);
 
+	/* Only guest-physical mappings of this cell changed, the
+	 * hypervisor's TLB is not affected. Dirty logging may also have
+	 * been switched on or off for the cell. */
 	if (cpu_data->flush_caches) {
 		cpu_data->flush_caches = false;
-		flush_tlb();
-		vmx_invept();
+		vmx_reload_ept(cpu_data->cell);
 	}
 
-	spin_unlock(&wait_lock);
+	mcs_unlock(&cpu_data->control_lock, &node);
+
+	/* the cell assignment or the cache partitioning may have changed */
+	cat_cpu_update(cpu_data);
+	profile_cpu_update(cpu_data);
 
 	return cpu_data->sipi_vector;
 }
@@ -254,29 +421,19 @@ static void apic_validate_ipi_mode(struct per_cpu *cpu_data, u32 lo_val)
 			     "ICR.lo=%x\n", lo_val);
 		panic_stop(cpu_data);
 	}
-
-	switch (lo_val & APIC_ICR_SH_MASK) {
-	case APIC_ICR_SH_NONE:
-	case APIC_ICR_SH_SELF:
-		break;
-	default:
-		panic_printk("FATAL: Unsupported shorthand, ICR.lo=%x\n",
-			     lo_val);
-		panic_stop(cpu_data);
-	}
 }
 
 static void apic_deliver_ipi(struct per_cpu *cpu_data,
 			     unsigned int target_cpu_id,
 			     u32 orig_icr_hi, u32 icr_lo)
 {
+	struct mcs_node node;
 	struct per_cpu *target_data;
 
 	if (target_cpu_id == APIC_INVALID_ID ||
 	    !test_bit(target_cpu_id, cpu_data->cell->cpu_set->bitmap)) {
-		printk("WARNING: CPU %d specified IPI destination outside "
-		       "cell boundaries, ICR.hi=%x\n",
-		       cpu_data->cpu_id, orig_icr_hi);
+		trace_event(cpu_data, JAILHOUSE_TRACE_IPI_OUTSIDE_CELL,
+			    orig_icr_hi, icr_lo);
 		return;
 	}
 
@@ -284,28 +441,26 @@ static void apic_deliver_ipi(struct per_cpu *cpu_data,
 
 	switch (icr_lo & APIC_ICR_DLVR_MASK) {
 	case APIC_ICR_DLVR_NMI:
-		/* TODO: must be sent via hypervisor */
-		printk("Ignoring NMI IPI\n");
+		/* not flagged as kick, so the target injects it */
+		apic_ops.send_ipi(target_data->apic_id,
+				  APIC_ICR_DLVR_NMI | APIC_ICR_DEST_PHYSICAL |
+				  APIC_ICR_LV_ASSERT | APIC_ICR_TM_EDGE |
+				  APIC_ICR_SH_NONE);
 		return;
 	case APIC_ICR_DLVR_INIT:
-		spin_lock(&wait_lock);
+		mcs_lock(&target_data->control_lock, &node);
 
 		if (!target_data->wait_for_sipi)
 			target_data->init_signaled = true;
 
-		spin_unlock(&wait_lock);
+		mcs_unlock(&target_data->control_lock, &node);
 
-		apic_ops.send_ipi(target_data->apic_id,
-				  APIC_ICR_DLVR_NMI |
-				  APIC_ICR_DEST_PHYSICAL |
-				  APIC_ICR_LV_ASSERT |
-				  APIC_ICR_TM_EDGE |
-				  APIC_ICR_SH_NONE);
+		arch_kick_cpu(target_cpu_id);
 		return;
 	case APIC_ICR_DLVR_SIPI:
 		target_data = per_cpu(target_cpu_id);
 
-		spin_lock(&wait_lock);
+		mcs_lock(&target_data->control_lock, &node);
 
 		if (target_data->wait_for_sipi) {
 			target_data->wait_for_sipi = false;
@@ -313,13 +468,91 @@ static void apic_deliver_ipi(struct per_cpu *cpu_data,
 				icr_lo & APIC_ICR_VECTOR_MASK;
 		}
 
-		spin_unlock(&wait_lock);
+		mcs_unlock(&target_data->control_lock, &node);
 		return;
 	}
 
 	apic_ops.send_ipi(target_data->apic_id, icr_lo);
 }
 
+/* x2APIC logical IDs of the cell's CPUs in the given cluster */
+static unsigned long apic_cluster_ids(struct cell *cell,
+				      unsigned int cluster_id)
+{
+	/* each cluster covers 16 APIC IDs, i.e. a quarter of a long */
+	return (cell->apic.id_bitmap[cluster_id / 4] >>
+		((cluster_id % 4) * 16)) & X2APIC_DEST_LOGICAL_ID_MASK;
+}
+
+/*
+ * Logical destinations are resolved by the APICs themselves. If all CPUs
+ * addressed belong to the cell, the IPI can be sent unmodified.
+ */
+static bool apic_logical_dest_in_cell(struct cell *cell, unsigned long dest)
+{
+	unsigned int cluster_id;
+
+	if (!using_x2apic)
+		/* flat mode, logical ID bit n is CPU n */
+		return (dest & ~cell->cpu_set->bitmap[0]) == 0;
+
+	cluster_id = (dest & X2APIC_DEST_CLUSTER_ID_MASK) >>
+		X2APIC_DEST_CLUSTER_ID_SHIFT;
+	if (cluster_id > X2APIC_MAX_CLUSTER_ID)
+		return false;
+
+	return (dest & X2APIC_DEST_LOGICAL_ID_MASK &
+		~apic_cluster_ids(cell, cluster_id)) == 0;
+}
+
+/*
+ * A broadcast must not leave the cell. It is expanded to one logical
+ * multicast per x2APIC cluster of the cell resp. a single one in flat mode.
+ * INIT and SIPI are emulated per CPU.
+ */
+static void apic_deliver_cell_ipi(struct per_cpu *cpu_data, u32 lo_val)
+{
+	bool all_but_self =
+		(lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_ALLOTHER;
+	struct cell *cell = cpu_data->cell;
+	unsigned int cluster_id, cpu;
+	unsigned long ids;
+
+	lo_val &= ~(APIC_ICR_SH_MASK | APIC_ICR_DEST_LOGICAL);
+
+	if ((lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_INIT ||
+	    (lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_SIPI) {
+		for_each_cpu_except(cpu, cell->cpu_set,
+				    all_but_self ? cpu_data->cpu_id : -1)
+			apic_deliver_ipi(cpu_data, cpu, 0, lo_val);
+		return;
+	}
+
+	lo_val |= APIC_ICR_DEST_LOGICAL;
+
+	if (!using_x2apic) {
+		ids = cell->cpu_set->bitmap[0] & 0xff;
+		if (all_but_self)
+			ids &= ~(1UL << cpu_data->cpu_id);
+		if (ids)
+			apic_ops.send_ipi(ids, lo_val);
+		return;
+	}
+
+	for (cluster_id = 0; cluster_id <= X2APIC_MAX_CLUSTER_ID;
+	     cluster_id++) {
+		ids = apic_cluster_ids(cell, cluster_id);
+		if (all_but_self && cluster_id ==
+		    cpu_data->apic_id >> X2APIC_CLUSTER_ID_SHIFT)
+			ids &= ~(1UL << (cpu_data->apic_id &
+					 X2APIC_LOGICAL_ID_MASK));
+		if (ids)
+			apic_ops.send_ipi(cluster_id <<
+					  X2APIC_DEST_CLUSTER_ID_SHIFT | ids,
+					  lo_val);
+	}
+}
+
 static void apic_deliver_logical_dest_ipi(struct per_cpu *cpu_data,
 					  unsigned long dest, u32 lo_val,
 					  u32 hi_val)
@@ -361,7 +594,17 @@ void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val)
 
 	apic_validate_ipi_mode(cpu_data, lo_val);
 
+	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_ALL ||
+	    (lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_ALLOTHER) {
+		apic_deliver_cell_ipi(cpu_data, lo_val);
+		return;
+	}
+
 	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_SELF) {
+		if ((lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_NMI) {
+			cpu_data->guest_nmi_pending = true;
+			return;
+		}
 		apic_ops.write(APIC_REG_ICR, (lo_val & APIC_ICR_VECTOR_MASK) |
 					     APIC_ICR_DLVR_FIXED |
 					     APIC_ICR_TM_EDGE |
@@ -374,6 +617,13 @@ void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val)
 		dest >>= 24;
 
 	if (lo_val & APIC_ICR_DEST_LOGICAL) {
+		/* INIT and SIPI are emulated, everything else can multicast */
+		if ((lo_val & APIC_ICR_DLVR_MASK) != APIC_ICR_DLVR_INIT &&
+		    (lo_val & APIC_ICR_DLVR_MASK) != APIC_ICR_DLVR_SIPI &&
+		    apic_logical_dest_in_cell(cpu_data->cell, dest)) {
+			apic_ops.send_ipi(dest, lo_val);
+			return;
+		}
 		lo_val &= ~APIC_ICR_DEST_LOGICAL;
 		apic_deliver_logical_dest_ipi(cpu_data, dest, lo_val, hi_val);
 	} else {
@@ -384,13 +634,14 @@ void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val)
 	}
 }
 
+#ifndef CONFIG_X86_X2APIC_ONLY
 unsigned int apic_mmio_access(struct registers *guest_regs,
 			      struct per_cpu *cpu_data, unsigned long rip,
 			      unsigned long page_table_addr, unsigned int reg,
-			      bool is_write)
+			      bool is_write, unsigned long *rflags)
 {
 	struct mmio_access access;
-	unsigned long val;
+	unsigned long val = 0;
 
 	access = mmio_parse(cpu_data, rip, page_table_addr, is_write);
 	if (access.inst_len == 0)
@@ -400,8 +651,15 @@ unsigned int apic_mmio_access(struct registers *guest_regs,
 			     access.size);
 		return 0;
 	}
-	if (is_write) {
-		val = ((unsigned long *)guest_regs)[access.reg];
+	/* nothing above the x2APIC range, read as 0, writes are dropped */
+	if (reg > MSR_X2APIC_END - MSR_X2APIC_BASE) {
+		mmio_execute(guest_regs, rflags, &access, 0);
+		return access.inst_len;
+	}
+	if (access.does_read)
+		val = apic_ops.read(reg);
+	val = mmio_execute(guest_regs, rflags, &access, val);
+	if (access.does_write) {
 		if (reg == APIC_REG_ICR) {
 			apic_handle_icr_write(cpu_data, val,
 					      apic_ops.read(APIC_REG_ICR_HI));
@@ -416,20 +674,21 @@ unsigned int apic_mmio_access(struct registers *guest_regs,
 			return 0;
 		} else
 			apic_ops.write(reg, val);
-	} else {
-		val = apic_ops.read(reg);
-		((unsigned long *)guest_regs)[access.reg] = val;
 	}
 	return access.inst_len;
 }
+#endif
 
 void x2apic_handle_write(struct registers *guest_regs)
 {
 	u32 reg = guest_regs->rcx;
 
 	if (reg == MSR_X2APIC_SELF_IPI)
-		/* TODO: emulate */
-		printk("Unhandled x2APIC self IPI write\n");
+		/* only reached with xAPIC hardware, x2APIC passes it through */
+		apic_ops.write(APIC_REG_ICR,
+			       (guest_regs->rax & APIC_ICR_VECTOR_MASK) |
+			       APIC_ICR_DLVR_FIXED | APIC_ICR_TM_EDGE |
+			       APIC_ICR_SH_SELF);
 	else
 		apic_ops.write(reg - MSR_X2APIC_BASE, guest_regs->rax);
 }
@@ -0,0 +1,251 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/control.h>
+#include <jailhouse/printk.h>
+#include <asm/cat.h>
+#include <asm/processor.h>
+
+#define CPUID_7_EBX_RDT_A	(1 << 15)
+#define CPUID_10_EBX_L3_CAT	(1 << 1)
+#define CPUID_10_EBX_MBA	(1 << 3)
+#define CPUID_10_3_ECX_LINEAR	(1 << 2)
+
+#define MBA_MAX_BANDWIDTH	100
+
+static bool l3_cat, mba;
+/* highest class of service supported by all available features */
+static unsigned int max_cos;
+static u32 all_ways;
+/* released by cells, but not adjacent to the ways of the root cell */
+static u32 unused_ways;
+/* throttling values are percentages in steps of mba_granularity */
+static u32 mba_max_delay, mba_granularity;
+
+static bool mask_contiguous(u32 mask)
+{
+	/* adding the lowest bit carries through a contiguous run */
+	return mask != 0 && ((mask + (mask & -mask)) & mask) == 0;
+}
+
+static int mba_delay(u32 bandwidth, u32 *delay)
+{
+	*delay = 0;
+	if (bandwidth == 0 || bandwidth == MBA_MAX_BANDWIDTH)
+		return 0;
+	if (bandwidth > MBA_MAX_BANDWIDTH)
+		return -EINVAL;
+	if (!mba)
+		return -ENODEV;
+
+	/* round towards the stricter budget */
+	*delay = (MBA_MAX_BANDWIDTH - bandwidth + mba_granularity - 1) /
+		mba_granularity * mba_granularity;
+	if (*delay > mba_max_delay)
+		*delay = mba_max_delay;
+	return 0;
+}
+
+int cat_init(struct cell *root_cell, struct jailhouse_cell_desc *config)
+{
+	unsigned int eax, ebx, ecx, edx, features = 0;
+
+	root_cell->cat.cos = CAT_ROOT_COS;
+
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 0x10) {
+		cpuid(7, &eax, &ebx, &ecx, &edx);
+		if (ebx & CPUID_7_EBX_RDT_A) {
+			cpuid(0x10, &eax, &ebx, &ecx, &edx);
+			features = ebx;
+		}
+	}
+
+	max_cos = -1;
+	if (features & CPUID_10_EBX_L3_CAT) {
+		eax = 0x10;
+		ecx = 1;
+		__cpuid(&eax, &ebx, &ecx, &edx);
+		all_ways = (eax & 0x1f) == 31 ?
+			~0U : (1U << ((eax & 0x1f) + 1)) - 1;
+		max_cos = edx & 0xffff;
+		l3_cat = true;
+	}
+	if (features & CPUID_10_EBX_MBA) {
+		eax = 0x10;
+		ecx = 3;
+		__cpuid(&eax, &ebx, &ecx, &edx);
+		if (ecx & CPUID_10_3_ECX_LINEAR) {
+			mba_max_delay = (eax & 0xfff) + 1;
+			mba_granularity = MBA_MAX_BANDWIDTH - mba_max_delay;
+			if ((edx & 0xffff) < max_cos)
+				max_cos = edx & 0xffff;
+			mba = true;
+		}
+	}
+
+	if (config->l3_cache_mask == 0)
+		root_cell->cat.mask = all_ways;
+	else if (!l3_cat)
+		return -ENODEV;
+	else if (config->l3_cache_mask & ~all_ways ||
+		 !mask_contiguous(config->l3_cache_mask))
+		return -EINVAL;
+	else
+		root_cell->cat.mask = config->l3_cache_mask;
+
+	if (l3_cat)
+		printk("CAT: L3 mask %x, %d classes of service\n", all_ways,
+		       max_cos + 1);
+	if (mba)
+		printk("MBA: throttling up to %d percent in steps of %d\n",
+		       mba_max_delay, mba_granularity);
+
+	/*
+	 * Class 0 is shared with all cells without own settings and is what
+	 * cat_cpu_exit falls back to, so it must never be throttled.
+	 */
+	root_cell->cat.mba_delay = 0;
+	if (config->mem_bandwidth != 0 &&
+	    config->mem_bandwidth != MBA_MAX_BANDWIDTH) {
+		printk("MBA: root cell cannot be throttled\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void write_cos(struct cell *cell)
+{
+	/* cells without own ways use those of the root cell */
+	if (l3_cat)
+		write_msr(MSR_IA32_L3_MASK_0 + cell->cat.cos,
+			  cell->cat.mask ? cell->cat.mask :
+			  cell_list->cat.mask);
+	if (mba)
+		write_msr(MSR_IA32_MBA_THRTL_0 + cell->cat.cos,
+			  cell->cat.mba_delay);
+}
+
+/*
+ * The class settings are per package. Each CPU rewrites those of all cells
+ * when its own class is assigned, so that changes to the root cell reach
+ * every package with root CPUs.
+ */
+void cat_cpu_update(struct per_cpu *cpu_data)
+{
+	struct cell *cell;
+
+	if (!l3_cat && !mba)
+		return;
+
+	write_cos(cpu_data->cell);
+	for (cell = cell_list; cell; cell = cell->next)
+		if (cell == cell_list || cell->cat.cos != CAT_ROOT_COS)
+			write_cos(cell);
+	write_msr(MSR_IA32_PQR_ASSOC, (u64)cpu_data->cell->cat.cos << 32);
+}
+
+void cat_cpu_exit(struct per_cpu *cpu_data)
+{
+	if (l3_cat)
+		write_msr(MSR_IA32_L3_MASK_0 + CAT_ROOT_COS, all_ways);
+	if (mba)
+		write_msr(MSR_IA32_MBA_THRTL_0 + CAT_ROOT_COS, 0);
+	if (l3_cat || mba)
+		write_msr(MSR_IA32_PQR_ASSOC, 0);
+}
+
+int cat_cell_init(struct per_cpu *cpu_data, struct cell *cell,
+		  struct jailhouse_cell_desc *config)
+{
+	u32 mask = config->l3_cache_mask;
+	u32 root_mask = cell_list->cat.mask;
+	struct cell *c;
+	u32 cos, delay;
+	int err;
+
+	cell->cat.cos = CAT_ROOT_COS;
+	cell->cat.mask = 0;
+	cell->cat.mba_delay = 0;
+
+	err = mba_delay(config->mem_bandwidth, &delay);
+	if (err)
+		return err;
+	if (mask == 0 && delay == 0)
+		return 0;
+	if (mask != 0 && !l3_cat)
+		return -ENODEV;
+
+	/* the root cell has to keep a contiguous, non-empty set of ways */
+	if (mask != 0 &&
+	    (mask & ~(root_mask | unused_ways) || !mask_contiguous(mask) ||
+	     !mask_contiguous(root_mask & ~mask)))
+		return -EINVAL;
+
+	/* the new cell is not yet listed */
+	for (cos = CAT_ROOT_COS + 1; cos <= max_cos; cos++) {
+		for (c = cell_list; c; c = c->next)
+			if (c->cat.cos == cos)
+				break;
+		if (!c)
+			break;
+	}
+	if (cos > max_cos)
+		return -EBUSY;
+
+	cell->cat.cos = cos;
+	cell->cat.mask = mask;
+	cell->cat.mba_delay = delay;
+	cell_list->cat.mask = root_mask & ~mask;
+	unused_ways &= ~mask;
+
+	/* suspended root CPUs and the new cell's CPUs update on resumption */
+	cat_cpu_update(cpu_data);
+
+	return 0;
+}
+
+void cat_cell_exit(struct per_cpu *cpu_data, struct cell *cell)
+{
+	u32 mask, grown;
+
+	if (cell->cat.cos == CAT_ROOT_COS)
+		return;
+
+	unused_ways |= cell->cat.mask;
+	cell->cat.cos = CAT_ROOT_COS;
+	cell->cat.mask = 0;
+	cell->cat.mba_delay = 0;
+
+	/* grow the root cell's ways as long as they stay contiguous */
+	mask = cell_list->cat.mask;
+	while ((grown = mask | (unused_ways & (mask << 1 | mask >> 1))) !=
+	       mask)
+		mask = grown;
+	cell_list->cat.mask = mask;
+	unused_ways &= ~mask;
+
+	cat_cpu_update(cpu_data);
+}
+
+/*
+ * Cells must not change their class, its ways or its bandwidth, writes are
+ * ignored. The range includes the MBA throttling MSRs.
+ */
+bool cat_handle_msr_write(struct registers *guest_regs)
+{
+	return guest_regs->rcx == MSR_IA32_PQR_ASSOC ||
+		(guest_regs->rcx >= MSR_IA32_L3_MASK_0 &&
+		 guest_regs->rcx <= MSR_IA32_L3_MASK_END);
+}
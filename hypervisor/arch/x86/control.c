@@ -11,17 +11,189 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/entry.h>
+#include <jailhouse/hypercall.h>
+#include <jailhouse/string.h>
+#include <asm/apic.h>
+#include <asm/cat.h>
+#include <asm/pci.h>
 #include <asm/vmx.h>
+#include <asm/vtd.h>
 
+/* the root cell is still running, only build the new cell's structures */
 int arch_cell_create(struct per_cpu *cpu_data, struct cell *new_cell,
 		     struct jailhouse_cell_desc *config)
+{
+	int err;
+
+	if (!apic_valid_doorbell_vector(config->doorbell_vector))
+		return -EINVAL;
+
+	err = cat_cell_init(cpu_data, new_cell, config);
+	if (err)
+		return err;
+
+	err = vmx_cell_init(new_cell, config);
+	if (err)
+		goto err_cat_exit;
+
+	err = vtd_cell_init(new_cell, config);
+	if (err)
+		goto err_vmx_exit;
+
+	err = pci_cell_init(new_cell, config);
+	if (err)
+		goto err_vtd_exit;
+
+	apic_cell_init(new_cell);
+
+	return 0;
+
+err_vtd_exit:
+	vtd_cell_exit(new_cell);
+err_vmx_exit:
+	vmx_cell_exit(new_cell);
+err_cat_exit:
+	cat_cell_exit(cpu_data, new_cell);
+	return err;
+}
+
+/* called for consecutive parts of the regions after arch_cell_create */
+int arch_map_memory_region(struct cell *cell,
+			   const struct jailhouse_memory *mem)
+{
+	int err;
+
+	if (!(cell->config->flags & JAILHOUSE_CELL_LAZY_EPT)) {
+		err = vmx_map_memory_region(cell, mem);
+		if (err)
+			return err;
+	}
+
+	return vtd_map_memory_region(cell, mem);
+}
+
+/* undoes arch_cell_create, the root cell has not given up anything yet */
+void arch_cell_abort(struct per_cpu *cpu_data, struct cell *cell)
+{
+	pci_cell_exit(cell);
+	vtd_cell_exit(cell);
+	vmx_cell_exit(cell);
+	cat_cell_exit(cpu_data, cell);
+}
+
+/* the root cell is suspended, take the resources of the new cell from it */
+void arch_cell_commit(struct per_cpu *cpu_data, struct cell *new_cell,
+		      struct jailhouse_cell_desc *config)
 {
 	unsigned int cpu;
 
 	vmx_cell_shrink(cpu_data->cell, config);
+	vtd_root_cell_shrink(config);
+	apic_root_cell_shrink(new_cell);
+
+	for_each_cpu_except(cpu, cpu_data->cell->cpu_set, cpu_data->cpu_id)
+		per_cpu(cpu)->flush_caches = true;
+}
+
+void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell)
+{
+	unsigned int cpu;
 
+	apic_cell_exit(cell);
+	pci_cell_exit(cell);
+	/* devices may still walk a shared EPT until moved to the root */
+	vtd_cell_exit(cell);
+	vmx_cell_exit(cell);
+	cat_cell_exit(cpu_data, cell);
+
+	/* the console page of the cell is gone from the root EPT */
 	for_each_cpu_except(cpu, cpu_data->cell->cpu_set, cpu_data->cpu_id)
 		per_cpu(cpu)->flush_caches = true;
+}
+
+int arch_cell_stop(struct per_cpu *cpu_data, struct cell *cell)
+{
+	return vmx_cell_set_loadable(cell);
+}
+
+void arch_cell_start(struct per_cpu *cpu_data, struct cell *cell)
+{
+	unsigned int cpu;
+
+	vmx_cell_clear_loadable(cell);
+	vtd_root_cell_ept_unmapped();
+
+	for_each_cpu_except(cpu, cpu_data->cell->cpu_set, cpu_data->cpu_id)
+		per_cpu(cpu)->flush_caches = true;
+}
+
+/* the root cell, the cell and the CPU are suspended */
+int arch_cell_add_cpu(struct per_cpu *cpu_data, struct cell *cell,
+		      unsigned int cpu_id)
+{
+	apic_cell_move_cpu(cpu_data->cell, cell, cpu_id);
+	return 0;
+}
+
+/* the root cell, the cell and the CPU are suspended */
+int arch_cell_remove_cpu(struct per_cpu *cpu_data, struct cell *cell,
+			 unsigned int cpu_id)
+{
+	apic_cell_move_cpu(cell, cpu_data->cell, cpu_id);
+	return 0;
+}
+
+int arch_cell_dirty_log(struct per_cpu *cpu_data, struct cell *cell,
+			struct jailhouse_dirty_log *log, u64 *bitmap)
+{
+	unsigned int cpu;
+	int err;
+
+	err = vmx_cell_dirty_log(cell, log, bitmap);
+
+	/* also after errors, the EPT may have been changed partially */
+	for_each_cpu(cpu, cell->cpu_set)
+		per_cpu(cpu)->flush_caches = true;
+
+	return err;
+}
+
+/* the CPU is stopped, cpu_state was saved on its way there */
+int arch_cpu_get_state(unsigned int cpu_id, struct jailhouse_cpu_state *state)
+{
+	struct per_cpu *target_data = per_cpu(cpu_id);
+
+	if (target_data->wait_for_sipi) {
+		memset(state, 0, sizeof(*state));
+		state->flags = JAILHOUSE_CPU_STATE_WAIT_FOR_SIPI;
+	} else
+		memcpy(state, &target_data->cpu_state, sizeof(*state));
+
+	return 0;
+}
+
+int arch_cpu_set_state(struct per_cpu *cpu_data, unsigned int cpu_id,
+		       const struct jailhouse_cpu_state *state)
+{
+	/* serialized by management_begin, kept off the small per-CPU stack */
+	static struct jailhouse_cpu_state copy;
+	struct per_cpu *target_data = per_cpu(cpu_id);
+	u64 pdpte[4];
+
+	/* the root cell can still modify its page, only check the copy */
+	memcpy(&copy, state, sizeof(copy));
+
+	if (copy.flags == JAILHOUSE_CPU_STATE_WAIT_FOR_SIPI)
+		memset(pdpte, 0, sizeof(pdpte));
+	else if (copy.flags != JAILHOUSE_CPU_STATE_VALID ||
+		 !vmx_cpu_state_valid(cpu_data, target_data->cell, &copy,
+				      pdpte))
+		return -EINVAL;
+
+	memcpy(&target_data->cpu_state, &copy, sizeof(copy));
+	memcpy(target_data->pdpte, pdpte, sizeof(pdpte));
+	target_data->restore_state = true;
 
-	return vmx_cell_init(new_cell, config);
+	return 0;
 }
@@ -22,11 +22,15 @@
 #define APIC_BASE_EN			(1 << 11)
 
 #define APIC_REG_ID			0x02
+#define APIC_REG_EOI			0x0b
 #define APIC_REG_LDR			0x0d
 #define APIC_REG_DFR			0x0e
 #define APIC_REG_SPIV			0x0f
 #define APIC_REG_ICR			0x30
 #define APIC_REG_ICR_HI			0x31
+#define APIC_REG_LVTPC			0x34
+
+#define APIC_LVT_MASKED			0x00010000
 
 #define APIC_ICR_VECTOR_MASK		0x000000ff
 #define APIC_ICR_DLVR_MASK		0x00000700
@@ -54,23 +58,70 @@
 #define X2APIC_DEST_CLUSTER_ID_SHIFT	16
 
 #define X2APIC_CLUSTER_ID_SHIFT		4
+#define X2APIC_LOGICAL_ID_MASK		0xf
+#define X2APIC_MAX_CLUSTER_ID		(APIC_MAX_PHYS_ID >> \
+					 X2APIC_CLUSTER_ID_SHIFT)
 
 #define APIC_BSP_PSEUDO_SIPI		0x100
 
+/*
+ * Define CONFIG_X86_EVENT_VECTOR in include/jailhouse/config.h to signal
+ * hypervisor events by this vector instead of an NMI. Events then take one
+ * VM exit instead of two, and NMIs are left to the guest. In turn, every
+ * external interrupt exits and is re-injected. Bare-metal Linux does not
+ * use this vector.
+ */
+#define APIC_EVENT_VECTOR		0xf3
+#ifdef CONFIG_X86_EVENT_VECTOR
+#define USE_EVENT_VECTOR		1
+#else
+#define USE_EVENT_VECTOR		0
+#endif
+
+/* 0 refuses doorbells, others have to be free external interrupt vectors */
+static inline bool apic_valid_doorbell_vector(u32 vector)
+{
+	if (vector == 0)
+		return true;
+	return vector >= 32 && vector <= APIC_ICR_VECTOR_MASK &&
+		!(USE_EVENT_VECTOR && vector == APIC_EVENT_VECTOR);
+}
+
+/*
+ * Define CONFIG_X86_X2APIC_ONLY in include/jailhouse/config.h for hosts whose
+ * APIC runs in x2APIC mode and cells that never program it via MMIO. The
+ * xAPIC access decoder is then left out, such accesses are fatal, and xAPIC
+ * hosts are refused.
+ */
+#ifdef CONFIG_X86_X2APIC_ONLY
+#define using_x2apic			true
+#else
 extern bool using_x2apic;
+#endif
 
 int apic_init(void);
 int apic_cpu_init(struct per_cpu *cpu_data);
 
-void apic_nmi_handler(struct per_cpu *cpu_data);
+void apic_cell_init(struct cell *cell);
+void apic_root_cell_shrink(struct cell *new_cell);
+void apic_cell_move_cpu(struct cell *from, struct cell *to,
+			unsigned int cpu_id);
+void apic_cell_exit(struct cell *cell);
+
+void apic_nmi_handler(struct per_cpu *cpu_data, unsigned long rip);
+void apic_set_pmi(bool enable);
 int apic_handle_events(struct per_cpu *cpu_data);
+void apic_eoi(void);
+void apic_resend_irq(unsigned int vector);
 
 void apic_handle_icr_write(struct per_cpu *cpu_data, u32 lo_val, u32 hi_val);
 
+#ifndef CONFIG_X86_X2APIC_ONLY
 unsigned int apic_mmio_access(struct registers *guest_regs,
 			      struct per_cpu *cpu_data, unsigned long rip,
 			      unsigned long page_table_addr, unsigned int reg,
-			      bool is_write);
+			      bool is_write, unsigned long *rflags);
+#endif
 
 void x2apic_handle_write(struct registers *guest_regs);
 void x2apic_handle_read(struct registers *guest_regs);
@@ -89,6 +89,15 @@ static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
 	return oldbit;
 }
 
+/* index of the most significant set bit, word must not be 0 */
+static inline unsigned long __fls(unsigned long word)
+{
+	asm("bsr %1,%0"
+		: "=r" (word)
+		: "rm" (word));
+	return word;
+}
+
 static inline unsigned long ffz(unsigned long word)
 {
 	asm("rep; bsf %1,%0"
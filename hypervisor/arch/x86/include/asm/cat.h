@@ -0,0 +1,27 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/cell.h>
+#include <asm/percpu.h>
+
+/* used by the root cell and all cells without own ways */
+#define CAT_ROOT_COS		0
+
+int cat_init(struct cell *root_cell, struct jailhouse_cell_desc *config);
+void cat_cpu_update(struct per_cpu *cpu_data);
+void cat_cpu_exit(struct per_cpu *cpu_data);
+
+int cat_cell_init(struct per_cpu *cpu_data, struct cell *cell,
+		  struct jailhouse_cell_desc *config);
+void cat_cell_exit(struct per_cpu *cpu_data, struct cell *cell);
+
+bool cat_handle_msr_write(struct registers *guest_regs);
@@ -17,25 +17,96 @@
 #include <asm/paging.h>
 
 #include <jailhouse/cell-config.h>
+#include <jailhouse/cell-console.h>
+#include <jailhouse/cell-info.h>
+
+#define CPUID_CACHE_BASIC_LEAVES	0x17
+#define CPUID_CACHE_EXT_LEAVES		9
+#define CPUID_CACHE_SUBLEAF_LEAVES	3
+#define CPUID_CACHE_SUBLEAVES		8
+
+struct cpuid_regs {
+	u32 eax, ebx, ecx, edx;
+};
 
 struct cell {
 	struct {
 		/* should be first as it requires page alignment */
 		u8 __attribute__((aligned(PAGE_SIZE))) io_bitmap[2*PAGE_SIZE];
+		/* indexed by VMX_MSR_BITMAP_* */
+		u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[4][0x2000/8];
 		pgd_t *ept;
+		/* one bitmap per memory region of the config, NULL for
+		 * regions without write access, set while writes are logged */
+		unsigned long **dirty_log;
+
+		struct {
+			unsigned int num_basic;
+			unsigned int num_ext;
+			struct cpuid_regs basic[CPUID_CACHE_BASIC_LEAVES];
+			struct cpuid_regs ext[CPUID_CACHE_EXT_LEAVES];
+			struct cpuid_regs subleaf[CPUID_CACHE_SUBLEAF_LEAVES]
+						 [CPUID_CACHE_SUBLEAVES];
+		} cpuid;
 	} vmx;
 
 	struct {
 		pgd_t *page_table;
 	} vtd;
 
+	struct {
+		/* set if JAILHOUSE_CELL_MEDIATE_PCI_CONFIG, never for root */
+		bool mediated;
+		struct pci_device *devices;
+		unsigned int num_devices;
+		/* emulated address register at PCI_ADDR_PORT */
+		u32 addr_port;
+	} pci;
+
+	struct {
+		/* bit n set if the CPU with APIC ID n belongs to the cell, in
+		 * x2APIC mode equal to the logical IDs of each cluster */
+		unsigned long id_bitmap[256 / BITS_PER_LONG];
+	} apic;
+
+	struct {
+		/* class of service, CAT_ROOT_COS if sharing the root's class */
+		u32 cos;
+		u32 mask;
+		/* MBA throttling in percent */
+		u32 mba_delay;
+	} cat;
+
 	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	struct jailhouse_cell_desc *config;
+	/* config->num_memory_regions pointers into the config each, sorted
+	 * by phys_start resp. virt_start, the regions do not overlap */
+	struct jailhouse_memory **mem_by_phys;
+	struct jailhouse_memory **mem_by_virt;
+	/* read-only page for the cell, NULL for the root cell */
+	struct jailhouse_cell_info *info;
+	/* output ring of the cell, NULL for the root cell */
+	struct jailhouse_cell_console *console;
+	/* console bytes already written to the hypervisor's debug output */
+	u32 console_flushed;
+	/* set while a CPU of the cell writes its console out */
+	bool console_flushing;
 	unsigned int id;
 
 	struct cpu_set *cpu_set;
 	struct cpu_set small_cpu_set;
 
 	unsigned long page_offset;
+	/* node the cell's tables are allocated from, or NUMA_NO_NODE */
+	int numa_node;
+
+	/* emulated MMIO, sorted by address */
+	struct mmio_region *mmio_regions;
+	unsigned int num_mmio_regions;
+
+	u32 doorbell_vector;
+	/* CPUs parked, image memory accessible by the root cell */
+	bool stopped;
 
 	struct cell *next;
 };
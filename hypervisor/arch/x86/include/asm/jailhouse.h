@@ -10,6 +10,62 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_JAILHOUSE_H
+#define _JAILHOUSE_ASM_JAILHOUSE_H
+
+/* segments in jailhouse_cpu_state, in the order of their VMCS fields */
+#define JAILHOUSE_SEG_ES		0
+#define JAILHOUSE_SEG_CS		1
+#define JAILHOUSE_SEG_SS		2
+#define JAILHOUSE_SEG_DS		3
+#define JAILHOUSE_SEG_FS		4
+#define JAILHOUSE_SEG_GS		5
+#define JAILHOUSE_SEG_LDTR		6
+#define JAILHOUSE_SEG_TR		7
+#define JAILHOUSE_NUM_SEGS		8
+
+struct jailhouse_segment {
+	__u64 base;
+	__u32 limit;
+	__u32 access_rights;
+	__u16 selector;
+	__u16 padding[3];
+};
+
+/*
+ * What a CPU of a stopped cell was doing, see JAILHOUSE_HC_CPU_GET_STATE.
+ * The local APIC and the FPU are not part of it.
+ */
+struct jailhouse_cpu_state {
+	__u32 flags;
+	__u32 activity_state;
+	__u32 interruptibility;
+	__u32 padding;
+	/* indexed by register number, from rax to r15 */
+	__u64 gpr[16];
+	__u64 rip;
+	__u64 rflags;
+	__u64 cr0;
+	__u64 cr3;
+	__u64 cr4;
+	__u64 efer;
+	__u64 dr7;
+	__u64 pat;
+	__u64 gdtr_base;
+	__u64 idtr_base;
+	__u32 gdtr_limit;
+	__u32 idtr_limit;
+	struct jailhouse_segment segment[JAILHOUSE_NUM_SEGS];
+	__u64 sysenter_cs;
+	__u64 sysenter_esp;
+	__u64 sysenter_eip;
+	__u64 star;
+	__u64 lstar;
+	__u64 cstar;
+	__u64 sfmask;
+	__u64 kernel_gs_base;
+};
+
 #define JAILHOUSE_CALL_INS	"vmcall"
 #define JAILHOUSE_CALL_RESULT	"=a" (result)
 #define JAILHOUSE_CALL_NUM	"a" (num)
@@ -18,9 +74,9 @@
 #define JAILHOUSE_CALL_ARG3	"d" (arg3)
 #define JAILHOUSE_CALL_ARG4	"c" (arg4)
 
-static inline __u32 jailhouse_call0(__u32 num)
+static inline unsigned long jailhouse_call0(__u32 num)
 {
-	__u32 result;
+	unsigned long result;
 
 	asm volatile(JAILHOUSE_CALL_INS
 		: JAILHOUSE_CALL_RESULT
@@ -29,9 +85,9 @@ static inline __u32 jailhouse_call0(__u32 num)
 	return result;
 }
 
-static inline __u32 jailhouse_call1(__u32 num, __u32 arg1)
+static inline unsigned long jailhouse_call1(__u32 num, __u32 arg1)
 {
-	__u32 result;
+	unsigned long result;
 
 	asm volatile(JAILHOUSE_CALL_INS
 		: JAILHOUSE_CALL_RESULT
@@ -40,9 +96,9 @@ static inline __u32 jailhouse_call1(__u32 num, __u32 arg1)
 	return result;
 }
 
-static inline __u32 jailhouse_call2(__u32 num, __u32 arg1, __u32 arg2)
+static inline unsigned long jailhouse_call2(__u32 num, __u32 arg1, __u32 arg2)
 {
-	__u32 result;
+	unsigned long result;
 
 	asm volatile(JAILHOUSE_CALL_INS
 		: JAILHOUSE_CALL_RESULT
@@ -51,10 +107,10 @@ static inline __u32 jailhouse_call2(__u32 num, __u32 arg1, __u32 arg2)
 	return result;
 }
 
-static inline __u32 jailhouse_call3(__u32 num, __u32 arg1, __u32 arg2,
+static inline unsigned long jailhouse_call3(__u32 num, __u32 arg1, __u32 arg2,
 				   __u32 arg3)
 {
-	__u32 result;
+	unsigned long result;
 
 	asm volatile(JAILHOUSE_CALL_INS
 		: JAILHOUSE_CALL_RESULT
@@ -64,10 +120,10 @@ static inline __u32 jailhouse_call3(__u32 num, __u32 arg1, __u32 arg2,
 	return result;
 }
 
-static inline __u32 jailhouse_call4(__u32 num, __u32 arg1, __u32 arg2,
+static inline unsigned long jailhouse_call4(__u32 num, __u32 arg1, __u32 arg2,
 				   __u32 arg3, __u32 arg4)
 {
-	__u32 result;
+	unsigned long result;
 
 	asm volatile(JAILHOUSE_CALL_INS
 		: JAILHOUSE_CALL_RESULT
@@ -76,3 +132,5 @@ static inline __u32 jailhouse_call4(__u32 num, __u32 arg1, __u32 arg2,
 		: "memory");
 	return result;
 }
+
+#endif /* !_JAILHOUSE_ASM_JAILHOUSE_H */
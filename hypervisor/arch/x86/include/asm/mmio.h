@@ -0,0 +1,59 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* register <- memory, zero- or sign-extended for MOVZX/MOVSX */
+#define MMIO_OP_LOAD		0
+/* memory <- register or immediate */
+#define MMIO_OP_STORE		1
+/* memory <- memory ALU register or immediate */
+#define MMIO_OP_ALU_MEM		2
+/* register <- register ALU memory */
+#define MMIO_OP_ALU_REG		3
+
+/* numbered like the ModRM.reg field of opcodes 0x80-0x83 */
+#define MMIO_ALU_ADD		0
+#define MMIO_ALU_OR		1
+#define MMIO_ALU_AND		4
+#define MMIO_ALU_SUB		5
+#define MMIO_ALU_XOR		6
+#define MMIO_ALU_CMP		7
+#define MMIO_ALU_TEST		8
+
+#define MMIO_CACHE_SIZE		8
+
+struct mmio_access {
+	/* 0 if the instruction could not be decoded */
+	unsigned int inst_len;
+	unsigned int op;
+	unsigned int alu_op;
+	/* width of the memory operand in bytes */
+	unsigned int size;
+	/* width of the register operand, differs only for MOVZX/MOVSX */
+	unsigned int reg_size;
+	/* index into struct registers */
+	unsigned int reg;
+	/* 8 for AH, CH, DH and BH */
+	unsigned int reg_shift;
+	bool sign_extend;
+	/* imm replaces the register as source operand */
+	bool has_imm;
+	bool does_read;
+	bool does_write;
+	unsigned long imm;
+};
+
+/* decoded MMIO instructions, keyed by guest RIP and CR3 */
+struct mmio_cache_entry {
+	unsigned long pc;
+	unsigned long page_table_addr;
+	struct mmio_access access;
+};
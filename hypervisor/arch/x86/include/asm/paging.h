@@ -19,6 +19,8 @@
 #define PAGE_SIZE		4096
 #define PAGE_MASK		~(PAGE_SIZE - 1)
 
+#define CACHE_LINE_SIZE		64
+
 #define PAGE_DIR_LEVELS		4
 
 #define PAGE_TABLE_OFFS_MASK	0x0000000000000ff8UL
@@ -26,10 +28,22 @@
 #define PAGE_OFFS_MASK		0x0000000000000fffUL
 #define HUGEPAGE_ADDR_MASK	0x000fffffffe00000UL
 #define HUGEPAGE_OFFS_MASK	0x00000000001fffffUL
+#define HUGEPAGE_SIZE		(HUGEPAGE_OFFS_MASK + 1)
+#define HUGEPAGE_1G_ADDR_MASK	0x000fffffc0000000UL
+#define HUGEPAGE_1G_OFFS_MASK	0x000000003fffffffUL
+#define HUGEPAGE_1G_SIZE	(HUGEPAGE_1G_OFFS_MASK + 1)
+/* span of a single entry of the 4th level */
+#define PGD_OFFS_MASK		0x0000007fffffffffUL
+#define PGD_SIZE		(PGD_OFFS_MASK + 1)
 
 #define PAGE_FLAG_PRESENT	0x01
 #define PAGE_FLAG_RW		0x02
 #define PAGE_FLAG_UNCACHED	0x10
+#define PAGE_FLAG_HUGEPAGE	0x80
+
+/* permission bits that are valid in both table and leaf entries of the
+ * regular, the EPT and the VT-d page table format */
+#define PAGE_TABLE_FLAGS_MASK	0x07
 
 #define PAGE_DEFAULT_FLAGS	(PAGE_FLAG_PRESENT | PAGE_FLAG_RW )
 #define PAGE_READONLY_FLAGS	PAGE_FLAG_PRESENT
@@ -90,11 +104,22 @@ static inline pud_t *pud3l_offset(pgd_t *page_table, unsigned long addr)
 			 ((addr >> 27) & PAGE_TABLE_OFFS_MASK));
 }
 
+static inline bool pud_is_hugepage(pud_t *pud)
+{
+	return *pud & PAGE_FLAG_HUGEPAGE;
+}
+
 static inline void set_pud(pud_t *pud, unsigned long addr, unsigned long flags)
 {
 	*pud = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pud_hugepage(pud_t *pud, unsigned long addr,
+				    unsigned long flags)
+{
+	*pud = (addr & HUGEPAGE_1G_ADDR_MASK) | flags | PAGE_FLAG_HUGEPAGE;
+}
+
 static inline void clear_pud(pud_t *pud)
 {
 	*pud = 0;
@@ -107,7 +132,7 @@ static inline bool pmd_valid(pmd_t *pmd)
 
 static inline bool pmd_is_hugepage(pmd_t *pmd)
 {
-	return *pmd & (1 << 7);
+	return *pmd & PAGE_FLAG_HUGEPAGE;
 }
 
 static inline pmd_t *pmd_offset(pud_t *pud, unsigned long page_table_offset,
@@ -124,6 +149,12 @@ static inline void set_pmd(pmd_t *pmd, unsigned long addr, unsigned long flags)
 	*pmd = (addr & PAGE_ADDR_MASK) | flags;
 }
 
+static inline void set_pmd_hugepage(pmd_t *pmd, unsigned long addr,
+				    unsigned long flags)
+{
+	*pmd = (addr & HUGEPAGE_ADDR_MASK) | flags | PAGE_FLAG_HUGEPAGE;
+}
+
 static inline void clear_pmd(pmd_t *pmd)
 {
 	*pmd = 0;
@@ -164,6 +195,17 @@ static inline unsigned long phys_address_hugepage(pmd_t *pmd,
 	return (*pmd & HUGEPAGE_ADDR_MASK) + (addr & HUGEPAGE_OFFS_MASK);
 }
 
+static inline unsigned long phys_address_hugepage_1g(pud_t *pud,
+						     unsigned long addr)
+{
+	return (*pud & HUGEPAGE_1G_ADDR_MASK) + (addr & HUGEPAGE_1G_OFFS_MASK);
+}
+
+static inline unsigned long hugepage_flags(unsigned long entry)
+{
+	return entry & ~(PAGE_ADDR_MASK | PAGE_FLAG_HUGEPAGE);
+}
+
 static inline bool pud_empty(pgd_t *pgd, unsigned long page_table_offset)
 {
 	pud_t *pud = (pud_t *)((*pgd & PAGE_ADDR_MASK) + page_table_offset);
@@ -205,6 +247,29 @@ static inline void flush_tlb(void)
 	write_cr4(cr4);
 }
 
+static inline void flush_tlb_page(unsigned long addr)
+{
+	asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+static inline void flush_cache_range(void *addr, unsigned long size)
+{
+	unsigned long line = (unsigned long)addr & ~(CACHE_LINE_SIZE - 1);
+
+	for (; line < (unsigned long)addr + size; line += CACHE_LINE_SIZE)
+		asm volatile("clflush (%0)" : : "r" (line) : "memory");
+}
+
+static inline void clear_page(void *page)
+{
+	unsigned long count = PAGE_SIZE / 8;
+
+	asm volatile("rep stosq"
+		: "+D" (page), "+c" (count)
+		: "a" (0UL)
+		: "memory");
+}
+
 #endif /* !__ASSEMBLY__ */
 
 #endif /* !_JAILHOUSE_ASM_PAGING_H */
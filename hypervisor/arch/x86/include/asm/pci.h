@@ -0,0 +1,41 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <asm/percpu.h>
+
+#define PCI_ADDR_PORT		0xcf8
+#define PCI_DATA_PORT		0xcfc
+#define PCI_NUM_PORTS		8
+
+#define PCI_HEADER_DWORDS	16
+#define PCI_NUM_BARS		6
+
+/* config space of a device assigned to a cell with mediated access */
+struct pci_device {
+	u16 bdf;
+	u8 type;
+	/* offset of the MSI capability, 0 if none */
+	u8 msi_cap;
+	/* served to the cell, only read-only and BAR registers are valid */
+	u32 header[PCI_HEADER_DWORDS];
+	/* address bits as found by sizing, and the assigned value */
+	u32 bar_mask[PCI_NUM_BARS];
+	u32 bar_orig[PCI_NUM_BARS];
+	/* hypervisor mapping of the device's MMCONFIG page */
+	void *mmcfg;
+};
+
+int pci_cell_init(struct cell *cell, struct jailhouse_cell_desc *config);
+void pci_cell_exit(struct cell *cell);
+
+bool pci_pio_access(struct per_cpu *cpu_data, u16 port, unsigned int size,
+		    bool is_write, u32 *value);
@@ -16,17 +16,25 @@
 #include <asm/types.h>
 #include <asm/paging.h>
 
+#include <jailhouse/cpu-stats.h>
+
 #define NUM_ENTRY_REGS			6
 
 /* Keep in sync with struct per_cpu! */
-#define PERCPU_SIZE_SHIFT		14
+#define PERCPU_SIZE_SHIFT		15
 #define PERCPU_STACK_END		PAGE_SIZE
 #define PERCPU_LINUX_SP			PERCPU_STACK_END
 #define PERCPU_CPU_ID			(PERCPU_LINUX_SP + 8)
 
+#define PERCPU_TRACE_RING_SIZE		(4 * PAGE_SIZE)
+
 #ifndef __ASSEMBLY__
 
+#include <jailhouse/mcs-lock.h>
+#include <jailhouse/trace.h>
 #include <asm/cell.h>
+#include <asm/jailhouse.h>
+#include <asm/mmio.h>
 
 struct vmcs {
 	u32 revision_id:31;
@@ -41,10 +49,53 @@ struct per_cpu {
 	unsigned long linux_sp;
 	unsigned int cpu_id;
 
+	/* read-mostly, also by other CPUs, share their line with the above */
 	u32 apic_id;
 	struct cell *cell;
+	enum { VMXOFF = 0, VMXON, VMCS_READY } vmx_state;
+
+	/* written by this CPU on every exit */
+	unsigned long stats[JAILHOUSE_NUM_CPU_STATS]
+		__attribute__((aligned(CACHE_LINE_SIZE)));
+	/* GUEST_RIP read once per exit, advanced with the emulation */
+	unsigned long guest_rip;
+	/* shadows of the execution controls in the VMCS */
+	u32 pin_based_ctrl;
+	u32 proc_based_ctrl;
+	/* the cell owns the performance counters, see vmx_pmu_set_cell_config */
+	bool pmu_owned;
+	struct mmio_cache_entry mmio_cache[MMIO_CACHE_SIZE];
+	/* guest interrupts acknowledged on exit and guest NMIs taken by the
+	 * host, injected on the next entry */
+	unsigned long pending_irqs[256 / BITS_PER_LONG];
+	bool guest_nmi_pending;
+#ifdef CONFIG_PROFILE
+	/* see asm/profile.h, the ring is filled from NMI context */
+	struct jailhouse_spsc_ring *profile_ring;
+	unsigned long profile_period;
+	u32 profile_reason;
+	u32 profile_dropped;
+	/* written by the reader of the ring, under its lock */
+	u32 profile_dropped_read;
+#endif
+
+	/* written by other CPUs to signal events, under control_lock */
+	mcs_lock_t control_lock __attribute__((aligned(CACHE_LINE_SIZE)));
+	volatile bool stop_cpu;
+	volatile bool wait_for_sipi;
+	volatile bool cpu_stopped;
+	/* kick NMIs sent but not yet handled, see apic_nmi_handler */
+	unsigned int kicks_pending;
+	bool init_signaled;
+	int sipi_vector;
+	bool flush_caches;
+	bool shutdown_cpu;
+	/* mapped struct jailhouse_hc_batch to run on the next kick */
+	struct jailhouse_hc_batch *async_batch;
 
-	struct desc_table_reg linux_gdtr;
+	/* cold, Linux state saved on entry and restored on shutdown */
+	struct desc_table_reg linux_gdtr
+		__attribute__((aligned(CACHE_LINE_SIZE)));
 	struct desc_table_reg linux_idtr;
 	unsigned long linux_reg[NUM_ENTRY_REGS];
 	unsigned long linux_ip;
@@ -61,18 +112,20 @@ struct per_cpu {
 	unsigned long linux_sysenter_eip;
 	unsigned long linux_sysenter_esp;
 	bool initialized;
-	enum { VMXOFF = 0, VMXON, VMCS_READY } vmx_state;
 
-	volatile bool stop_cpu;
-	volatile bool wait_for_sipi;
-	volatile bool cpu_stopped;
-	bool init_signaled;
-	int sipi_vector;
-	bool flush_caches;
-	bool shutdown_cpu;
+	/* of a non-root cell CPU, saved on each of its management events */
+	struct jailhouse_cpu_state cpu_state;
+	/* PDPTEs of a set cpu_state, as read when it was validated */
+	u64 pdpte[4];
+	/* continue from cpu_state instead of the next reset */
+	bool restore_state;
 
 	struct vmcs vmxon_region __attribute__((aligned(PAGE_SIZE)));
 	struct vmcs vmcs __attribute__((aligned(PAGE_SIZE)));
+
+	/* struct jailhouse_trace_ring, mapped read-only into the Linux cell */
+	u8 trace_ring[PERCPU_TRACE_RING_SIZE]
+		__attribute__((aligned(PAGE_SIZE)));
 } __attribute__((aligned(PAGE_SIZE)));
 
 static inline struct per_cpu *per_cpu(unsigned int cpu)
@@ -100,6 +153,14 @@ static inline void __check_assumptions(void)
 			 PERCPU_LINUX_SP);
 	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, cpu_id) ==
 			 PERCPU_CPU_ID);
+	/* read-mostly fields fit into the line of linux_sp, sections are
+	 * line-aligned so that they do not share lines */
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, stats) ==
+			 PERCPU_LINUX_SP + CACHE_LINE_SIZE);
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, control_lock) %
+			 CACHE_LINE_SIZE == 0);
+	CHECK_ASSUMPTION(__builtin_offsetof(struct per_cpu, linux_gdtr) %
+			 CACHE_LINE_SIZE == 0);
 }
 #endif /* !__ASSEMBLY__ */
 
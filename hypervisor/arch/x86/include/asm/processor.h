@@ -15,7 +15,17 @@
 
 #include <asm/types.h>
 
+/* CPUID leaf 1, ECX */
+#define X86_FEATURE_MWAIT				(1 << 3)
 #define X86_FEATURE_VMX					(1 << 5)
+#define X86_FEATURE_OSXSAVE				(1 << 27)
+/* CPUID leaf 7, ECX */
+#define X86_FEATURE_OSPKE				(1 << 4)
+/* CPUID leaf 5, ECX */
+#define X86_MWAIT_EXTENSIONS				(1 << 0)
+#define X86_MWAIT_INT_BREAK				(1 << 1)
+/* MWAIT, ECX */
+#define X86_MWAIT_BREAK_ON_IRQ				(1 << 0)
 
 #define X86_CR0_PE					0x00000001
 #define X86_CR0_ET					0x00000010
@@ -23,19 +33,31 @@
 #define X86_CR0_CD					0x40000000
 #define X86_CR0_PG					0x80000000
 
+#define X86_CR4_PAE					0x00000020
 #define X86_CR4_PGE					0x00000080
 #define X86_CR4_VMXE					0x00002000
+#define X86_CR4_OSXSAVE					0x00040000
+#define X86_CR4_PKE					0x00400000
 
 #define MSR_IA32_APICBASE				0x0000001b
 #define MSR_IA32_FEATURE_CONTROL			0x0000003a
+#define MSR_IA32_PMC0					0x000000c1
 #define MSR_IA32_SYSENTER_CS				0x00000174
 #define MSR_IA32_SYSENTER_ESP				0x00000175
 #define MSR_IA32_SYSENTER_EIP				0x00000176
+#define MSR_IA32_PERFEVTSEL0				0x00000186
+#define MSR_IA32_PAT					0x00000277
+#define MSR_CORE_PERF_FIXED_CTR0			0x00000309
+#define MSR_CORE_PERF_FIXED_CTR_CTRL			0x0000038d
+#define MSR_CORE_PERF_GLOBAL_STATUS			0x0000038e
+#define MSR_CORE_PERF_GLOBAL_CTRL			0x0000038f
+#define MSR_CORE_PERF_GLOBAL_OVF_CTRL			0x00000390
 #define MSR_IA32_VMX_BASIC				0x00000480
 #define MSR_IA32_VMX_PINBASED_CTLS			0x00000481
 #define MSR_IA32_VMX_PROCBASED_CTLS			0x00000482
 #define MSR_IA32_VMX_EXIT_CTLS				0x00000483
 #define MSR_IA32_VMX_ENTRY_CTLS				0x00000484
+#define MSR_IA32_VMX_MISC				0x00000485
 #define MSR_IA32_VMX_CR0_FIXED0				0x00000486
 #define MSR_IA32_VMX_CR0_FIXED1				0x00000487
 #define MSR_IA32_VMX_CR4_FIXED0				0x00000488
@@ -46,13 +68,23 @@
 #define MSR_IA32_VMX_TRUE_PROCBASED_CTLS		0x0000048e
 #define MSR_IA32_VMX_TRUE_EXIT_CTLS			0x0000048f
 #define MSR_IA32_VMX_TRUE_ENTRY_CTLS			0x00000490
+#define MSR_IA32_A_PMC0					0x000004c1
 #define MSR_X2APIC_BASE					0x00000800
 #define MSR_X2APIC_ICR					0x00000830
 #define MSR_X2APIC_SELF_IPI				0x0000083f
 #define MSR_X2APIC_END					MSR_X2APIC_SELF_IPI
+#define MSR_IA32_PQR_ASSOC				0x00000c8f
+#define MSR_IA32_L3_MASK_0				0x00000c90
+#define MSR_IA32_MBA_THRTL_0				0x00000d50
+#define MSR_IA32_L3_MASK_END				0x00000d8f
 #define MSR_EFER					0xc0000080
+#define MSR_STAR					0xc0000081
+#define MSR_LSTAR					0xc0000082
+#define MSR_CSTAR					0xc0000083
+#define MSR_SFMASK					0xc0000084
 #define MSR_FS_BASE					0xc0000100
 #define MSR_GS_BASE					0xc0000101
+#define MSR_KERNGS_BASE					0xc0000102
 
 #define FEATURE_CONTROL_LOCKED				(1 << 0)
 #define FEATURE_CONTROL_VMXON_ENABLED_OUTSIDE_SMX	(1 << 2)
@@ -66,15 +98,63 @@
 #define GDT_DESC_TSS_HI					3
 #define NUM_GDT_DESC					4
 
+#define X86_INST_LEN_HLT				1
 #define X86_INST_LEN_CPUID				2
 #define X86_INST_LEN_RDMSR				2
 #define X86_INST_LEN_WRMSR				2
 #define X86_INST_LEN_VMCALL				3
 #define X86_INST_LEN_MOV_TO_CR				3
 
-#define X86_OP_REGR_PREFIX				0x44
+#define X86_MAX_INST_LEN				15
+
+#define X86_PREFIX_OPSIZE				0x66
+#define X86_PREFIX_ADDRSIZE				0x67
+#define X86_PREFIX_LOCK					0xf0
+#define X86_PREFIX_SEG_ES				0x26
+#define X86_PREFIX_SEG_CS				0x2e
+#define X86_PREFIX_SEG_SS				0x36
+#define X86_PREFIX_SEG_DS				0x3e
+#define X86_PREFIX_SEG_FS				0x64
+#define X86_PREFIX_SEG_GS				0x65
+
+#define X86_REX_BASE					0x40
+#define X86_REX_MASK					0xf0
+#define X86_REX_W					(1 << 3)
+#define X86_REX_R					(1 << 2)
+
+#define X86_OP_ALU_LAST					0x3f
+#define X86_OP_MOVSXD					0x63
+#define X86_OP_GRP1_IMM8				0x80
+#define X86_OP_GRP1_IMM					0x81
+#define X86_OP_GRP1_SIMM8				0x83
+#define X86_OP_TEST8					0x84
+#define X86_OP_TEST					0x85
+#define X86_OP_MOV_TO_MEM8				0x88
 #define X86_OP_MOV_TO_MEM				0x89
+#define X86_OP_MOV_FROM_MEM8				0x8a
 #define X86_OP_MOV_FROM_MEM				0x8b
+#define X86_OP_MOV_FROM_MOFFS8				0xa0
+#define X86_OP_MOV_FROM_MOFFS				0xa1
+#define X86_OP_MOV_TO_MOFFS8				0xa2
+#define X86_OP_MOV_TO_MOFFS				0xa3
+#define X86_OP_MOV_IMM8_TO_MEM				0xc6
+#define X86_OP_MOV_IMM_TO_MEM				0xc7
+#define X86_OP_GRP3_8					0xf6
+#define X86_OP_GRP3					0xf7
+#define X86_OP_TWO_BYTE					0x0f
+#define X86_OP2_MOVZX8					0xb6
+#define X86_OP2_MOVZX16					0xb7
+#define X86_OP2_MOVSX8					0xbe
+#define X86_OP2_MOVSX16					0xbf
+
+#define X86_RFLAGS_CF					(1 << 0)
+#define X86_RFLAGS_PF					(1 << 2)
+#define X86_RFLAGS_AF					(1 << 4)
+#define X86_RFLAGS_ZF					(1 << 6)
+#define X86_RFLAGS_SF					(1 << 7)
+#define X86_RFLAGS_IF					(1 << 9)
+#define X86_RFLAGS_OF					(1 << 11)
+#define X86_RFLAGS_ARITH_MASK				0x8d5
 
 #define NMI_VECTOR					2
 
@@ -111,6 +191,25 @@ static inline void memory_barrier(void)
 	asm volatile("mfence" : : : "memory");
 }
 
+extern bool cpu_has_mwait;
+
+/* arms the monitor on the cache line of addr */
+static inline void cpu_monitor(const volatile void *addr)
+{
+	if (cpu_has_mwait)
+		asm volatile("monitor" : : "a" (addr), "c" (0), "d" (0)
+			     : "memory");
+}
+
+/* sleeps in C1 until the monitored line is written, or just pauses */
+static inline void cpu_wait(void)
+{
+	if (cpu_has_mwait)
+		asm volatile("mwait" : : "a" (0), "c" (0) : "memory");
+	else
+		cpu_relax();
+}
+
 static inline void __cpuid(unsigned int *eax, unsigned int *ebx,
 			   unsigned int *ecx, unsigned int *edx)
 {
@@ -192,6 +291,14 @@ static inline void write_msr(unsigned int msr, unsigned long val)
 		: "memory");
 }
 
+static inline unsigned long read_tsc(void)
+{
+	u32 low, high;
+
+	asm volatile("rdtsc" : "=a" (low), "=d" (high));
+	return low | ((unsigned long)high << 32);
+}
+
 static inline void read_gdtr(struct desc_table_reg *val)
 {
 	asm volatile("sgdtq %0" : "=m" (*val));
@@ -0,0 +1,64 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_PROFILE_H
+#define _JAILHOUSE_ASM_PROFILE_H
+
+#include <asm/percpu.h>
+
+/*
+ * Define CONFIG_PROFILE in include/jailhouse/config.h to sample where the
+ * hypervisor spends its cycles. Every period unhalted cycles, the first
+ * general-purpose counter raises an NMI that records the interrupted
+ * hypervisor RIP together with the VM exit being handled. Without it, the
+ * per-CPU state is absent and the hooks vanish. CPUs of cells with
+ * JAILHOUSE_CELL_PMU_PASSTHROUGH are never sampled.
+ */
+#ifdef CONFIG_PROFILE
+
+int profile_init(void);
+void profile_cpu_update(struct per_cpu *cpu_data);
+void profile_cpu_exit(struct per_cpu *cpu_data);
+bool profile_nmi(struct per_cpu *cpu_data, unsigned long rip);
+
+static inline void profile_set_reason(struct per_cpu *cpu_data, u32 reason)
+{
+	cpu_data->profile_reason = reason;
+}
+
+#else /* !CONFIG_PROFILE */
+
+static inline int profile_init(void)
+{
+	return 0;
+}
+
+static inline void profile_cpu_update(struct per_cpu *cpu_data)
+{
+}
+
+static inline void profile_cpu_exit(struct per_cpu *cpu_data)
+{
+}
+
+static inline bool profile_nmi(struct per_cpu *cpu_data, unsigned long rip)
+{
+	return false;
+}
+
+static inline void profile_set_reason(struct per_cpu *cpu_data, u32 reason)
+{
+}
+
+#endif /* !CONFIG_PROFILE */
+
+#endif /* !_JAILHOUSE_ASM_PROFILE_H */
@@ -10,23 +10,65 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_ASM_SPINLOCK_H
+#define _JAILHOUSE_ASM_SPINLOCK_H
+
+#include <jailhouse/lock-stats.h>
 #include <asm/bitops.h>
 #include <asm/processor.h>
 
+/* ticket lock, CPUs are served in the order they arrived */
 typedef struct {
-	unsigned long state;
+	u16 owner;
+	u16 next;
+	struct lock_stats stats;
 } spinlock_t;
 
 #define DEFINE_SPINLOCK(name)	spinlock_t (name)
 
 static inline void spin_lock(spinlock_t *lock)
 {
-	while (test_and_set_bit(0, &lock->state))
-		cpu_relax();
+	unsigned long start = lock_stats_now();
+	u16 ticket = 1;
+
+	asm volatile("lock xaddw %0, %1"
+		: "+r" (ticket), "+m" (lock->next)
+		: : "memory");
+
+	if (ticket != *(volatile u16 *)&lock->owner) {
+		while (ticket != *(volatile u16 *)&lock->owner)
+			cpu_relax();
+		lock_stats_acquired(&lock->stats, start, true);
+	} else
+		lock_stats_acquired(&lock->stats, start, false);
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
+	lock_stats_release(&lock->stats);
 	asm volatile("": : :"memory");
-	clear_bit(0, &lock->state);
+	/* only the owner writes this field, stores are ordered on x86 */
+	*(volatile u16 *)&lock->owner = lock->owner + 1;
+}
+
+/* atomic pointer updates, fully ordered like lock-prefixed instructions */
+static inline void *atomic_xchg_ptr(void **ptr, void *value)
+{
+	asm volatile("xchg %0, %1"
+		: "+r" (value), "+m" (*ptr)
+		: : "memory");
+	return value;
 }
+
+static inline void *atomic_cmpxchg_ptr(void **ptr, void *old, void *new)
+{
+	void *prev;
+
+	asm volatile("lock cmpxchg %2, %1"
+		: "=a" (prev), "+m" (*ptr)
+		: "r" (new), "0" (old)
+		: "memory");
+	return prev;
+}
+
+#endif /* !_JAILHOUSE_ASM_SPINLOCK_H */
@@ -174,31 +174,53 @@ enum vmcs_field {
 };
 
 #define GUEST_ACTIVITY_ACTIVE			0
+#define GUEST_ACTIVITY_HLT			1
+
+#define GUEST_INTR_BLOCK_STI			0x00000001
+#define GUEST_INTR_BLOCK_MOV_SS			0x00000002
+#define GUEST_INTR_BLOCK_NMI			0x00000008
 
 #define VMX_MSR_BITMAP_0000_READ		0
 #define VMX_MSR_BITMAP_C000_READ		1
 #define VMX_MSR_BITMAP_0000_WRITE		2
 #define VMX_MSR_BITMAP_C000_WRITE		3
 
+#define PIN_BASED_EXT_INTR_MASK			0x00000001
 #define PIN_BASED_NMI_EXITING			0x00000008
+#define PIN_BASED_VIRTUAL_NMIS			0x00000020
 #define PIN_BASED_VMX_PREEMPTION_TIMER		0x00000040
 
+#define CPU_BASED_VIRTUAL_INTR_PENDING		0x00000004
+#define CPU_BASED_HLT_EXITING			0x00000080
+#define CPU_BASED_VIRTUAL_NMI_PENDING		0x00400000
 #define CPU_BASED_USE_IO_BITMAPS		0x02000000
 #define CPU_BASED_USE_MSR_BITMAPS		0x10000000
 #define CPU_BASED_ACTIVATE_SECONDARY_CONTROLS	0x80000000
 
 #define SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES	0x00000001
 #define SECONDARY_EXEC_ENABLE_EPT		0x00000002
+#define SECONDARY_EXEC_ENABLE_VPID		0x00000020
 #define SECONDARY_EXEC_UNRESTRICTED_GUEST	0x00000080
 
+#define VMX_MISC_ACTIVITY_HLT			(1UL << 6)
+
 #define VM_EXIT_HOST_ADDR_SPACE_SIZE		0x00000200
+#define VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL	0x00001000
+#define VM_EXIT_ACK_INTR_ON_EXIT		0x00008000
 #define VM_EXIT_SAVE_IA32_EFER			0x00100000
 #define VM_EXIT_LOAD_IA32_EFER			0x00200000
 
 #define VM_ENTRY_IA32E_MODE			0x00000200
+#define VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL	0x00002000
 #define VM_ENTRY_LOAD_IA32_EFER			0x00008000
 
-#define INTR_INFO_UNBLOCK_NMI			0x1000
+#define INTR_INFO_VECTOR_MASK			0x000000ff
+#define INTR_INFO_INTR_TYPE_MASK		0x00000700
+#define INTR_INFO_UNBLOCK_NMI			0x00001000
+#define INTR_INFO_VALID_MASK			0x80000000
+
+#define INTR_TYPE_EXT_INTR			0x00000000
+#define INTR_TYPE_NMI_INTR			0x00000200
 
 #define EXIT_REASONS_FAILED_VMENTRY		0x80000000
 
@@ -252,39 +274,82 @@ enum vmcs_field {
 #define EPT_FLAG_WRITE				0x002
 #define EPT_FLAG_EXECUTE			0x004
 #define EPT_FLAG_WB_TYPE			0x030
+/* set by the CPU if EPT_AD_ENABLE is set in the EPT pointer */
+#define EPT_FLAG_DIRTY				0x200
 
 #define EPT_TYPE_UNCACHEABLE			0
 #define EPT_TYPE_WRITEBACK			6
 #define EPT_PAGE_WALK_LEN			((4-1) << 3)
+#define EPT_AD_ENABLE				(1UL << 6)
 
 #define EPT_PAGE_WALK_4				(1UL << 6)
 #define EPTP_WB					(1UL << 14)
+#define EPT_2M_PAGES				(1UL << 16)
+#define EPT_1G_PAGES				(1UL << 17)
 #define EPT_INVEPT				(1UL << 20)
+#define EPT_AD_BITS				(1UL << 21)
 #define EPT_INVEPT_SINGLE			(1UL << 25)
 #define EPT_INVEPT_GLOBAL			(1UL << 26)
 #define EPT_MANDATORY_FEATURES			(EPT_PAGE_WALK_4 | EPTP_WB | \
 						 EPT_INVEPT)
+#define VPID_INVVPID				(1UL << 32)
+#define VPID_INVVPID_SINGLE			(1UL << 41)
+#define VPID_INVVPID_GLOBAL			(1UL << 42)
 
 #define VMX_INVEPT_SINGLE			1
 #define VMX_INVEPT_GLOBAL			2
 
+#define VMX_INVVPID_SINGLE			1
+#define VMX_INVVPID_GLOBAL			2
+
 #define APIC_ACCESS_OFFET_MASK			0x00000fff
 #define APIC_ACCESS_TYPE_MASK			0x0000f000
 #define APIC_ACCESS_TYPE_LINEAR_READ		0x00000000
 #define APIC_ACCESS_TYPE_LINEAR_WRITE		0x00001000
 
-void vmx_init(void);
+#define EPT_VIOLATION_WRITE			0x00000002
+#define EPT_VIOLATION_FETCH			0x00000004
+#define EPT_VIOLATION_READABLE			0x00000008
+#define EPT_VIOLATION_WRITABLE			0x00000010
+#define EPT_VIOLATION_EXECUTABLE		0x00000020
+
+#define IO_SIZE_MASK				0x00000007
+#define IO_DIRECTION_IN				0x00000008
+#define IO_STRING				0x00000010
+#define IO_REP					0x00000020
+#define IO_PORT_SHIFT				16
+
+struct jailhouse_dirty_log;
+
+extern unsigned int ept_huge_pages;
+
+int vmx_init(void);
 
 int vmx_cell_init(struct cell *cell, struct jailhouse_cell_desc *config);
+int vmx_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem);
+int vmx_map_trace_rings(struct cell *cell);
 void vmx_cell_shrink(struct cell *cell, struct jailhouse_cell_desc *config);
+void vmx_cell_exit(struct cell *cell);
+int vmx_cell_set_loadable(struct cell *cell);
+void vmx_cell_clear_loadable(struct cell *cell);
+int vmx_cell_dirty_log(struct cell *cell, struct jailhouse_dirty_log *log,
+		       u64 *bitmap);
+
+bool vmx_cpu_state_valid(struct per_cpu *cpu_data, struct cell *cell,
+			 const struct jailhouse_cpu_state *state, u64 *pdpte);
 
 int vmx_cpu_init(struct per_cpu *cpu_data);
 void vmx_cpu_exit(struct per_cpu *cpu_data);
 
 void __attribute__((noreturn)) vmx_cpu_activate_vmm(struct per_cpu *cpu_data);
+bool vmx_handle_fast_exit(struct registers *guest_regs,
+			  struct per_cpu *cpu_data);
 void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data);
 void vmx_entry_failure(struct per_cpu *cpu_data);
 
+void vmx_reload_ept(struct cell *cell);
 void vmx_invept(void);
+void vmx_invvpid(u16 vpid);
 
 void vmx_schedule_vmexit(struct per_cpu *cpu_data);
@@ -61,6 +61,43 @@ struct vtd_entry {
 	u64 hi_word;
 };
 
+#define VTD_MAX_SEGMENTS		8
+#define VTD_MAX_UNITS			16
+
+struct vtd_segment {
+	u16 id;
+	struct vtd_entry *root_entry_table;
+	/* entries are owned by the cell listing them */
+	struct vtd_entry *irq_remap_table;
+};
+
+struct vtd_unit {
+	void *reg_base;
+	void *iotlb_reg;
+	struct vtd_segment *segment;
+	/* NULL if the unit only supports register-based invalidation */
+	struct vtd_entry *inv_queue;
+};
+
+#define VTD_IRTE_PRESENT		0x00000001
+#define VTD_IRTE_VECTOR_SHIFT		16
+#define VTD_IRTE_DEST_SHIFT		32
+#define VTD_IRTE_XAPIC_DEST_SHIFT	40
+#define VTD_IRTE_SVT_VERIFY_SID		(1UL << 18)
+
+/* one page, 2^(VTD_IRTA_SIZE + 1) entries */
+#define VTD_IRT_ENTRIES			256
+#define VTD_IRTA_SIZE			7
+
+#define VTD_REQ_CC_GLOBAL		0x00000011
+#define VTD_REQ_IOTLB_GLOBAL		0x000000d2
+#define VTD_REQ_IEC_GLOBAL		0x00000004
+#define VTD_REQ_INV_WAIT		0x00000025
+# define VTD_INV_WAIT_SDATA_SHIFT	32
+
+/* one page */
+#define VTD_INV_QUEUE_ENTRIES		256
+
 #define VTD_PAGE_READ			0x00000001
 #define VTD_PAGE_WRITE			0x00000002
 
@@ -70,21 +107,63 @@ struct vtd_entry {
 # define VTD_CAP_SAGAW48		0x00000400
 # define VTD_CAP_SAGAW57		0x00000800
 # define VTD_CAP_SAGAW64		0x00001000
+# define VTD_CAP_SLLPS2M		(1UL << 34)
+# define VTD_CAP_SLLPS1G		(1UL << 35)
 #define VTD_ECAP_REG			0x10
+# define VTD_ECAP_C			0x0000000000000001UL
+# define VTD_ECAP_QI			0x0000000000000002UL
+# define VTD_ECAP_IR			0x0000000000000008UL
+# define VTD_ECAP_IRO_MASK		0x000000000003ff00UL
+# define VTD_ECAP_IRO_SHIFT		8
 #define VTD_GCMD_REG			0x18
+# define VTD_GCMD_CFI			0x00800000
+# define VTD_GCMD_SIRTP			0x01000000
+# define VTD_GCMD_IRE			0x02000000
+# define VTD_GCMD_QIE			0x04000000
 # define VTD_GCMD_SRTP			0x40000000
 # define VTD_GCMD_TE			0x80000000
 #define VTD_GSTS_REG			0x1C
+# define VTD_GSTS_CFIS			0x00800000
+# define VTD_GSTS_IRTPS			0x01000000
+# define VTD_GSTS_IRES			0x02000000
+# define VTD_GSTS_QIES			0x04000000
 # define VTD_GSTS_SRTP			0x40000000
 # define VTD_GSTS_TE			0x80000000
+# define VTD_GSTS_USED_CTRLS		(VTD_GSTS_CFIS | VTD_GSTS_IRES | \
+					 VTD_GSTS_QIES | VTD_GSTS_TE)
 #define VTD_RTADDR_REG			0x20
 #define VTD_CCMD_REG			0x28
+# define VTD_CCMD_CIRG_GLOBAL		(1UL << 61)
+# define VTD_CCMD_ICC			(1UL << 63)
 #define VTD_PMEN_REG			0x64
 #define VTD_PLMBASE_REG			0x68
 #define VTD_PLMLIMIT_REG		0x6C
 #define VTD_PHMBASE_REG			0x70
 #define VTD_PHMLIMIT_REG		0x78
+#define VTD_IQH_REG			0x80
+#define VTD_IQT_REG			0x88
+# define VTD_IQT_QT_SHIFT		4
+#define VTD_IQA_REG			0x90
+#define VTD_IRTA_REG			0xB8
+# define VTD_IRTA_EIME			0x00000800
 
+/* relative to the IOTLB register offset in ECAP */
+#define VTD_IOTLB_REG			0x8
+# define VTD_IOTLB_IIRG_GLOBAL		(1UL << 60)
+# define VTD_IOTLB_IVT			(1UL << 63)
+
+/*
+ * Define CONFIG_X86_NO_VTD in include/jailhouse/config.h for machines
+ * without VT-d. The hypervisor then behaves as if no DMAR table was found,
+ * without carrying the driver.
+ */
 int vtd_init(void);
 int vtd_cell_init(struct cell *cell, struct jailhouse_cell_desc *config);
+int vtd_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem);
+void vtd_enable_units(void);
+void vtd_root_cell_shrink(struct jailhouse_cell_desc *config);
+void vtd_root_cell_ept_unmapped(void);
+bool vtd_cell_shares_ept(struct cell *cell);
+void vtd_cell_exit(struct cell *cell);
 void vtd_shutdown(void);
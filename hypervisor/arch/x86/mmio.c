@@ -13,7 +13,7 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
-#include <asm/spinlock.h>
+#include <jailhouse/string.h>
 #include <asm/fault.h>
 
 struct modrm {
@@ -28,104 +28,329 @@ struct sib {
 	u8 ss:2;
 } __attribute__((packed));
 
-static DEFINE_SPINLOCK(mmio_lock);
+struct inst_buffer {
+	u8 bytes[X86_MAX_INST_LEN];
+	unsigned int len;
+	unsigned int pos;
+};
 
-struct mmio_access mmio_parse(struct per_cpu *cpu_data, unsigned long pc,
-			      unsigned long page_table_addr, bool is_write)
+/* copies the bytes at pc, stops early at an unmapped page boundary */
+static bool fetch_instruction(struct per_cpu *cpu_data, unsigned long pc,
+			      unsigned long page_table_addr,
+			      struct inst_buffer *inst)
 {
-	struct mmio_access access = { .inst_len = 0 };
-	unsigned int cpu_id = cpu_data->cpu_id;
-	struct cell *cell = cpu_data->cell;
-	bool has_regr, has_modrm, does_write;
-	struct modrm modrm;
-	struct sib sib;
+	unsigned int offs, chunk;
 	u8 *page;
 
-	spin_lock(&mmio_lock);
+	inst->len = 0;
+	inst->pos = 0;
+	while (inst->len < X86_MAX_INST_LEN) {
+		page = page_map_get_foreign_page(cpu_data->cpu_id,
+						 page_table_addr,
+						 cpu_data->cell->page_offset,
+						 pc, PAGE_DEFAULT_FLAGS);
+		if (!page)
+			break;
 
-	access.inst_len = 0;
-	has_regr = false;
-
-restart:
-	page = page_map_get_foreign_page(cpu_id, page_table_addr,
-					 cell->page_offset, pc,
-					 PAGE_DEFAULT_FLAGS);
-	if (!page)
-		goto error_nopage;
-
-	has_modrm = false;
-	switch (page[pc & PAGE_OFFS_MASK]) {
-	case X86_OP_REGR_PREFIX:
-		if (has_regr)
-			goto error_unsupported;
-		has_regr = true;
-		pc++;
-		access.inst_len++;
-		goto restart;
+		offs = pc & PAGE_OFFS_MASK;
+		chunk = PAGE_SIZE - offs;
+		if (chunk > X86_MAX_INST_LEN - inst->len)
+			chunk = X86_MAX_INST_LEN - inst->len;
+		memcpy(&inst->bytes[inst->len], &page[offs], chunk);
+		inst->len += chunk;
+		pc += chunk;
+	}
+	return inst->len > 0;
+}
+
+static bool next_byte(struct inst_buffer *inst, u8 *byte)
+{
+	if (inst->pos >= inst->len)
+		return false;
+	*byte = inst->bytes[inst->pos++];
+	return true;
+}
+
+static bool skip_bytes(struct inst_buffer *inst, unsigned int num)
+{
+	if (inst->pos + num > inst->len)
+		return false;
+	inst->pos += num;
+	return true;
+}
+
+/* little endian, sign-extended */
+static bool fetch_imm(struct inst_buffer *inst, unsigned int size,
+		      unsigned long *imm)
+{
+	unsigned int n;
+
+	if (inst->pos + size > inst->len)
+		return false;
+
+	*imm = 0;
+	for (n = 0; n < size; n++)
+		*imm |= (unsigned long)inst->bytes[inst->pos++] << (n * 8);
+	if (size < sizeof(long) && *imm & (1UL << (size * 8 - 1)))
+		*imm |= ~0UL << (size * 8);
+	return true;
+}
+
+/* only memory operands are valid, the address is known from the exit */
+static bool decode_modrm(struct inst_buffer *inst, struct modrm *modrm)
+{
+	struct sib sib;
+	u8 byte;
+
+	if (!next_byte(inst, &byte))
+		return false;
+	*modrm = *(struct modrm *)&byte;
+
+	switch (modrm->mod) {
+	case 0:
+		if (modrm->rm == 5)
+			/* RIP-relative */
+			return skip_bytes(inst, 4);
+		if (modrm->rm != 4)
+			return true;
+		if (!next_byte(inst, &byte))
+			return false;
+		sib = *(struct sib *)&byte;
+		return sib.reg == 5 ? skip_bytes(inst, 4) : true;
+	case 1:
+		return skip_bytes(inst, modrm->rm == 4 ? 2 : 1);
+	case 2:
+		return skip_bytes(inst, modrm->rm == 4 ? 5 : 4);
+	default:
+		return false;
+	}
+}
+
+static bool set_reg_operand(struct mmio_access *access, unsigned int gpr,
+			    bool has_rex)
+{
+	if (access->reg_size == 1 && !has_rex && gpr >= 4 && gpr < 8) {
+		gpr -= 4;
+		access->reg_shift = 8;
+	} else if (gpr == 4) {
+		/* RSP is not part of struct registers */
+		return false;
+	}
+	access->reg = 15 - gpr;
+	return true;
+}
+
+static bool decode(struct inst_buffer *inst, struct mmio_access *access)
+{
+	unsigned int opsize = 4, imm_size = 0;
+	bool addr32 = false, use_modrm = true;
+	struct modrm modrm;
+	unsigned int gpr;
+	u8 rex = 0, op, op2;
+
+	memset(access, 0, sizeof(*access));
+
+	while (1) {
+		if (!next_byte(inst, &op))
+			return false;
+		switch (op) {
+		case X86_PREFIX_OPSIZE:
+			opsize = 2;
+			continue;
+		case X86_PREFIX_ADDRSIZE:
+			addr32 = true;
+			continue;
+		case X86_PREFIX_LOCK:
+		case X86_PREFIX_SEG_ES:
+		case X86_PREFIX_SEG_CS:
+		case X86_PREFIX_SEG_SS:
+		case X86_PREFIX_SEG_DS:
+		case X86_PREFIX_SEG_FS:
+		case X86_PREFIX_SEG_GS:
+			continue;
+		}
+		break;
+	}
+	/* REX has to be the last prefix */
+	if ((op & X86_REX_MASK) == X86_REX_BASE) {
+		rex = op;
+		if (!next_byte(inst, &op))
+			return false;
+		if (rex & X86_REX_W)
+			opsize = 8;
+	}
+
+	access->size = (op & 1) ? opsize : 1;
+
+	switch (op) {
+	case X86_OP_MOV_TO_MEM8:
 	case X86_OP_MOV_TO_MEM:
-		access.inst_len += 2;
-		access.size = 4;
-		has_modrm = true;
-		does_write = true;
+		access->op = MMIO_OP_STORE;
 		break;
+	case X86_OP_MOV_FROM_MEM8:
 	case X86_OP_MOV_FROM_MEM:
-		access.inst_len += 2;
-		access.size = 4;
-		has_modrm = true;
-		does_write = false;
+		access->op = MMIO_OP_LOAD;
+		break;
+	case X86_OP_MOV_FROM_MOFFS8:
+	case X86_OP_MOV_FROM_MOFFS:
+	case X86_OP_MOV_TO_MOFFS8:
+	case X86_OP_MOV_TO_MOFFS:
+		access->op = op < X86_OP_MOV_TO_MOFFS8 ?
+			MMIO_OP_LOAD : MMIO_OP_STORE;
+		use_modrm = false;
+		if (!skip_bytes(inst, addr32 ? 4 : 8))
+			return false;
+		break;
+	case X86_OP_MOV_IMM8_TO_MEM:
+	case X86_OP_MOV_IMM_TO_MEM:
+		access->op = MMIO_OP_STORE;
+		access->has_imm = true;
+		break;
+	case X86_OP_TEST8:
+	case X86_OP_TEST:
+		access->op = MMIO_OP_ALU_MEM;
+		access->alu_op = MMIO_ALU_TEST;
+		break;
+	case X86_OP_GRP1_SIMM8:
+		imm_size = 1;
+		/* fall through */
+	case X86_OP_GRP1_IMM8:
+	case X86_OP_GRP1_IMM:
+		access->op = MMIO_OP_ALU_MEM;
+		access->has_imm = true;
+		break;
+	case X86_OP_GRP3_8:
+	case X86_OP_GRP3:
+		access->op = MMIO_OP_ALU_MEM;
+		access->alu_op = MMIO_ALU_TEST;
+		access->has_imm = true;
+		break;
+	case X86_OP_MOVSXD:
+		if (opsize != 8)
+			return false;
+		access->op = MMIO_OP_LOAD;
+		access->size = 4;
+		access->sign_extend = true;
+		break;
+	case X86_OP_TWO_BYTE:
+		if (!next_byte(inst, &op2))
+			return false;
+		switch (op2) {
+		case X86_OP2_MOVSX8:
+		case X86_OP2_MOVSX16:
+			access->sign_extend = true;
+			/* fall through */
+		case X86_OP2_MOVZX8:
+		case X86_OP2_MOVZX16:
+			access->op = MMIO_OP_LOAD;
+			access->size = (op2 & 1) ? 2 : 1;
+			break;
+		default:
+			return false;
+		}
 		break;
 	default:
-		goto error_unsupported;
+		/* ADD, OR, AND, SUB, XOR, CMP with register operand */
+		if (op > X86_OP_ALU_LAST || (op & 7) > 3)
+			return false;
+		access->alu_op = op >> 3;
+		if (access->alu_op == 2 || access->alu_op == 3)
+			/* ADC and SBB */
+			return false;
+		access->op = (op & 2) ? MMIO_OP_ALU_REG : MMIO_OP_ALU_MEM;
+		break;
 	}
 
-	if (has_modrm) {
-		pc++;
-		page = page_map_get_foreign_page(cpu_id, page_table_addr,
-						 cell->page_offset, pc,
-						 PAGE_DEFAULT_FLAGS);
-		if (!page)
-			goto error_nopage;
+	access->reg_size = access->size;
+	if (access->op == MMIO_OP_LOAD && op == X86_OP_TWO_BYTE)
+		access->reg_size = opsize;
+	if (op == X86_OP_MOVSXD)
+		access->reg_size = 8;
 
-		modrm = *(struct modrm *)&page[pc & PAGE_OFFS_MASK];
-		switch (modrm.mod) {
-		case 0:
-			if (modrm.rm != 4)
-				goto error_unsupported;
-
-			pc++;
-			page = page_map_get_foreign_page(cpu_id,
-							 page_table_addr,
-							 cell->page_offset, pc,
-							 PAGE_DEFAULT_FLAGS);
-			if (!page)
-				goto error_nopage;
-
-			sib = *(struct sib *)&page[pc & PAGE_OFFS_MASK];
-			if (sib.ss !=0 || sib.index != 4 || sib.reg != 5)
-				goto error_unsupported;
-			access.inst_len += 5;
+	if (use_modrm) {
+		if (!decode_modrm(inst, &modrm))
+			return false;
+		gpr = modrm.reg | ((rex & X86_REX_R) ? 8 : 0);
+	} else {
+		gpr = 0;
+	}
+
+	if (access->has_imm) {
+		switch (op) {
+		case X86_OP_MOV_IMM8_TO_MEM:
+		case X86_OP_MOV_IMM_TO_MEM:
+			if (modrm.reg != 0)
+				return false;
 			break;
-		case 2:
-			access.inst_len += 4;
+		case X86_OP_GRP3_8:
+		case X86_OP_GRP3:
+			/* only TEST, not NOT, NEG, MUL or DIV */
+			if (modrm.reg > 1)
+				return false;
 			break;
 		default:
-			goto error_unsupported;
+			access->alu_op = modrm.reg;
+			if (access->alu_op == 2 || access->alu_op == 3)
+				return false;
 		}
-		if (has_regr)
-			access.reg = 7 - modrm.reg;
-		else if (modrm.reg == 4)
+		if (imm_size == 0)
+			imm_size = access->size > 4 ? 4 : access->size;
+		if (!fetch_imm(inst, imm_size, &access->imm))
+			return false;
+	} else if (!set_reg_operand(access, gpr, rex != 0)) {
+		return false;
+	}
+
+	access->does_read = access->op != MMIO_OP_STORE;
+	access->does_write = access->op == MMIO_OP_STORE ||
+		(access->op == MMIO_OP_ALU_MEM &&
+		 access->alu_op != MMIO_ALU_CMP &&
+		 access->alu_op != MMIO_ALU_TEST);
+	access->inst_len = inst->pos;
+	return true;
+}
+
+void mmio_cache_flush(struct per_cpu *cpu_data)
+{
+	memset(cpu_data->mmio_cache, 0, sizeof(cpu_data->mmio_cache));
+}
+
+/*
+ * Guest code at a cached site is assumed to remain unchanged as long as
+ * the CPU stays with its cell. The cache is flushed on CPU reset.
+ */
+static struct mmio_cache_entry *
+mmio_cache_entry(struct per_cpu *cpu_data, unsigned long pc)
+{
+	return &cpu_data->mmio_cache[(pc ^ (pc >> 12)) &
+				     (MMIO_CACHE_SIZE - 1)];
+}
+
+struct mmio_access mmio_parse(struct per_cpu *cpu_data, unsigned long pc,
+			      unsigned long page_table_addr, bool is_write)
+{
+	struct mmio_cache_entry *entry = mmio_cache_entry(cpu_data, pc);
+	struct mmio_access access = { .inst_len = 0 };
+	struct inst_buffer inst;
+
+	if (entry->access.inst_len == 0 || entry->pc != pc ||
+	    entry->page_table_addr != page_table_addr) {
+		if (!fetch_instruction(cpu_data, pc, page_table_addr, &inst))
+			goto error_nopage;
+		if (!decode(&inst, &access))
 			goto error_unsupported;
-		else
-			access.reg = 15 - modrm.reg;
+
+		entry->pc = pc;
+		entry->page_table_addr = page_table_addr;
+		entry->access = access;
+	} else {
+		access = entry->access;
 	}
 
-	if (does_write != is_write)
+	if (access.does_write != is_write)
 		goto error_inconsitent;
 
-unmap_out:
-	page_map_release_foreign_page(cpu_id);
-
-	spin_unlock(&mmio_lock);
+out:
 	return access;
 
 error_nopage:
@@ -141,5 +366,157 @@ error_inconsitent:
 		     is_write ? "write" : "read");
 error:
 	access.inst_len = 0;
-	goto unmap_out;
+	goto out;
+}
+
+static unsigned long size_mask(unsigned int size)
+{
+	return size >= sizeof(long) ? ~0UL : (1UL << (size * 8)) - 1;
+}
+
+static unsigned long alu(unsigned int alu_op, unsigned long a,
+			 unsigned long b, unsigned int size,
+			 unsigned long *rflags)
+{
+	unsigned long mask = size_mask(size);
+	unsigned long sign = 1UL << (size * 8 - 1);
+	unsigned long res, flags = 0;
+	u8 parity;
+
+	a &= mask;
+	b &= mask;
+
+	switch (alu_op) {
+	case MMIO_ALU_ADD:
+		res = (a + b) & mask;
+		if (res < a)
+			flags |= X86_RFLAGS_CF;
+		if ((a ^ res) & (b ^ res) & sign)
+			flags |= X86_RFLAGS_OF;
+		flags |= (a ^ b ^ res) & X86_RFLAGS_AF;
+		break;
+	case MMIO_ALU_SUB:
+	case MMIO_ALU_CMP:
+		res = (a - b) & mask;
+		if (a < b)
+			flags |= X86_RFLAGS_CF;
+		if ((a ^ b) & (a ^ res) & sign)
+			flags |= X86_RFLAGS_OF;
+		flags |= (a ^ b ^ res) & X86_RFLAGS_AF;
+		break;
+	case MMIO_ALU_OR:
+		res = a | b;
+		break;
+	case MMIO_ALU_XOR:
+		res = a ^ b;
+		break;
+	default:
+		/* AND, TEST */
+		res = a & b;
+		break;
+	}
+
+	if (res == 0)
+		flags |= X86_RFLAGS_ZF;
+	if (res & sign)
+		flags |= X86_RFLAGS_SF;
+	parity = res;
+	parity ^= parity >> 4;
+	parity ^= parity >> 2;
+	parity ^= parity >> 1;
+	if (!(parity & 1))
+		flags |= X86_RFLAGS_PF;
+
+	*rflags = (*rflags & ~X86_RFLAGS_ARITH_MASK) | flags;
+	return res;
+}
+
+static unsigned long get_reg(struct registers *guest_regs,
+			     const struct mmio_access *access)
+{
+	return (((unsigned long *)guest_regs)[access->reg] >>
+		access->reg_shift) & size_mask(access->reg_size);
+}
+
+static void set_reg(struct registers *guest_regs,
+		    const struct mmio_access *access, unsigned long val)
+{
+	unsigned long *reg = &((unsigned long *)guest_regs)[access->reg];
+	unsigned long mask;
+
+	/* 32-bit results are zero-extended, narrower ones get merged */
+	if (access->reg_size >= 4) {
+		*reg = val & size_mask(access->reg_size);
+		return;
+	}
+	mask = size_mask(access->reg_size) << access->reg_shift;
+	*reg = (*reg & ~mask) | ((val << access->reg_shift) & mask);
+}
+
+unsigned long mmio_execute(struct registers *guest_regs,
+			   unsigned long *rflags,
+			   const struct mmio_access *access,
+			   unsigned long mem_val)
+{
+	unsigned long src, sign;
+
+	mem_val &= size_mask(access->size);
+	src = access->has_imm ? access->imm : get_reg(guest_regs, access);
+
+	switch (access->op) {
+	case MMIO_OP_LOAD:
+		sign = 1UL << (access->size * 8 - 1);
+		if (access->sign_extend && (mem_val & sign))
+			mem_val |= ~size_mask(access->size);
+		set_reg(guest_regs, access, mem_val);
+		return 0;
+	case MMIO_OP_STORE:
+		return src & size_mask(access->size);
+	case MMIO_OP_ALU_MEM:
+		return alu(access->alu_op, mem_val, src, access->size,
+			   rflags);
+	default:
+		/* MMIO_OP_ALU_REG */
+		src = alu(access->alu_op, src, mem_val, access->size, rflags);
+		if (access->alu_op != MMIO_ALU_CMP)
+			set_reg(guest_regs, access, src);
+		return 0;
+	}
+}
+
+unsigned int mmio_handle_access(struct registers *guest_regs,
+				struct per_cpu *cpu_data,
+				unsigned long phys_addr, unsigned long pc,
+				unsigned long page_table_addr, bool is_write,
+				unsigned long *rflags)
+{
+	struct mmio_region *region;
+	struct mmio_access access;
+	unsigned long offset, val = 0;
+
+	region = mmio_find_region(cpu_data->cell, phys_addr);
+	if (!region)
+		return 0;
+
+	access = mmio_parse(cpu_data, pc, page_table_addr, is_write);
+	if (access.inst_len == 0)
+		return 0;
+
+	offset = phys_addr - region->start;
+	if (region->size - offset < access.size) {
+		panic_printk("FATAL: MMIO access crosses region boundary\n");
+		return 0;
+	}
+
+	if (access.does_read &&
+	    !region->handler(cpu_data, region->arg, offset, access.size,
+			     false, &val))
+		return 0;
+	val = mmio_execute(guest_regs, rflags, &access, val);
+	if (access.does_write &&
+	    !region->handler(cpu_data, region->arg, offset, access.size,
+			     true, &val))
+		return 0;
+
+	return access.inst_len;
 }
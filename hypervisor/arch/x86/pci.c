@@ -0,0 +1,466 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/string.h>
+#include <asm/pci.h>
+
+#define PCI_ADDR_ENABLE		(1UL << 31)
+
+#define PCI_MMCONFIG_BDF_SHIFT	12
+
+#define PCI_CFG_COMMAND		0x04
+#define PCI_CFG_CACHE_LINE	0x0c
+#define PCI_CFG_BAR		0x10
+#define PCI_CFG_ROM		0x30
+#define PCI_CFG_CAP_PTR		0x34
+#define PCI_CFG_BRIDGE_ROM	0x38
+#define PCI_CFG_INT_LINE	0x3c
+
+#define PCI_CMD_DECODE		0x0003
+#define PCI_STS_CAP_LIST	(1 << 20)
+
+#define PCI_BAR_IO		0x1
+#define PCI_BAR_MEM_TYPE_MASK	0x6
+#define PCI_BAR_MEM_TYPE_64	0x4
+
+#define PCI_CAP_ID_MSI		0x05
+/* bounds the walk in case the capability list loops */
+#define PCI_MAX_CAPS		48
+
+#define MSI_ADDR_REMAPPABLE	(1 << 4)
+#define MSI_ADDR_HANDLE_15	(1 << 2)
+#define MSI_ADDR_HANDLE_SHIFT	5
+#define MSI_ADDR_HANDLE_MASK	0x7fff
+
+/* how the cell's accesses to a config space dword are handled */
+#define PCI_REG_PASS		0
+#define PCI_REG_RO		1
+#define PCI_REG_BAR		2
+#define PCI_REG_MSI_ADDR	3
+
+static unsigned long mmconfig_size(void)
+{
+	return ((unsigned long)system_config->pci_mmconfig_end_bus + 1) << 20;
+}
+
+static u32 size_mask(unsigned int size)
+{
+	return size == 4 ? ~0U : (1U << (size * 8)) - 1;
+}
+
+static u32 pci_read_hw(struct pci_device *dev, unsigned int reg,
+		       unsigned int size)
+{
+	switch (size) {
+	case 1:
+		return mmio_read8(dev->mmcfg + reg);
+	case 2:
+		return mmio_read16(dev->mmcfg + reg);
+	default:
+		return mmio_read32(dev->mmcfg + reg);
+	}
+}
+
+static void pci_write_hw(struct pci_device *dev, unsigned int reg,
+			 unsigned int size, u32 value)
+{
+	switch (size) {
+	case 1:
+		mmio_write8(dev->mmcfg + reg, value);
+		break;
+	case 2:
+		mmio_write16(dev->mmcfg + reg, value);
+		break;
+	default:
+		mmio_write32(dev->mmcfg + reg, value);
+		break;
+	}
+}
+
+static unsigned int pci_num_bars(struct pci_device *dev)
+{
+	return dev->type == JAILHOUSE_PCI_TYPE_BRIDGE ? 2 : PCI_NUM_BARS;
+}
+
+static unsigned int pci_reg_type(struct pci_device *dev, unsigned int reg)
+{
+	if (reg >= PCI_HEADER_DWORDS * 4) {
+		if (dev->msi_cap && reg == dev->msi_cap + 4)
+			return PCI_REG_MSI_ADDR;
+		return PCI_REG_PASS;
+	}
+	if (reg >= PCI_CFG_BAR && reg < PCI_CFG_BAR + pci_num_bars(dev) * 4)
+		return PCI_REG_BAR;
+
+	switch (reg) {
+	case PCI_CFG_COMMAND:
+	case PCI_CFG_CACHE_LINE:
+		return PCI_REG_PASS;
+	case PCI_CFG_INT_LINE:
+		/* includes the bridge control register on bridges */
+		return dev->type == JAILHOUSE_PCI_TYPE_DEVICE ?
+			PCI_REG_PASS : PCI_REG_RO;
+	default:
+		/* IDs, class, bus numbers, bridge windows, capabilities */
+		return PCI_REG_RO;
+	}
+}
+
+static struct pci_device *pci_find_device(struct cell *cell, u16 bdf)
+{
+	unsigned int n;
+
+	for (n = 0; n < cell->pci.num_devices; n++)
+		if (cell->pci.devices[n].bdf == bdf)
+			return &cell->pci.devices[n];
+	return NULL;
+}
+
+static bool pci_msi_addr_valid(struct cell *cell, struct pci_device *dev,
+			       u32 addr)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_irq_line *irq_line;
+	unsigned int handle, n;
+
+	/* the compatibility format would bypass interrupt remapping */
+	if (!(addr & MSI_ADDR_REMAPPABLE))
+		return false;
+	handle = ((addr >> MSI_ADDR_HANDLE_SHIFT) & MSI_ADDR_HANDLE_MASK) |
+		((addr & MSI_ADDR_HANDLE_15) << 13);
+
+	irq_line = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory);
+	for (n = 0; n < config->num_irq_lines; n++, irq_line++)
+		if (irq_line->num == handle && irq_line->domain == 0 &&
+		    irq_line->bus == dev->bdf >> 8 &&
+		    irq_line->devfn == (dev->bdf & 0xff))
+			return true;
+	return false;
+}
+
+static u32 pci_config_read(struct cell *cell, u16 bdf, unsigned int reg,
+			   unsigned int size)
+{
+	struct pci_device *dev = pci_find_device(cell, bdf);
+
+	/* other devices are hidden */
+	if (!dev)
+		return size_mask(size);
+
+	switch (pci_reg_type(dev, reg & ~3)) {
+	case PCI_REG_RO:
+	case PCI_REG_BAR:
+		/* served from the shadow, no hardware access */
+		return (dev->header[reg / 4] >> ((reg & 3) * 8)) &
+			size_mask(size);
+	default:
+		return pci_read_hw(dev, reg, size);
+	}
+}
+
+static void pci_config_write(struct cell *cell, u16 bdf, unsigned int reg,
+			     unsigned int size, u32 value)
+{
+	struct pci_device *dev = pci_find_device(cell, bdf);
+	unsigned int shift = (reg & 3) * 8, bar;
+	u32 mask = size_mask(size) << shift, val;
+
+	if (!dev)
+		return;
+
+	switch (pci_reg_type(dev, reg & ~3)) {
+	case PCI_REG_PASS:
+		pci_write_hw(dev, reg, size, value);
+		break;
+	case PCI_REG_BAR:
+		/*
+		 * Sizing is emulated, any other value restores the assigned
+		 * address. The hardware BAR is never moved.
+		 */
+		bar = (reg / 4) - (PCI_CFG_BAR / 4);
+		val = (dev->header[reg / 4] & ~mask) |
+			((value << shift) & mask);
+		if ((val & dev->bar_mask[bar]) == dev->bar_mask[bar])
+			dev->header[reg / 4] = dev->bar_mask[bar] |
+				(dev->bar_orig[bar] & ~dev->bar_mask[bar]);
+		else
+			dev->header[reg / 4] = dev->bar_orig[bar];
+		break;
+	case PCI_REG_MSI_ADDR:
+		if (size == 4 && pci_msi_addr_valid(cell, dev, value))
+			pci_write_hw(dev, reg, size, value);
+		else
+			printk("WARNING: Cell \"%s\" programmed invalid MSI "
+			       "address %x into %02x:%02x.%x\n", cell->name,
+			       value, bdf >> 8, (bdf >> 3) & 0x1f, bdf & 0x7);
+		break;
+	}
+}
+
+bool pci_pio_access(struct per_cpu *cpu_data, u16 port, unsigned int size,
+		    bool is_write, u32 *value)
+{
+	struct cell *cell = cpu_data->cell;
+	u32 addr = cell->pci.addr_port;
+	unsigned int reg;
+
+	if (!cell->pci.mediated || port < PCI_ADDR_PORT ||
+	    port + size > PCI_ADDR_PORT + PCI_NUM_PORTS)
+		return false;
+
+	if (port == PCI_ADDR_PORT && size == 4) {
+		if (is_write)
+			cell->pci.addr_port = *value;
+		else
+			*value = addr;
+	} else if (port >= PCI_DATA_PORT && (addr & PCI_ADDR_ENABLE)) {
+		reg = (addr & 0xfc) + port - PCI_DATA_PORT;
+		if (is_write)
+			pci_config_write(cell, addr >> 8, reg, size, *value);
+		else
+			*value = pci_config_read(cell, addr >> 8, reg, size);
+	} else if (!is_write) {
+		*value = size_mask(size);
+	}
+	/* writes to other ports, including the reset register, are ignored */
+	return true;
+}
+
+static bool pci_mmconfig_access(struct per_cpu *cpu_data, void *arg,
+				unsigned long offset, unsigned int size,
+				bool is_write, unsigned long *value)
+{
+	unsigned int reg = offset & PAGE_OFFS_MASK;
+	u16 bdf = offset >> PCI_MMCONFIG_BDF_SHIFT;
+
+	if (size > 4 || (reg & (size - 1))) {
+		panic_printk("FATAL: Invalid PCI MMCONFIG access, offset %x "
+			     "size %d\n", offset, size);
+		return false;
+	}
+
+	if (is_write)
+		pci_config_write(cpu_data->cell, bdf, reg, size, *value);
+	else
+		*value = pci_config_read(cpu_data->cell, bdf, reg, size);
+	return true;
+}
+
+static void pci_size_bars(struct pci_device *dev)
+{
+	unsigned int n, reg;
+	bool upper = false;
+	u16 cmd;
+	u32 val;
+
+	/* keep the device from decoding while the BARs are all ones */
+	cmd = pci_read_hw(dev, PCI_CFG_COMMAND, 2);
+	pci_write_hw(dev, PCI_CFG_COMMAND, 2, cmd & ~PCI_CMD_DECODE);
+
+	for (n = 0; n < pci_num_bars(dev); n++) {
+		reg = PCI_CFG_BAR + n * 4;
+		dev->bar_orig[n] = dev->header[reg / 4];
+		pci_write_hw(dev, reg, 4, ~0U);
+		val = pci_read_hw(dev, reg, 4);
+		pci_write_hw(dev, reg, 4, dev->bar_orig[n]);
+
+		if (upper) {
+			dev->bar_mask[n] = val;
+			upper = false;
+		} else if (dev->bar_orig[n] & PCI_BAR_IO) {
+			dev->bar_mask[n] = val & ~0x3;
+		} else {
+			dev->bar_mask[n] = val & ~0xf;
+			upper = (dev->bar_orig[n] & PCI_BAR_MEM_TYPE_MASK) ==
+				PCI_BAR_MEM_TYPE_64;
+		}
+	}
+
+	pci_write_hw(dev, PCI_CFG_COMMAND, 2, cmd);
+}
+
+static void pci_find_msi(struct pci_device *dev)
+{
+	unsigned int n, pos;
+	u32 cap;
+
+	if (!(dev->header[PCI_CFG_COMMAND / 4] & PCI_STS_CAP_LIST))
+		return;
+
+	pos = dev->header[PCI_CFG_CAP_PTR / 4] & 0xfc;
+	for (n = 0; pos != 0 && n < PCI_MAX_CAPS; n++) {
+		cap = pci_read_hw(dev, pos, 4);
+		if ((cap & 0xff) == PCI_CAP_ID_MSI) {
+			dev->msi_cap = pos;
+			return;
+		}
+		pos = (cap >> 8) & 0xfc;
+	}
+}
+
+static int pci_device_init(struct pci_device *dev,
+			   struct jailhouse_pci_device *config_dev)
+{
+	unsigned long mmcfg_addr;
+	unsigned int n;
+	int err;
+
+	if (config_dev->domain != 0 ||
+	    config_dev->bus > system_config->pci_mmconfig_end_bus)
+		return -EINVAL;
+
+	dev->bdf = (config_dev->bus << 8) | config_dev->devfn;
+	dev->type = config_dev->type;
+
+	dev->mmcfg = page_alloc(&remap_pool, 1, JAILHOUSE_POOL_USER_REMAP);
+	if (!dev->mmcfg)
+		return -ENOMEM;
+	mmcfg_addr = system_config->pci_mmconfig_base +
+		((unsigned long)dev->bdf << PCI_MMCONFIG_BDF_SHIFT);
+	err = page_map_create(hv_page_table, mmcfg_addr, PAGE_SIZE,
+			      (unsigned long)dev->mmcfg,
+			      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
+			      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			      PAGE_MAP_NO_HUGE);
+	if (err) {
+		page_free(&remap_pool, dev->mmcfg, 1,
+			  JAILHOUSE_POOL_USER_REMAP);
+		dev->mmcfg = NULL;
+		return err;
+	}
+
+	for (n = 0; n < PCI_HEADER_DWORDS; n++)
+		dev->header[n] = pci_read_hw(dev, n * 4, 4);
+	if (dev->header[0] == ~0U)
+		return -ENODEV;
+
+	pci_size_bars(dev);
+	pci_find_msi(dev);
+
+	/* expansion ROMs are hidden */
+	dev->header[(dev->type == JAILHOUSE_PCI_TYPE_BRIDGE ?
+		     PCI_CFG_BRIDGE_ROM : PCI_CFG_ROM) / 4] = 0;
+
+	return 0;
+}
+
+static bool pci_ports_trapped(struct jailhouse_cell_desc *config)
+{
+	u8 *pio_bitmap;
+	unsigned int port;
+
+	pio_bitmap = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory) +
+		config->num_irq_lines * sizeof(struct jailhouse_irq_line);
+
+	for (port = PCI_ADDR_PORT; port < PCI_ADDR_PORT + PCI_NUM_PORTS;
+	     port++)
+		if (port / 8 < config->pio_bitmap_size &&
+		    !(pio_bitmap[port / 8] & (1 << (port % 8))))
+			return false;
+	return true;
+}
+
+int pci_cell_init(struct cell *cell, struct jailhouse_cell_desc *config)
+{
+	unsigned long base = system_config->pci_mmconfig_base;
+	struct jailhouse_pci_device *config_dev;
+	const struct jailhouse_memory *mem;
+	unsigned int n, pages;
+	int err;
+
+	if (!(config->flags & JAILHOUSE_CELL_MEDIATE_PCI_CONFIG))
+		return 0;
+
+	if (base == 0 || !pci_ports_trapped(config))
+		return -EINVAL;
+
+	/* the MMCONFIG window has to trap */
+	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size;
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		if (mem->virt_start < base + mmconfig_size() &&
+		    mem->virt_start + mem->size > base)
+			return -EINVAL;
+
+	config_dev = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory) +
+		config->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		config->pio_bitmap_size;
+
+	if (config->num_pci_devices > 0) {
+		pages = PAGE_ALIGN(config->num_pci_devices *
+				   sizeof(struct pci_device)) / PAGE_SIZE;
+		cell->pci.devices = page_alloc_node(cell->numa_node, pages,
+						    JAILHOUSE_POOL_USER_CELL);
+		if (!cell->pci.devices)
+			return -ENOMEM;
+		memset(cell->pci.devices, 0, pages * PAGE_SIZE);
+	}
+
+	for (n = 0; n < config->num_pci_devices; n++) {
+		cell->pci.num_devices++;
+		err = pci_device_init(&cell->pci.devices[n], &config_dev[n]);
+		if (err)
+			goto error;
+	}
+
+	err = mmio_region_register(cell, base, mmconfig_size(),
+				   pci_mmconfig_access, NULL);
+	if (err)
+		goto error;
+
+	cell->pci.mediated = true;
+	return 0;
+
+error:
+	pci_cell_exit(cell);
+	return err;
+}
+
+void pci_cell_exit(struct cell *cell)
+{
+	struct pci_device *dev;
+	unsigned int n;
+
+	if (!(cell->config->flags & JAILHOUSE_CELL_MEDIATE_PCI_CONFIG))
+		return;
+
+	cell->pci.mediated = false;
+	mmio_region_unregister(cell, system_config->pci_mmconfig_base);
+
+	for (n = 0; n < cell->pci.num_devices; n++) {
+		dev = &cell->pci.devices[n];
+		if (!dev->mmcfg)
+			continue;
+		page_map_destroy(hv_page_table, (unsigned long)dev->mmcfg,
+				 PAGE_SIZE, PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE);
+		page_free(&remap_pool, dev->mmcfg, 1,
+			  JAILHOUSE_POOL_USER_REMAP);
+	}
+
+	page_free_node(cell->pci.devices,
+		       PAGE_ALIGN(cell->config->num_pci_devices *
+				  sizeof(struct pci_device)) / PAGE_SIZE,
+		       JAILHOUSE_POOL_USER_CELL);
+	cell->pci.devices = NULL;
+	cell->pci.num_devices = 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/control.h>
+#include <jailhouse/hypercall.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/spsc-ring.h>
+#include <asm/apic.h>
+#include <asm/processor.h>
+#include <asm/profile.h>
+#include <asm/spinlock.h>
+
+#ifdef CONFIG_PROFILE
+
+#define CPUID_A_EAX_VERSION(eax)	((eax) & 0xff)
+#define CPUID_A_EAX_NUM_COUNTERS(eax)	(((eax) >> 8) & 0xff)
+/* set if the event is not available */
+#define CPUID_A_EBX_NO_CORE_CYCLES	(1 << 0)
+
+#define PERFEVTSEL_CORE_CYCLES		0x3c
+#define PERFEVTSEL_USR			(1 << 16)
+#define PERFEVTSEL_OS			(1 << 17)
+#define PERFEVTSEL_INT			(1 << 20)
+#define PERFEVTSEL_EN			(1 << 22)
+
+#define GLOBAL_PMC0			(1UL << 0)
+
+#define PROFILE_RING_SLOTS		1024
+#define PROFILE_RING_PAGES						\
+	(PAGE_ALIGN(jailhouse_spsc_ring_size(PROFILE_RING_SLOTS,	\
+			sizeof(struct jailhouse_profile_sample))) / PAGE_SIZE)
+
+extern u8 __start[];
+
+static bool pmu_available;
+/* the period all CPUs follow on their next event processing */
+static unsigned long profile_period;
+
+/* serializes the readers of all rings */
+static DEFINE_SPINLOCK(read_lock);
+
+int profile_init(void)
+{
+	unsigned int eax, ebx, ecx, edx, cpu;
+	struct jailhouse_spsc_ring *ring;
+
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 0xa) {
+		cpuid(0xa, &eax, &ebx, &ecx, &edx);
+		/* the global control and overflow MSRs came with version 2 */
+		pmu_available = CPUID_A_EAX_VERSION(eax) >= 2 &&
+			CPUID_A_EAX_NUM_COUNTERS(eax) >= 1 &&
+			!(ebx & CPUID_A_EBX_NO_CORE_CYCLES);
+	}
+	if (!pmu_available) {
+		printk("Profiling unavailable, no suitable PMU\n");
+		return 0;
+	}
+
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++) {
+		ring = page_alloc(&mem_pool, PROFILE_RING_PAGES,
+				  JAILHOUSE_POOL_USER_HYPERVISOR);
+		if (!ring)
+			return -ENOMEM;
+		jailhouse_spsc_init(ring, PROFILE_RING_SLOTS,
+				    sizeof(struct jailhouse_profile_sample));
+		per_cpu(cpu)->profile_ring = ring;
+	}
+
+	return 0;
+}
+
+static void profile_arm_counter(unsigned long period)
+{
+	/* sign-extended from bit 31, hence the limit of the period */
+	write_msr(MSR_IA32_PMC0, -period);
+}
+
+/*
+ * Follows profile_period, unless the cell of the CPU owns the counters. The
+ * counter is reprogrammed only here and in the NMI handler of the same CPU,
+ * which does not touch it while sampling is off for this CPU.
+ */
+void profile_cpu_update(struct per_cpu *cpu_data)
+{
+	unsigned long period = cpu_data->pmu_owned ? 0 : profile_period;
+
+	if (cpu_data->profile_period == period)
+		return;
+
+	/* stop the counter before the NMI handler ignores it */
+	write_msr(MSR_IA32_PERFEVTSEL0, 0);
+	cpu_data->profile_period = period;
+	if (period == 0) {
+		write_msr(MSR_CORE_PERF_GLOBAL_CTRL,
+			  read_msr(MSR_CORE_PERF_GLOBAL_CTRL) & ~GLOBAL_PMC0);
+		apic_set_pmi(false);
+		return;
+	}
+
+	profile_arm_counter(period);
+	write_msr(MSR_CORE_PERF_GLOBAL_OVF_CTRL, GLOBAL_PMC0);
+	apic_set_pmi(true);
+	write_msr(MSR_IA32_PERFEVTSEL0, PERFEVTSEL_CORE_CYCLES |
+		  PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_INT |
+		  PERFEVTSEL_EN);
+	write_msr(MSR_CORE_PERF_GLOBAL_CTRL,
+		  read_msr(MSR_CORE_PERF_GLOBAL_CTRL) | GLOBAL_PMC0);
+}
+
+/* leave no counter behind that raises NMIs under Linux */
+void profile_cpu_exit(struct per_cpu *cpu_data)
+{
+	if (cpu_data->profile_period == 0)
+		return;
+
+	write_msr(MSR_IA32_PERFEVTSEL0, 0);
+	write_msr(MSR_CORE_PERF_GLOBAL_CTRL,
+		  read_msr(MSR_CORE_PERF_GLOBAL_CTRL) & ~GLOBAL_PMC0);
+	apic_set_pmi(false);
+	cpu_data->profile_period = 0;
+}
+
+/* claims the NMI if it is an overflow of the sampling counter */
+bool profile_nmi(struct per_cpu *cpu_data, unsigned long rip)
+{
+	struct jailhouse_profile_sample *sample;
+	u32 num;
+
+	if (cpu_data->profile_period == 0 ||
+	    !(read_msr(MSR_CORE_PERF_GLOBAL_STATUS) & GLOBAL_PMC0))
+		return false;
+
+	/* NMIs do not nest, this is the only producer of the ring */
+	sample = jailhouse_spsc_reserve(cpu_data->profile_ring, 1, &num);
+	if (num == 1) {
+		sample->offset = rip - (unsigned long)__start;
+		sample->reason = cpu_data->profile_reason;
+		jailhouse_spsc_commit(cpu_data->profile_ring, 1);
+	} else
+		cpu_data->profile_dropped++;
+
+	profile_arm_counter(cpu_data->profile_period);
+	write_msr(MSR_CORE_PERF_GLOBAL_OVF_CTRL, GLOBAL_PMC0);
+	/* the delivery masked the vector */
+	apic_set_pmi(true);
+
+	return true;
+}
+
+int arch_profile_set(struct per_cpu *cpu_data, unsigned long period)
+{
+	unsigned int cpu;
+
+	if (!pmu_available)
+		return -ENODEV;
+	if (period != 0 && (period < JAILHOUSE_PROFILE_MIN_PERIOD ||
+			    period > JAILHOUSE_PROFILE_MAX_PERIOD))
+		return -EINVAL;
+
+	profile_period = period;
+
+	/* all others pick the new period up on their way back into a cell */
+	profile_cpu_update(cpu_data);
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++)
+		if (cpu != cpu_data->cpu_id && per_cpu(cpu)->initialized)
+			arch_kick_cpu(cpu);
+
+	return 0;
+}
+
+long arch_profile_read(unsigned int cpu_id,
+		       struct jailhouse_profile_read *read,
+		       unsigned int max_samples)
+{
+	struct per_cpu *cpu_data;
+	u32 dropped;
+	long num;
+
+	if (cpu_id >= hypervisor_header.possible_cpus)
+		return -EINVAL;
+	cpu_data = per_cpu(cpu_id);
+	if (!pmu_available || !cpu_data->initialized)
+		return -ENODEV;
+
+	spin_lock(&read_lock);
+
+	num = jailhouse_spsc_dequeue(cpu_data->profile_ring, read->sample,
+				     max_samples);
+	dropped = cpu_data->profile_dropped;
+	read->dropped = dropped - cpu_data->profile_dropped_read;
+	cpu_data->profile_dropped_read = dropped;
+
+	spin_unlock(&read_lock);
+
+	return num;
+}
+
+#else /* !CONFIG_PROFILE */
+
+int arch_profile_set(struct per_cpu *cpu_data, unsigned long period)
+{
+	return -ENOSYS;
+}
+
+long arch_profile_read(unsigned int cpu_id,
+		       struct jailhouse_profile_read *read,
+		       unsigned int max_samples)
+{
+	return -ENOSYS;
+}
+
+#endif /* !CONFIG_PROFILE */
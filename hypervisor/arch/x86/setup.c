@@ -17,6 +17,9 @@
 #include <jailhouse/processor.h>
 #include <asm/apic.h>
 #include <asm/bitops.h>
+#include <asm/cat.h>
+#include <asm/profile.h>
+#include <asm/spinlock.h>
 #include <asm/vmx.h>
 #include <asm/vtd.h>
 
@@ -41,13 +44,22 @@ extern u8 nmi_entry[];
 
 static u32 idt[NUM_IDT_DESC * 4];
 
+bool cpu_has_mwait;
+
+/* protects the TSS busy flag in the shared GDT */
+static DEFINE_SPINLOCK(gdt_lock);
+
 int arch_init_early(struct cell *linux_cell,
 		    struct jailhouse_cell_desc *config)
 {
+	struct jailhouse_memory *mem;
 	unsigned long entry;
-	unsigned int vector;
+	unsigned int vector, n;
 	int err;
 
+	/* CPUs that come later still pause until they see this */
+	cpu_has_mwait = !!(cpuid_ecx(1) & X86_FEATURE_MWAIT);
+
 	err = apic_init();
 	if (err)
 		return err;
@@ -68,12 +80,38 @@ int arch_init_early(struct cell *linux_cell,
 	idt[NMI_VECTOR * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
 	idt[NMI_VECTOR * 4 + 2] = entry >> 32;
 
-	vmx_init();
+	if (!apic_valid_doorbell_vector(config->doorbell_vector))
+		return -EINVAL;
+
+	err = vmx_init();
+	if (err)
+		return err;
+
+	err = cat_init(linux_cell, config);
+	if (err)
+		return err;
+
+	err = profile_init();
+	if (err)
+		return err;
 
 	err = vmx_cell_init(linux_cell, config);
 	if (err)
 		return err;
 
+	/* a lazy EPT is filled on the first accesses instead */
+	mem = jailhouse_cell_mem_regions(config);
+	if (!(config->flags & JAILHOUSE_CELL_LAZY_EPT))
+		for (n = 0; n < config->num_memory_regions; n++, mem++) {
+			err = vmx_map_memory_region(linux_cell, mem);
+			if (err)
+				return err;
+		}
+
+	err = vmx_map_trace_rings(linux_cell);
+	if (err)
+		return err;
+
 	return 0;
 }
 
@@ -138,8 +176,10 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 		: : "r" (0));
 
 	/* clear TSS busy flag set by previous loading, then set TR */
+	spin_lock(&gdt_lock);
 	gdt[GDT_DESC_TSS] &= ~TSS_BUSY_FLAG;
 	asm volatile("ltr %%ax" : : "a" (GDT_DESC_TSS * 8));
+	spin_unlock(&gdt_lock);
 
 	/* swap IDTR */
 	read_idtr(&cpu_data->linux_idtr);
@@ -165,6 +205,8 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 	if (err)
 		goto error_out;
 
+	cat_cpu_update(cpu_data);
+
 	return 0;
 
 error_out:
@@ -175,6 +217,8 @@ error_out:
 int arch_init_late(struct cell *linux_cell,
 		   struct jailhouse_cell_desc *config)
 {
+	struct jailhouse_memory *mem;
+	unsigned int n;
 	int err;
 
 	err = vtd_init();
@@ -185,6 +229,15 @@ int arch_init_late(struct cell *linux_cell,
 	if (err)
 		return err;
 
+	mem = jailhouse_cell_mem_regions(config);
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		err = vtd_map_memory_region(linux_cell, mem);
+		if (err)
+			return err;
+	}
+
+	vtd_enable_units();
+
 	return 0;
 }
 
@@ -200,7 +253,9 @@ void arch_cpu_restore(struct per_cpu *cpu_data)
 	if (!cpu_data->initialized)
 		return;
 
+	profile_cpu_exit(cpu_data);
 	vmx_cpu_exit(cpu_data);
+	cat_cpu_exit(cpu_data);
 
 	write_msr(MSR_EFER, cpu_data->linux_efer);
 	write_cr3(cpu_data->linux_cr3);
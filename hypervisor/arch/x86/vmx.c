@@ -17,12 +17,22 @@
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
 #include <jailhouse/hypercall.h>
+#include <jailhouse/mmio.h>
 #include <asm/apic.h>
+#include <asm/bitops.h>
+#include <asm/cat.h>
 #include <asm/fault.h>
+#include <asm/pci.h>
+#include <asm/profile.h>
 #include <asm/vmx.h>
 #include <asm/vtd.h>
 
-static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
+/* EPT tables are accounted separately and live on the node of the cell */
+#define EPT_MAP_FLAGS(cell)	(PAGE_MAP_USER(JAILHOUSE_POOL_USER_EPT) | \
+				 PAGE_MAP_NODE((cell)->numa_node))
+
+/* MSR accesses the hypervisor has to intercept, copied into each cell */
+static u8 msr_bitmap[][0x2000/8] = {
 	[ VMX_MSR_BITMAP_0000_READ ] = {
 		[      0/8 ...  0x7ff/8 ] = 0,
 		[  0x800/8 ...  0x807/8 ] = 0x0c, /* 0x802, 0x803 */
@@ -45,7 +55,10 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 		[  0x828/8 ...  0x82f/8 ] = 0x81, /* 0x828, 0x82f */
 		[  0x830/8 ...  0x837/8 ] = 0xfd, /* 0x830, 0x832 - 0x837 */
 		[  0x838/8 ...  0x83f/8 ] = 0xc1, /* 0x838, 0x83e, 0x83f */
-		[  0x840/8 ... 0x1fff/8 ] = 0,
+		[  0x840/8 ...  0xc87/8 ] = 0,
+		[  0xc88/8 ...  0xc8f/8 ] = 0x80, /* 0xc8f */
+		[  0xc90/8 ...  0xd8f/8 ] = 0xff, /* 0xc90 - 0xd8f */
+		[  0xd90/8 ... 0x1fff/8 ] = 0,
 	},
 	[ VMX_MSR_BITMAP_C000_WRITE ] = {
 		[      0/8 ... 0x1fff/8 ] = 0,
@@ -54,6 +67,37 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 static u8 __attribute__((aligned(PAGE_SIZE))) apic_access_page[PAGE_SIZE];
 
 static unsigned int vmx_true_msr_offs;
+unsigned int ept_huge_pages;
+static u64 invept_type;
+/* dirty logging uses the EPT dirty bits instead of write protection */
+static bool ept_ad_bits;
+/* 0 if VPIDs are not used */
+static u64 invvpid_type;
+
+/* set if halted guests can be idled, see vmx_handle_hlt */
+static bool hlt_idle_supported;
+/* NMI blocking of the guest is tracked, enabling NMI-window exits */
+static bool virtual_nmis;
+/* architectural counters cells may own, none without a version 2 PMU */
+static unsigned int pmu_counters, pmu_fixed_counters;
+static u64 pmu_global_ctrl_mask;
+/* IA32_PERF_GLOBAL_CTRL can be switched on VM entry and exit */
+static bool pmu_passthrough;
+
+/* MSR numbers beyond these belong to other features */
+#define PMU_MAX_COUNTERS		8
+#define PMU_MAX_FIXED_COUNTERS		4
+
+/* basic leaves whose output only depends on the leaf number */
+#define CPUID_CACHED_BASIC_LEAVES	((1 << 0x00) | (1 << 0x01) | \
+					 (1 << 0x02) | (1 << 0x05) | \
+					 (1 << 0x06) | (1 << 0x0a) | \
+					 (1 << 0x15) | (1 << 0x16))
+
+/* leaves whose output also depends on the subleaf in ECX */
+static const u32 cpuid_subleaf_leaves[CPUID_CACHE_SUBLEAF_LEAVES] = {
+	0x04, 0x07, 0x0b
+};
 
 static bool vmxon(struct per_cpu *cpu_data)
 {
@@ -143,10 +187,157 @@ static bool vmcs_write32(unsigned long field, u32 value)
 	return vmcs_write64(field, value);
 }
 
-void vmx_init(void)
+static int vmx_check_features(void)
+{
+	unsigned long vmx_proc_ctrl, vmx_proc_ctrl2, ept_cap;
+	unsigned long vmx_pin_ctrl, vmx_basic;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!(cpuid_ecx(1) & X86_FEATURE_VMX))
+		return -ENODEV;
+
+	vmx_basic = read_msr(MSR_IA32_VMX_BASIC);
+
+	/* require VMCS size <= PAGE_SIZE */
+	if (((vmx_basic >> 32) & 0x1fff) > PAGE_SIZE)
+		return -EIO;
+
+	/* require VMCS memory access type == write back */
+	if (((vmx_basic >> 50) & 0xf) != 6)
+		return -EIO;
+
+	if (vmx_basic & (1UL << 55))
+		vmx_true_msr_offs = MSR_IA32_VMX_TRUE_PINBASED_CTLS -
+			MSR_IA32_VMX_PINBASED_CTLS;
+
+	/* require NMI exiting and preemption timer support */
+	vmx_pin_ctrl = read_msr(MSR_IA32_VMX_PINBASED_CTLS +
+				vmx_true_msr_offs) >> 32;
+	if (!(vmx_pin_ctrl & PIN_BASED_NMI_EXITING) ||
+	    !(vmx_pin_ctrl & PIN_BASED_VMX_PREEMPTION_TIMER))
+		return -EIO;
+
+	/* only available together with NMI exiting */
+	if (!USE_EVENT_VECTOR && vmx_pin_ctrl & PIN_BASED_VIRTUAL_NMIS)
+		virtual_nmis = true;
+
+	/* events by vector need exits on interrupts that acknowledge them */
+	if (USE_EVENT_VECTOR &&
+	    (!(vmx_pin_ctrl & PIN_BASED_EXT_INTR_MASK) ||
+	     !((read_msr(MSR_IA32_VMX_EXIT_CTLS + vmx_true_msr_offs) >> 32) &
+	       VM_EXIT_ACK_INTR_ON_EXIT)))
+		return -EIO;
+
+	/* require I/O and MSR bitmap as well as secondary controls support */
+	vmx_proc_ctrl = read_msr(MSR_IA32_VMX_PROCBASED_CTLS +
+				 vmx_true_msr_offs) >> 32;
+	if (!(vmx_proc_ctrl & CPU_BASED_USE_IO_BITMAPS) ||
+	    !(vmx_proc_ctrl & CPU_BASED_USE_MSR_BITMAPS) ||
+	    !(vmx_proc_ctrl & CPU_BASED_ACTIVATE_SECONDARY_CONTROLS))
+		return -EIO;
+
+	/* require APIC access, EPT and unrestricted guest mode support */
+	vmx_proc_ctrl2 = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32;
+	ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
+	if (!(vmx_proc_ctrl2 & SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES) ||
+	    !(vmx_proc_ctrl2 & SECONDARY_EXEC_ENABLE_EPT) ||
+	    (ept_cap & EPT_MANDATORY_FEATURES) != EPT_MANDATORY_FEATURES ||
+	    !(ept_cap & (EPT_INVEPT_SINGLE | EPT_INVEPT_GLOBAL)) ||
+	    !(vmx_proc_ctrl2 & SECONDARY_EXEC_UNRESTRICTED_GUEST))
+		return -EIO;
+
+	/* tag guest TLB entries with a per-cell VPID if possible */
+	if ((vmx_proc_ctrl2 & SECONDARY_EXEC_ENABLE_VPID) &&
+	    (ept_cap & VPID_INVVPID)) {
+		if (ept_cap & VPID_INVVPID_SINGLE)
+			invvpid_type = VMX_INVVPID_SINGLE;
+		else if (ept_cap & VPID_INVVPID_GLOBAL)
+			invvpid_type = VMX_INVVPID_GLOBAL;
+	}
+
+	/* only this cell's EPT needs to be flushed if supported */
+	invept_type = (ept_cap & EPT_INVEPT_SINGLE) ? VMX_INVEPT_SINGLE
+						     : VMX_INVEPT_GLOBAL;
+
+	if (ept_cap & EPT_2M_PAGES)
+		ept_huge_pages |= PAGE_MAP_HUGE_2M;
+	if (ept_cap & EPT_1G_PAGES)
+		ept_huge_pages |= PAGE_MAP_HUGE_1G;
+	if (ept_cap & EPT_AD_BITS)
+		ept_ad_bits = true;
+
+	/* Idling needs an MWAIT that wakes up on interrupts masked in the
+	 * host, and the HLT activity state for guests halting with IF=0. */
+	if (cpu_has_mwait &&
+	    (cpuid_ecx(5) & (X86_MWAIT_EXTENSIONS | X86_MWAIT_INT_BREAK)) ==
+	    (X86_MWAIT_EXTENSIONS | X86_MWAIT_INT_BREAK) &&
+	    (read_msr(MSR_IA32_VMX_MISC) & VMX_MISC_ACTIVITY_HLT))
+		hlt_idle_supported = true;
+
+	/* the global control and overflow MSRs came with version 2 */
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 0xa) {
+		cpuid(0xa, &eax, &ebx, &ecx, &edx);
+		if ((eax & 0xff) >= 2) {
+			pmu_counters = (eax >> 8) & 0xff;
+			if (pmu_counters > PMU_MAX_COUNTERS)
+				pmu_counters = PMU_MAX_COUNTERS;
+			pmu_fixed_counters = edx & 0x1f;
+			if (pmu_fixed_counters > PMU_MAX_FIXED_COUNTERS)
+				pmu_fixed_counters = PMU_MAX_FIXED_COUNTERS;
+		}
+	}
+	pmu_global_ctrl_mask = ((1UL << pmu_counters) - 1) |
+		(((1UL << pmu_fixed_counters) - 1) << 32);
+	if (pmu_counters > 0 &&
+	    ((read_msr(MSR_IA32_VMX_EXIT_CTLS + vmx_true_msr_offs) >> 32) &
+	     VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL) &&
+	    ((read_msr(MSR_IA32_VMX_ENTRY_CTLS + vmx_true_msr_offs) >> 32) &
+	     VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL))
+		pmu_passthrough = true;
+
+	return 0;
+}
+
+/* the counters and their controls, whether the CPU has them or not */
+static bool vmx_pmu_msr(u32 msr)
+{
+	return msr - MSR_IA32_PMC0 < PMU_MAX_COUNTERS ||
+		msr - MSR_IA32_PERFEVTSEL0 < PMU_MAX_COUNTERS ||
+		msr - MSR_IA32_A_PMC0 < PMU_MAX_COUNTERS ||
+		msr - MSR_CORE_PERF_FIXED_CTR0 < PMU_MAX_FIXED_COUNTERS ||
+		msr - MSR_CORE_PERF_FIXED_CTR_CTRL <=
+			MSR_CORE_PERF_GLOBAL_OVF_CTRL -
+			MSR_CORE_PERF_FIXED_CTR_CTRL;
+}
+
+static bool vmx_pmu_owned_by(struct jailhouse_cell_desc *config)
+{
+	return pmu_passthrough &&
+		config->flags & JAILHOUSE_CELL_PMU_PASSTHROUGH;
+}
+
+int vmx_init(void)
 {
+	unsigned int msr;
+	int err;
+
+	/* Note: We assume that all CPUs have the same VMX features. */
+	err = vmx_check_features();
+	if (err)
+		return err;
+
+	/* the counters are only accessible to cells owning them */
+	for (msr = 0; msr < MSR_IA32_A_PMC0 + PMU_MAX_COUNTERS; msr++)
+		if (vmx_pmu_msr(msr)) {
+			msr_bitmap[VMX_MSR_BITMAP_0000_READ][msr / 8] |=
+				1 << (msr % 8);
+			msr_bitmap[VMX_MSR_BITMAP_0000_WRITE][msr / 8] |=
+				1 << (msr % 8);
+		}
+
 	if (!using_x2apic)
-		return;
+		return 0;
 
 	/* allow direct x2APIC access except for ICR writes */
 	memset(&msr_bitmap[VMX_MSR_BITMAP_0000_READ][MSR_X2APIC_BASE/8], 0,
@@ -154,56 +345,282 @@ void vmx_init(void)
 	memset(&msr_bitmap[VMX_MSR_BITMAP_0000_WRITE][MSR_X2APIC_BASE/8], 0,
 	       (MSR_X2APIC_END - MSR_X2APIC_BASE + 1)/8);
 	msr_bitmap[VMX_MSR_BITMAP_0000_WRITE][MSR_X2APIC_ICR/8] = 0x01;
+
+	return 0;
+}
+
+static void vmx_read_cpuid(u32 leaf, u32 subleaf, struct cpuid_regs *regs)
+{
+	regs->eax = leaf;
+	regs->ecx = subleaf;
+	__cpuid(&regs->eax, &regs->ebx, &regs->ecx, &regs->edx);
+}
+
+/*
+ * Leaves that depend on the calling CPU or on guest state (such as 0x0d
+ * with its XCR0-dependent sizes) are not cached. The per-CPU bits of the
+ * cached ones are patched in by vmx_handle_cpuid.
+ */
+static void vmx_cell_init_cpuid(struct cell *cell,
+				struct jailhouse_cell_desc *config)
+{
+	struct cpuid_regs *basic = cell->vmx.cpuid.basic;
+	struct cpuid_regs *ext = cell->vmx.cpuid.ext;
+	unsigned int leaf, subleaf, n;
+
+	vmx_read_cpuid(0, 0, &basic[0]);
+	cell->vmx.cpuid.num_basic = basic[0].eax + 1;
+	if (cell->vmx.cpuid.num_basic > CPUID_CACHE_BASIC_LEAVES)
+		cell->vmx.cpuid.num_basic = CPUID_CACHE_BASIC_LEAVES;
+
+	for (leaf = 1; leaf < cell->vmx.cpuid.num_basic; leaf++)
+		if (CPUID_CACHED_BASIC_LEAVES & (1 << leaf))
+			vmx_read_cpuid(leaf, 0, &basic[leaf]);
+
+	for (n = 0; n < CPUID_CACHE_SUBLEAF_LEAVES; n++)
+		for (subleaf = 0; subleaf < CPUID_CACHE_SUBLEAVES; subleaf++)
+			vmx_read_cpuid(cpuid_subleaf_leaves[n], subleaf,
+				       &cell->vmx.cpuid.subleaf[n][subleaf]);
+
+	vmx_read_cpuid(0x80000000, 0, &ext[0]);
+	cell->vmx.cpuid.num_ext = 0;
+	if (ext[0].eax >= 0x80000000)
+		cell->vmx.cpuid.num_ext = ext[0].eax - 0x80000000 + 1;
+	if (cell->vmx.cpuid.num_ext > CPUID_CACHE_EXT_LEAVES)
+		cell->vmx.cpuid.num_ext = CPUID_CACHE_EXT_LEAVES;
+
+	for (leaf = 1; leaf < cell->vmx.cpuid.num_ext; leaf++)
+		vmx_read_cpuid(0x80000000 + leaf, 0, &ext[leaf]);
+
+	/* nested VMX is not supported */
+	basic[1].ecx &= ~X86_FEATURE_VMX;
+
+	/* only owners see the counters, and only those passed through */
+	if (vmx_pmu_owned_by(config)) {
+		basic[0xa].eax = (basic[0xa].eax & ~0xff00) |
+			(pmu_counters << 8);
+		basic[0xa].edx = (basic[0xa].edx & ~0x1f) | pmu_fixed_counters;
+	} else {
+		memset(&basic[0xa], 0, sizeof(basic[0xa]));
+	}
+}
+
+/* bitmap is VMX_MSR_BITMAP_0000_READ or VMX_MSR_BITMAP_0000_WRITE */
+static void vmx_msr_passthrough(struct cell *cell, u32 msr,
+				unsigned int bitmap)
+{
+	if (msr >= 0xc0000000) {
+		msr -= 0xc0000000;
+		bitmap++;
+	}
+	/* everything outside the two bitmap ranges always traps */
+	if (msr >= 0x2000)
+		return;
+
+	cell->vmx.msr_bitmap[bitmap][msr / 8] &= ~(1 << (msr % 8));
+}
+
+static void vmx_cell_init_msr_bitmap(struct cell *cell,
+				     struct jailhouse_cell_desc *config,
+				     struct jailhouse_msr_range *range)
+{
+	u8 *bitmap = &cell->vmx.msr_bitmap[0][0];
+	u8 *intercepts = &msr_bitmap[0][0];
+	unsigned int n, num;
+	u32 msr;
+
+	if (config->num_msr_ranges == 0) {
+		memcpy(cell->vmx.msr_bitmap, msr_bitmap,
+		       sizeof(cell->vmx.msr_bitmap));
+		return;
+	}
+
+	memset(cell->vmx.msr_bitmap, -1, sizeof(cell->vmx.msr_bitmap));
+
+	for (n = 0; n < config->num_msr_ranges; n++, range++) {
+		/* larger ranges cannot match more bitmap entries */
+		num = range->num < 0x2000 ? range->num : 0x2000;
+		for (msr = range->start; num > 0; msr++, num--) {
+			if (range->access_flags & JAILHOUSE_MSR_READ)
+				vmx_msr_passthrough(cell, msr,
+						    VMX_MSR_BITMAP_0000_READ);
+			if (range->access_flags & JAILHOUSE_MSR_WRITE)
+				vmx_msr_passthrough(cell, msr,
+						    VMX_MSR_BITMAP_0000_WRITE);
+		}
+	}
+
+	/* MSRs the hypervisor has to see always trap */
+	for (n = 0; n < sizeof(cell->vmx.msr_bitmap); n++)
+		bitmap[n] |= intercepts[n];
+}
+
+static void vmx_pmu_passthrough(struct cell *cell, u32 msr, unsigned int num)
+{
+	for (; num > 0; msr++, num--) {
+		vmx_msr_passthrough(cell, msr, VMX_MSR_BITMAP_0000_READ);
+		vmx_msr_passthrough(cell, msr, VMX_MSR_BITMAP_0000_WRITE);
+	}
+}
+
+static void vmx_cell_init_pmu_msrs(struct cell *cell)
+{
+	vmx_pmu_passthrough(cell, MSR_IA32_PMC0, pmu_counters);
+	vmx_pmu_passthrough(cell, MSR_IA32_PERFEVTSEL0, pmu_counters);
+	vmx_pmu_passthrough(cell, MSR_IA32_A_PMC0, pmu_counters);
+	vmx_pmu_passthrough(cell, MSR_CORE_PERF_FIXED_CTR0,
+			    pmu_fixed_counters);
+	vmx_pmu_passthrough(cell, MSR_CORE_PERF_FIXED_CTR_CTRL, 1);
+	vmx_pmu_passthrough(cell, MSR_CORE_PERF_GLOBAL_OVF_CTRL, 1);
+
+	/* writes of the global control trap, the VMCS loads it on entry */
+	vmx_msr_passthrough(cell, MSR_CORE_PERF_GLOBAL_STATUS,
+			    VMX_MSR_BITMAP_0000_READ);
+	vmx_msr_passthrough(cell, MSR_CORE_PERF_GLOBAL_CTRL,
+			    VMX_MSR_BITMAP_0000_READ);
+}
+
+static int vmx_map_memory_pages(struct cell *cell, unsigned long phys,
+				unsigned long size, unsigned long virt,
+				u64 access_flags, unsigned int huge_pages)
+{
+	u32 page_flags, table_flags;
+
+	page_flags = EPT_FLAG_WB_TYPE;
+	if (access_flags & JAILHOUSE_MEM_READ)
+		page_flags |= EPT_FLAG_READ;
+	if (access_flags & JAILHOUSE_MEM_WRITE)
+		page_flags |= EPT_FLAG_WRITE;
+	if (access_flags & JAILHOUSE_MEM_EXECUTE)
+		page_flags |= EPT_FLAG_EXECUTE;
+	table_flags = page_flags & ~EPT_FLAG_WB_TYPE;
+
+	return page_map_create(cell->vmx.ept, phys, size, virt, page_flags,
+			       table_flags, PAGE_DIR_LEVELS,
+			       huge_pages | EPT_MAP_FLAGS(cell));
+}
+
+static int vmx_map_memory(struct cell *cell, unsigned long phys,
+			  unsigned long size, unsigned long virt,
+			  u64 access_flags)
+{
+	return vmx_map_memory_pages(cell, phys, size, virt, access_flags,
+				    ept_huge_pages);
+}
+
+/* the info and console pages are left out if the cell uses their address */
+static bool vmx_cell_page_mappable(struct cell *cell, void *page,
+				   unsigned long addr)
+{
+	return page && !cell_mem_by_virt(cell, addr);
+}
+
+/* tears down what vmx_cell_init and vmx_map_memory_region built */
+static void vmx_cell_ept_destroy(struct cell *cell,
+				 struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	u32 n;
+
+	/* regions may only be partially mapped after a failed creation */
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		page_map_destroy(cell->vmx.ept, mem->virt_start, mem->size,
+				 PAGE_DIR_LEVELS,
+				 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell));
+	page_map_destroy(cell->vmx.ept, XAPIC_BASE, PAGE_SIZE, PAGE_DIR_LEVELS,
+			 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell));
+	if (vmx_cell_page_mappable(cell, cell->info,
+				   JAILHOUSE_CELL_INFO_ADDR))
+		page_map_destroy(cell->vmx.ept, JAILHOUSE_CELL_INFO_ADDR,
+				 PAGE_SIZE, PAGE_DIR_LEVELS,
+				 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell));
+	if (vmx_cell_page_mappable(cell, cell->console,
+				   JAILHOUSE_CELL_CONSOLE_ADDR))
+		page_map_destroy(cell->vmx.ept, JAILHOUSE_CELL_CONSOLE_ADDR,
+				 PAGE_SIZE, PAGE_DIR_LEVELS,
+				 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell));
+	if (cell->console)
+		page_map_destroy(cell_list->vmx.ept,
+				 page_map_hvirt2phys(cell->console), PAGE_SIZE,
+				 PAGE_DIR_LEVELS,
+				 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell_list));
+
+	page_free_node(cell->vmx.ept, 1, JAILHOUSE_POOL_USER_EPT);
+	cell->vmx.ept = NULL;
 }
 
+/* the memory regions are added separately via vmx_map_memory_region */
 int vmx_cell_init(struct cell *cell, struct jailhouse_cell_desc *config)
 {
-	struct jailhouse_memory *mem;
+	struct jailhouse_msr_range *msr_range;
 	u32 page_flags, table_flags;
 	u32 pio_bitmap_size, size;
+	unsigned long ring_phys;
 	u8 *pio_bitmap;
 	int n, err;
 
-	/* build root cell EPT */
-	cell->vmx.ept = page_alloc(&mem_pool, 1);
+	vmx_cell_init_cpuid(cell, config);
+
+	cell->vmx.ept = page_alloc_node(cell->numa_node, 1,
+					JAILHOUSE_POOL_USER_EPT);
 	if (!cell->vmx.ept)
 		return -ENOMEM;
 
-	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
-		config->cpu_set_size;
-
-	for (n = 0; n < config->num_memory_regions; n++, mem++) {
-		page_flags = EPT_FLAG_WB_TYPE;
-		if (mem->access_flags & JAILHOUSE_MEM_READ)
-			page_flags |= EPT_FLAG_READ;
-		if (mem->access_flags & JAILHOUSE_MEM_WRITE)
-			page_flags |= EPT_FLAG_WRITE;
-		if (mem->access_flags & JAILHOUSE_MEM_EXECUTE)
-			page_flags |= EPT_FLAG_EXECUTE;
-		table_flags = page_flags & ~EPT_FLAG_WB_TYPE;
-
-		err = page_map_create(cell->vmx.ept, mem->phys_start,
-				      mem->size, mem->virt_start, page_flags,
-				      table_flags, PAGE_DIR_LEVELS);
+	table_flags = EPT_FLAG_READ | EPT_FLAG_WRITE;
+	if (using_x2apic) {
+		page_flags = EPT_FLAG_READ | EPT_FLAG_WRITE | EPT_FLAG_WB_TYPE;
+		err = page_map_create(cell->vmx.ept,
+				      page_map_hvirt2phys(apic_access_page),
+				      PAGE_SIZE, XAPIC_BASE, page_flags,
+				      table_flags, PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE | EPT_MAP_FLAGS(cell));
+	} else {
+		/* Let reads go directly to the physical APIC, writes trap
+		 * as EPT violations. The memory type is uncacheable. */
+		page_flags = EPT_FLAG_READ;
+		err = page_map_create(cell->vmx.ept, XAPIC_BASE, PAGE_SIZE,
+				      XAPIC_BASE, page_flags, table_flags,
+				      PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE | EPT_MAP_FLAGS(cell));
+	}
+	if (err)
+		goto err_destroy_ept;
+
+	if (vmx_cell_page_mappable(cell, cell->info,
+				   JAILHOUSE_CELL_INFO_ADDR)) {
+		err = page_map_create(cell->vmx.ept,
+				      page_map_hvirt2phys(cell->info),
+				      PAGE_SIZE, JAILHOUSE_CELL_INFO_ADDR,
+				      EPT_FLAG_READ | EPT_FLAG_WB_TYPE,
+				      EPT_FLAG_READ | EPT_FLAG_WRITE,
+				      PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE | EPT_MAP_FLAGS(cell));
 		if (err)
-			/* FIXME: release vmx.ept */
-			return err;
+			goto err_destroy_ept;
 	}
 
-	page_flags = EPT_FLAG_READ | EPT_FLAG_WRITE | EPT_FLAG_WB_TYPE;
-	table_flags = EPT_FLAG_READ | EPT_FLAG_WRITE;
-	err = page_map_create(cell->vmx.ept,
-			      page_map_hvirt2phys(apic_access_page),
-			      PAGE_SIZE, XAPIC_BASE, page_flags, table_flags,
-			      PAGE_DIR_LEVELS);
-	if (err)
-		/* FIXME: release vmx.ept */
-		return err;
+	if (vmx_cell_page_mappable(cell, cell->console,
+				   JAILHOUSE_CELL_CONSOLE_ADDR)) {
+		err = page_map_create(cell->vmx.ept,
+				      page_map_hvirt2phys(cell->console),
+				      PAGE_SIZE, JAILHOUSE_CELL_CONSOLE_ADDR,
+				      EPT_FLAG_READ | EPT_FLAG_WRITE |
+				      EPT_FLAG_WB_TYPE,
+				      EPT_FLAG_READ | EPT_FLAG_WRITE,
+				      PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE | EPT_MAP_FLAGS(cell));
+		if (err)
+			goto err_destroy_ept;
+	}
 
-	pio_bitmap = (void *)mem +
-		config->num_irq_lines * sizeof(struct jailhouse_irq_line);
+	pio_bitmap = jailhouse_cell_pio_bitmap(config);
 	pio_bitmap_size = config->pio_bitmap_size;
 
+	msr_range = jailhouse_cell_msr_ranges(config);
+	vmx_cell_init_msr_bitmap(cell, config, msr_range);
+	if (vmx_pmu_owned_by(config))
+		vmx_cell_init_pmu_msrs(cell);
+
 	memset(cell->vmx.io_bitmap, -1, sizeof(cell->vmx.io_bitmap));
 
 	for (n = 0; n < 2; n++) {
@@ -214,6 +631,58 @@ int vmx_cell_init(struct cell *cell, struct jailhouse_cell_desc *config)
 		pio_bitmap_size -= size;
 	}
 
+	/* the root cell drains the console, like the trace rings */
+	if (cell->console) {
+		ring_phys = page_map_hvirt2phys(cell->console);
+		err = page_map_create(cell_list->vmx.ept, ring_phys,
+				      PAGE_SIZE, ring_phys,
+				      EPT_FLAG_READ | EPT_FLAG_WB_TYPE,
+				      EPT_FLAG_READ | EPT_FLAG_WRITE,
+				      PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE |
+				      EPT_MAP_FLAGS(cell_list));
+		if (err)
+			goto err_destroy_ept;
+	}
+
+	return 0;
+
+err_destroy_ept:
+	vmx_cell_ept_destroy(cell, config);
+	return err;
+}
+
+int vmx_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem)
+{
+	return vmx_map_memory(cell, mem->phys_start, mem->size,
+			      mem->virt_start, mem->access_flags);
+}
+
+int vmx_map_trace_rings(struct cell *cell)
+{
+	unsigned long ring_phys;
+	unsigned int cpu;
+	int err;
+
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++) {
+		ring_phys = page_map_hvirt2phys(per_cpu(cpu)->trace_ring);
+		err = page_map_create(cell->vmx.ept, ring_phys,
+				      PERCPU_TRACE_RING_SIZE, ring_phys,
+				      EPT_FLAG_READ | EPT_FLAG_WB_TYPE,
+				      EPT_FLAG_READ | EPT_FLAG_WRITE,
+				      PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE | EPT_MAP_FLAGS(cell));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int vmx_root_cell_unmap(const struct jailhouse_memory *part)
+{
+	page_map_destroy(cell_list->vmx.ept, part->virt_start, part->size,
+			 PAGE_DIR_LEVELS,
+			 PAGE_MAP_COHERENT | EPT_MAP_FLAGS(cell_list));
 	return 0;
 }
 
@@ -227,12 +696,13 @@ void vmx_cell_shrink(struct cell *cell, struct jailhouse_cell_desc *config)
 	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
 		config->cpu_set_size;
 
-	for (n = 0; n < config->num_memory_regions; n++, mem++)
-		/* FIXME: phys_start only works for the Linux cell. We need
-		 * the original memory region, match phys_start and use
-		 * virt_start from there. */
-		page_map_destroy(cell->vmx.ept, mem->phys_start, mem->size,
-				 PAGE_DIR_LEVELS);
+	/* unmapped at the root cell's addresses of the regions */
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		/* communication regions remain shared with the donor */
+		if (mem->access_flags & JAILHOUSE_MEM_COMM_REGION)
+			continue;
+		root_cell_remap(mem, vmx_root_cell_unmap);
+	}
 
 	pio_bitmap = (void *)mem +
 		config->num_irq_lines * sizeof(struct jailhouse_irq_line);
@@ -245,29 +715,301 @@ void vmx_cell_shrink(struct cell *cell, struct jailhouse_cell_desc *config)
 	vmx_invept();
 }
 
+static unsigned long dirty_log_index_pages(struct jailhouse_cell_desc *config)
+{
+	return PAGE_ALIGN(config->num_memory_regions *
+			  sizeof(unsigned long *)) / PAGE_SIZE;
+}
+
+/* one bit per page of the region */
+static unsigned long dirty_log_pages(const struct jailhouse_memory *mem)
+{
+	return PAGE_ALIGN((mem->size / PAGE_SIZE + 7) / 8) / PAGE_SIZE;
+}
+
+static void vmx_dirty_log_free(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	u32 n;
+
+	if (!cell->vmx.dirty_log)
+		return;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		page_free_node(cell->vmx.dirty_log[n], dirty_log_pages(mem),
+			       JAILHOUSE_POOL_USER_CELL);
+	page_free_node(cell->vmx.dirty_log, dirty_log_index_pages(config),
+		       JAILHOUSE_POOL_USER_CELL);
+	cell->vmx.dirty_log = NULL;
+}
+
+static int vmx_root_cell_map(const struct jailhouse_memory *part)
+{
+	return vmx_map_memory(cell_list, part->phys_start, part->size,
+			      part->virt_start, part->access_flags);
+}
+
+void vmx_cell_exit(struct cell *cell)
+{
+	struct jailhouse_cell_desc *root_config = cell_list->config;
+	struct jailhouse_cell_desc *config = cell->config;
+	u8 *root_io_bitmap = cell_list->vmx.io_bitmap;
+	u8 *pio_bitmap, *root_pio_bitmap, root_bits;
+	struct jailhouse_memory *mem;
+	u32 pio_bitmap_size, n;
+
+	vmx_cell_ept_destroy(cell, config);
+	vmx_dirty_log_free(cell);
+
+	mem = jailhouse_cell_mem_regions(config);
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		/* regions still shared with other cells stay with them */
+		if (mem->access_flags & JAILHOUSE_MEM_COMM_REGION ||
+		    non_root_cell_uses_memory(mem))
+			continue;
+		if (root_cell_remap(mem, vmx_root_cell_map))
+			printk("WARNING: Failed to return memory %p to root "
+			       "cell\n", mem->phys_start);
+	}
+
+	/* ports the cell owned fall back to the root cell's configuration */
+	pio_bitmap = (void *)mem +
+		config->num_irq_lines * sizeof(struct jailhouse_irq_line);
+	pio_bitmap_size = config->pio_bitmap_size;
+
+	root_pio_bitmap = (void *)root_config +
+		sizeof(struct jailhouse_cell_desc) +
+		root_config->cpu_set_size +
+		root_config->num_memory_regions *
+		sizeof(struct jailhouse_memory) +
+		root_config->num_irq_lines * sizeof(struct jailhouse_irq_line);
+
+	for (n = 0; n < pio_bitmap_size; n++) {
+		root_bits = n < root_config->pio_bitmap_size ?
+			root_pio_bitmap[n] : 0xff;
+		root_io_bitmap[n] = (root_io_bitmap[n] & pio_bitmap[n]) |
+			(root_bits & ~pio_bitmap[n]);
+	}
+
+	vmx_invept();
+}
+
+/* the first memory region of a cell holds its image */
+int vmx_cell_set_loadable(struct cell *cell)
+{
+	struct jailhouse_memory *ram = (void *)cell->config +
+		sizeof(struct jailhouse_cell_desc) +
+		cell->config->cpu_set_size;
+
+	return root_cell_remap(ram, vmx_root_cell_map);
+}
+
+void vmx_cell_clear_loadable(struct cell *cell)
+{
+	struct jailhouse_memory *ram = (void *)cell->config +
+		sizeof(struct jailhouse_cell_desc) +
+		cell->config->cpu_set_size;
+
+	root_cell_remap(ram, vmx_root_cell_unmap);
+	vmx_invept();
+}
+
+/* Tables split for logging are kept, the regions stay mapped with 4K pages
+ * where they were. */
+static int vmx_dirty_log_stop(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	int err, result = 0;
+	u32 n;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		if (!cell->vmx.dirty_log[n])
+			continue;
+		err = vmx_map_memory(cell, mem->phys_start, mem->size,
+				     mem->virt_start, mem->access_flags);
+		if (err)
+			result = err;
+	}
+
+	vmx_dirty_log_free(cell);
+	return result;
+}
+
+/*
+ * With dirty bits, the regions are remapped with 4K leaves that start out
+ * clean. Without them, the regions become read-only so that the first write
+ * to each page faults, see vmx_handle_dirty_fault. Lazily filled EPTs are
+ * completed either way, their faults would not be logged. An EPT shared with
+ * VT-d is refused, DMA writes would hit the write protection as well.
+ */
+static int vmx_dirty_log_start(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	int err;
+	u32 n;
+
+	if (cell->vmx.dirty_log || vtd_cell_shares_ept(cell))
+		return -EBUSY;
+
+	cell->vmx.dirty_log = page_alloc_node(cell->numa_node,
+					      dirty_log_index_pages(config),
+					      JAILHOUSE_POOL_USER_CELL);
+	if (!cell->vmx.dirty_log)
+		return -ENOMEM;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		if (!(mem->access_flags & JAILHOUSE_MEM_WRITE))
+			continue;
+
+		cell->vmx.dirty_log[n] = page_alloc_node(cell->numa_node,
+							 dirty_log_pages(mem),
+							 JAILHOUSE_POOL_USER_CELL);
+		if (!cell->vmx.dirty_log[n]) {
+			err = -ENOMEM;
+			goto err_stop;
+		}
+
+		if (ept_ad_bits)
+			err = vmx_map_memory_pages(cell, mem->phys_start,
+						   mem->size, mem->virt_start,
+						   mem->access_flags,
+						   PAGE_MAP_NO_HUGE);
+		else
+			err = vmx_map_memory(cell, mem->phys_start, mem->size,
+					     mem->virt_start,
+					     mem->access_flags &
+					     ~JAILHOUSE_MEM_WRITE);
+		if (err)
+			goto err_stop;
+	}
+
+	return 0;
+
+err_stop:
+	vmx_dirty_log_stop(cell);
+	return err;
+}
+
+/* write-protects the pages set in word again, in runs of adjacent pages */
+static int vmx_dirty_log_protect(struct cell *cell,
+				 const struct jailhouse_memory *mem,
+				 unsigned long first_page, unsigned long word)
+{
+	unsigned int bit, end;
+	unsigned long offs;
+	int err;
+
+	for (bit = 0; bit < BITS_PER_LONG; bit = end) {
+		end = bit + 1;
+		if (!(word & (1UL << bit)))
+			continue;
+		while (end < BITS_PER_LONG && word & (1UL << end))
+			end++;
+
+		offs = (first_page + bit) * PAGE_SIZE;
+		err = vmx_map_memory(cell, mem->phys_start + offs,
+				     (end - bit) * PAGE_SIZE,
+				     mem->virt_start + offs,
+				     mem->access_flags & ~JAILHOUSE_MEM_WRITE);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int vmx_dirty_log_fetch(struct cell *cell,
+			       struct jailhouse_dirty_log *log, u64 *bitmap)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_memory *mem;
+	unsigned long *dirty;
+	unsigned long n, mask, word;
+	int err;
+
+	if (!cell->vmx.dirty_log || log->region >= config->num_memory_regions ||
+	    !cell->vmx.dirty_log[log->region] ||
+	    log->start_page % BITS_PER_LONG)
+		return -EINVAL;
+
+	mem = jailhouse_cell_mem_regions(config) + log->region;
+	log->region_pages = mem->size / PAGE_SIZE;
+	if (log->start_page >= log->region_pages) {
+		log->num_pages = 0;
+		return 0;
+	}
+	if (log->num_pages > log->region_pages - log->start_page)
+		log->num_pages = log->region_pages - log->start_page;
+
+	dirty = cell->vmx.dirty_log[log->region] +
+		log->start_page / BITS_PER_LONG;
+
+	/* the CPUs of the cell are held, their TLBs are flushed on resume */
+	if (ept_ad_bits)
+		page_map_test_and_clear(cell->vmx.ept,
+					mem->virt_start +
+					log->start_page * PAGE_SIZE,
+					log->num_pages * PAGE_SIZE,
+					PAGE_DIR_LEVELS, EPT_FLAG_DIRTY,
+					dirty);
+
+	for (n = 0; n < log->num_pages; n += BITS_PER_LONG) {
+		mask = log->num_pages - n < BITS_PER_LONG ?
+			(1UL << (log->num_pages - n)) - 1 : ~0UL;
+		word = dirty[n / BITS_PER_LONG] & mask;
+		dirty[n / BITS_PER_LONG] &= ~mask;
+		bitmap[n / BITS_PER_LONG] = word;
+
+		if (!ept_ad_bits && word) {
+			err = vmx_dirty_log_protect(cell, mem,
+						    log->start_page + n,
+						    word);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/* the CPUs of the cell are suspended or stopped */
+int vmx_cell_dirty_log(struct cell *cell, struct jailhouse_dirty_log *log,
+		       u64 *bitmap)
+{
+	switch (log->cmd) {
+	case JAILHOUSE_DIRTY_LOG_START:
+		return vmx_dirty_log_start(cell);
+	case JAILHOUSE_DIRTY_LOG_STOP:
+		if (!cell->vmx.dirty_log)
+			return -EINVAL;
+		return vmx_dirty_log_stop(cell);
+	case JAILHOUSE_DIRTY_LOG_FETCH:
+		return vmx_dirty_log_fetch(cell, log, bitmap);
+	default:
+		return -EINVAL;
+	}
+}
+
 void vmx_invept(void)
 {
-	unsigned long ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
 	struct {
 		u64 eptp;
 		u64 reserved;
 	} descriptor;
-	u64 type;
 	u8 ok;
 
 	descriptor.reserved = 0;
-	if (ept_cap & EPT_INVEPT_SINGLE) {
-		type = VMX_INVEPT_SINGLE;
+	if (invept_type == VMX_INVEPT_SINGLE)
 		descriptor.eptp = vmcs_read64(EPT_POINTER);
-	} else {
-		type = VMX_INVEPT_GLOBAL;
+	else
 		descriptor.eptp = 0;
-	}
 	asm volatile(
 		"invept (%1),%2\n\t"
 		"seta %0\n\t"
 		: "=qm" (ok)
-		: "r" (&descriptor), "r" (type)
+		: "r" (&descriptor), "r" (invept_type)
 		: "memory", "cc");
 
 	if (!ok) {
@@ -277,10 +1019,34 @@ void vmx_invept(void)
 	}
 }
 
-static bool vmx_set_guest_cr(int cr, unsigned long val)
+void vmx_invvpid(u16 vpid)
 {
-	unsigned long fixed0, fixed1, required1;
-	bool ok = true;
+	struct {
+		u64 vpid;
+		u64 linear_addr;
+	} descriptor;
+	u8 ok;
+
+	descriptor.vpid = vpid;
+	descriptor.linear_addr = 0;
+	asm volatile(
+		"invvpid (%1),%2\n\t"
+		"seta %0\n\t"
+		: "=qm" (ok)
+		: "r" (&descriptor), "r" (invvpid_type)
+		: "memory", "cc");
+
+	if (!ok) {
+		panic_printk("FATAL: invvpid failed, error %d\n",
+			     vmcs_read32(VM_INSTRUCTION_ERROR));
+		panic_stop(NULL);
+	}
+}
+
+static bool vmx_set_guest_cr(int cr, unsigned long val)
+{
+	unsigned long fixed0, fixed1, required1;
+	bool ok = true;
 
 	fixed0 = read_msr(cr ? MSR_IA32_VMX_CR4_FIXED0
 			     : MSR_IA32_VMX_CR0_FIXED0);
@@ -304,8 +1070,92 @@ static bool vmx_set_guest_cr(int cr, unsigned long val)
 	return ok;
 }
 
-static bool vmx_set_cell_config(struct cell *cell)
+/* the CPU only maintains dirty bits while the writes of a cell are logged */
+static u64 vmx_eptp(struct cell *cell)
 {
+	u64 eptp = page_map_hvirt2phys(cell->vmx.ept) | EPT_TYPE_WRITEBACK |
+		EPT_PAGE_WALK_LEN;
+
+	if (ept_ad_bits && cell->vmx.dirty_log)
+		eptp |= EPT_AD_ENABLE;
+	return eptp;
+}
+
+/* flushes what the previous EPT pointer may have cached, then switches */
+void vmx_reload_ept(struct cell *cell)
+{
+	vmx_invept();
+	vmcs_write64(EPT_POINTER, vmx_eptp(cell));
+}
+
+/* stops all counters and clears what they leave behind */
+static void vmx_pmu_reset(void)
+{
+	unsigned int n;
+
+	write_msr(MSR_CORE_PERF_GLOBAL_CTRL, 0);
+	write_msr(MSR_CORE_PERF_FIXED_CTR_CTRL, 0);
+	for (n = 0; n < pmu_counters; n++) {
+		write_msr(MSR_IA32_PERFEVTSEL0 + n, 0);
+		write_msr(MSR_IA32_PMC0 + n, 0);
+	}
+	for (n = 0; n < pmu_fixed_counters; n++)
+		write_msr(MSR_CORE_PERF_FIXED_CTR0 + n, 0);
+	write_msr(MSR_CORE_PERF_GLOBAL_OVF_CTRL,
+		  read_msr(MSR_CORE_PERF_GLOBAL_STATUS) &
+		  pmu_global_ctrl_mask);
+}
+
+/*
+ * Owning cells run with their IA32_PERF_GLOBAL_CTRL, the hypervisor with
+ * all counters stopped. Whenever an owner is involved, the CPU changes
+ * hands with a clean PMU. Only Linux keeps what it programmed before if the
+ * root cell owns the counters. The profiler leaves owned CPUs alone.
+ */
+static bool vmx_pmu_set_cell_config(struct per_cpu *cpu_data)
+{
+	bool owned = vmx_pmu_owned_by(cpu_data->cell->config);
+	u64 guest_ctrl = 0;
+	u32 entry_ctrl, exit_ctrl;
+	bool ok = true;
+
+	if (pmu_counters == 0)
+		return true;
+
+	if (cpu_data->vmx_state != VMCS_READY) {
+		if (owned)
+			guest_ctrl = read_msr(MSR_CORE_PERF_GLOBAL_CTRL) &
+				pmu_global_ctrl_mask;
+		else
+			vmx_pmu_reset();
+	} else if (owned || cpu_data->pmu_owned) {
+		profile_cpu_exit(cpu_data);
+		vmx_pmu_reset();
+	}
+	cpu_data->pmu_owned = owned;
+	/* sampling resumes on CPUs that come back from an owner */
+	profile_cpu_update(cpu_data);
+
+	entry_ctrl = vmcs_read32(VM_ENTRY_CONTROLS) &
+		~VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL;
+	exit_ctrl = vmcs_read32(VM_EXIT_CONTROLS) &
+		~VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL;
+	if (owned) {
+		entry_ctrl |= VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL;
+		exit_ctrl |= VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL;
+		ok &= vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL, guest_ctrl);
+		ok &= vmcs_write64(HOST_IA32_PERF_GLOBAL_CTRL, 0);
+	}
+	ok &= vmcs_write32(VM_ENTRY_CONTROLS, entry_ctrl);
+	ok &= vmcs_write32(VM_EXIT_CONTROLS, exit_ctrl);
+
+	return ok;
+}
+
+static bool vmx_set_cell_config(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+	u32 proc_ctrl;
 	u8 *io_bitmap;
 	bool ok = true;
 
@@ -314,9 +1164,28 @@ static bool vmx_set_cell_config(struct cell *cell)
 	ok &= vmcs_write64(IO_BITMAP_B,
 			   page_map_hvirt2phys(io_bitmap + PAGE_SIZE));
 
-	ok &= vmcs_write64(EPT_POINTER,
-			   page_map_hvirt2phys(cell->vmx.ept) |
-			   EPT_TYPE_WRITEBACK | EPT_PAGE_WALK_LEN);
+	ok &= vmcs_write64(MSR_BITMAP,
+			   page_map_hvirt2phys(cell->vmx.msr_bitmap));
+
+	ok &= vmcs_write64(EPT_POINTER, vmx_eptp(cell));
+
+	/* VPID 0 is reserved for the host. The CPU may have run a different
+	 * guest context under this VPID before, start from a clean state. */
+	if (invvpid_type) {
+		ok &= vmcs_write16(VIRTUAL_PROCESSOR_ID, cell->id + 1);
+		vmx_invvpid(cell->id + 1);
+	}
+
+	proc_ctrl = cpu_data->proc_based_ctrl;
+	if (hlt_idle_supported &&
+	    cell->config->flags & JAILHOUSE_CELL_HLT_EXITING)
+		proc_ctrl |= CPU_BASED_HLT_EXITING;
+	else
+		proc_ctrl &= ~CPU_BASED_HLT_EXITING;
+	cpu_data->proc_based_ctrl = proc_ctrl;
+	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, proc_ctrl);
+
+	ok &= vmx_pmu_set_cell_config(cpu_data);
 
 	return ok;
 }
@@ -428,13 +1297,17 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 
 	ok &= vmcs_write64(GUEST_IA32_EFER, cpu_data->linux_efer);
 
-	// TODO: switch PAT, PERF */
+	// TODO: switch PAT */
 
 	ok &= vmcs_write64(VMCS_LINK_POINTER, -1UL);
 	ok &= vmcs_write32(VM_ENTRY_INTR_INFO_FIELD, 0);
 
 	val = read_msr(MSR_IA32_VMX_PINBASED_CTLS + vmx_true_msr_offs);
-	val |= PIN_BASED_NMI_EXITING;
+	val |= USE_EVENT_VECTOR ? PIN_BASED_EXT_INTR_MASK :
+		PIN_BASED_NMI_EXITING;
+	if (virtual_nmis)
+		val |= PIN_BASED_VIRTUAL_NMIS;
+	cpu_data->pin_based_ctrl = val;
 	ok &= vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, val);
 
 	ok &= vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
@@ -442,25 +1315,27 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS + vmx_true_msr_offs);
 	val |= CPU_BASED_USE_IO_BITMAPS | CPU_BASED_USE_MSR_BITMAPS |
 		CPU_BASED_ACTIVATE_SECONDARY_CONTROLS;
+	cpu_data->proc_based_ctrl = val;
 	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, val);
 
-	ok &= vmcs_write64(MSR_BITMAP, page_map_hvirt2phys(msr_bitmap));
 
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2);
 	val |= SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES |
 		SECONDARY_EXEC_ENABLE_EPT | SECONDARY_EXEC_UNRESTRICTED_GUEST;
+	if (invvpid_type)
+		val |= SECONDARY_EXEC_ENABLE_VPID;
 	ok &= vmcs_write32(SECONDARY_VM_EXEC_CONTROL, val);
 
 	ok &= vmcs_write64(APIC_ACCESS_ADDR,
 			   page_map_hvirt2phys(apic_access_page));
 
-	ok &= vmx_set_cell_config(cpu_data->cell);
-
 	ok &= vmcs_write32(EXCEPTION_BITMAP, 0);
 
 	val = read_msr(MSR_IA32_VMX_EXIT_CTLS + vmx_true_msr_offs);
 	val |= VM_EXIT_HOST_ADDR_SPACE_SIZE | VM_EXIT_SAVE_IA32_EFER |
 		VM_EXIT_LOAD_IA32_EFER;
+	if (USE_EVENT_VECTOR)
+		val |= VM_EXIT_ACK_INTR_ON_EXIT;
 	ok &= vmcs_write32(VM_EXIT_CONTROLS, val);
 
 	ok &= vmcs_write32(VM_EXIT_MSR_STORE_COUNT, 0);
@@ -471,6 +1346,9 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 	val |= VM_ENTRY_IA32E_MODE | VM_ENTRY_LOAD_IA32_EFER;
 	ok &= vmcs_write32(VM_ENTRY_CONTROLS, val);
 
+	/* adjusts the entry and exit controls written above */
+	ok &= vmx_set_cell_config(cpu_data);
+
 	ok &= vmcs_write64(CR4_GUEST_HOST_MASK, 0);
 
 	ok &= vmcs_write32(CR3_TARGET_COUNT, 0);
@@ -480,57 +1358,18 @@ static bool vmcs_setup(struct per_cpu *cpu_data)
 
 int vmx_cpu_init(struct per_cpu *cpu_data)
 {
-	unsigned long vmx_proc_ctrl, vmx_proc_ctrl2, ept_cap;
-	unsigned long vmx_pin_ctrl, feature_ctrl, mask;
+	unsigned long feature_ctrl, mask;
 	unsigned long vmx_basic;
 	unsigned long cr4;
 	u32 revision_id;
 
-	if (!(cpuid_ecx(1) & X86_FEATURE_VMX))
-		return -ENODEV;
-
 	cr4 = read_cr4();
 	if (cr4 & X86_CR4_VMXE)
 		return -EBUSY;
 
-	vmx_basic = read_msr(MSR_IA32_VMX_BASIC);
-
-	/* require VMCS size <= PAGE_SIZE */
-	if (((vmx_basic >> 32) & 0x1fff) > PAGE_SIZE)
-		return -EIO;
-
-	/* require VMCS memory access type == write back */
-	if (((vmx_basic >> 50) & 0xf) != 6)
-		return -EIO;
-
-	if (vmx_basic & (1UL << 55))
-		vmx_true_msr_offs = MSR_IA32_VMX_TRUE_PINBASED_CTLS -
-			MSR_IA32_VMX_PINBASED_CTLS;
-
-	/* require NMI exiting and preemption timer support */
-	vmx_pin_ctrl = read_msr(MSR_IA32_VMX_PINBASED_CTLS +
-				vmx_true_msr_offs) >> 32;
-	if (!(vmx_pin_ctrl & PIN_BASED_NMI_EXITING) ||
-	    !(vmx_pin_ctrl & PIN_BASED_VMX_PREEMPTION_TIMER))
-		return -EIO;
-
-	/* require I/O and MSR bitmap as well as secondary controls support */
-	vmx_proc_ctrl = read_msr(MSR_IA32_VMX_PROCBASED_CTLS +
-				 vmx_true_msr_offs) >> 32;
-	if (!(vmx_proc_ctrl & CPU_BASED_USE_IO_BITMAPS) ||
-	    !(vmx_proc_ctrl & CPU_BASED_USE_MSR_BITMAPS) ||
-	    !(vmx_proc_ctrl & CPU_BASED_ACTIVATE_SECONDARY_CONTROLS))
-		return -EIO;
+	mmio_cache_flush(cpu_data);
 
-	/* require APIC access, EPT and unrestricted guest mode support */
-	vmx_proc_ctrl2 = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32;
-	ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
-	if (!(vmx_proc_ctrl2 & SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES) ||
-	    !(vmx_proc_ctrl2 & SECONDARY_EXEC_ENABLE_EPT) ||
-	    (ept_cap & EPT_MANDATORY_FEATURES) != EPT_MANDATORY_FEATURES ||
-	    !(ept_cap & (EPT_INVEPT_SINGLE | EPT_INVEPT_GLOBAL)) ||
-	    !(vmx_proc_ctrl2 & SECONDARY_EXEC_UNRESTRICTED_GUEST))
-		return -EIO;
+	vmx_basic = read_msr(MSR_IA32_VMX_BASIC);
 
 	revision_id = (u32)vmx_basic;
 	cpu_data->vmxon_region.revision_id = revision_id;
@@ -606,11 +1445,50 @@ void vmx_cpu_activate_vmm(struct per_cpu *cpu_data)
 	panic_stop(cpu_data);
 }
 
+/* highest vector acknowledged on exit but not yet injected, or -1 */
+static int vmx_pending_irq(struct per_cpu *cpu_data)
+{
+	int n;
+
+	for (n = 256 / BITS_PER_LONG - 1; n >= 0; n--)
+		if (cpu_data->pending_irqs[n])
+			return n * BITS_PER_LONG +
+				__fls(cpu_data->pending_irqs[n]);
+	return -1;
+}
+
+static void vmx_queue_irq(struct per_cpu *cpu_data, unsigned int vector)
+{
+	cpu_data->pending_irqs[vector / BITS_PER_LONG] |=
+		1UL << (vector % BITS_PER_LONG);
+}
+
+static void vmx_dequeue_irq(struct per_cpu *cpu_data, unsigned int vector)
+{
+	cpu_data->pending_irqs[vector / BITS_PER_LONG] &=
+		~(1UL << (vector % BITS_PER_LONG));
+}
+
+/*
+ * Linux takes over without injection, so hand queued interrupts back to the
+ * APIC. Each one arrived above everything in service before, thus the
+ * highest queued vector is always the highest one in service.
+ */
+static void vmx_return_pending_irqs(struct per_cpu *cpu_data)
+{
+	int vector;
+
+	while ((vector = vmx_pending_irq(cpu_data)) >= 0) {
+		vmx_dequeue_irq(cpu_data, vector);
+		apic_resend_irq(vector);
+	}
+}
+
 static void __attribute__((noreturn))
 vmx_cpu_deactivate_vmm(struct registers *guest_regs, struct per_cpu *cpu_data)
 {
 	unsigned long *stack = (unsigned long *)vmcs_read64(GUEST_RSP);
-	unsigned long linux_ip = vmcs_read64(GUEST_RIP);
+	unsigned long linux_ip = cpu_data->guest_rip;
 
 	cpu_data->linux_cr3 = vmcs_read64(GUEST_CR3);
 
@@ -631,6 +1509,13 @@ vmx_cpu_deactivate_vmm(struct registers *guest_regs, struct per_cpu *cpu_data)
 	cpu_data->linux_sysenter_eip = vmcs_read64(GUEST_SYSENTER_EIP);
 	cpu_data->linux_sysenter_esp = vmcs_read64(GUEST_SYSENTER_ESP);
 
+	/* the last exit stopped the counters Linux owns */
+	if (cpu_data->pmu_owned)
+		write_msr(MSR_CORE_PERF_GLOBAL_CTRL,
+			  vmcs_read64(GUEST_IA32_PERF_GLOBAL_CTRL));
+
+	vmx_return_pending_irqs(cpu_data);
+
 	arch_cpu_restore(cpu_data);
 
 	stack--;
@@ -666,6 +1551,8 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 	unsigned long val;
 	bool ok = true;
 
+	mmio_cache_flush(cpu_data);
+
 	ok &= vmx_set_guest_cr(0, X86_CR0_NW | X86_CR0_CD | X86_CR0_ET);
 	ok &= vmx_set_guest_cr(4, 0);
 
@@ -742,7 +1629,7 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 	val &= ~VM_ENTRY_IA32E_MODE;
 	ok &= vmcs_write32(VM_ENTRY_CONTROLS, val);
 
-	ok &= vmx_set_cell_config(cpu_data->cell);
+	ok &= vmx_set_cell_config(cpu_data);
 
 	memset(guest_regs, 0, sizeof(*guest_regs));
 
@@ -752,29 +1639,407 @@ static void vmx_cpu_reset(struct registers *guest_regs,
 	}
 }
 
-void vmx_schedule_vmexit(struct per_cpu *cpu_data)
+/* what the guest reads, bits it may change freely come from the VMCS */
+static unsigned long vmx_get_guest_cr(int cr)
+{
+	unsigned long mask = vmcs_read64(cr ? CR4_GUEST_HOST_MASK :
+					 CR0_GUEST_HOST_MASK);
+
+	return (vmcs_read64(cr ? GUEST_CR4 : GUEST_CR0) & ~mask) |
+		(vmcs_read64(cr ? CR4_READ_SHADOW : CR0_READ_SHADOW) & mask);
+}
+
+static void vmx_cpu_save_state(struct registers *guest_regs,
+			       struct per_cpu *cpu_data)
 {
-	u32 pin_based_ctrl;
+	struct jailhouse_cpu_state *state = &cpu_data->cpu_state;
+	struct jailhouse_segment *seg;
+	unsigned int n;
+
+	state->flags = JAILHOUSE_CPU_STATE_VALID;
+	state->activity_state = vmcs_read32(GUEST_ACTIVITY_STATE);
+	state->interruptibility = vmcs_read32(GUEST_INTERRUPTIBILITY_INFO);
+
+	for (n = 0; n < 16; n++)
+		state->gpr[n] = ((unsigned long *)guest_regs)[15 - n];
+	state->gpr[4] = vmcs_read64(GUEST_RSP);
+	state->rip = cpu_data->guest_rip;
+	state->rflags = vmcs_read64(GUEST_RFLAGS);
+
+	state->cr0 = vmx_get_guest_cr(0);
+	state->cr3 = vmcs_read64(GUEST_CR3);
+	state->cr4 = vmx_get_guest_cr(4) & ~X86_CR4_VMXE;
+	state->efer = vmcs_read64(GUEST_IA32_EFER);
+	state->dr7 = vmcs_read64(GUEST_DR7);
+
+	state->gdtr_base = vmcs_read64(GUEST_GDTR_BASE);
+	state->gdtr_limit = vmcs_read32(GUEST_GDTR_LIMIT);
+	state->idtr_base = vmcs_read64(GUEST_IDTR_BASE);
+	state->idtr_limit = vmcs_read32(GUEST_IDTR_LIMIT);
+
+	/* the fields of all segments are laid out in the same order */
+	for (n = 0, seg = state->segment; n < JAILHOUSE_NUM_SEGS; n++, seg++) {
+		seg->selector = vmcs_read16(GUEST_ES_SELECTOR + n * 2);
+		seg->base = vmcs_read64(GUEST_ES_BASE + n * 2);
+		seg->limit = vmcs_read32(GUEST_ES_LIMIT + n * 2);
+		seg->access_rights = vmcs_read32(GUEST_ES_AR_BYTES + n * 2);
+	}
+
+	state->sysenter_cs = vmcs_read32(GUEST_SYSENTER_CS);
+	state->sysenter_esp = vmcs_read64(GUEST_SYSENTER_ESP);
+	state->sysenter_eip = vmcs_read64(GUEST_SYSENTER_EIP);
+
+	/* not switched on VM exits, still hold the guest's values */
+	state->pat = read_msr(MSR_IA32_PAT);
+	state->star = read_msr(MSR_STAR);
+	state->lstar = read_msr(MSR_LSTAR);
+	state->cstar = read_msr(MSR_CSTAR);
+	state->sfmask = read_msr(MSR_SFMASK);
+	state->kernel_gs_base = read_msr(MSR_KERNGS_BASE);
+}
+
+static bool vmx_canonical(u64 addr)
+{
+	return (long)(addr << 16) >> 16 == (long)addr;
+}
 
-	if (!cpu_data->vmx_state == VMCS_READY)
+/* bits at and above MAXPHYADDR */
+static u64 vmx_phys_addr_reserved(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
+	return ~0ULL << (eax & 0xff);
+}
+
+/*
+ * A usable segment needs its present bit, no reserved access rights bits and
+ * a granularity that matches its limit. Code and data segments are no system
+ * segments, LDTR and TR are.
+ */
+static bool vmx_segment_valid(const struct jailhouse_segment *seg,
+			      bool system)
+{
+	u32 ar = seg->access_rights;
+
+	if (ar & 0x10000)
+		return true;
+	if (ar & 0xfffe0f00 || !(ar & 0x80) || !!(ar & 0x10) == system)
+		return false;
+	if ((seg->limit & 0xfff) != 0xfff && ar & 0x8000)
+		return false;
+	if (seg->limit & 0xfff00000 && !(ar & 0x8000))
+		return false;
+	return true;
+}
+
+/*
+ * Reads the four PDPTEs that PAE paging outside of IA-32e mode loads from
+ * CR3 through the EPT of the cell and checks their reserved bits. Like on
+ * real hardware, they are taken when the state is set, later changes to
+ * the table do not matter.
+ */
+static bool vmx_get_pdptes(struct per_cpu *cpu_data, struct cell *cell,
+			   unsigned long cr3, u64 *pdpte)
+{
+	u64 reserved = vmx_phys_addr_reserved() | 0x1e6;
+	u64 *table;
+	unsigned int n;
+
+	table = page_map_get_foreign_page(cpu_data->cpu_id,
+					  page_map_hvirt2phys(cell->vmx.ept),
+					  0, cr3, PAGE_READONLY_FLAGS);
+	if (!table)
+		return false;
+
+	table = (void *)table + (cr3 & PAGE_OFFS_MASK & ~0x1fUL);
+	for (n = 0; n < 4; n++) {
+		pdpte[n] = table[n];
+		if (pdpte[n] & 1 && pdpte[n] & reserved)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Applies the guest-state checks of VM entry (SDM 26.3.1) and those of the
+ * MSR writes in vmx_cpu_restore_state to a state for a CPU of cell, so that
+ * restoring it cannot fail. Virtual-8086 mode is not supported, STAR holds
+ * selectors and takes any value. The PDPTEs of PAE paging are returned in
+ * pdpte, the page table has to be mapped in the cell already.
+ */
+bool vmx_cpu_state_valid(struct per_cpu *cpu_data, struct cell *cell,
+			 const struct jailhouse_cpu_state *state, u64 *pdpte)
+{
+	const struct jailhouse_segment *cs = &state->segment[JAILHOUSE_SEG_CS];
+	const struct jailhouse_segment *ss = &state->segment[JAILHOUSE_SEG_SS];
+	const struct jailhouse_segment *tr = &state->segment[JAILHOUSE_SEG_TR];
+	const struct jailhouse_segment *ldtr =
+		&state->segment[JAILHOUSE_SEG_LDTR];
+	bool long_mode = state->efer & EFER_LMA;
+	u32 intr = state->interruptibility;
+	unsigned int n;
+	u8 type;
+
+	memset(pdpte, 0, 4 * sizeof(*pdpte));
+
+	if (state->activity_state != GUEST_ACTIVITY_ACTIVE &&
+	    state->activity_state != GUEST_ACTIVITY_HLT)
+		return false;
+
+	/* no SMI or enclave blocking, STI and MOV SS blocking are exclusive */
+	if (intr & ~(GUEST_INTR_BLOCK_STI | GUEST_INTR_BLOCK_MOV_SS |
+		     GUEST_INTR_BLOCK_NMI) ||
+	    (intr & GUEST_INTR_BLOCK_STI && intr & GUEST_INTR_BLOCK_MOV_SS) ||
+	    (intr & GUEST_INTR_BLOCK_STI && !(state->rflags & X86_RFLAGS_IF)))
+		return false;
+	if (state->activity_state == GUEST_ACTIVITY_HLT &&
+	    (intr & (GUEST_INTR_BLOCK_STI | GUEST_INTR_BLOCK_MOV_SS) ||
+	     ss->access_rights & 0x60))
+		return false;
+
+	/* types 2, 3 and everything above 7 are reserved */
+	for (n = 0; n < 64; n += 8) {
+		type = state->pat >> n;
+		if (type == 2 || type == 3 || type > 7)
+			return false;
+	}
+
+	/* only SCE, LME, LMA and NXE are defined */
+	if (state->efer & ~(0x1UL | EFER_LME | EFER_LMA | 0x800UL))
+		return false;
+
+	/* IA-32e mode needs PAE paging, EFER.LME has to match it under paging */
+	if (long_mode &&
+	    (!(state->cr0 & X86_CR0_PG) || !(state->cr4 & X86_CR4_PAE)))
+		return false;
+	if (state->cr0 & X86_CR0_PG &&
+	    (!(state->cr0 & X86_CR0_PE) ||
+	     !(state->efer & EFER_LME) != !long_mode))
+		return false;
+
+	if (state->cr3 & vmx_phys_addr_reserved() || state->dr7 >> 32)
+		return false;
+	if (state->cr0 & X86_CR0_PG && state->cr4 & X86_CR4_PAE &&
+	    !long_mode && !vmx_get_pdptes(cpu_data, cell, state->cr3, pdpte))
+		return false;
+
+	/* bit 1 is fixed to 1, the others outside the defined flags and VM
+	 * to 0 */
+	if (state->rflags & ~0x3d7fd7UL || !(state->rflags & 0x2))
+		return false;
+
+	/* only 64-bit code can run above 4G */
+	if (long_mode && cs->access_rights & 0x2000 ?
+	    !vmx_canonical(state->rip) : state->rip >> 32)
+		return false;
+
+	if (!vmx_canonical(state->lstar) || !vmx_canonical(state->cstar) ||
+	    !vmx_canonical(state->kernel_gs_base) ||
+	    !vmx_canonical(state->sysenter_esp) ||
+	    !vmx_canonical(state->sysenter_eip) ||
+	    !vmx_canonical(state->gdtr_base) ||
+	    !vmx_canonical(state->idtr_base) || state->sfmask >> 32 ||
+	    state->gdtr_limit > 0xffff || state->idtr_limit > 0xffff)
+		return false;
+
+	for (n = 0; n < JAILHOUSE_NUM_SEGS; n++)
+		if (!vmx_canonical(state->segment[n].base) ||
+		    !vmx_segment_valid(&state->segment[n],
+				       n >= JAILHOUSE_SEG_LDTR))
+			return false;
+
+	/*
+	 * CS and TR have to be usable, TR a busy TSS (16-bit only outside of
+	 * IA-32e mode), and 64-bit code cannot be 32-bit at the same time.
+	 * CS holds accessed code, or a read/write data segment in real mode.
+	 */
+	type = tr->access_rights & 0xf;
+	if (cs->access_rights & 0x10000 || tr->access_rights & 0x10000 ||
+	    (type != 11 && (long_mode || type != 3)))
+		return false;
+	if (long_mode && cs->access_rights & 0x2000 &&
+	    cs->access_rights & 0x4000)
+		return false;
+	type = cs->access_rights & 0xf;
+	if (type != 9 && type != 11 && type != 13 && type != 15 &&
+	    (type != 3 || state->cr0 & X86_CR0_PE))
+		return false;
+
+	/*
+	 * Privilege levels (DPL in bits 6:5): real mode runs at 0, normal
+	 * code at the level of SS, conforming code at most there. TR and a
+	 * usable LDTR have to be taken from the GDT.
+	 */
+	if ((type == 3 || !(state->cr0 & X86_CR0_PE)) &&
+	    (cs->access_rights & 0x60 || ss->access_rights & 0x60))
+		return false;
+	if ((type == 9 || type == 11) &&
+	    (cs->access_rights & 0x60) != (ss->access_rights & 0x60))
+		return false;
+	if ((type == 13 || type == 15) &&
+	    (cs->access_rights & 0x60) > (ss->access_rights & 0x60))
+		return false;
+	if (tr->selector & 0x4 ||
+	    (!(ldtr->access_rights & 0x10000) && ldtr->selector & 0x4))
+		return false;
+
+	/* data segments have to be accessed, SS writable, LDTR an LDT */
+	for (n = 0; n < JAILHOUSE_SEG_LDTR; n++) {
+		if (n == JAILHOUSE_SEG_CS ||
+		    state->segment[n].access_rights & 0x10000)
+			continue;
+		type = state->segment[n].access_rights & 0xf;
+		if (!(type & 0x1) || (type & 0x8 && !(type & 0x2)) ||
+		    (n == JAILHOUSE_SEG_SS && type != 3 && type != 7))
+			return false;
+	}
+	if (!(ldtr->access_rights & 0x10000) &&
+	    (ldtr->access_rights & 0xf) != 2)
+		return false;
+
+	return true;
+}
+
+/*
+ * Like vmx_cpu_reset, but into the state set by JAILHOUSE_HC_CPU_SET_STATE.
+ * That state was checked by vmx_cpu_state_valid.
+ */
+static void vmx_cpu_restore_state(struct registers *guest_regs,
+				  struct per_cpu *cpu_data)
+{
+	struct jailhouse_cpu_state *state = &cpu_data->cpu_state;
+	struct jailhouse_segment *seg;
+	unsigned long val;
+	bool ok = true;
+	unsigned int n;
+
+	cpu_data->restore_state = false;
+
+	mmio_cache_flush(cpu_data);
+
+	ok &= vmx_set_guest_cr(0, state->cr0);
+	ok &= vmx_set_guest_cr(4, state->cr4);
+	ok &= vmcs_write64(GUEST_CR3, state->cr3);
+	ok &= vmcs_write64(GUEST_IA32_EFER, state->efer);
+	ok &= vmcs_write64(GUEST_DR7, state->dr7);
+
+	ok &= vmcs_write64(GUEST_RIP, state->rip);
+	ok &= vmcs_write64(GUEST_RSP, state->gpr[4]);
+	ok &= vmcs_write64(GUEST_RFLAGS, state->rflags);
+
+	ok &= vmcs_write64(GUEST_GDTR_BASE, state->gdtr_base);
+	ok &= vmcs_write32(GUEST_GDTR_LIMIT, state->gdtr_limit);
+	ok &= vmcs_write64(GUEST_IDTR_BASE, state->idtr_base);
+	ok &= vmcs_write32(GUEST_IDTR_LIMIT, state->idtr_limit);
+
+	for (n = 0, seg = state->segment; n < JAILHOUSE_NUM_SEGS; n++, seg++) {
+		ok &= vmcs_write16(GUEST_ES_SELECTOR + n * 2, seg->selector);
+		ok &= vmcs_write64(GUEST_ES_BASE + n * 2, seg->base);
+		ok &= vmcs_write32(GUEST_ES_LIMIT + n * 2, seg->limit);
+		ok &= vmcs_write32(GUEST_ES_AR_BYTES + n * 2,
+				   seg->access_rights);
+	}
+
+	ok &= vmcs_write32(GUEST_SYSENTER_CS, state->sysenter_cs);
+	ok &= vmcs_write64(GUEST_SYSENTER_ESP, state->sysenter_esp);
+	ok &= vmcs_write64(GUEST_SYSENTER_EIP, state->sysenter_eip);
+
+	ok &= vmcs_write32(GUEST_ACTIVITY_STATE, state->activity_state);
+	ok &= vmcs_write32(GUEST_INTERRUPTIBILITY_INFO,
+			   state->interruptibility);
+	ok &= vmcs_write32(GUEST_PENDING_DBG_EXCEPTIONS, 0);
+
+	val = vmcs_read32(VM_ENTRY_CONTROLS);
+	if (state->efer & EFER_LMA)
+		val |= VM_ENTRY_IA32E_MODE;
+	else
+		val &= ~VM_ENTRY_IA32E_MODE;
+	ok &= vmcs_write32(VM_ENTRY_CONTROLS, val);
+
+	/* only used by PAE paging outside of IA-32e mode */
+	for (n = 0; n < 4; n++)
+		ok &= vmcs_write64(GUEST_PDPTR0 + n * 2, cpu_data->pdpte[n]);
+
+	ok &= vmx_set_cell_config(cpu_data);
+
+	for (n = 0; n < 16; n++)
+		((unsigned long *)guest_regs)[15 - n] = state->gpr[n];
+
+	write_msr(MSR_IA32_PAT, state->pat);
+	write_msr(MSR_STAR, state->star);
+	write_msr(MSR_LSTAR, state->lstar);
+	write_msr(MSR_CSTAR, state->cstar);
+	write_msr(MSR_SFMASK, state->sfmask);
+	write_msr(MSR_KERNGS_BASE, state->kernel_gs_base);
+
+	if (!ok) {
+		panic_printk("FATAL: CPU state restore failed\n");
+		panic_stop(cpu_data);
+	}
+}
+
+void vmx_schedule_vmexit(struct per_cpu *cpu_data)
+{
+	if (cpu_data->vmx_state != VMCS_READY)
 		return;
 
-	pin_based_ctrl = vmcs_read32(PIN_BASED_VM_EXEC_CONTROL);
-	pin_based_ctrl |= PIN_BASED_VMX_PREEMPTION_TIMER;
-	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, pin_based_ctrl);
+	cpu_data->pin_based_ctrl |= PIN_BASED_VMX_PREEMPTION_TIMER;
+	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, cpu_data->pin_based_ctrl);
 }
 
-static void vmx_disable_preemption_timer(void)
+static void vmx_disable_preemption_timer(struct per_cpu *cpu_data)
 {
-	u32 pin_based_ctrl = vmcs_read32(PIN_BASED_VM_EXEC_CONTROL);
+	cpu_data->pin_based_ctrl &= ~PIN_BASED_VMX_PREEMPTION_TIMER;
+	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, cpu_data->pin_based_ctrl);
+}
 
-	pin_based_ctrl &= ~PIN_BASED_VMX_PREEMPTION_TIMER;
-	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, pin_based_ctrl);
+static void vmx_skip_emulated_instruction(struct per_cpu *cpu_data,
+					  unsigned int inst_len)
+{
+	cpu_data->guest_rip += inst_len;
+	vmcs_write64(GUEST_RIP, cpu_data->guest_rip);
 }
 
-static void vmx_skip_emulated_instruction(unsigned int inst_len)
+/* events that other CPUs signal by a store to the line of stop_cpu */
+static bool vmx_events_pending(struct per_cpu *cpu_data)
 {
-	vmcs_write64(GUEST_RIP, vmcs_read64(GUEST_RIP) + inst_len);
+	return cpu_data->stop_cpu || cpu_data->init_signaled ||
+		cpu_data->async_batch || cpu_data->guest_nmi_pending ||
+		vmx_pending_irq(cpu_data) >= 0 ||
+		cpu_data->pin_based_ctrl & PIN_BASED_VMX_PREEMPTION_TIMER;
+}
+
+static bool vmx_handle_hlt(struct registers *guest_regs,
+			   struct per_cpu *cpu_data)
+{
+	u32 intr_state = vmcs_read32(GUEST_INTERRUPTIBILITY_INFO);
+	unsigned long start;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_HLT]++;
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_HLT);
+	vmcs_write32(GUEST_INTERRUPTIBILITY_INFO, intr_state &
+		     ~(GUEST_INTR_BLOCK_STI | GUEST_INTR_BLOCK_MOV_SS));
+
+	/* only NMIs and INIT end this, let the CPU halt in the guest */
+	if (!(vmcs_read64(GUEST_RFLAGS) & X86_RFLAGS_IF)) {
+		vmcs_write32(GUEST_ACTIVITY_STATE, GUEST_ACTIVITY_HLT);
+		return true;
+	}
+
+	/*
+	 * Interrupts stay pending while the host runs with IF=0, the guest
+	 * receives them after VM entry. Kicks store to the monitored line
+	 * before sending the NMI, so none of them can be missed.
+	 */
+	start = read_tsc();
+	cpu_monitor(&cpu_data->stop_cpu);
+	if (!vmx_events_pending(cpu_data))
+		asm volatile("mwait"
+			     : : "a" (cpu_data->cell->config->idle_mwait_hint),
+			     "c" (X86_MWAIT_BREAK_ON_IRQ) : "memory");
+	cpu_data->stats[JAILHOUSE_CPU_STAT_IDLE_CYCLES] += read_tsc() - start;
+	return true;
 }
 
 static void update_efer(void)
@@ -796,6 +2061,7 @@ static bool vmx_handle_cr(struct registers *guest_regs,
 	u64 exit_qualification = vmcs_read64(EXIT_QUALIFICATION);
 	unsigned long cr, reg, val;
 
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CR]++;
 	cr = exit_qualification & 0xf;
 	reg = (exit_qualification >> 8) & 0xf;
 
@@ -807,7 +2073,8 @@ static bool vmx_handle_cr(struct registers *guest_regs,
 			val = ((unsigned long *)guest_regs)[15 - reg];
 
 		if (cr == 0 || cr == 4) {
-			vmx_skip_emulated_instruction(X86_INST_LEN_MOV_TO_CR);
+			vmx_skip_emulated_instruction(cpu_data,
+						      X86_INST_LEN_MOV_TO_CR);
 			/* TODO: check for #GP reasons */
 			vmx_set_guest_cr(cr, val);
 			if (cr == 0 && val & X86_CR0_PG)
@@ -823,11 +2090,40 @@ static bool vmx_handle_cr(struct registers *guest_regs,
 	return false;
 }
 
+#ifndef CONFIG_X86_X2APIC_ONLY
+static bool vmx_handle_apic_mmio(struct registers *guest_regs,
+				 struct per_cpu *cpu_data, unsigned int offset,
+				 bool is_write)
+{
+	unsigned long page_table_addr, rflags, old_rflags;
+	unsigned int inst_len;
+
+	if (offset & 0x00f)
+		return false;
+
+	page_table_addr = vmcs_read64(GUEST_CR3) & PAGE_ADDR_MASK;
+	rflags = old_rflags = vmcs_read64(GUEST_RFLAGS);
+
+	inst_len = apic_mmio_access(guest_regs, cpu_data,
+				    cpu_data->guest_rip, page_table_addr,
+				    offset >> 4, is_write, &rflags);
+	if (!inst_len)
+		return false;
+	if (rflags != old_rflags)
+		vmcs_write64(GUEST_RFLAGS, rflags);
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_XAPIC]++;
+	/* the page extends beyond the registers that have a slot */
+	if ((offset >> 4) < JAILHOUSE_CPU_STAT_NUM_APIC_REGS)
+		cpu_data->stats[JAILHOUSE_CPU_STAT_APIC_REG + (offset >> 4)]++;
+
+	vmx_skip_emulated_instruction(cpu_data, inst_len);
+	return true;
+}
+
 static bool vmx_handle_apic_access(struct registers *guest_regs,
 				   struct per_cpu *cpu_data)
 {
-	unsigned int inst_len, offset;
-	unsigned long page_table_addr;
 	u64 qualification;
 	bool is_write;
 
@@ -837,26 +2133,17 @@ static bool vmx_handle_apic_access(struct registers *guest_regs,
 	case APIC_ACCESS_TYPE_LINEAR_READ:
 	case APIC_ACCESS_TYPE_LINEAR_WRITE:
 		is_write = !!(qualification & APIC_ACCESS_TYPE_LINEAR_WRITE);
-		offset = qualification & APIC_ACCESS_OFFET_MASK;
-		if (offset & 0x00f)
-			break;
-
-		page_table_addr = vmcs_read64(GUEST_CR3) & PAGE_ADDR_MASK;
-
-		inst_len = apic_mmio_access(guest_regs, cpu_data,
-					    vmcs_read64(GUEST_RIP),
-					    page_table_addr, offset >> 4,
-					    is_write);
-		if (!inst_len)
-			return false;
-
-		vmx_skip_emulated_instruction(inst_len);
-		return true;
+		if (vmx_handle_apic_mmio(guest_regs, cpu_data,
+					 qualification & APIC_ACCESS_OFFET_MASK,
+					 is_write))
+			return true;
+		break;
 	}
 	panic_printk("FATAL: Unhandled APIC access, "
 		     "qualification %x\n", qualification);
 	return false;
 }
+#endif
 
 static void dump_vm_exit_details(u32 reason)
 {
@@ -871,6 +2158,158 @@ static void dump_vm_exit_details(u32 reason)
 			     vmcs_read64(GUEST_LINEAR_ADDRESS));
 }
 
+/* maps the 2M or, if not possible, the 4K page around a lazy cell's fault */
+static bool vmx_handle_lazy_fault(struct cell *cell, u64 phys_addr,
+				  u64 qualification)
+{
+	const struct jailhouse_memory *mem;
+	struct jailhouse_memory part;
+	unsigned long size = HUGEPAGE_SIZE;
+
+	/* accesses the present entry does not permit are real violations */
+	if (!(cell->config->flags & JAILHOUSE_CELL_LAZY_EPT) ||
+	    qualification & (EPT_VIOLATION_READABLE | EPT_VIOLATION_WRITABLE |
+			     EPT_VIOLATION_EXECUTABLE))
+		return false;
+
+	mem = cell_mem_by_virt(cell, phys_addr);
+	if (!mem)
+		return false;
+
+	while (1) {
+		part.virt_start = phys_addr & ~(u64)(size - 1);
+		part.phys_start = mem->phys_start +
+			(part.virt_start - mem->virt_start);
+		part.size = size;
+		part.access_flags = mem->access_flags;
+		/* the root cell must not get back what it handed out */
+		if (part.virt_start >= mem->virt_start &&
+		    part.virt_start + size <= mem->virt_start + mem->size &&
+		    (cell != cell_list || !non_root_cell_owns_memory(&part)))
+			break;
+		if (size == PAGE_SIZE)
+			return false;
+		size = PAGE_SIZE;
+	}
+
+	return vmx_map_memory(cell, part.phys_start, part.size,
+			      part.virt_start, part.access_flags) == 0;
+}
+
+/*
+ * Logs the first write to a write-protected page of a cell whose writes are
+ * logged and makes the page writable again. The fault invalidates cached
+ * translations of the address on this CPU. Other CPUs may still fault on it
+ * and simply find it writable.
+ */
+static bool vmx_handle_dirty_fault(struct cell *cell, u64 phys_addr,
+				   u64 qualification)
+{
+	const struct jailhouse_memory *mem;
+	unsigned long page;
+	unsigned int region;
+
+	if (!cell->vmx.dirty_log || ept_ad_bits ||
+	    !(qualification & EPT_VIOLATION_WRITE) ||
+	    !(qualification & EPT_VIOLATION_READABLE))
+		return false;
+
+	mem = cell_mem_by_virt(cell, phys_addr);
+	if (!mem)
+		return false;
+	region = mem - jailhouse_cell_mem_regions(cell->config);
+	if (!cell->vmx.dirty_log[region])
+		return false;
+
+	page = (phys_addr - mem->virt_start) / PAGE_SIZE;
+	set_bit(page, cell->vmx.dirty_log[region]);
+
+	return vmx_map_memory(cell, mem->phys_start + page * PAGE_SIZE,
+			      PAGE_SIZE, mem->virt_start + page * PAGE_SIZE,
+			      mem->access_flags) == 0;
+}
+
+static bool vmx_handle_ept_violation(struct registers *guest_regs,
+				     struct per_cpu *cpu_data)
+{
+	u64 phys_addr = vmcs_read64(GUEST_PHYSICAL_ADDRESS);
+	u64 qualification = vmcs_read64(EXIT_QUALIFICATION);
+	unsigned long rflags, old_rflags;
+	unsigned int inst_len;
+
+	/* the faulting access is simply repeated */
+	if (vmx_handle_dirty_fault(cpu_data->cell, phys_addr, qualification) ||
+	    vmx_handle_lazy_fault(cpu_data->cell, phys_addr, qualification))
+		return true;
+
+#ifndef CONFIG_X86_X2APIC_ONLY
+	/* only writes to the read-only mapped xAPIC page are expected */
+	if (!using_x2apic && (phys_addr & PAGE_MASK) == XAPIC_BASE &&
+	    qualification & EPT_VIOLATION_WRITE &&
+	    vmx_handle_apic_mmio(guest_regs, cpu_data,
+				 phys_addr & ~PAGE_MASK, true))
+		return true;
+#endif
+
+	/* emulated device registers, code is never fetched from them */
+	if (!(qualification & EPT_VIOLATION_FETCH)) {
+		rflags = old_rflags = vmcs_read64(GUEST_RFLAGS);
+		inst_len = mmio_handle_access(guest_regs, cpu_data, phys_addr,
+					      cpu_data->guest_rip,
+					      vmcs_read64(GUEST_CR3) &
+					      PAGE_ADDR_MASK,
+					      !!(qualification &
+						 EPT_VIOLATION_WRITE),
+					      &rflags);
+		if (inst_len) {
+			if (rflags != old_rflags)
+				vmcs_write64(GUEST_RFLAGS, rflags);
+			cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
+			vmx_skip_emulated_instruction(cpu_data, inst_len);
+			return true;
+		}
+	}
+
+	panic_printk("FATAL: Unhandled EPT violation, ");
+	dump_vm_exit_details(EXIT_REASON_EPT_VIOLATION);
+	return false;
+}
+
+static bool vmx_handle_io_access(struct registers *guest_regs,
+				 struct per_cpu *cpu_data)
+{
+	u64 qualification = vmcs_read64(EXIT_QUALIFICATION);
+	unsigned int size = (qualification & IO_SIZE_MASK) + 1;
+	bool is_write = !(qualification & IO_DIRECTION_IN);
+	u16 port = qualification >> IO_PORT_SHIFT;
+	u32 value = guest_regs->rax;
+	unsigned long mask;
+
+	if (qualification & (IO_STRING | IO_REP) ||
+	    !pci_pio_access(cpu_data, port, size, is_write, &value)) {
+		panic_printk("FATAL: Unhandled I/O access, port %x, "
+			     "qualification %x\n", port, qualification);
+		return false;
+	}
+
+	if (!is_write) {
+		/* like any 32-bit result, IN to EAX clears the upper half */
+		mask = size == 4 ? ~0UL : (1UL << (size * 8)) - 1;
+		guest_regs->rax = (guest_regs->rax & ~mask) | (value & mask);
+	}
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_PIO]++;
+	vmx_skip_emulated_instruction(cpu_data,
+				      vmcs_read32(VM_EXIT_INSTRUCTION_LEN));
+	return true;
+}
+
+static void vmx_count_x2apic_access(struct per_cpu *cpu_data,
+				    unsigned long msr)
+{
+	cpu_data->stats[JAILHOUSE_CPU_STAT_APIC_REG + msr - MSR_X2APIC_BASE]++;
+}
+
 static void dump_guest_regs(struct registers *guest_regs)
 {
 	panic_printk("RIP: %p RSP: %p FLAGS: %x\n", vmcs_read64(GUEST_RIP),
@@ -889,105 +2328,404 @@ static void dump_guest_regs(struct registers *guest_regs)
 	panic_printk("EFER: %p\n", vmcs_read64(GUEST_IA32_EFER));
 }
 
-void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data)
+static const struct cpuid_regs *vmx_cpuid_lookup(struct cell *cell,
+						 u32 leaf, u32 subleaf)
 {
-	u32 reason = vmcs_read32(VM_EXIT_REASON);
-	int sipi_vector;
+	unsigned int n;
 
-	if (reason & EXIT_REASONS_FAILED_VMENTRY) {
-		panic_printk("FATAL: VM-Entry failure, reason %d\n",
-			     (u16)reason);
-		goto dump_and_stop;
+	if (leaf >= 0x80000000) {
+		leaf -= 0x80000000;
+		return leaf < cell->vmx.cpuid.num_ext ?
+			&cell->vmx.cpuid.ext[leaf] : NULL;
 	}
+	if (leaf >= cell->vmx.cpuid.num_basic)
+		return NULL;
 
-	switch (reason) {
-	case EXIT_REASON_EXCEPTION_NMI:
-		asm volatile("int %0" : : "i" (NMI_VECTOR));
-		/* fall through */
-	case EXIT_REASON_PREEMPTION_TIMER:
-		vmx_disable_preemption_timer();
-		sipi_vector = apic_handle_events(cpu_data);
-		if (sipi_vector >= 0) {
-			printk("CPU %d received SIPI, vector %x\n",
-			       cpu_data->cpu_id, sipi_vector);
-			vmx_cpu_reset(guest_regs, cpu_data, sipi_vector);
-		}
-		return;
-	case EXIT_REASON_CPUID:
-		vmx_skip_emulated_instruction(X86_INST_LEN_CPUID);
-		guest_regs->rax &= 0xffffffff;
-		guest_regs->rbx &= 0xffffffff;
-		guest_regs->rcx &= 0xffffffff;
-		guest_regs->rdx &= 0xffffffff;
-		__cpuid((u32 *)&guest_regs->rax, (u32 *)&guest_regs->rbx,
-			(u32 *)&guest_regs->rcx, (u32 *)&guest_regs->rdx);
-		return;
-	case EXIT_REASON_VMCALL:
-		vmx_skip_emulated_instruction(X86_INST_LEN_VMCALL);
-		switch (guest_regs->rax) {
-		case JAILHOUSE_HC_DISABLE:
-			guest_regs->rax = shutdown(cpu_data);
-			if (guest_regs->rax == 0) {
-				vtd_shutdown();
-				vmx_cpu_deactivate_vmm(guest_regs, cpu_data);
-			}
-			break;
-		case JAILHOUSE_HC_CELL_CREATE:
-			guest_regs->rax = cell_create(cpu_data,
-						      guest_regs->rdi);
-			break;
-		default:
-			printk("CPU %d: Unknown vmcall %d, RIP: %p\n",
-			       cpu_data->cpu_id, guest_regs->rax,
-			       vmcs_read64(GUEST_RIP) - X86_INST_LEN_VMCALL);
-			guest_regs->rax = -ENOSYS;
+	for (n = 0; n < CPUID_CACHE_SUBLEAF_LEAVES; n++)
+		if (cpuid_subleaf_leaves[n] == leaf)
+			return subleaf < CPUID_CACHE_SUBLEAVES ?
+				&cell->vmx.cpuid.subleaf[n][subleaf] : NULL;
+
+	if (!(CPUID_CACHED_BASIC_LEAVES & (1 << leaf)))
+		return NULL;
+	return &cell->vmx.cpuid.basic[leaf];
+}
+
+static bool vmx_handle_cpuid(struct registers *guest_regs,
+			     struct per_cpu *cpu_data)
+{
+	u32 leaf = guest_regs->rax, subleaf = guest_regs->rcx;
+	const struct cpuid_regs *cached;
+	struct cpuid_regs regs;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CPUID]++;
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_CPUID);
+
+	cached = vmx_cpuid_lookup(cpu_data->cell, leaf, subleaf);
+	if (cached)
+		regs = *cached;
+	else
+		vmx_read_cpuid(leaf, subleaf, &regs);
+
+	switch (leaf) {
+	case 0x01:
+		regs.ebx = (regs.ebx & 0x00ffffff) | (cpu_data->apic_id << 24);
+		regs.ecx &= ~X86_FEATURE_OSXSAVE;
+		if (vmcs_read64(GUEST_CR4) & X86_CR4_OSXSAVE)
+			regs.ecx |= X86_FEATURE_OSXSAVE;
+		break;
+	case 0x07:
+		if (subleaf != 0)
 			break;
-		}
-		return;
-	case EXIT_REASON_CR_ACCESS:
-		if (vmx_handle_cr(guest_regs, cpu_data))
-			return;
+		regs.ecx &= ~X86_FEATURE_OSPKE;
+		if (vmcs_read64(GUEST_CR4) & X86_CR4_PKE)
+			regs.ecx |= X86_FEATURE_OSPKE;
 		break;
-	case EXIT_REASON_MSR_READ:
-		vmx_skip_emulated_instruction(X86_INST_LEN_RDMSR);
-		if (guest_regs->rcx >= MSR_X2APIC_BASE &&
-		    guest_regs->rcx <= MSR_X2APIC_END) {
-			x2apic_handle_read(guest_regs);
-			return;
-		}
-		panic_printk("FATAL: Unhandled MSR read: %08x\n",
-			     guest_regs->rcx);
+	case 0x0b:
+		regs.edx = cpu_data->apic_id;
 		break;
-	case EXIT_REASON_MSR_WRITE:
-		vmx_skip_emulated_instruction(X86_INST_LEN_WRMSR);
-		if (guest_regs->rcx == MSR_X2APIC_ICR) {
+	}
+
+	guest_regs->rax = regs.eax;
+	guest_regs->rbx = regs.ebx;
+	guest_regs->rcx = regs.ecx;
+	guest_regs->rdx = regs.edx;
+	return true;
+}
+
+static void vmx_handle_events(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
+{
+	int sipi_vector;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
+	vmx_disable_preemption_timer(cpu_data);
+	/* the CPU does not return to the guest before a stop takes effect */
+	if (cpu_data->cell != cell_list)
+		vmx_cpu_save_state(guest_regs, cpu_data);
+	sipi_vector = apic_handle_events(cpu_data);
+	if (sipi_vector >= 0) {
+		trace_event(cpu_data, JAILHOUSE_TRACE_SIPI, sipi_vector, 0);
+		if (cpu_data->restore_state)
+			vmx_cpu_restore_state(guest_regs, cpu_data);
+		else
+			vmx_cpu_reset(guest_regs, cpu_data, sipi_vector);
+	}
+	hypercall_run_async(cpu_data);
+}
+
+static bool vmx_handle_ext_intr(struct registers *guest_regs,
+				struct per_cpu *cpu_data)
+{
+	u32 vector = vmcs_read32(VM_EXIT_INTR_INFO) & INTR_INFO_VECTOR_MASK;
+
+	if (vector == APIC_EVENT_VECTOR) {
+		apic_eoi();
+		vmx_handle_events(guest_regs, cpu_data);
+	} else {
+		/* acknowledged on exit, the guest will send the EOI */
+		vmx_queue_irq(cpu_data, vector);
+	}
+	return true;
+}
+
+static bool vmx_handle_nmi(struct registers *guest_regs,
+			   struct per_cpu *cpu_data)
+{
+	/* a sample of this NMI hit the guest, not the exit handler */
+	profile_set_reason(cpu_data, JAILHOUSE_PROFILE_IN_GUEST);
+	asm volatile("int %0" : : "i" (NMI_VECTOR));
+	profile_set_reason(cpu_data, EXIT_REASON_EXCEPTION_NMI);
+	/* only kicks arm the timer, guest NMIs are injected on the way back */
+	if (cpu_data->pin_based_ctrl & PIN_BASED_VMX_PREEMPTION_TIMER)
+		vmx_handle_events(guest_regs, cpu_data);
+	return true;
+}
+
+static bool vmx_handle_preemption_timer(struct registers *guest_regs,
+					struct per_cpu *cpu_data)
+{
+	vmx_handle_events(guest_regs, cpu_data);
+	return true;
+}
+
+/* the pending interrupt or NMI is injected on the way back */
+static bool vmx_handle_window(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
+{
+	return true;
+}
+
+static bool vmx_handle_vmcall(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
+{
+	unsigned long code = guest_regs->rax;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL]++;
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_VMCALL);
+	trace_event(cpu_data, JAILHOUSE_TRACE_HYPERCALL, code,
+		    guest_regs->rdi);
+
+	if (code == JAILHOUSE_HC_DISABLE) {
+		guest_regs->rax = shutdown(cpu_data);
+		if (guest_regs->rax == 0) {
+			vtd_shutdown();
+			vmx_cpu_deactivate_vmm(guest_regs, cpu_data);
+		}
+		return true;
+	}
+
+	guest_regs->rax = hypercall(cpu_data, code, guest_regs->rdi,
+				    guest_regs->rsi);
+	if (guest_regs->rax == -ENOSYS)
+		trace_event(cpu_data, JAILHOUSE_TRACE_UNKNOWN_HYPERCALL, code,
+			    cpu_data->guest_rip - X86_INST_LEN_VMCALL);
+	return true;
+}
+
+static bool vmx_handle_msr_read(struct registers *guest_regs,
+				struct per_cpu *cpu_data)
+{
+	u32 msr = guest_regs->rcx;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR]++;
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_RDMSR);
+
+	/* a single compare covers the whole x2APIC range */
+	if (msr - MSR_X2APIC_BASE <= MSR_X2APIC_END - MSR_X2APIC_BASE) {
+		vmx_count_x2apic_access(cpu_data, msr);
+		x2apic_handle_read(guest_regs);
+		return true;
+	}
+	/* counters not passed through read as stopped and cleared */
+	if (vmx_pmu_msr(msr)) {
+		guest_regs->rax = 0;
+		guest_regs->rdx = 0;
+		return true;
+	}
+
+	panic_printk("FATAL: Unhandled MSR read: %08x\n", msr);
+	return false;
+}
+
+static bool vmx_handle_msr_write(struct registers *guest_regs,
+				 struct per_cpu *cpu_data)
+{
+	u32 msr = guest_regs->rcx;
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR]++;
+	vmx_skip_emulated_instruction(cpu_data, X86_INST_LEN_WRMSR);
+
+	if (msr - MSR_X2APIC_BASE <= MSR_X2APIC_END - MSR_X2APIC_BASE) {
+		vmx_count_x2apic_access(cpu_data, msr);
+		if (msr == MSR_X2APIC_ICR)
 			apic_handle_icr_write(cpu_data, guest_regs->rax,
 					      guest_regs->rdx);
-			return;
-		}
-		if (guest_regs->rcx >= MSR_X2APIC_BASE &&
-		    guest_regs->rcx <= MSR_X2APIC_END) {
+		else
 			x2apic_handle_write(guest_regs);
+		return true;
+	}
+	if (msr == MSR_CORE_PERF_GLOBAL_CTRL && cpu_data->pmu_owned) {
+		vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL,
+			     ((guest_regs->rdx << 32) | (u32)guest_regs->rax) &
+			     pmu_global_ctrl_mask);
+		return true;
+	}
+	/* cells not owning the counters cannot start them */
+	if (vmx_pmu_msr(msr))
+		return true;
+	if (cat_handle_msr_write(guest_regs))
+		return true;
+
+	panic_printk("FATAL: Unhandled MSR write: %08x\n", msr);
+	return false;
+}
+
+/*
+ * Indexed by the basic exit reason. Reasons without a handler are fatal, so
+ * are those a handler returns false for.
+ */
+static bool (*const exit_handlers[])(struct registers *guest_regs,
+				     struct per_cpu *cpu_data) = {
+	[EXIT_REASON_EXCEPTION_NMI] = vmx_handle_nmi,
+	[EXIT_REASON_EXTERNAL_INTERRUPT] = vmx_handle_ext_intr,
+	[EXIT_REASON_PENDING_INTERRUPT] = vmx_handle_window,
+	[EXIT_REASON_NMI_WINDOW] = vmx_handle_window,
+	[EXIT_REASON_CPUID] = vmx_handle_cpuid,
+	[EXIT_REASON_HLT] = vmx_handle_hlt,
+	[EXIT_REASON_VMCALL] = vmx_handle_vmcall,
+	[EXIT_REASON_CR_ACCESS] = vmx_handle_cr,
+	[EXIT_REASON_IO_INSTRUCTION] = vmx_handle_io_access,
+	[EXIT_REASON_MSR_READ] = vmx_handle_msr_read,
+	[EXIT_REASON_MSR_WRITE] = vmx_handle_msr_write,
+#ifndef CONFIG_X86_X2APIC_ONLY
+	[EXIT_REASON_APIC_ACCESS] = vmx_handle_apic_access,
+#endif
+	[EXIT_REASON_EPT_VIOLATION] = vmx_handle_ept_violation,
+	[EXIT_REASON_PREEMPTION_TIMER] = vmx_handle_preemption_timer,
+};
+#define NUM_EXIT_HANDLERS	(sizeof(exit_handlers) / sizeof(exit_handlers[0]))
+
+/* events whose delivery to the guest was cut short by this exit */
+static void vmx_requeue_vectoring_event(struct per_cpu *cpu_data)
+{
+	u32 info = vmcs_read32(IDT_VECTORING_INFO_FIELD);
+
+	if (!(info & INTR_INFO_VALID_MASK))
+		return;
+	if ((info & INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_EXT_INTR)
+		vmx_queue_irq(cpu_data, info & INTR_INFO_VECTOR_MASK);
+	else if ((info & INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_NMI_INTR)
+		cpu_data->guest_nmi_pending = true;
+}
+
+/*
+ * Injects one pending NMI or interrupt, the NMI and then the highest vector
+ * first. What cannot be taken yet opens an interrupt or NMI window. Without
+ * virtual NMIs, there is no NMI window, and blocked NMIs are retried on the
+ * next exit.
+ */
+static void vmx_inject_pending(struct per_cpu *cpu_data)
+{
+	u32 intr_state, proc_ctrl;
+	bool injected = false;
+	int vector;
+
+	vector = vmx_pending_irq(cpu_data);
+	if (vector < 0 && !cpu_data->guest_nmi_pending)
+		return;
+
+	intr_state = vmcs_read32(GUEST_INTERRUPTIBILITY_INFO);
+
+	if (cpu_data->guest_nmi_pending &&
+	    !(intr_state & (GUEST_INTR_BLOCK_STI | GUEST_INTR_BLOCK_MOV_SS |
+			    GUEST_INTR_BLOCK_NMI))) {
+		cpu_data->guest_nmi_pending = false;
+		vmcs_write32(VM_ENTRY_INTR_INFO_FIELD, NMI_VECTOR |
+			     INTR_TYPE_NMI_INTR | INTR_INFO_VALID_MASK);
+		injected = true;
+	}
+
+	if (vector >= 0 && !injected &&
+	    vmcs_read64(GUEST_RFLAGS) & X86_RFLAGS_IF &&
+	    !(intr_state & (GUEST_INTR_BLOCK_STI | GUEST_INTR_BLOCK_MOV_SS))) {
+		vmx_dequeue_irq(cpu_data, vector);
+		vmcs_write32(VM_ENTRY_INTR_INFO_FIELD, vector |
+			     INTR_TYPE_EXT_INTR | INTR_INFO_VALID_MASK);
+		vector = vmx_pending_irq(cpu_data);
+	}
+
+	proc_ctrl = cpu_data->proc_based_ctrl &
+		~(CPU_BASED_VIRTUAL_INTR_PENDING |
+		  CPU_BASED_VIRTUAL_NMI_PENDING);
+	if (vector >= 0)
+		proc_ctrl |= CPU_BASED_VIRTUAL_INTR_PENDING;
+	if (cpu_data->guest_nmi_pending && virtual_nmis)
+		proc_ctrl |= CPU_BASED_VIRTUAL_NMI_PENDING;
+	if (proc_ctrl != cpu_data->proc_based_ctrl) {
+		cpu_data->proc_based_ctrl = proc_ctrl;
+		vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, proc_ctrl);
+	}
+}
+
+static void vmx_dispatch_exit(struct registers *guest_regs,
+			      struct per_cpu *cpu_data)
+{
+	u32 reason = vmcs_read32(VM_EXIT_REASON);
+
+	if (reason & EXIT_REASONS_FAILED_VMENTRY) {
+		panic_printk("FATAL: VM-Entry failure, reason %d\n",
+			     (u16)reason);
+		goto dump_and_stop;
+	}
+
+	cpu_data->guest_rip = vmcs_read64(GUEST_RIP);
+	trace_event(cpu_data, JAILHOUSE_TRACE_VMEXIT, reason,
+		    cpu_data->guest_rip);
+	profile_set_reason(cpu_data, reason);
+
+	if (reason < NUM_EXIT_HANDLERS && exit_handlers[reason]) {
+		if (exit_handlers[reason](guest_regs, cpu_data))
 			return;
-		}
-		panic_printk("FATAL: Unhandled MSR write: %08x\n",
-			     guest_regs->rcx);
-		break;
-	case EXIT_REASON_APIC_ACCESS:
-		if (vmx_handle_apic_access(guest_regs, cpu_data))
-			return;
-		break;
-	default:
+	} else {
 		panic_printk("FATAL: Unhandled VM-Exit, reason %d, ",
 			     (u16)reason);
 		dump_vm_exit_details(reason);
-		break;
 	}
 dump_and_stop:
 	dump_guest_regs(guest_regs);
 	panic_stop(cpu_data);
 }
 
+/*
+ * Exits caused by an instruction that is emulated without touching r12-r15,
+ * see vm_exit. They carry no event whose delivery they interrupted. Events
+ * pending before the exit take the full path, but an x2APIC ICR write can
+ * queue a self-NMI, so injection still runs afterwards. Everything else
+ * returns false and takes the full path.
+ */
+bool vmx_handle_fast_exit(struct registers *guest_regs,
+			  struct per_cpu *cpu_data)
+{
+	u32 reason = vmcs_read32(VM_EXIT_REASON);
+	unsigned long start;
+
+	switch (reason) {
+	case EXIT_REASON_CPUID:
+		break;
+	case EXIT_REASON_MSR_WRITE:
+		/* written by perf on every overflow and context switch */
+		if ((u32)guest_regs->rcx == MSR_CORE_PERF_GLOBAL_CTRL)
+			break;
+		/* fall through */
+	case EXIT_REASON_MSR_READ:
+		if ((u32)guest_regs->rcx - MSR_X2APIC_BASE <=
+		    MSR_X2APIC_END - MSR_X2APIC_BASE)
+			break;
+		return false;
+	default:
+		return false;
+	}
+	if (cpu_data->guest_nmi_pending || vmx_pending_irq(cpu_data) >= 0)
+		return false;
+
+	start = read_tsc();
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+
+	cpu_data->guest_rip = vmcs_read64(GUEST_RIP);
+	trace_event(cpu_data, JAILHOUSE_TRACE_VMEXIT, reason,
+		    cpu_data->guest_rip);
+	profile_set_reason(cpu_data, reason);
+
+	/* none of them fails for the exits filtered above */
+	exit_handlers[reason](guest_regs, cpu_data);
+
+	vmx_inject_pending(cpu_data);
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CYCLES] +=
+		read_tsc() - start;
+	return true;
+}
+
+void vmx_handle_exit(struct registers *guest_regs, struct per_cpu *cpu_data)
+{
+	unsigned long idle = cpu_data->stats[JAILHOUSE_CPU_STAT_IDLE_CYCLES];
+	unsigned long start = read_tsc();
+
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+
+	vmx_requeue_vectoring_event(cpu_data);
+
+	vmx_dispatch_exit(guest_regs, cpu_data);
+
+	vmx_inject_pending(cpu_data);
+
+	/* time slept for the guest is idle, not exit handling */
+	idle = cpu_data->stats[JAILHOUSE_CPU_STAT_IDLE_CYCLES] - idle;
+	cpu_data->stats[JAILHOUSE_CPU_STAT_VMEXITS_CYCLES] +=
+		read_tsc() - start - idle;
+}
+
 void vmx_entry_failure(struct per_cpu *cpu_data)
 {
 	panic_printk("FATAL: vmresume failed, error %d\n",
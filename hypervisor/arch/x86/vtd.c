@@ -10,26 +10,74 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <asm/apic.h>
+#include <asm/vmx.h>
 #include <asm/vtd.h>
 
-/* TODO: Support multiple segments */
-static struct vtd_entry __attribute__((aligned(PAGE_SIZE)))
-	root_entry_table[256];
-static void *dmar_reg_base;
+#ifndef CONFIG_X86_NO_VTD
+
+static struct vtd_segment segments[VTD_MAX_SEGMENTS];
+static unsigned int dmar_segments;
+static struct vtd_unit units[VTD_MAX_UNITS];
 static unsigned int dmar_units;
+static bool irq_remapping = true;
+/* DMA-only cells may use their EPT as VT-d page table */
+static bool ept_sharing;
 static unsigned dmar_pt_levels;
+/* PAGE_MAP_NON_COHERENT is set if any unit does not snoop CPU caches */
+static unsigned int dmar_map_flags = PAGE_MAP_HUGE_2M | PAGE_MAP_HUGE_1G |
+	PAGE_MAP_USER(JAILHOUSE_POOL_USER_VTD);
+
+static struct vtd_segment *vtd_find_segment(u16 id)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_segments; n++)
+		if (segments[n].id == id)
+			return &segments[n];
+	return NULL;
+}
+
+static struct vtd_segment *vtd_add_segment(u16 id)
+{
+	struct vtd_segment *segment = vtd_find_segment(id);
+
+	if (segment)
+		return segment;
+
+	if (dmar_segments == VTD_MAX_SEGMENTS)
+		return NULL;
+	segment = &segments[dmar_segments];
+
+	segment->root_entry_table = page_alloc(&mem_pool, 1,
+						 JAILHOUSE_POOL_USER_VTD);
+	if (!segment->root_entry_table)
+		return NULL;
+	segment->id = id;
+	dmar_segments++;
+
+	return segment;
+}
+
+static void vtd_flush_cpu_caches(void *addr, unsigned long size)
+{
+	if (dmar_map_flags & PAGE_MAP_NON_COHERENT)
+		flush_cache_range(addr, size);
+}
 
 int vtd_init(void)
 {
 	const struct acpi_dmar_table *dmar;
 	const struct acpi_dmar_drhd *drhd;
-	unsigned int pt_levels;
-	void *reg_base = NULL;
+	unsigned long sagaw = VTD_CAP_SAGAW39 | VTD_CAP_SAGAW48;
 	unsigned long offset;
-	unsigned long caps;
+	unsigned long caps, ecaps;
+	struct vtd_unit *unit;
+	unsigned int n;
 	int err;
 
 	dmar = (struct acpi_dmar_table *)acpi_find_table("DMAR", NULL);
@@ -51,41 +99,59 @@ int vtd_init(void)
 		    offset + drhd->header.length > dmar->header.length)
 			return -EIO;
 
-		/* TODO: support multiple segments */
-		if (drhd->segment != 0)
-			return -EIO;
+		if (dmar_units == VTD_MAX_UNITS)
+			return -ERANGE;
+		unit = &units[dmar_units];
 
-		printk("Found DMAR @%p\n", drhd->register_base_addr);
+		printk("Found DMAR @%p, segment %d\n",
+		       drhd->register_base_addr, drhd->segment);
 
-		reg_base = page_alloc(&remap_pool, 1);
-		if (!reg_base)
+		unit->segment = vtd_add_segment(drhd->segment);
+		if (!unit->segment)
 			return -ENOMEM;
 
-		if (dmar_units == 0)
-			dmar_reg_base = reg_base;
-		else if (reg_base != dmar_reg_base + dmar_units * PAGE_SIZE)
+		unit->reg_base = page_alloc(&remap_pool, 1,
+					    JAILHOUSE_POOL_USER_REMAP);
+		if (!unit->reg_base)
 			return -ENOMEM;
 
 		err = page_map_create(hv_page_table, drhd->register_base_addr,
-				      PAGE_SIZE, (unsigned long)reg_base,
+				      PAGE_SIZE, (unsigned long)unit->reg_base,
 				      PAGE_DEFAULT_FLAGS | PAGE_FLAG_UNCACHED,
-				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS);
+				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				      PAGE_MAP_NO_HUGE);
 		if (err)
 			return err;
 
-		caps = mmio_read64(reg_base + VTD_CAP_REG);
-		if (caps & VTD_CAP_SAGAW39)
-			pt_levels = 3;
-		else if (caps & VTD_CAP_SAGAW48)
-			pt_levels = 4;
-		else
-			return -EIO;
+		/* only use table levels and super pages all units support */
+		caps = mmio_read64(unit->reg_base + VTD_CAP_REG);
+		sagaw &= caps;
+		if (!(caps & VTD_CAP_SLLPS2M))
+			dmar_map_flags &= ~PAGE_MAP_HUGE_2M;
+		if (!(caps & VTD_CAP_SLLPS1G))
+			dmar_map_flags &= ~PAGE_MAP_HUGE_1G;
+
+		ecaps = mmio_read64(unit->reg_base + VTD_ECAP_REG);
+		if (!(ecaps & VTD_ECAP_C))
+			dmar_map_flags |= PAGE_MAP_NON_COHERENT;
+
+		unit->iotlb_reg = unit->reg_base + VTD_IOTLB_REG +
+			((ecaps & VTD_ECAP_IRO_MASK) >> VTD_ECAP_IRO_SHIFT) *
+			16;
+
+		if (ecaps & VTD_ECAP_QI) {
+			unit->inv_queue = page_alloc(&mem_pool, 1,
+						     JAILHOUSE_POOL_USER_VTD);
+			if (!unit->inv_queue)
+				return -ENOMEM;
+		}
 
-		if (dmar_pt_levels > 0 && dmar_pt_levels != pt_levels)
-			return -EIO;
-		dmar_pt_levels = pt_levels;
+		/* IR needs QI for interrupt entry cache invalidations */
+		if (!(ecaps & VTD_ECAP_QI) || !(ecaps & VTD_ECAP_IR))
+			irq_remapping = false;
 
-		if (mmio_read32(reg_base + VTD_GSTS_REG) & VTD_GSTS_TE)
+		if (mmio_read32(unit->reg_base + VTD_GSTS_REG) &
+		    (VTD_GSTS_TE | VTD_GSTS_IRES | VTD_GSTS_QIES))
 			return -EBUSY;
 
 		dmar_units++;
@@ -96,24 +162,184 @@ int vtd_init(void)
 	} while (offset < dmar->header.length &&
 		 drhd->header.type == ACPI_DMAR_DRHD);
 
+	/*
+	 * The EPT can serve as second-level table if it has the same depth,
+	 * uses no super pages VT-d lacks and needs no cache write-backs.
+	 * Memory type and execute bits are ignored by VT-d.
+	 */
+	if (sagaw & VTD_CAP_SAGAW48 && PAGE_DIR_LEVELS == 4 &&
+	    !(dmar_map_flags & PAGE_MAP_NON_COHERENT) &&
+	    !(ept_huge_pages & ~dmar_map_flags)) {
+		dmar_pt_levels = 4;
+		ept_sharing = true;
+	} else if (sagaw & VTD_CAP_SAGAW39)
+		dmar_pt_levels = 3;
+	else if (sagaw & VTD_CAP_SAGAW48)
+		dmar_pt_levels = 4;
+	else
+		return -EIO;
+
+	if (!irq_remapping) {
+		printk("WARNING: No interrupt remapping support!\n");
+		return 0;
+	}
+	if (system_config->flags & JAILHOUSE_SYS_VTD_COMPAT_MSI)
+		printk("WARNING: Compatibility format MSIs bypass interrupt "
+		       "remapping!\n");
+
+	for (n = 0; n < dmar_segments; n++) {
+		segments[n].irq_remap_table =
+			page_alloc(&mem_pool, 1, JAILHOUSE_POOL_USER_VTD);
+		if (!segments[n].irq_remap_table)
+			return -ENOMEM;
+	}
+
 	return 0;
 }
 
-static bool vtd_add_device_to_cell(struct cell *cell,
-				   struct jailhouse_pci_device *device)
+static void vtd_update_gcmd(struct vtd_unit *unit, u32 command, u32 status)
+{
+	u32 value = mmio_read32(unit->reg_base + VTD_GSTS_REG) &
+		VTD_GSTS_USED_CTRLS;
+
+	/* only one command per write, keeping all enabled controls */
+	mmio_write32(unit->reg_base + VTD_GCMD_REG, value | command);
+	while (!(mmio_read32(unit->reg_base + VTD_GSTS_REG) & status))
+		cpu_relax();
+}
+
+static void vtd_submit_iq_requests(struct vtd_unit *unit,
+				   const struct vtd_entry *requests,
+				   unsigned int num)
+{
+	volatile u32 completed = 0;
+	unsigned int index, n;
+
+	index = mmio_read64(unit->reg_base + VTD_IQT_REG) >> VTD_IQT_QT_SHIFT;
+	for (n = 0; n <= num; n++) {
+		if (n < num) {
+			unit->inv_queue[index] = requests[n];
+		} else {
+			unit->inv_queue[index].lo_word = VTD_REQ_INV_WAIT |
+				(1UL << VTD_INV_WAIT_SDATA_SHIFT);
+			unit->inv_queue[index].hi_word =
+				page_map_hvirt2phys((void *)&completed);
+		}
+		vtd_flush_cpu_caches(&unit->inv_queue[index],
+				     sizeof(struct vtd_entry));
+		index = (index + 1) % VTD_INV_QUEUE_ENTRIES;
+	}
+	memory_barrier();
+
+	mmio_write64(unit->reg_base + VTD_IQT_REG, index << VTD_IQT_QT_SHIFT);
+	while (!completed)
+		cpu_relax();
+}
+
+static void vtd_flush_caches(struct vtd_unit *unit)
+{
+	static const struct vtd_entry inv_requests[] = {
+		{ .lo_word = VTD_REQ_CC_GLOBAL },
+		{ .lo_word = VTD_REQ_IOTLB_GLOBAL },
+		{ .lo_word = VTD_REQ_IEC_GLOBAL },
+	};
+
+	/* register-based invalidation is unavailable while QI is on */
+	if (mmio_read32(unit->reg_base + VTD_GSTS_REG) & VTD_GSTS_QIES) {
+		vtd_submit_iq_requests(unit, inv_requests,
+				       sizeof(inv_requests) /
+				       sizeof(inv_requests[0]));
+		return;
+	}
+
+	mmio_write64(unit->reg_base + VTD_CCMD_REG,
+		     VTD_CCMD_ICC | VTD_CCMD_CIRG_GLOBAL);
+	while (mmio_read64(unit->reg_base + VTD_CCMD_REG) & VTD_CCMD_ICC)
+		cpu_relax();
+
+	mmio_write64(unit->iotlb_reg, VTD_IOTLB_IVT | VTD_IOTLB_IIRG_GLOBAL);
+	while (mmio_read64(unit->iotlb_reg) & VTD_IOTLB_IVT)
+		cpu_relax();
+}
+
+static void vtd_flush_all_caches(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		vtd_flush_caches(&units[n]);
+}
+
+bool vtd_cell_shares_ept(struct cell *cell)
+{
+	return cell->vtd.page_table == cell->vmx.ept;
+}
+
+/* sharing must not grant devices access to regions the cell forbids */
+static bool vtd_cell_can_share_ept(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem;
+	unsigned int n;
+
+	/* devices cannot wait for a lazy EPT to be filled */
+	if (!ept_sharing || config->flags & JAILHOUSE_CELL_LAZY_EPT)
+		return false;
+
+	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size;
+
+	for (n = 0; n < config->num_memory_regions; n++, mem++)
+		if (mem->access_flags &
+		    (JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE) &&
+		    !(mem->access_flags & JAILHOUSE_MEM_DMA))
+			return false;
+	return true;
+}
+
+static int vtd_map_memory(struct cell *cell,
+			  const struct jailhouse_memory *mem)
+{
+	u32 page_flags = 0;
+
+	/* a shared EPT is maintained by vmx */
+	if (!(mem->access_flags & JAILHOUSE_MEM_DMA) ||
+	    vtd_cell_shares_ept(cell))
+		return 0;
+
+	if (mem->access_flags & JAILHOUSE_MEM_READ)
+		page_flags |= VTD_PAGE_READ;
+	if (mem->access_flags & JAILHOUSE_MEM_WRITE)
+		page_flags |= VTD_PAGE_WRITE;
+
+	return page_map_create(cell->vtd.page_table, mem->phys_start,
+			       mem->size, mem->virt_start, page_flags,
+			       VTD_PAGE_READ | VTD_PAGE_WRITE, dmar_pt_levels,
+			       dmar_map_flags | PAGE_MAP_NODE(cell->numa_node));
+}
+
+static int vtd_add_device_to_cell(struct cell *cell,
+				  struct jailhouse_pci_device *device)
 {
-	u64 root_entry_lo = root_entry_table[device->bus].lo_word;
+	struct vtd_segment *segment = vtd_find_segment(device->domain);
 	struct vtd_entry *context_entry_table, *context_entry;
+	struct vtd_entry *root_entry;
 
-	if (root_entry_lo & VTD_ROOT_PRESENT) {
+	if (!segment)
+		return -ENODEV;
+	root_entry = &segment->root_entry_table[device->bus];
+
+	if (root_entry->lo_word & VTD_ROOT_PRESENT) {
 		context_entry_table =
-			page_map_phys2hvirt(root_entry_lo & PAGE_MASK);
+			page_map_phys2hvirt(root_entry->lo_word & PAGE_MASK);
 	} else {
-		context_entry_table = page_alloc(&mem_pool, 1);
+		context_entry_table = page_alloc(&mem_pool, 1,
+						 JAILHOUSE_POOL_USER_VTD);
 		if (!context_entry_table)
-			return false;
-		root_entry_table[device->bus].lo_word = VTD_ROOT_PRESENT |
+			return -ENOMEM;
+		vtd_flush_cpu_caches(context_entry_table, PAGE_SIZE);
+		root_entry->lo_word = VTD_ROOT_PRESENT |
 			page_map_hvirt2phys(context_entry_table);
+		vtd_flush_cpu_caches(root_entry, sizeof(struct vtd_entry));
 	}
 
 	context_entry = &context_entry_table[device->devfn];
@@ -123,85 +349,413 @@ static bool vtd_add_device_to_cell(struct cell *cell,
 	context_entry->hi_word = (dmar_pt_levels == 3 ? VTD_CTX_AGAW_39
 						      : VTD_CTX_AGAW_48) |
 		((cell->id << VTD_CTX_DID_SHIFT) & VTD_CTX_DID16_MASK);
+	vtd_flush_cpu_caches(context_entry, sizeof(struct vtd_entry));
 
-	return true;
+	return 0;
+}
+
+static bool vtd_cell_has_device(struct jailhouse_cell_desc *config,
+				struct jailhouse_irq_line *irq_line)
+{
+	struct jailhouse_pci_device *dev;
+	unsigned int n;
+
+	dev = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory) +
+		config->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		config->pio_bitmap_size;
+
+	for (n = 0; n < config->num_pci_devices; n++)
+		if (dev[n].domain == irq_line->domain &&
+		    dev[n].bus == irq_line->bus &&
+		    dev[n].devfn == irq_line->devfn)
+			return true;
+	return false;
 }
 
+static int vtd_check_irq_lines(struct cell *cell,
+			       struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_irq_line *irq_line;
+	struct vtd_segment *segment;
+	unsigned int n, i;
+
+	irq_line = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory);
+
+	if (config->num_irq_lines > 0 && !irq_remapping)
+		return -ENODEV;
+
+	for (n = 0; n < config->num_irq_lines; n++) {
+		if (irq_line[n].irqchip != JAILHOUSE_IRQCHIP_IOMMU ||
+		    irq_line[n].num >= VTD_IRT_ENTRIES ||
+		    irq_line[n].vector < 32)
+			return -EINVAL;
+		segment = vtd_find_segment(irq_line[n].domain);
+		if (!segment)
+			return -ENODEV;
+		if (irq_line[n].cpu > cell->cpu_set->max_cpu_id ||
+		    !test_bit(irq_line[n].cpu, cell->cpu_set->bitmap) ||
+		    !vtd_cell_has_device(config, &irq_line[n]))
+			return -EPERM;
+		if (segment->irq_remap_table[irq_line[n].num].lo_word &
+		    VTD_IRTE_PRESENT)
+			return -EBUSY;
+		for (i = 0; i < n; i++)
+			if (irq_line[i].domain == irq_line[n].domain &&
+			    irq_line[i].num == irq_line[n].num)
+				return -EBUSY;
+	}
+	return 0;
+}
+
+static void vtd_set_irq_lines(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_irq_line *irq_line;
+	struct vtd_entry *irte;
+	unsigned int n;
+	u64 dest;
+
+	irq_line = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory);
+
+	for (n = 0; n < config->num_irq_lines; n++, irq_line++) {
+		irte = &vtd_find_segment(irq_line->domain)->
+			irq_remap_table[irq_line->num];
+		dest = per_cpu(irq_line->cpu)->apic_id;
+
+		/* fixed, edge-triggered, physical destination */
+		irte->hi_word = VTD_IRTE_SVT_VERIFY_SID |
+			(irq_line->bus << 8) | irq_line->devfn;
+		irte->lo_word = VTD_IRTE_PRESENT |
+			(irq_line->vector << VTD_IRTE_VECTOR_SHIFT) |
+			(dest << (using_x2apic ? VTD_IRTE_DEST_SHIFT
+					       : VTD_IRTE_XAPIC_DEST_SHIFT));
+		vtd_flush_cpu_caches(irte, sizeof(struct vtd_entry));
+	}
+}
+
+static void vtd_clear_irq_lines(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_irq_line *irq_line;
+	struct vtd_entry *irte;
+	unsigned int n;
+
+	irq_line = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size +
+		config->num_memory_regions * sizeof(struct jailhouse_memory);
+
+	for (n = 0; n < config->num_irq_lines; n++, irq_line++) {
+		irte = &vtd_find_segment(irq_line->domain)->
+			irq_remap_table[irq_line->num];
+		irte->lo_word = 0;
+		irte->hi_word = 0;
+		vtd_flush_cpu_caches(irte, sizeof(struct vtd_entry));
+	}
+}
+
+static void vtd_enable_unit(struct vtd_unit *unit)
+{
+	u64 irta;
+
+	vtd_flush_cpu_caches(unit->segment->root_entry_table, PAGE_SIZE);
+	mmio_write64(unit->reg_base + VTD_RTADDR_REG,
+		     page_map_hvirt2phys(unit->segment->root_entry_table));
+	vtd_update_gcmd(unit, VTD_GCMD_SRTP, VTD_GSTS_SRTP);
+
+	if (unit->inv_queue) {
+		vtd_flush_cpu_caches(unit->inv_queue, PAGE_SIZE);
+		mmio_write64(unit->reg_base + VTD_IQT_REG, 0);
+		mmio_write64(unit->reg_base + VTD_IQA_REG,
+			     page_map_hvirt2phys(unit->inv_queue));
+		vtd_update_gcmd(unit, VTD_GCMD_QIE, VTD_GSTS_QIES);
+	}
+
+	if (irq_remapping) {
+		vtd_flush_cpu_caches(unit->segment->irq_remap_table,
+				     PAGE_SIZE);
+		irta = page_map_hvirt2phys(unit->segment->irq_remap_table) |
+			VTD_IRTA_SIZE;
+		if (using_x2apic)
+			irta |= VTD_IRTA_EIME;
+		mmio_write64(unit->reg_base + VTD_IRTA_REG, irta);
+		vtd_update_gcmd(unit, VTD_GCMD_SIRTP, VTD_GSTS_IRTPS);
+	}
+
+	vtd_flush_caches(unit);
+
+	if (irq_remapping) {
+		/*
+		 * Only let MSIs in compatibility format pass on request, a
+		 * root cell booted with intremap=off needs them. Cells with
+		 * assigned devices use the remappable format.
+		 */
+		if (system_config->flags & JAILHOUSE_SYS_VTD_COMPAT_MSI)
+			vtd_update_gcmd(unit, VTD_GCMD_CFI, VTD_GSTS_CFIS);
+		vtd_update_gcmd(unit, VTD_GCMD_IRE, VTD_GSTS_IRES);
+	}
+
+	vtd_update_gcmd(unit, VTD_GCMD_TE, VTD_GSTS_TE);
+}
+
+static bool vtd_root_cell_has_device(struct jailhouse_pci_device *device)
+{
+	struct jailhouse_cell_desc *root_config = cell_list->config;
+	struct jailhouse_pci_device *dev;
+	unsigned int n;
+
+	dev = (void *)root_config + sizeof(struct jailhouse_cell_desc) +
+		root_config->cpu_set_size +
+		root_config->num_memory_regions *
+		sizeof(struct jailhouse_memory) +
+		root_config->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		root_config->pio_bitmap_size;
+
+	for (n = 0; n < root_config->num_pci_devices; n++)
+		if (dev[n].domain == device->domain &&
+		    dev[n].bus == device->bus && dev[n].devfn == device->devfn)
+			return true;
+	return false;
+}
+
+static void vtd_remove_device(struct jailhouse_pci_device *device)
+{
+	struct vtd_segment *segment = vtd_find_segment(device->domain);
+	struct vtd_entry *context_entry;
+	u64 root_entry_lo;
+
+	if (!segment)
+		return;
+	root_entry_lo = segment->root_entry_table[device->bus].lo_word;
+	if (!(root_entry_lo & VTD_ROOT_PRESENT))
+		return;
+
+	context_entry = page_map_phys2hvirt(root_entry_lo & PAGE_MASK);
+	context_entry += device->devfn;
+	context_entry->lo_word = 0;
+	context_entry->hi_word = 0;
+	vtd_flush_cpu_caches(context_entry, sizeof(struct vtd_entry));
+}
+
+/* the context tables already exist, re-adding can't fail */
+static void vtd_return_devices(struct jailhouse_pci_device *dev,
+			       unsigned int num)
+{
+	unsigned int n;
+
+	for (n = 0; n < num; n++)
+		if (vtd_root_cell_has_device(&dev[n]))
+			vtd_add_device_to_cell(cell_list, &dev[n]);
+		else
+			vtd_remove_device(&dev[n]);
+}
+
+/* the memory regions are added separately via vtd_map_memory_region */
 int vtd_cell_init(struct cell *cell, struct jailhouse_cell_desc *config)
 {
 	struct jailhouse_pci_device *dev;
-	void *reg_base = dmar_reg_base;
-	struct jailhouse_memory *mem;
-	u32 page_flags;
-	int n, err;
+	unsigned int n;
+	int err;
 
 	// HACK for QEMU
 	if (dmar_units == 0)
 		return 0;
 
-	cell->vtd.page_table = page_alloc(&mem_pool, 1);
-	if (!cell->vtd.page_table)
-		return -ENOMEM;
+	err = vtd_check_irq_lines(cell, config);
+	if (err)
+		return err;
+
+	if (vtd_cell_can_share_ept(config)) {
+		cell->vtd.page_table = cell->vmx.ept;
+	} else {
+		cell->vtd.page_table = page_alloc_node(cell->numa_node, 1,
+						       JAILHOUSE_POOL_USER_VTD);
+		if (!cell->vtd.page_table)
+			return -ENOMEM;
+		vtd_flush_cpu_caches(cell->vtd.page_table, PAGE_SIZE);
+	}
+
+	dev = jailhouse_cell_pci_devices(config);
+
+	for (n = 0; n < config->num_pci_devices; n++) {
+		err = vtd_add_device_to_cell(cell, &dev[n]);
+		if (err)
+			goto err_return_devices;
+	}
+
+	vtd_set_irq_lines(config);
+
+	/* modified structures are already written back, the units are
+	 * flushed or enabled when the cell takes over */
+	return 0;
+
+err_return_devices:
+	vtd_return_devices(dev, n);
+	if (!vtd_cell_shares_ept(cell))
+		page_free_node(cell->vtd.page_table, 1,
+			       JAILHOUSE_POOL_USER_VTD);
+	cell->vtd.page_table = NULL;
+	return err;
+}
+
+int vtd_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem)
+{
+	if (dmar_units == 0)
+		return 0;
+
+	return vtd_map_memory(cell, mem);
+}
+
+/* translation starts once the root cell's DMA regions are mapped */
+void vtd_enable_units(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		if (!(mmio_read32(units[n].reg_base + VTD_GSTS_REG) &
+		      VTD_GSTS_TE))
+			vtd_enable_unit(&units[n]);
+		else
+			vtd_flush_caches(&units[n]);
+}
+
+static int vtd_root_cell_unmap(const struct jailhouse_memory *part)
+{
+	page_map_destroy(cell_list->vtd.page_table, part->virt_start,
+			 part->size, dmar_pt_levels, dmar_map_flags);
+	return 0;
+}
+
+void vtd_root_cell_shrink(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem;
+	unsigned int n;
+
+	if (dmar_units == 0)
+		return;
 
 	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
 		config->cpu_set_size;
 
-	for (n = 0; n < config->num_memory_regions; n++, mem++) {
-		if (!(mem->access_flags & JAILHOUSE_MEM_DMA))
-			continue;
+	/* a shared EPT was already shrunk by vmx_cell_shrink */
+	if (!vtd_cell_shares_ept(cell_list))
+		for (n = 0; n < config->num_memory_regions; n++, mem++)
+			if (mem->access_flags & JAILHOUSE_MEM_DMA &&
+			    !(mem->access_flags & JAILHOUSE_MEM_COMM_REGION))
+				root_cell_remap(mem, vtd_root_cell_unmap);
 
-		page_flags = 0;
-		if (mem->access_flags & JAILHOUSE_MEM_READ)
-			page_flags |= VTD_PAGE_READ;
-		if (mem->access_flags & JAILHOUSE_MEM_WRITE)
-			page_flags |= VTD_PAGE_WRITE;
+	/* the new cell's devices were added before, flush on our own */
+	vtd_flush_all_caches();
+}
 
-		err = page_map_create(cell->vtd.page_table, mem->phys_start,
-				      mem->size, mem->virt_start, page_flags,
-				      VTD_PAGE_READ | VTD_PAGE_WRITE,
-				      dmar_pt_levels);
-		if (err)
-			/* FIXME: release vtd.page_table */
-			return err;
-	}
+void vtd_root_cell_ept_unmapped(void)
+{
+	if (dmar_units > 0 && vtd_cell_shares_ept(cell_list))
+		vtd_flush_all_caches();
+}
+
+static int vtd_root_cell_map(const struct jailhouse_memory *part)
+{
+	return vtd_map_memory(cell_list, part);
+}
 
+void vtd_cell_exit(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_pci_device *dev;
+	struct jailhouse_memory *mem;
+	unsigned int n;
+
+	if (dmar_units == 0)
+		return;
+
+	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
+		config->cpu_set_size;
 	dev = (void *)mem +
+		config->num_memory_regions * sizeof(struct jailhouse_memory) +
 		config->num_irq_lines * sizeof(struct jailhouse_irq_line) +
 		config->pio_bitmap_size;
 
-	for (n = 0; n < config->num_pci_devices; n++)
-		if (!vtd_add_device_to_cell(cell, &dev[n]))
-			/* FIXME: release vtd.page_table,
-			 * revert device additions*/
-			return -ENOMEM;
+	vtd_return_devices(dev, config->num_pci_devices);
 
-	/* Brute-force write-back of CPU caches in case the hardware accesses
-	 * translation structures non-coherently */
-	asm volatile("wbinvd");
+	vtd_clear_irq_lines(config);
 
-	for (n = 0; n < dmar_units; n++, reg_base += PAGE_SIZE) {
-		if (!(mmio_read32(reg_base + VTD_GSTS_REG) & VTD_GSTS_TE)) {
-			mmio_write64(reg_base + VTD_RTADDR_REG,
-				     page_map_hvirt2phys(root_entry_table));
-			mmio_write32(reg_base + VTD_GCMD_REG, VTD_GCMD_SRTP);
-			while (!(mmio_read32(reg_base + VTD_GSTS_REG) &
-				 VTD_GSTS_SRTP))
-				cpu_relax();
-
-			mmio_write32(reg_base + VTD_GCMD_REG, VTD_GCMD_TE);
-		} else {
-			// cache flush, somehow
-		}
+	/* a shared EPT is released by vmx_cell_exit */
+	for (n = 0; n < config->num_memory_regions; n++, mem++) {
+		if (!(mem->access_flags & JAILHOUSE_MEM_DMA))
+			continue;
+		if (!vtd_cell_shares_ept(cell))
+			page_map_destroy(cell->vtd.page_table, mem->virt_start,
+					 mem->size, dmar_pt_levels,
+					 dmar_map_flags);
+		if (mem->access_flags & JAILHOUSE_MEM_COMM_REGION ||
+		    non_root_cell_uses_memory(mem))
+			continue;
+		if (root_cell_remap(mem, vtd_root_cell_map))
+			printk("WARNING: Failed to return DMA memory %p to "
+			       "root cell\n", mem->phys_start);
 	}
+	if (!vtd_cell_shares_ept(cell))
+		page_free_node(cell->vtd.page_table, 1,
+			       JAILHOUSE_POOL_USER_VTD);
 
-	return 0;
+	vtd_flush_all_caches();
 }
 
 void vtd_shutdown(void)
 {
-	void *reg_base = dmar_reg_base;
 	unsigned int n;
 
-	for (n = 0; n < dmar_units; n++, reg_base += PAGE_SIZE)
-		mmio_write32(reg_base + VTD_GCMD_REG, 0);
+	for (n = 0; n < dmar_units; n++)
+		mmio_write32(units[n].reg_base + VTD_GCMD_REG, 0);
+}
+
+#else /* CONFIG_X86_NO_VTD */
+
+int vtd_init(void)
+{
+	printk("WARNING: VT-d support not built, no DMA isolation!\n");
+	return 0;
+}
+
+int vtd_cell_init(struct cell *cell, struct jailhouse_cell_desc *config)
+{
+	return 0;
+}
+
+int vtd_map_memory_region(struct cell *cell,
+			  const struct jailhouse_memory *mem)
+{
+	return 0;
+}
+
+void vtd_enable_units(void)
+{
+}
+
+void vtd_root_cell_shrink(struct jailhouse_cell_desc *config)
+{
 }
+
+void vtd_root_cell_ept_unmapped(void)
+{
+}
+
+bool vtd_cell_shares_ept(struct cell *cell)
+{
+	return false;
+}
+
+void vtd_cell_exit(struct cell *cell)
+{
+}
+
+void vtd_shutdown(void)
+{
+}
+
+#endif /* CONFIG_X86_NO_VTD */
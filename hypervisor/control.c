@@ -12,16 +12,52 @@
 
 #include <jailhouse/entry.h>
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/string.h>
 #include <asm/bitops.h>
 #include <asm/spinlock.h>
 
+/* remap window for reading cell configs, larger ones are copied in chunks */
+#define CONFIG_COPY_PAGES	16
+
+/*
+ * Memory mapped for a new cell per hypercall. Parts end on multiples of it
+ * so that splitting regions does not rule out huge pages.
+ */
+#define CELL_CREATE_CHUNK_SIZE	(1UL << 30)
+
+/* bounds the debug port time a cell can take with one console flush */
+#define CONSOLE_FLUSH_MAX	256
+
 struct jailhouse_system *system_config;
 struct cell *cell_list;
 
 static DEFINE_SPINLOCK(shutdown_lock);
+/* serializes cell_list updates against doorbell lookups */
+static DEFINE_SPINLOCK(cell_list_lock);
+/* guards the flush state of the cells' consoles */
+static DEFINE_SPINLOCK(console_lock);
+/*
+ * Set while a cell is created or destroyed, stopped or started. The root
+ * cell may run meanwhile, so concurrent requests are refused rather than
+ * waited for.
+ */
+static unsigned long management_busy;
+
+/*
+ * A cell creation that has to be continued by further hypercalls of its
+ * requester, or aborted by it. As long as it is pending, other management
+ * requests fail.
+ */
+static struct {
+	struct cell *cell;
+	struct cell *requester;
+	unsigned long config_address;
+	unsigned int region;
+	unsigned long offset;
+} creation;
 
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set, int exception)
 {
@@ -32,14 +68,28 @@ unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set, int exception)
 	return cpu;
 }
 
+static bool management_begin(void)
+{
+	if (test_and_set_bit(0, &management_busy))
+		return false;
+	if (creation.cell) {
+		clear_bit(0, &management_busy);
+		return false;
+	}
+	return true;
+}
+
+static void management_end(void)
+{
+	clear_bit(0, &management_busy);
+}
+
 static void cell_suspend(struct per_cpu *cpu_data)
 {
 	struct cell *cell = cpu_data->cell;
-	unsigned int cpu;
 
-	for_each_cpu_except(cpu, cell->cpu_set, cpu_data->cpu_id)
-		arch_suspend_cpu(cpu);
-	printk("Suspended cell \"%s\"\n", cell->name);
+	arch_suspend_cpus(cell->cpu_set, cpu_data->cpu_id);
+	trace_event(cpu_data, JAILHOUSE_TRACE_CELL_SUSPEND, cell->id, 0);
 }
 
 static void cell_resume(struct per_cpu *cpu_data)
@@ -48,6 +98,14 @@ static void cell_resume(struct per_cpu *cpu_data)
 
 	for_each_cpu_except(cpu, cpu_data->cell->cpu_set, cpu_data->cpu_id)
 		arch_resume_cpu(cpu);
+	trace_event(cpu_data, JAILHOUSE_TRACE_CELL_RESUME,
+		    cpu_data->cell->id, 0);
+}
+
+static void cell_management_epilogue(struct per_cpu *cpu_data)
+{
+	cell_resume(cpu_data);
+	management_end();
 }
 
 static unsigned int get_free_cell_id(void)
@@ -65,27 +123,159 @@ retry:
 	return id;
 }
 
+static u64 mem_start(const struct jailhouse_memory *mem, bool virt)
+{
+	return virt ? mem->virt_start : mem->phys_start;
+}
+
+static unsigned int mem_index_pages(struct jailhouse_cell_desc *config)
+{
+	return PAGE_ALIGN(config->num_memory_regions * 2 *
+			  sizeof(struct jailhouse_memory *)) / PAGE_SIZE;
+}
+
+/* sorts the regions into index by their start, rejecting overlaps */
+static int mem_index_build(struct jailhouse_memory **index,
+			   struct jailhouse_memory *mem, unsigned int num,
+			   bool virt)
+{
+	unsigned int n, i;
+	u64 start;
+
+	for (n = 0; n < num; n++, mem++) {
+		start = mem_start(mem, virt);
+		for (i = n; i > 0; i--) {
+			if (mem_start(index[i - 1], virt) < start)
+				break;
+			index[i] = index[i - 1];
+		}
+		index[i] = mem;
+	}
+
+	for (n = 1; n < num; n++)
+		if (mem_start(index[n], virt) - mem_start(index[n - 1], virt) <
+		    index[n - 1]->size) {
+			printk("FATAL: Overlapping memory regions at %p\n",
+			       mem_start(index[n], virt));
+			return -EINVAL;
+		}
+	return 0;
+}
+
+/* returns the position of the first region ending above addr */
+static unsigned int mem_index_search(struct jailhouse_memory **index,
+				     unsigned int num, u64 addr, bool virt)
+{
+	unsigned int lower = 0, upper = num, n;
+
+	while (lower < upper) {
+		n = (lower + upper) / 2;
+		if (mem_start(index[n], virt) + index[n]->size <= addr)
+			lower = n + 1;
+		else
+			upper = n;
+	}
+	return lower;
+}
+
+static struct jailhouse_memory *mem_index_find(struct jailhouse_memory **index,
+					       unsigned int num, u64 addr,
+					       bool virt)
+{
+	unsigned int n = mem_index_search(index, num, addr, virt);
+
+	if (n < num && addr >= mem_start(index[n], virt))
+		return index[n];
+	return NULL;
+}
+
+static void mem_index_exit(struct cell *cell)
+{
+	page_free_node(cell->mem_by_phys, mem_index_pages(cell->config),
+		       JAILHOUSE_POOL_USER_CELL);
+	cell->mem_by_phys = cell->mem_by_virt = NULL;
+}
+
+static int mem_index_init(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	unsigned int num = config->num_memory_regions;
+	int err;
+
+	if (num == 0)
+		return 0;
+
+	cell->mem_by_phys = page_alloc_node(cell->numa_node,
+					    mem_index_pages(config),
+					    JAILHOUSE_POOL_USER_CELL);
+	if (!cell->mem_by_phys)
+		return -ENOMEM;
+	cell->mem_by_virt = cell->mem_by_phys + num;
+
+	err = mem_index_build(cell->mem_by_phys,
+			      jailhouse_cell_mem_regions(config), num, false);
+	if (!err)
+		err = mem_index_build(cell->mem_by_virt,
+				      jailhouse_cell_mem_regions(config), num,
+				      true);
+	if (err)
+		mem_index_exit(cell);
+	return err;
+}
+
+/* the region of the cell containing host-physical address addr, or NULL */
+struct jailhouse_memory *cell_mem_by_phys(struct cell *cell, u64 addr)
+{
+	return mem_index_find(cell->mem_by_phys,
+			      cell->config->num_memory_regions, addr, false);
+}
+
+/* the region of the cell containing guest-physical address addr, or NULL */
+struct jailhouse_memory *cell_mem_by_virt(struct cell *cell, u64 addr)
+{
+	return mem_index_find(cell->mem_by_virt,
+			      cell->config->num_memory_regions, addr, true);
+}
+
+/* checks if any region of the cell overlaps mem in host-physical space */
+bool cell_mem_overlaps(struct cell *cell, const struct jailhouse_memory *mem)
+{
+	unsigned int num = cell->config->num_memory_regions;
+	unsigned int n = mem_index_search(cell->mem_by_phys, num,
+					  mem->phys_start, false);
+
+	return n < num && cell->mem_by_phys[n]->phys_start <
+		mem->phys_start + mem->size;
+}
+
 int cell_init(struct cell *cell, struct jailhouse_cell_desc *config,
 	      bool copy_cpu_set)
 {
-	unsigned long *config_cpu_set =
-		(unsigned long *)(((void *)config) +
-				  sizeof(struct jailhouse_cell_desc));
+	unsigned long *config_cpu_set = jailhouse_cell_cpu_set(config);
 	unsigned long cpu_set_size = config->cpu_set_size;
 	struct jailhouse_memory *config_ram =
-		(struct jailhouse_memory *)(((void *)config_cpu_set) +
-					    cpu_set_size);
+		jailhouse_cell_mem_regions(config);
 	struct cpu_set *cpu_set;
+	int err;
 
 	memcpy(cell->name, config->name, sizeof(cell->name));
 	cell->id = get_free_cell_id();
+	cell->config = config;
 
 	if (cpu_set_size > PAGE_SIZE)
 		return -EINVAL;
-	else if (cpu_set_size > sizeof(cell->small_cpu_set.bitmap)) {
-		cpu_set = page_alloc(&mem_pool, 1);
-		if (!cpu_set)
+
+	err = mem_index_init(cell);
+	if (err)
+		return err;
+
+	if (cpu_set_size > sizeof(cell->small_cpu_set.bitmap)) {
+		cpu_set = page_alloc(&mem_pool, 1,
+				     JAILHOUSE_POOL_USER_CPU_SET);
+		if (!cpu_set) {
+			mem_index_exit(cell);
 			return -ENOMEM;
+		}
 		cpu_set->max_cpu_id =
 			((PAGE_SIZE - sizeof(unsigned long)) * 8) - 1;
 	} else {
@@ -98,23 +288,59 @@ int cell_init(struct cell *cell, struct jailhouse_cell_desc *config,
 		memcpy(cell->cpu_set->bitmap, config_cpu_set, cpu_set_size);
 
 	cell->page_offset = config_ram->phys_start;
+	cell->doorbell_vector = config->doorbell_vector;
 
 	return 0;
 }
 
-static void destroy_cpu_set(struct cell *cell)
+static void cell_info_update_cpus(struct cell *cell)
 {
-	if (cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+	struct jailhouse_cell_info *info = cell->info;
+	unsigned int cpu, n = 0;
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		if (n == JAILHOUSE_CELL_INFO_MAX_CPUS)
+			break;
+		info->cpus[n].cpu_id = cpu;
+		info->cpus[n].phys_id = arch_cpu_phys_id(cpu);
+		n++;
+	}
+	info->num_cpus = n;
 }
 
-int check_mem_regions(struct jailhouse_cell_desc *config)
+static void cell_info_init(struct cell *cell)
 {
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_cell_info *info = cell->info;
 	struct jailhouse_memory *mem;
 	unsigned int n;
 
-	mem = (void *)config + sizeof(struct jailhouse_cell_desc) +
-		config->cpu_set_size;
+	memcpy(info->signature, JAILHOUSE_CELL_INFO_SIGNATURE,
+	       sizeof(info->signature));
+	info->tsc_khz = hypervisor_header.tsc_khz;
+	info->cell_id = cell->id;
+	memcpy(info->name, cell->name, sizeof(info->name));
+
+	cell_info_update_cpus(cell);
+
+	mem = jailhouse_cell_mem_regions(config);
+	for (n = 0; n < config->num_memory_regions &&
+	     n < JAILHOUSE_CELL_INFO_MAX_MEMORY; n++)
+		info->memory[n] = mem[n];
+	info->num_memory_regions = n;
+}
+
+static void destroy_cpu_set(struct cell *cell)
+{
+	if (cell->cpu_set != &cell->small_cpu_set)
+		page_free(&mem_pool, cell->cpu_set, 1,
+			  JAILHOUSE_POOL_USER_CPU_SET);
+}
+
+static int check_mem_regions(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_memory *mem = jailhouse_cell_mem_regions(config);
+	unsigned int n;
 
 	for (n = 0; n < config->num_memory_regions; n++, mem++) {
 		if (mem->phys_start & ~PAGE_MASK ||
@@ -130,56 +356,325 @@ int check_mem_regions(struct jailhouse_cell_desc *config)
 	return 0;
 }
 
-int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
+/* the MSR numbers of a range must not wrap around to 0 */
+static int check_msr_ranges(struct jailhouse_cell_desc *config)
+{
+	struct jailhouse_msr_range *range = jailhouse_cell_msr_ranges(config);
+	unsigned int n;
+
+	for (n = 0; n < config->num_msr_ranges; n++, range++)
+		if ((u64)range->start + range->num > 0x100000000ULL) {
+			printk("FATAL: Invalid MSR range (%x, %x)\n",
+			       range->start, range->num);
+			return -EINVAL;
+		}
+	return 0;
+}
+
+/*
+ * Validates a config of size bytes in a single pass. Afterwards, its
+ * sections can be indexed directly.
+ */
+int check_cell_config(struct jailhouse_cell_desc *config, unsigned long size)
+{
+	int err;
+
+	if (size < sizeof(struct jailhouse_cell_desc) ||
+	    memcmp(config->signature, JAILHOUSE_CELL_DESC_SIGNATURE,
+		   sizeof(config->signature)) != 0) {
+		printk("FATAL: Invalid cell config signature\n");
+		return -EINVAL;
+	}
+	if (config->revision != JAILHOUSE_CELL_DESC_REVISION) {
+		printk("FATAL: Unsupported cell config revision %d\n",
+		       config->revision);
+		return -EINVAL;
+	}
+	if (config->total_size != size ||
+	    jailhouse_cell_config_size(config) != size) {
+		printk("FATAL: Inconsistent cell config size\n");
+		return -EINVAL;
+	}
+	if (config->name[JAILHOUSE_CELL_NAME_MAXLEN] != 0)
+		return -EINVAL;
+
+	err = check_msr_ranges(config);
+	if (err)
+		return err;
+
+	return check_mem_regions(config);
+}
+
+/* checks if any non-root cell in cell_list still uses parts of mem */
+bool non_root_cell_uses_memory(const struct jailhouse_memory *mem)
+{
+	struct cell *cell;
+
+	for (cell = cell_list->next; cell; cell = cell->next)
+		if (cell_mem_overlaps(cell, mem))
+			return true;
+	return false;
+}
+
+/* like non_root_cell_uses_memory, but ignoring shared communication regions */
+bool non_root_cell_owns_memory(const struct jailhouse_memory *mem)
+{
+	struct jailhouse_memory **index;
+	unsigned int num, n;
+	struct cell *cell;
+
+	for (cell = cell_list->next; cell; cell = cell->next) {
+		index = cell->mem_by_phys;
+		num = cell->config->num_memory_regions;
+		for (n = mem_index_search(index, num, mem->phys_start, false);
+		     n < num &&
+		     index[n]->phys_start < mem->phys_start + mem->size; n++)
+			if (!(index[n]->access_flags &
+			      JAILHOUSE_MEM_COMM_REGION))
+				return true;
+	}
+	return false;
+}
+
+/*
+ * Hand those parts of mem back to the root cell that its configuration
+ * covers. map is called with each part, translated to the root cell's
+ * address and access flags.
+ */
+int root_cell_remap(const struct jailhouse_memory *mem,
+		    int (*map)(const struct jailhouse_memory *part))
+{
+	unsigned int num = cell_list->config->num_memory_regions;
+	const struct jailhouse_memory *root_mem;
+	struct jailhouse_memory part;
+	unsigned long start, end;
+	unsigned int n;
+	int err;
+
+	/* only visit the root regions overlapping mem, ordered by address */
+	for (n = mem_index_search(cell_list->mem_by_phys, num,
+				  mem->phys_start, false); n < num; n++) {
+		root_mem = cell_list->mem_by_phys[n];
+		if (root_mem->phys_start >= mem->phys_start + mem->size)
+			break;
+
+		start = mem->phys_start > root_mem->phys_start ?
+			mem->phys_start : root_mem->phys_start;
+		end = mem->phys_start + mem->size <
+			root_mem->phys_start + root_mem->size ?
+			mem->phys_start + mem->size :
+			root_mem->phys_start + root_mem->size;
+		if (start >= end)
+			continue;
+
+		part.phys_start = start;
+		part.virt_start = root_mem->virt_start +
+			(start - root_mem->phys_start);
+		part.size = end - start;
+		part.access_flags = root_mem->access_flags;
+
+		err = map(&part);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static void *map_cell_config(unsigned long config_address,
+			     unsigned int pages)
+{
+	void *mapping;
+
+	mapping = page_alloc(&remap_pool, pages, JAILHOUSE_POOL_USER_REMAP);
+	if (!mapping)
+		return NULL;
+
+	if (page_map_create(hv_page_table, config_address & PAGE_MASK,
+			    pages * PAGE_SIZE, (unsigned long)mapping,
+			    PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
+			    PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE)) {
+		page_map_destroy(hv_page_table, (unsigned long)mapping,
+				 pages * PAGE_SIZE, PAGE_DIR_LEVELS,
+				 PAGE_MAP_COHERENT);
+		page_free(&remap_pool, mapping, pages,
+			  JAILHOUSE_POOL_USER_REMAP);
+		return NULL;
+	}
+	return mapping;
+}
+
+static void unmap_cell_config(void *mapping, unsigned int pages)
+{
+	page_map_destroy(hv_page_table, (unsigned long)mapping,
+			 pages * PAGE_SIZE, PAGE_DIR_LEVELS,
+			 PAGE_MAP_COHERENT);
+	page_free(&remap_pool, mapping, pages, JAILHOUSE_POOL_USER_REMAP);
+}
+
+static unsigned int cell_config_pages(struct jailhouse_cell_desc *config)
+{
+	return PAGE_ALIGN(config->total_size) / PAGE_SIZE;
+}
+
+/*
+ * Streams the config into dest through a window of a few remapped pages,
+ * so that large configs do not require a large remap area.
+ */
+static int copy_cell_config(void *dest, unsigned long config_address,
+			    unsigned long size)
+{
+	unsigned long page_offs, len;
+	unsigned int pages;
+	void *mapping;
+
+	while (size > 0) {
+		page_offs = config_address & ~PAGE_MASK;
+		pages = PAGE_ALIGN(page_offs + size) / PAGE_SIZE;
+		if (pages > CONFIG_COPY_PAGES)
+			pages = CONFIG_COPY_PAGES;
+		len = pages * PAGE_SIZE - page_offs;
+		if (len > size)
+			len = size;
+
+		mapping = map_cell_config(config_address, pages);
+		if (!mapping)
+			return -ENOMEM;
+		memcpy(dest, mapping + page_offs, len);
+		unmap_cell_config(mapping, pages);
+
+		dest += len;
+		config_address += len;
+		size -= len;
+	}
+	return 0;
+}
+
+/* returns -EAGAIN if regions remain to be mapped by the next hypercall */
+static int cell_create_map_chunk(struct cell *cell)
+{
+	struct jailhouse_cell_desc *config = cell->config;
+	struct jailhouse_memory *mem, part;
+	unsigned long mapped = 0, limit;
+	u64 chunk_offset;
+	int err;
+
+	for (; creation.region < config->num_memory_regions;
+	     creation.region++, creation.offset = 0) {
+		mem = jailhouse_cell_mem_regions(config) + creation.region;
+
+		while (creation.offset < mem->size) {
+			if (mapped >= CELL_CREATE_CHUNK_SIZE)
+				return -EAGAIN;
+
+			part = *mem;
+			part.phys_start += creation.offset;
+			part.virt_start += creation.offset;
+			part.size -= creation.offset;
+			chunk_offset = part.virt_start &
+				(CELL_CREATE_CHUNK_SIZE - 1);
+			limit = CELL_CREATE_CHUNK_SIZE - chunk_offset;
+			if (part.size > limit)
+				part.size = limit;
+
+			err = arch_map_memory_region(cell, &part);
+			if (err)
+				return err;
+
+			creation.offset += part.size;
+			mapped += part.size;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The memory of the new cell is mapped in chunks while the root cell keeps
+ * running. The requester repeats the hypercall with the same arguments as
+ * long as it returns -EAGAIN, or passes a config_size of 0 to abort.
+ */
+int cell_create(struct per_cpu *cpu_data, unsigned long config_address,
+		unsigned long config_size)
 {
-	unsigned long header_size, total_size;
-	struct jailhouse_cell_desc *cfg;
+	struct jailhouse_cell_desc *cfg_copy;
+	unsigned long stopped, copy_pages;
 	struct cpu_set *shrinking_set;
 	unsigned int cell_pages, cpu;
 	struct cell *cell, *last;
-	int err;
+	int err, node;
 
-	cell_suspend(cpu_data);
+	if (config_size > mem_pool.pages * PAGE_SIZE)
+		return -EINVAL;
 
-	header_size = (config_address & ~PAGE_MASK) +
-		sizeof(struct jailhouse_cell_desc);
+	/* management_begin would refuse to continue a pending creation */
+	if (test_and_set_bit(0, &management_busy))
+		return -EBUSY;
 
-	err = page_map_create(hv_page_table, config_address & PAGE_MASK,
-			      header_size, FOREIGN_MAPPING_BASE,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS);
-	if (err)
-		goto resume_out;
+	if (creation.cell) {
+		cell = creation.cell;
+		cfg_copy = cell->config;
+		/* the checked copy is authoritative, not the repeated size */
+		if (cpu_data->cell != creation.requester ||
+		    config_address != creation.config_address ||
+		    (config_size != 0 && config_size != cfg_copy->total_size)) {
+			err = -EBUSY;
+			goto end_out;
+		}
+		copy_pages = cell_config_pages(cfg_copy);
+		cell_pages = PAGE_ALIGN(sizeof(*cell)) / PAGE_SIZE;
+		shrinking_set = cpu_data->cell->cpu_set;
+		if (config_size == 0) {
+			creation.cell = NULL;
+			printk("Aborted creation of cell \"%s\"\n", cell->name);
+			err = 0;
+			goto err_cell_abort;
+		}
+		goto map_chunk;
+	}
 
-	cfg = (struct jailhouse_cell_desc *)(FOREIGN_MAPPING_BASE +
-					     (config_address & ~PAGE_MASK));
-	total_size = jailhouse_cell_config_size(cfg);
-	if (total_size >
-	    hypervisor_header.possible_cpus * NUM_FOREIGN_PAGES * PAGE_SIZE) {
-		total_size = PAGE_SIZE;
+	/* the copy is taken before the config is checked, bound it first */
+	if (config_size < sizeof(struct jailhouse_cell_desc)) {
+		err = -EINVAL;
+		goto end_out;
+	}
+
+	/*
+	 * The root cell keeps running while the new cell is prepared. Only
+	 * the final hand-over of its resources stops it.
+	 */
+
+	/*
+	 * Keep a private copy, it is needed again when destroying the cell,
+	 * and the root cell may modify the original meanwhile.
+	 */
+	copy_pages = PAGE_ALIGN(config_size) / PAGE_SIZE;
+	cfg_copy = page_alloc_node(numa_node_of_cpu(cpu_data->cpu_id),
+				   copy_pages, JAILHOUSE_POOL_USER_CELL);
+	if (!cfg_copy) {
 		err = -ENOMEM;
-		goto unmap_out;
+		goto end_out;
 	}
 
-	err = page_map_create(hv_page_table, config_address & PAGE_MASK,
-			      total_size, FOREIGN_MAPPING_BASE,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS);
+	err = copy_cell_config(cfg_copy, config_address,
+			       copy_pages * PAGE_SIZE < config_size ?
+			       copy_pages * PAGE_SIZE : config_size);
 	if (err)
-		goto unmap_out;
+		goto err_free_config;
 
-	err = check_mem_regions(cfg);
+	err = check_cell_config(cfg_copy, config_size);
 	if (err)
-		goto unmap_out;
+		goto err_free_config;
 
+	/* the cell holds the I/O and MSR bitmaps, keep it close to its CPUs */
+	node = numa_node_of_cell(cfg_copy);
 	cell_pages = PAGE_ALIGN(sizeof(*cell)) / PAGE_SIZE;
-	cell = page_alloc(&mem_pool, cell_pages);
+	cell = page_alloc_node(node, cell_pages, JAILHOUSE_POOL_USER_CELL);
 	if (!cell) {
 		err = -ENOMEM;
-		goto unmap_out;
+		goto err_free_config;
 	}
 
-	err = cell_init(cell, cfg, true);
+	cell->numa_node = node;
+	err = cell_init(cell, cfg_copy, true);
 	if (err)
 		goto err_free_cell;
 
@@ -203,48 +698,578 @@ int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 			goto err_free_cpu_set;
 		}
 
+	cell->info = page_alloc_node(node, 1, JAILHOUSE_POOL_USER_CELL);
+	if (!cell->info) {
+		err = -ENOMEM;
+		goto err_free_cpu_set;
+	}
+	cell_info_init(cell);
+
+	cell->console = page_alloc_node(node, 1, JAILHOUSE_POOL_USER_CELL);
+	if (!cell->console) {
+		err = -ENOMEM;
+		goto err_free_info;
+	}
+	memcpy(cell->console->signature, JAILHOUSE_CELL_CONSOLE_SIGNATURE,
+	       sizeof(cell->console->signature));
+	cell->console_flushed = 0;
+	cell->console_flushing = false;
+
+	err = arch_cell_create(cpu_data, cell, cfg_copy);
+	if (err)
+		goto err_free_console;
+
+	creation.cell = cell;
+	creation.requester = cpu_data->cell;
+	creation.config_address = config_address;
+	creation.region = 0;
+	creation.offset = 0;
+
+map_chunk:
+	err = cell_create_map_chunk(cell);
+	if (err == -EAGAIN)
+		goto end_out;
+	creation.cell = NULL;
+	if (err)
+		goto err_cell_abort;
+
+	/* the requester may have moved to another CPU meanwhile */
+	if (cpu_data->cpu_id <= cell->cpu_set->max_cpu_id &&
+	    test_bit(cpu_data->cpu_id, cell->cpu_set->bitmap)) {
+		err = -EBUSY;
+		goto err_cell_abort;
+	}
+
+	stopped = read_tsc();
+	cell_suspend(cpu_data);
+
 	for_each_cpu(cpu, cell->cpu_set)
 		clear_bit(cpu, shrinking_set->bitmap);
 
-	err = arch_cell_create(cpu_data, cell, cfg);
-	if (err)
-		goto err_restore_cpu_set;
+	arch_cell_commit(cpu_data, cell, cfg_copy);
 
+	spin_lock(&cell_list_lock);
 	last = cell_list;
 	while (last->next)
 		last = last->next;
 	last->next = cell;
+	spin_unlock(&cell_list_lock);
 
-	/* update cell references and clean up before releasing the cpus of
-	 * the new cell */
-	for_each_cpu(cpu, cell->cpu_set)
+	/* update cell references before releasing the cpus of the new cell */
+	for_each_cpu(cpu, cell->cpu_set) {
 		per_cpu(cpu)->cell = cell;
+		arch_reset_cpu(cpu);
+	}
 
-	printk("Created cell \"%s\"\n", cell->name);
+	cell_resume(cpu_data);
+	stopped = read_tsc() - stopped;
 
-	page_map_destroy(hv_page_table, FOREIGN_MAPPING_BASE, total_size,
-			 PAGE_DIR_LEVELS);
+	if (hypervisor_header.tsc_khz)
+		printk("Created cell \"%s\", root cell stopped for %lu us\n",
+		       cell->name, stopped * 1000 / hypervisor_header.tsc_khz);
+	else
+		printk("Created cell \"%s\", root cell stopped for %lu "
+		       "cycles\n", cell->name, stopped);
 	page_map_dump_stats("after cell creation");
+	lock_stats_dump("after cell creation");
 
-	for_each_cpu(cpu, cell->cpu_set)
-		arch_reset_cpu(cpu);
+	err = cell->id;
+	goto end_out;
 
-resume_out:
-	cell_resume(cpu_data);
+err_cell_abort:
+	arch_cell_abort(cpu_data, cell);
+err_free_console:
+	mmio_cell_exit(cell);
+	page_free_node(cell->console, 1, JAILHOUSE_POOL_USER_CELL);
+err_free_info:
+	page_free_node(cell->info, 1, JAILHOUSE_POOL_USER_CELL);
+err_free_cpu_set:
+	destroy_cpu_set(cell);
+	mem_index_exit(cell);
+err_free_cell:
+	page_free_node(cell, cell_pages, JAILHOUSE_POOL_USER_CELL);
+err_free_config:
+	page_free_node(cfg_copy, copy_pages, JAILHOUSE_POOL_USER_CELL);
+end_out:
+	management_end();
 
 	return err;
+}
+
+int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *root_cell = cell_list;
+	struct cell *cell, *previous;
+	unsigned int cpu;
+	int err = 0;
+
+	/* only the root cell can hand out and take back resources */
+	if (cpu_data->cell != root_cell)
+		return -EPERM;
+	if (id == root_cell->id)
+		return -EINVAL;
+	if (!management_begin())
+		return -EBUSY;
+
+	cell_suspend(cpu_data);
+
+	/* unlink first so that no doorbell can reach the cell anymore */
+	spin_lock(&cell_list_lock);
+	for (previous = root_cell; previous->next; previous = previous->next)
+		if (previous->next->id == id)
+			break;
+	cell = previous->next;
+	if (cell)
+		previous->next = cell->next;
+	spin_unlock(&cell_list_lock);
+
+	if (!cell) {
+		err = -ENOENT;
+		goto resume_out;
+	}
 
-err_restore_cpu_set:
+	/* park the CPUs of the cell, other cells continue to run */
+	arch_suspend_cpus(cell->cpu_set, -1);
+
+	printk("Closing cell \"%s\"\n", cell->name);
+
+	arch_cell_destroy(cpu_data, cell);
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		set_bit(cpu, root_cell->cpu_set->bitmap);
+		per_cpu(cpu)->cell = root_cell;
+	}
+
+	/* the CPUs wait for the root cell to bring them up again */
 	for_each_cpu(cpu, cell->cpu_set)
-		set_bit(cpu, shrinking_set->bitmap);
-err_free_cpu_set:
+		arch_park_cpu(cpu);
+
+	mmio_cell_exit(cell);
+	page_free_node(cell->console, 1, JAILHOUSE_POOL_USER_CELL);
+	page_free_node(cell->info, 1, JAILHOUSE_POOL_USER_CELL);
+	mem_index_exit(cell);
+	page_free_node(cell->config, cell_config_pages(cell->config),
+		       JAILHOUSE_POOL_USER_CELL);
 	destroy_cpu_set(cell);
-err_free_cell:
-	page_free(&mem_pool, cell, cell_pages);
-unmap_out:
-	page_map_destroy(hv_page_table, FOREIGN_MAPPING_BASE, total_size,
-			 PAGE_DIR_LEVELS);
-	goto resume_out;
+	page_free_node(cell, PAGE_ALIGN(sizeof(*cell)) / PAGE_SIZE,
+		       JAILHOUSE_POOL_USER_CELL);
+
+	page_map_dump_stats("after cell destruction");
+	lock_stats_dump("after cell destruction");
+
+resume_out:
+	cell_management_epilogue(cpu_data);
+
+	return err;
+}
+
+/*
+ * On success, the calling cell is suspended and has to be resumed via
+ * cell_management_epilogue.
+ */
+static int cell_management_prologue(struct per_cpu *cpu_data,
+				    unsigned long id, struct cell **cell_ptr)
+{
+	struct cell *cell;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+	if (id == cell_list->id)
+		return -EINVAL;
+	if (!management_begin())
+		return -EBUSY;
+
+	cell_suspend(cpu_data);
+
+	for (cell = cell_list->next; cell; cell = cell->next)
+		if (cell->id == id) {
+			*cell_ptr = cell;
+			return 0;
+		}
+
+	cell_management_epilogue(cpu_data);
+	return -ENOENT;
+}
+
+int cell_stop(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	err = cell_management_prologue(cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	if (!cell->stopped) {
+		arch_suspend_cpus(cell->cpu_set, -1);
+
+		err = arch_cell_stop(cpu_data, cell);
+		if (err) {
+			for_each_cpu(cpu, cell->cpu_set)
+				arch_resume_cpu(cpu);
+			goto resume_out;
+		}
+		cell->stopped = true;
+
+		printk("Stopped cell \"%s\"\n", cell->name);
+	}
+
+resume_out:
+	cell_management_epilogue(cpu_data);
+
+	return err;
+}
+
+int cell_start(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	err = cell_management_prologue(cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	if (cell->stopped) {
+		/* the EPT and VT-d tables of the cell are reused as is */
+		arch_cell_start(cpu_data, cell);
+		cell->stopped = false;
+
+		for_each_cpu(cpu, cell->cpu_set)
+			arch_reset_cpu(cpu);
+
+		printk("Started cell \"%s\"\n", cell->name);
+	} else
+		err = -EBUSY;
+
+	cell_management_epilogue(cpu_data);
+
+	return err;
+}
+
+/*
+ * The cell's CPUs are suspended while the CPU moves so that none of them
+ * delivers an IPI based on a half-updated CPU set. The CPU then waits in the
+ * cell for INIT/SIPI, like an AP after reset.
+ */
+int cell_add_cpu(struct per_cpu *cpu_data, unsigned long id,
+		 unsigned long cpu_id)
+{
+	struct cpu_set *root_set = cell_list->cpu_set;
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	err = cell_management_prologue(cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	if (cpu_id > root_set->max_cpu_id ||
+	    !test_bit(cpu_id, root_set->bitmap) ||
+	    cpu_id > cell->cpu_set->max_cpu_id) {
+		err = -EINVAL;
+		goto resume_out;
+	}
+	/* the root cell keeps the CPU it manages cells from */
+	if (cpu_id == cpu_data->cpu_id) {
+		err = -EBUSY;
+		goto resume_out;
+	}
+
+	/* the CPU is stopped along with the root cell */
+	if (!cell->stopped)
+		arch_suspend_cpus(cell->cpu_set, -1);
+
+	err = arch_cell_add_cpu(cpu_data, cell, cpu_id);
+	if (err)
+		goto resume_cell;
+
+	clear_bit(cpu_id, root_set->bitmap);
+	set_bit(cpu_id, cell->cpu_set->bitmap);
+	per_cpu(cpu_id)->cell = cell;
+	cell_info_update_cpus(cell);
+
+	arch_park_cpu(cpu_id);
+
+	printk("Added CPU %d to cell \"%s\"\n", cpu_id, cell->name);
+
+resume_cell:
+	if (!cell->stopped)
+		for_each_cpu_except(cpu, cell->cpu_set, cpu_id)
+			arch_resume_cpu(cpu);
+resume_out:
+	cell_management_epilogue(cpu_data);
+
+	return err;
+}
+
+/*
+ * The CPU is taken away even if the guest is still running on it, so the
+ * cell should release it first. The remaining CPUs are suspended while the
+ * CPU moves and keep running without it afterwards.
+ */
+int cell_remove_cpu(struct per_cpu *cpu_data, unsigned long id,
+		    unsigned long cpu_id)
+{
+	struct jailhouse_irq_line *irq_line;
+	unsigned int n, cpu;
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	if (cpu_id > cell->cpu_set->max_cpu_id ||
+	    !test_bit(cpu_id, cell->cpu_set->bitmap)) {
+		err = -EINVAL;
+		goto resume_out;
+	}
+	/* a cell without CPUs has to be destroyed instead */
+	if (next_cpu(-1, cell->cpu_set, cpu_id) > cell->cpu_set->max_cpu_id) {
+		err = -EBUSY;
+		goto resume_out;
+	}
+	/* interrupts of the cell's devices must not reach the root cell */
+	irq_line = jailhouse_cell_irq_lines(cell->config);
+	for (n = 0; n < cell->config->num_irq_lines; n++)
+		if (irq_line[n].cpu == cpu_id) {
+			err = -EBUSY;
+			goto resume_out;
+		}
+
+	if (!cell->stopped)
+		arch_suspend_cpus(cell->cpu_set, -1);
+
+	err = arch_cell_remove_cpu(cpu_data, cell, cpu_id);
+	if (err) {
+		if (!cell->stopped)
+			for_each_cpu(cpu, cell->cpu_set)
+				arch_resume_cpu(cpu);
+		goto resume_out;
+	}
+
+	clear_bit(cpu_id, cell->cpu_set->bitmap);
+	set_bit(cpu_id, cell_list->cpu_set->bitmap);
+	per_cpu(cpu_id)->cell = cell_list;
+	cell_info_update_cpus(cell);
+
+	/* the root cell brings the CPU up again */
+	arch_park_cpu(cpu_id);
+
+	printk("Removed CPU %d from cell \"%s\"\n", cpu_id, cell->name);
+
+	if (!cell->stopped)
+		for_each_cpu(cpu, cell->cpu_set)
+			arch_resume_cpu(cpu);
+resume_out:
+	cell_management_epilogue(cpu_data);
+
+	return err;
+}
+
+long cpu_get_stat(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long stat)
+{
+	if (cpu_id >= hypervisor_header.possible_cpus ||
+	    stat >= JAILHOUSE_NUM_CPU_STATS)
+		return -EINVAL;
+
+	/* non-root cells may only read the statistics of their own CPUs */
+	if (cpu_data->cell != cell_list &&
+	    per_cpu(cpu_id)->cell != cpu_data->cell)
+		return -EPERM;
+
+	return per_cpu(cpu_id)->stats[stat];
+}
+
+/* the CPU must belong to a stopped non-root cell */
+static int stopped_cell_cpu(unsigned long cpu_id)
+{
+	struct cell *cell;
+
+	if (cpu_id >= hypervisor_header.possible_cpus)
+		return -EINVAL;
+
+	cell = per_cpu(cpu_id)->cell;
+	if (!cell || cell == cell_list)
+		return -EINVAL;
+	if (!cell->stopped)
+		return -EBUSY;
+
+	return 0;
+}
+
+int cpu_get_state(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  struct jailhouse_cpu_state *state)
+{
+	int err;
+
+	if (!management_begin())
+		return -EBUSY;
+
+	err = stopped_cell_cpu(cpu_id);
+	if (!err)
+		err = arch_cpu_get_state(cpu_id, state);
+
+	management_end();
+
+	return err;
+}
+
+/* takes effect when the cell of the CPU is started */
+int cpu_set_state(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  const struct jailhouse_cpu_state *state)
+{
+	int err;
+
+	if (!management_begin())
+		return -EBUSY;
+
+	err = stopped_cell_cpu(cpu_id);
+	if (!err)
+		err = arch_cpu_set_state(cpu_data, cpu_id, state);
+
+	management_end();
+
+	return err;
+}
+
+/* the cell keeps running, its CPUs are only held while its EPT changes */
+int cell_dirty_log(struct per_cpu *cpu_data, unsigned long id,
+		   struct jailhouse_dirty_log *log, u64 *bitmap)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	if (id == cell_list->id)
+		return -EINVAL;
+	if (!management_begin())
+		return -EBUSY;
+
+	for (cell = cell_list->next; cell; cell = cell->next)
+		if (cell->id == id)
+			break;
+	if (!cell) {
+		err = -ENOENT;
+		goto end_out;
+	}
+
+	/* the CPUs of a stopped cell are already parked */
+	if (!cell->stopped)
+		arch_suspend_cpus(cell->cpu_set, -1);
+
+	err = arch_cell_dirty_log(cpu_data, cell, log, bitmap);
+
+	if (!cell->stopped)
+		for_each_cpu(cpu, cell->cpu_set)
+			arch_resume_cpu(cpu);
+
+end_out:
+	management_end();
+
+	return err;
+}
+
+int cell_doorbell(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+	int err = -ENOENT;
+
+	spin_lock(&cell_list_lock);
+
+	for (cell = cell_list; cell; cell = cell->next)
+		if (cell->id == id) {
+			/* the receiver has to opt in by providing a vector */
+			if (cell->doorbell_vector) {
+				arch_cell_doorbell(cpu_data, cell);
+				err = 0;
+			} else
+				err = -EPERM;
+			break;
+		}
+
+	spin_unlock(&cell_list_lock);
+
+	return err;
+}
+
+/* offset of the cell's console into the hypervisor memory */
+long cell_get_console(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+	long offset = -ENOENT;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+
+	spin_lock(&cell_list_lock);
+
+	for (cell = cell_list->next; cell; cell = cell->next)
+		if (cell->id == id) {
+			offset = page_map_hvirt2phys(cell->console) -
+				system_config->hypervisor_memory.phys_start;
+			break;
+		}
+
+	spin_unlock(&cell_list_lock);
+
+	return offset;
+}
+
+/*
+ * Writes pending console output of the calling cell to the debug port, at
+ * most CONSOLE_FLUSH_MAX bytes per call. The lock only guards claiming each
+ * chunk, the slow UART writes run without it. A CPU that finds another one of
+ * its cell flushing leaves the output to it. Returns the bytes still pending.
+ */
+int cell_console_flush(struct per_cpu *cpu_data)
+{
+	struct cell *cell = cpu_data->cell;
+	struct jailhouse_cell_console *console = cell->console;
+	u32 head, len, n, done = 0;
+	char buf[64 + 1];
+
+	if (!console)
+		return -EINVAL;
+
+	spin_lock(&console_lock);
+	if (cell->console_flushing) {
+		spin_unlock(&console_lock);
+		return 0;
+	}
+	cell->console_flushing = true;
+
+	while (1) {
+		head = *(volatile u32 *)&console->head;
+		/* whatever the cell overwrote in the meantime is lost */
+		if (head - cell->console_flushed > JAILHOUSE_CELL_CONSOLE_SIZE)
+			cell->console_flushed =
+				head - JAILHOUSE_CELL_CONSOLE_SIZE;
+
+		len = head - cell->console_flushed;
+		if (len == 0 || done >= CONSOLE_FLUSH_MAX)
+			break;
+		if (len > sizeof(buf) - 1)
+			len = sizeof(buf) - 1;
+		for (n = 0; n < len; n++)
+			buf[n] = console->data[(cell->console_flushed + n) %
+					       JAILHOUSE_CELL_CONSOLE_SIZE];
+		buf[len] = 0;
+		cell->console_flushed += len;
+		done += len;
+
+		spin_unlock(&console_lock);
+		printk("%s", buf);
+		spin_lock(&console_lock);
+	}
+
+	cell->console_flushing = false;
+	spin_unlock(&console_lock);
+
+	return len;
 }
 
 int shutdown(struct per_cpu *cpu_data)
@@ -266,10 +1291,9 @@ int shutdown(struct per_cpu *cpu_data)
 		while (cell) {
 			printk(" Closing cell \"%s\"\n", cell->name);
 
-			for_each_cpu(cpu, cell->cpu_set) {
+			for_each_cpu(cpu, cell->cpu_set)
 				printk("  Releasing CPU %d\n", cpu);
-				arch_shutdown_cpu(cpu);
-			}
+			arch_shutdown_cpus(cell->cpu_set);
 			cell = cell->next;
 		}
 
@@ -0,0 +1,299 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/control.h>
+#include <jailhouse/hypercall.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/string.h>
+#include <asm/bitops.h>
+#include <asm/spinlock.h>
+
+/* serializes the hand-over of batches to worker CPUs */
+static DEFINE_SPINLOCK(async_lock);
+
+/* maps the page of a root cell structure that must not cross it */
+static void *map_root_page(unsigned long address)
+{
+	const struct jailhouse_memory *hv_mem =
+		&system_config->hypervisor_memory;
+	struct jailhouse_memory page = {
+		.phys_start = address & PAGE_MASK,
+		.size = PAGE_SIZE,
+	};
+	void *mapping;
+
+	/* results are written back, keep away from foreign memory */
+	if (page.phys_start < hv_mem->phys_start + hv_mem->size &&
+	    hv_mem->phys_start < page.phys_start + PAGE_SIZE)
+		return NULL;
+	if (non_root_cell_uses_memory(&page))
+		return NULL;
+
+	mapping = page_alloc(&remap_pool, 1, JAILHOUSE_POOL_USER_REMAP);
+	if (!mapping)
+		return NULL;
+
+	if (page_map_create(hv_page_table, page.phys_start, PAGE_SIZE,
+			    (unsigned long)mapping, PAGE_DEFAULT_FLAGS,
+			    PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+			    PAGE_MAP_NO_HUGE)) {
+		page_free(&remap_pool, mapping, 1, JAILHOUSE_POOL_USER_REMAP);
+		return NULL;
+	}
+	return mapping + (address & ~PAGE_MASK);
+}
+
+static void unmap_root_page(void *ptr)
+{
+	unsigned long mapping = (unsigned long)ptr & PAGE_MASK;
+
+	page_map_destroy(hv_page_table, mapping, PAGE_SIZE, PAGE_DIR_LEVELS,
+			 PAGE_MAP_COHERENT);
+	page_free(&remap_pool, (void *)mapping, 1, JAILHOUSE_POOL_USER_REMAP);
+}
+
+/*
+ * The caller may modify the batch concurrently, so num_ops and each
+ * operation are read exactly once and only the local copies are used.
+ */
+static void run_batch(struct per_cpu *cpu_data,
+		      struct jailhouse_hc_batch *batch)
+{
+	unsigned long offs = (unsigned long)batch & ~PAGE_MASK;
+	struct jailhouse_hc_op *op = batch->op;
+	u32 num_ops = *(volatile u32 *)&batch->num_ops;
+	unsigned long arg1, arg2;
+	u32 n, code;
+
+	if (num_ops > (PAGE_SIZE - offs - sizeof(*batch)) / sizeof(*op))
+		num_ops = 0;
+
+	for (n = 0; n < num_ops; n++, op++) {
+		code = *(volatile u32 *)&op->code;
+		arg1 = *(volatile u64 *)&op->arg1;
+		arg2 = *(volatile u64 *)&op->arg2;
+
+		trace_event(cpu_data, JAILHOUSE_TRACE_HYPERCALL, code, arg1);
+		if (code == JAILHOUSE_HC_BATCH)
+			op->result = -EINVAL;
+		else
+			op->result = hypercall(cpu_data, code, arg1, arg2);
+		batch->num_done = n + 1;
+	}
+
+	memory_barrier();
+	batch->status = JAILHOUSE_HC_BATCH_DONE;
+}
+
+static long hypercall_batch(struct per_cpu *cpu_data, unsigned long address)
+{
+	struct jailhouse_hc_batch *batch;
+	struct per_cpu *worker_data;
+	unsigned int worker;
+	long err = 0;
+
+	/* only the root cell is trusted with physical addresses */
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+	if ((address & ~PAGE_MASK) > PAGE_SIZE - sizeof(*batch))
+		return -EINVAL;
+
+	batch = map_root_page(address);
+	if (!batch)
+		return -EINVAL;
+
+	batch->status = JAILHOUSE_HC_BATCH_PENDING;
+	batch->num_done = 0;
+
+	if (!(batch->flags & JAILHOUSE_HC_BATCH_ASYNC)) {
+		run_batch(cpu_data, batch);
+		goto unmap_out;
+	}
+
+	/* the worker must be a running CPU of the caller's cell */
+	worker = batch->worker_cpu;
+	if (worker == cpu_data->cpu_id ||
+	    worker > cell_list->cpu_set->max_cpu_id ||
+	    !test_bit(worker, cell_list->cpu_set->bitmap)) {
+		err = -EINVAL;
+		goto unmap_out;
+	}
+	worker_data = per_cpu(worker);
+
+	spin_lock(&async_lock);
+	if (worker_data->async_batch || worker_data->wait_for_sipi)
+		err = -EBUSY;
+	else
+		worker_data->async_batch = batch;
+	spin_unlock(&async_lock);
+
+	if (err)
+		goto unmap_out;
+
+	/* the worker releases the mapping when done */
+	arch_kick_cpu(worker);
+	return 0;
+
+unmap_out:
+	unmap_root_page(batch);
+	return err;
+}
+
+static long hypercall_cpu_state(struct per_cpu *cpu_data, unsigned long cpu_id,
+				unsigned long address, bool set)
+{
+	struct jailhouse_cpu_state *state;
+	long err;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+	if ((address & ~PAGE_MASK) > PAGE_SIZE - sizeof(*state))
+		return -EINVAL;
+
+	state = map_root_page(address);
+	if (!state)
+		return -EINVAL;
+
+	if (set)
+		err = cpu_set_state(cpu_data, cpu_id, state);
+	else
+		err = cpu_get_state(cpu_data, cpu_id, state);
+
+	unmap_root_page(state);
+	return err;
+}
+
+static long hypercall_dirty_log(struct per_cpu *cpu_data, unsigned long id,
+				unsigned long address)
+{
+	unsigned long offs = address & ~PAGE_MASK;
+	struct jailhouse_dirty_log *log, req;
+	unsigned long max_pages;
+	long err;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+	if (offs > PAGE_SIZE - sizeof(*log))
+		return -EINVAL;
+
+	log = map_root_page(address);
+	if (!log)
+		return -EINVAL;
+
+	/* work on a copy, the caller may modify the request concurrently */
+	memcpy(&req, log, sizeof(req));
+	max_pages = (PAGE_SIZE - offs - sizeof(*log)) / sizeof(u64) * 64;
+	if (req.num_pages > max_pages)
+		req.num_pages = max_pages;
+
+	err = cell_dirty_log(cpu_data, id, &req, log->bitmap);
+	if (!err) {
+		log->num_pages = req.num_pages;
+		log->region_pages = req.region_pages;
+	}
+
+	unmap_root_page(log);
+	return err;
+}
+
+static long hypercall_profile_read(struct per_cpu *cpu_data,
+				   unsigned long cpu_id, unsigned long address)
+{
+	unsigned long offs = address & ~PAGE_MASK;
+	struct jailhouse_profile_read *read;
+	long num;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+	if (offs > PAGE_SIZE - sizeof(*read))
+		return -EINVAL;
+
+	read = map_root_page(address);
+	if (!read)
+		return -EINVAL;
+
+	num = arch_profile_read(cpu_id, read,
+				(PAGE_SIZE - offs - sizeof(*read)) /
+				sizeof(read->sample[0]));
+
+	unmap_root_page(read);
+	return num;
+}
+
+/* called by a kicked CPU on its way back into the cell */
+void hypercall_run_async(struct per_cpu *cpu_data)
+{
+	struct jailhouse_hc_batch *batch = cpu_data->async_batch;
+
+	if (!batch)
+		return;
+
+	run_batch(cpu_data, batch);
+	unmap_root_page(batch);
+
+	spin_lock(&async_lock);
+	cpu_data->async_batch = NULL;
+	spin_unlock(&async_lock);
+
+	/* the root cell may wait for the completion instead of polling */
+	if (cell_list->doorbell_vector)
+		arch_cell_doorbell(cpu_data, cell_list);
+}
+
+long hypercall(struct per_cpu *cpu_data, unsigned long code,
+	       unsigned long arg1, unsigned long arg2)
+{
+	switch (code) {
+	case JAILHOUSE_HC_CELL_CREATE:
+		return cell_create(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_DESTROY:
+		return cell_destroy(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_STOP:
+		return cell_stop(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_START:
+		return cell_start(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_ADD_CPU:
+		return cell_add_cpu(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_REMOVE_CPU:
+		return cell_remove_cpu(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CPU_GET_STAT:
+		return cpu_get_stat(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_DOORBELL:
+		return cell_doorbell(cpu_data, arg1);
+	case JAILHOUSE_HC_POOL_GET_STAT:
+		return page_pool_get_stat(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_GET_CONSOLE:
+		return cell_get_console(cpu_data, arg1);
+	case JAILHOUSE_HC_CONSOLE_FLUSH:
+		return cell_console_flush(cpu_data);
+	case JAILHOUSE_HC_BATCH:
+		return hypercall_batch(cpu_data, arg1);
+	case JAILHOUSE_HC_CPU_GET_STATE:
+		return hypercall_cpu_state(cpu_data, arg1, arg2, false);
+	case JAILHOUSE_HC_CPU_SET_STATE:
+		return hypercall_cpu_state(cpu_data, arg1, arg2, true);
+	case JAILHOUSE_HC_CELL_DIRTY_LOG:
+		return hypercall_dirty_log(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_PROFILE_SET:
+		if (cpu_data->cell != cell_list)
+			return -EPERM;
+		return arch_profile_set(cpu_data, arg1);
+	case JAILHOUSE_HC_PROFILE_READ:
+		return hypercall_profile_read(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_NOP:
+		return 0;
+	default:
+		return -ENOSYS;
+	}
+}
@@ -15,7 +15,22 @@
 
 #define JAILHOUSE_CELL_NAME_MAXLEN	31
 
+#define JAILHOUSE_CELL_DESC_SIGNATURE	"JHCELL"
+/* to be increased on any incompatible change of the binary format */
+#define JAILHOUSE_CELL_DESC_REVISION	2
+
+/*
+ * A cell configuration is a single binary blob: this descriptor, followed
+ * by the cpu set, memory regions, irq lines, pio bitmap, PCI devices and
+ * MSR ranges. The sections are located via jailhouse_cell_*() below.
+ */
 struct jailhouse_cell_desc {
+	char signature[6];
+	__u16 revision;
+	/* size of the whole blob, has to match jailhouse_cell_config_size */
+	__u32 total_size;
+	__u32 padding;
+
 	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
 
 	__u32 cpu_set_size;
@@ -24,19 +39,50 @@ struct jailhouse_cell_desc {
 	__u32 pio_bitmap_size;
 
 	__u32 num_pci_devices;
-
-	__u32 padding[3];
+	__u32 num_msr_ranges;
+
+	/* vector raised by JAILHOUSE_HC_CELL_DOORBELL, 0 to refuse doorbells */
+	__u32 doorbell_vector;
+
+	/* contiguous L3 ways for the cell (Intel CAT capacity bitmask), taken
+	 * from the root cell, 0 to share the root cell's ways. For the root
+	 * cell, 0 means all ways. */
+	__u32 l3_cache_mask;
+	/* share of the memory bandwidth in percent, enforced via Intel MBA,
+	 * 0 for no limit. The root cell cannot be limited. */
+	__u32 mem_bandwidth;
+	/* JAILHOUSE_CELL_* */
+	__u32 flags;
+	/* MWAIT hint (target C-state) for JAILHOUSE_CELL_HLT_EXITING */
+	__u32 idle_mwait_hint;
+	__u32 padding2;
 };
 
+/* config space access only to the cell's PCI devices, mediated by the
+ * hypervisor, requires pci_mmconfig_base */
+#define JAILHOUSE_CELL_MEDIATE_PCI_CONFIG	0x0001
+/* guest HLT traps, the hypervisor idles the CPU via MWAIT and accounts it.
+ * Ignored if the CPU cannot wake up from MWAIT on masked interrupts. */
+#define JAILHOUSE_CELL_HLT_EXITING		0x0002
+/* x86: the EPT is filled on the first access to each part of a region.
+ * Without it, all regions are mapped up front, so the cell never faults. */
+#define JAILHOUSE_CELL_LAZY_EPT			0x0004
+/* x86: the cell owns the performance counters of its CPUs, guests access
+ * them directly. Without it, the counters are hidden from the cell. */
+#define JAILHOUSE_CELL_PMU_PASSTHROUGH		0x0008
+
 #define JAILHOUSE_MEM_READ		0x0001
 #define JAILHOUSE_MEM_WRITE		0x0002
 #define JAILHOUSE_MEM_EXECUTE		0x0004
 #define JAILHOUSE_MEM_DMA		0x0008
+/* stays mapped in the cell the region is taken from */
+#define JAILHOUSE_MEM_COMM_REGION	0x0010
 
 #define JAILHOUSE_MEM_VALID_FLAGS	(JAILHOUSE_MEM_READ | \
 					 JAILHOUSE_MEM_WRITE | \
 					 JAILHOUSE_MEM_EXECUTE | \
-					 JAILHOUSE_MEM_DMA)
+					 JAILHOUSE_MEM_DMA | \
+					 JAILHOUSE_MEM_COMM_REGION)
 
 struct jailhouse_memory {
 	__u64 phys_start;
@@ -45,9 +91,22 @@ struct jailhouse_memory {
 	__u64 access_flags;
 };
 
+/*
+ * MSI of an assigned PCI device, remapped by the IOMMU. num is the index
+ * into the interrupt remapping table that the cell programs into the
+ * device's MSI address, using the remappable format.
+ */
+#define JAILHOUSE_IRQCHIP_IOMMU		0x01
+
 struct jailhouse_irq_line {
 	__u32 num;
 	__u32 irqchip;
+	__u32 cpu;		/* destination, has to belong to the cell */
+	__u16 domain;		/* requester, has to belong to the cell */
+	__u8 bus;
+	__u8 devfn;
+	__u8 vector;
+	__u8 padding[7];
 };
 
 #define JAILHOUSE_PCI_TYPE_DEVICE	0x01
@@ -60,29 +119,119 @@ struct jailhouse_pci_device {
 	__u8 devfn;
 } __attribute__((packed));
 
+/* direct guest access, otherwise MSRs trap */
+#define JAILHOUSE_MSR_READ		0x0001
+#define JAILHOUSE_MSR_WRITE		0x0002
+
+/* Without any ranges, a cell gets direct access to all MSRs the hypervisor
+ * does not have to intercept. */
+struct jailhouse_msr_range {
+	__u32 start;
+	__u32 num;
+	__u32 access_flags;
+	__u32 padding;
+};
+
+#define JAILHOUSE_MAX_NUMA_NODES	4
+
+/*
+ * Additional hypervisor memory local to the listed CPUs. Page tables and
+ * control structures of cells that only run on these CPUs are allocated
+ * from it. Like hypervisor_memory, it must not be part of any cell.
+ */
+struct jailhouse_numa_node {
+	__u64 phys_start;
+	__u64 size;
+	__u64 cpu_set[4];	/* bitmap of CPUs 0..255 */
+};
+
+/*
+ * Let compatibility format MSIs pass VT-d interrupt remapping. The root cell
+ * needs this while Linux runs with intremap=off, but such interrupts are not
+ * isolated: any device can raise any vector on any CPU.
+ */
+#define JAILHOUSE_SYS_VTD_COMPAT_MSI	0x0001
+
 struct jailhouse_system {
 	struct jailhouse_memory hypervisor_memory;
 	struct jailhouse_memory config_memory;
+	__u32 num_numa_nodes;
+	/* JAILHOUSE_SYS_* */
+	__u32 flags;
+	struct jailhouse_numa_node numa_nodes[JAILHOUSE_MAX_NUMA_NODES];
+	/* ECAM window of PCI segment 0, starting at bus 0, 0 if none */
+	__u64 pci_mmconfig_base;
+	__u8 pci_mmconfig_end_bus;
+	__u8 padding2[7];
 	struct jailhouse_cell_desc system;
 };
 
-static inline __u32
+static inline __u64
 jailhouse_cell_config_size(struct jailhouse_cell_desc *cell)
 {
+	/* 64-bit arithmetic, bogus counts must not wrap around */
 	return sizeof(struct jailhouse_cell_desc) +
-		cell->cpu_set_size +
-		cell->num_memory_regions * sizeof(struct jailhouse_memory) +
-		cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
-		cell->pio_bitmap_size +
-		cell->num_pci_devices * sizeof(struct jailhouse_pci_device);
+		(__u64)cell->cpu_set_size +
+		(__u64)cell->num_memory_regions *
+			sizeof(struct jailhouse_memory) +
+		(__u64)cell->num_irq_lines * sizeof(struct jailhouse_irq_line) +
+		(__u64)cell->pio_bitmap_size +
+		(__u64)cell->num_pci_devices *
+			sizeof(struct jailhouse_pci_device) +
+		(__u64)cell->num_msr_ranges *
+			sizeof(struct jailhouse_msr_range);
 }
 
-static inline __u32
+static inline __u64
 jailhouse_system_config_size(struct jailhouse_system *system)
 {
 	return sizeof(system->hypervisor_memory) +
 		sizeof(system->config_memory) +
+		sizeof(system->num_numa_nodes) + sizeof(system->flags) +
+		sizeof(system->numa_nodes) +
+		sizeof(system->pci_mmconfig_base) +
+		sizeof(system->pci_mmconfig_end_bus) +
+		sizeof(system->padding2) +
 		jailhouse_cell_config_size(&system->system);
 }
 
+static inline void *
+jailhouse_cell_cpu_set(struct jailhouse_cell_desc *cell)
+{
+	return (void *)cell + sizeof(struct jailhouse_cell_desc);
+}
+
+static inline struct jailhouse_memory *
+jailhouse_cell_mem_regions(struct jailhouse_cell_desc *cell)
+{
+	return jailhouse_cell_cpu_set(cell) + cell->cpu_set_size;
+}
+
+static inline struct jailhouse_irq_line *
+jailhouse_cell_irq_lines(struct jailhouse_cell_desc *cell)
+{
+	return (void *)(jailhouse_cell_mem_regions(cell) +
+			cell->num_memory_regions);
+}
+
+static inline __u8 *
+jailhouse_cell_pio_bitmap(struct jailhouse_cell_desc *cell)
+{
+	return (void *)(jailhouse_cell_irq_lines(cell) + cell->num_irq_lines);
+}
+
+static inline struct jailhouse_pci_device *
+jailhouse_cell_pci_devices(struct jailhouse_cell_desc *cell)
+{
+	return (void *)(jailhouse_cell_pio_bitmap(cell) +
+			cell->pio_bitmap_size);
+}
+
+static inline struct jailhouse_msr_range *
+jailhouse_cell_msr_ranges(struct jailhouse_cell_desc *cell)
+{
+	return (void *)(jailhouse_cell_pci_devices(cell) +
+			cell->num_pci_devices);
+}
+
 #endif /* !_JAILHOUSE_CELL_CONFIG_H */
@@ -0,0 +1,38 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_CELL_CONSOLE_H
+#define _JAILHOUSE_CELL_CONSOLE_H
+
+/*
+ * Writable page the hypervisor maps into each non-root cell at
+ * JAILHOUSE_CELL_CONSOLE_ADDR, unless a memory region of the cell covers
+ * that address. The cell appends its output with plain stores, the root
+ * cell reads it back at its own pace. Unread output is overwritten once
+ * the cell wraps around.
+ */
+#define JAILHOUSE_CELL_CONSOLE_ADDR	0x1fe000
+
+#define JAILHOUSE_CELL_CONSOLE_SIGNATURE	"CONSOLE"
+
+/* power of two, so that the head can wrap around freely */
+#define JAILHOUSE_CELL_CONSOLE_SIZE	2048
+
+struct jailhouse_cell_console {
+	char signature[8];
+	/* bytes written so far, updated after the data */
+	__u32 head;
+	__u32 padding;
+	char data[JAILHOUSE_CELL_CONSOLE_SIZE];
+};
+
+#endif /* !_JAILHOUSE_CELL_CONSOLE_H */
@@ -0,0 +1,51 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_CELL_INFO_H
+#define _JAILHOUSE_CELL_INFO_H
+
+#include <jailhouse/cell-config.h>
+
+/*
+ * Read-only page the hypervisor maps into each non-root cell at
+ * JAILHOUSE_CELL_INFO_ADDR, unless a memory region of the cell covers
+ * that address.
+ */
+#define JAILHOUSE_CELL_INFO_ADDR	0x1ff000
+
+#define JAILHOUSE_CELL_INFO_SIGNATURE	"CELLINFO"
+
+#define JAILHOUSE_CELL_INFO_MAX_CPUS	64
+#define JAILHOUSE_CELL_INFO_MAX_MEMORY	64
+
+struct jailhouse_cell_info_cpu {
+	__u32 cpu_id;
+	/* APIC ID on x86 */
+	__u32 phys_id;
+};
+
+struct jailhouse_cell_info {
+	char signature[8];
+	/* invariant TSC frequency, 0 if unknown */
+	__u32 tsc_khz;
+	__u32 cell_id;
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	/* entries in use, at most JAILHOUSE_CELL_INFO_MAX_* */
+	__u32 num_cpus;
+	__u32 num_memory_regions;
+	__u32 padding[2];
+	struct jailhouse_cell_info_cpu cpus[JAILHOUSE_CELL_INFO_MAX_CPUS];
+	/* as in the cell's configuration */
+	struct jailhouse_memory memory[JAILHOUSE_CELL_INFO_MAX_MEMORY];
+};
+
+#endif /* !_JAILHOUSE_CELL_INFO_H */
@@ -16,6 +16,10 @@
 
 extern struct jailhouse_system *system_config;
 
+struct jailhouse_cpu_state;
+struct jailhouse_dirty_log;
+struct jailhouse_profile_read;
+
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 		      int exception);
 
@@ -31,18 +35,77 @@ unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 	     (cpu) <= (set)->max_cpu_id;			\
 	    )
 
-int check_mem_regions(struct jailhouse_cell_desc *config);
+int check_cell_config(struct jailhouse_cell_desc *config, unsigned long size);
 int cell_init(struct cell *cell, struct jailhouse_cell_desc *config,
 	      bool copy_cpu_set);
+struct jailhouse_memory *cell_mem_by_phys(struct cell *cell, u64 addr);
+struct jailhouse_memory *cell_mem_by_virt(struct cell *cell, u64 addr);
+bool cell_mem_overlaps(struct cell *cell, const struct jailhouse_memory *mem);
+bool non_root_cell_uses_memory(const struct jailhouse_memory *mem);
+bool non_root_cell_owns_memory(const struct jailhouse_memory *mem);
+int root_cell_remap(const struct jailhouse_memory *mem,
+		    int (*map)(const struct jailhouse_memory *part));
 
-int cell_create(struct per_cpu *cpu_data, unsigned long config_address);
+int cell_create(struct per_cpu *cpu_data, unsigned long config_address,
+		unsigned long config_size);
+int cell_destroy(struct per_cpu *cpu_data, unsigned long id);
+int cell_stop(struct per_cpu *cpu_data, unsigned long id);
+int cell_start(struct per_cpu *cpu_data, unsigned long id);
+int cell_add_cpu(struct per_cpu *cpu_data, unsigned long id,
+		 unsigned long cpu_id);
+int cell_remove_cpu(struct per_cpu *cpu_data, unsigned long id,
+		    unsigned long cpu_id);
 
 int shutdown(struct per_cpu *cpu_data);
 
-void arch_suspend_cpu(unsigned int cpu_id);
+long cpu_get_stat(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  unsigned long stat);
+int cpu_get_state(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  struct jailhouse_cpu_state *state);
+int cpu_set_state(struct per_cpu *cpu_data, unsigned long cpu_id,
+		  const struct jailhouse_cpu_state *state);
+
+int cell_dirty_log(struct per_cpu *cpu_data, unsigned long id,
+		   struct jailhouse_dirty_log *log, u64 *bitmap);
+
+int cell_doorbell(struct per_cpu *cpu_data, unsigned long id);
+
+long cell_get_console(struct per_cpu *cpu_data, unsigned long id);
+int cell_console_flush(struct per_cpu *cpu_data);
+
+long hypercall(struct per_cpu *cpu_data, unsigned long code,
+	       unsigned long arg1, unsigned long arg2);
+void hypercall_run_async(struct per_cpu *cpu_data);
+
+void arch_suspend_cpus(struct cpu_set *cpu_set, int exception);
 void arch_resume_cpu(unsigned int cpu_id);
 void arch_reset_cpu(unsigned int cpu_id);
-void arch_shutdown_cpu(unsigned int cpu_id);
+void arch_park_cpu(unsigned int cpu_id);
+void arch_shutdown_cpus(struct cpu_set *cpu_set);
+void arch_kick_cpu(unsigned int cpu_id);
+void arch_cell_doorbell(struct per_cpu *cpu_data, struct cell *cell);
+unsigned int arch_cpu_phys_id(unsigned int cpu_id);
+int arch_cpu_get_state(unsigned int cpu_id, struct jailhouse_cpu_state *state);
+int arch_cpu_set_state(struct per_cpu *cpu_data, unsigned int cpu_id,
+		       const struct jailhouse_cpu_state *state);
+int arch_profile_set(struct per_cpu *cpu_data, unsigned long period);
+long arch_profile_read(unsigned int cpu_id,
+		       struct jailhouse_profile_read *read,
+		       unsigned int max_samples);
 
 int arch_cell_create(struct per_cpu *cpu_data, struct cell *new_cell,
 		     struct jailhouse_cell_desc *config);
+int arch_map_memory_region(struct cell *cell,
+			   const struct jailhouse_memory *mem);
+void arch_cell_abort(struct per_cpu *cpu_data, struct cell *cell);
+void arch_cell_commit(struct per_cpu *cpu_data, struct cell *new_cell,
+		      struct jailhouse_cell_desc *config);
+void arch_cell_destroy(struct per_cpu *cpu_data, struct cell *cell);
+int arch_cell_stop(struct per_cpu *cpu_data, struct cell *cell);
+void arch_cell_start(struct per_cpu *cpu_data, struct cell *cell);
+int arch_cell_add_cpu(struct per_cpu *cpu_data, struct cell *cell,
+		      unsigned int cpu_id);
+int arch_cell_remove_cpu(struct per_cpu *cpu_data, struct cell *cell,
+			 unsigned int cpu_id);
+int arch_cell_dirty_log(struct per_cpu *cpu_data, struct cell *cell,
+			struct jailhouse_dirty_log *log, u64 *bitmap);
@@ -0,0 +1,38 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_CPU_STATS_H
+#define _JAILHOUSE_CPU_STATS_H
+
+#define JAILHOUSE_CPU_STAT_VMEXITS_TOTAL	0
+#define JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT	1
+#define JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL	2
+#define JAILHOUSE_CPU_STAT_VMEXITS_CPUID	3
+#define JAILHOUSE_CPU_STAT_VMEXITS_CR		4
+#define JAILHOUSE_CPU_STAT_VMEXITS_MSR		5
+#define JAILHOUSE_CPU_STAT_VMEXITS_XAPIC	6
+/* TSC cycles spent in the exit handler */
+#define JAILHOUSE_CPU_STAT_VMEXITS_CYCLES	7
+#define JAILHOUSE_CPU_STAT_VMEXITS_MMIO		8
+#define JAILHOUSE_CPU_STAT_VMEXITS_PIO		9
+#define JAILHOUSE_CPU_STAT_VMEXITS_HLT		10
+/* TSC cycles the CPU slept on behalf of a halted guest, not part of
+ * JAILHOUSE_CPU_STAT_VMEXITS_CYCLES */
+#define JAILHOUSE_CPU_STAT_IDLE_CYCLES		11
+/* APIC register accesses, xAPIC and x2APIC, indexed by register number */
+#define JAILHOUSE_CPU_STAT_APIC_REG		12
+#define JAILHOUSE_CPU_STAT_NUM_APIC_REGS	64
+
+#define JAILHOUSE_NUM_CPU_STATS			(JAILHOUSE_CPU_STAT_APIC_REG + \
+						 JAILHOUSE_CPU_STAT_NUM_APIC_REGS)
+
+#endif /* !_JAILHOUSE_CPU_STATS_H */
@@ -18,7 +18,10 @@
 
 #include <jailhouse/cell-config.h>
 
+#define EPERM		1
+#define ENOENT		2
 #define EIO		5
+#define EAGAIN		11
 #define ENOMEM		12
 #define EBUSY		16
 #define ENODEV		19
@@ -0,0 +1,49 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_EXIT_BENCH_H
+#define _JAILHOUSE_EXIT_BENCH_H
+
+/*
+ * Round trips of guest operations that the hypervisor intercepts, measured
+ * in TSC cycles by the exit-bench inmate and, for the root cell, by the
+ * driver. Each operation runs a number of times with interrupts disabled,
+ * the distribution of the single round trips is reduced to these values.
+ */
+
+#define JAILHOUSE_EXIT_BENCH_CPUID		0
+#define JAILHOUSE_EXIT_BENCH_HYPERCALL		1
+#define JAILHOUSE_EXIT_BENCH_X2APIC_READ	2
+#define JAILHOUSE_EXIT_BENCH_X2APIC_WRITE	3
+#define JAILHOUSE_EXIT_BENCH_XAPIC_READ		4
+#define JAILHOUSE_EXIT_BENCH_XAPIC_WRITE	5
+#define JAILHOUSE_EXIT_BENCH_IPI		6
+#define JAILHOUSE_EXIT_BENCH_PIO		7
+#define JAILHOUSE_EXIT_BENCH_NUM		8
+
+#define JAILHOUSE_EXIT_BENCH_MAX_ITERATIONS	4096
+
+/* the registers used by the APIC tests, the task priority is left at 0 */
+#define JAILHOUSE_EXIT_BENCH_APIC_REG		0x08	/* TPR */
+/* the PCI address port, trapped and emulated with mediated config access */
+#define JAILHOUSE_EXIT_BENCH_PIO_PORT		0xcf8
+
+struct jailhouse_exit_bench_result {
+	/* 0 if the operation was not available */
+	__u64 iterations;
+	__u64 min;
+	__u64 median;
+	__u64 p99;
+	__u64 max;
+};
+
+#endif /* !_JAILHOUSE_EXIT_BENCH_H */
@@ -18,6 +18,7 @@ struct jailhouse_header {
 	unsigned long bss_start;
 	unsigned long bss_end;
 	unsigned long percpu_size;
+	unsigned long percpu_trace_offset;
 	unsigned long entry;
 
 	/* filled by loader */
@@ -25,6 +26,8 @@ struct jailhouse_header {
 	unsigned long page_offset;
 	unsigned int possible_cpus;
 	unsigned int online_cpus;
+	/* 0 if unknown */
+	unsigned long tsc_khz;
 };
 
 typedef int (*entry_func)(unsigned int);
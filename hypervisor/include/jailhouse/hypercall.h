@@ -11,7 +11,140 @@
  */
 
 #include <asm/jailhouse.h>
+#include <jailhouse/profile.h>
 
 #define JAILHOUSE_HC_DISABLE		0
 #define JAILHOUSE_HC_CELL_CREATE	1
 #define JAILHOUSE_HC_CELL_DESTROY	2
+#define JAILHOUSE_HC_CPU_GET_STAT	3
+#define JAILHOUSE_HC_CELL_DOORBELL	4
+#define JAILHOUSE_HC_CELL_STOP		5
+#define JAILHOUSE_HC_CELL_START		6
+#define JAILHOUSE_HC_POOL_GET_STAT	7
+#define JAILHOUSE_HC_CELL_GET_CONSOLE	8
+#define JAILHOUSE_HC_CONSOLE_FLUSH	9
+#define JAILHOUSE_HC_BATCH		10
+#define JAILHOUSE_HC_CPU_GET_STATE	11
+#define JAILHOUSE_HC_CPU_SET_STATE	12
+#define JAILHOUSE_HC_CELL_DIRTY_LOG	13
+#define JAILHOUSE_HC_PROFILE_SET	14
+#define JAILHOUSE_HC_PROFILE_READ	15
+#define JAILHOUSE_HC_NOP		16
+#define JAILHOUSE_HC_CELL_ADD_CPU	17
+#define JAILHOUSE_HC_CELL_REMOVE_CPU	18
+
+/* JAILHOUSE_HC_NOP returns 0 to any cell, it measures the hypercall path */
+
+/*
+ * JAILHOUSE_HC_CONSOLE_FLUSH writes a bounded part of the calling cell's
+ * console to the debug port and returns the number of bytes still pending.
+ * It returns 0 while another CPU of the cell is flushing.
+ */
+
+/*
+ * JAILHOUSE_HC_CELL_ADD_CPU and _REMOVE_CPU take a non-root cell and a CPU
+ * that moves between it and the root cell. The cell's CPUs are suspended
+ * during the move, the CPU then waits for INIT/SIPI on either side. Removal
+ * does not wait for the cell to release the CPU. A CPU that is the last of its
+ * cell or the destination of one of the cell's irq_lines cannot be removed.
+ */
+
+/*
+ * JAILHOUSE_HC_CELL_CREATE returns -EAGAIN while the memory of the new cell
+ * is mapped, the caller has to repeat it with the same arguments. Repeating
+ * it with a config size of 0 aborts the pending creation instead.
+ */
+
+/*
+ * JAILHOUSE_HC_CPU_GET_STATE and _SET_STATE take a CPU of a stopped cell and
+ * the physical address of a struct jailhouse_cpu_state that must not cross
+ * a page boundary. A CPU is saved when its cell stops. A restored CPU
+ * continues from its state when the cell is started the next time instead
+ * of being reset.
+ */
+
+/* flags of a CPU state, exactly one of them is set */
+#define JAILHOUSE_CPU_STATE_VALID		0x0001
+/* the CPU was waiting for a SIPI, the rest of the state is unused */
+#define JAILHOUSE_CPU_STATE_WAIT_FOR_SIPI	0x0002
+
+/*
+ * JAILHOUSE_HC_CELL_DIRTY_LOG takes a non-root cell and the physical address
+ * of a struct jailhouse_dirty_log that must not cross a page boundary, the
+ * bitmap is limited to the rest of that page. While started, writes of the
+ * cell's CPUs to its writable memory regions are logged per page. Writes by
+ * devices or by the root cell to a stopped cell's memory are not.
+ */
+
+#define JAILHOUSE_DIRTY_LOG_START	0
+#define JAILHOUSE_DIRTY_LOG_STOP	1
+/* report and clear the dirty pages of a region, from start_page on */
+#define JAILHOUSE_DIRTY_LOG_FETCH	2
+
+struct jailhouse_dirty_log {
+	__u32 cmd;
+	/* index into the memory regions of the cell */
+	__u32 region;
+	/* multiple of 64 */
+	__u64 start_page;
+	/* in: capacity of bitmap, out: pages reported, 0 past the region */
+	__u32 num_pages;
+	__u32 padding;
+	/* out: size of the region in pages */
+	__u64 region_pages;
+	/* bit n set if page start_page + n was written since the last fetch */
+	__u64 bitmap[];
+};
+
+/*
+ * JAILHOUSE_HC_PROFILE_SET takes the sampling period in unhalted cycles, 0
+ * stops sampling. It fails with -ENOSYS if the hypervisor was built without
+ * CONFIG_PROFILE. JAILHOUSE_HC_PROFILE_READ takes a CPU and the physical
+ * address of a struct jailhouse_profile_read that must not cross a page
+ * boundary, the samples are limited to the rest of that page. It returns
+ * the number of samples moved out of the CPU's ring.
+ */
+
+struct jailhouse_profile_read {
+	/* out: samples lost to a full ring since the last read */
+	__u32 dropped;
+	__u32 padding;
+	struct jailhouse_profile_sample sample[];
+};
+
+/* run the batch on worker_cpu, return to the caller right away */
+#define JAILHOUSE_HC_BATCH_ASYNC	0x0001
+
+#define JAILHOUSE_HC_BATCH_PENDING	0
+#define JAILHOUSE_HC_BATCH_DONE		1
+
+struct jailhouse_hc_op {
+	__u32 code;
+	__u32 padding;
+	__u64 arg1;
+	__u64 arg2;
+	/* out: what the hypercall would have returned in a register */
+	__s64 result;
+};
+
+/*
+ * Passed by physical address to JAILHOUSE_HC_BATCH, must not cross a page
+ * boundary. All ops are processed in order, each one reports its result.
+ * Batches cannot be nested, and JAILHOUSE_HC_DISABLE cannot be batched.
+ */
+struct jailhouse_hc_batch {
+	__u32 num_ops;
+	__u32 flags;
+	/* with JAILHOUSE_HC_BATCH_ASYNC, another CPU of the calling cell */
+	__u32 worker_cpu;
+	/* out: JAILHOUSE_HC_BATCH_PENDING or _DONE, set after the results */
+	__u32 status;
+	/* out */
+	__u32 num_done;
+	__u32 padding;
+	struct jailhouse_hc_op op[];
+};
+
+#define JAILHOUSE_HC_BATCH_MAX_OPS					\
+	((4096 - sizeof(struct jailhouse_hc_batch)) /			\
+	 sizeof(struct jailhouse_hc_op))
@@ -0,0 +1,42 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_LATENCY_REPORT_H
+#define _JAILHOUSE_LATENCY_REPORT_H
+
+/*
+ * Timer interrupt latency histogram published by the latency benchmark
+ * inmate in shared memory, readable by the root cell. The counters are
+ * updated one by one while the benchmark runs, JAILHOUSE_LATENCY_SIGNATURE
+ * marks a valid report.
+ */
+
+#define JAILHOUSE_LATENCY_SIGNATURE	0x594e544c	/* "LTNY" */
+
+#define JAILHOUSE_LATENCY_BUCKETS	1024
+#define JAILHOUSE_LATENCY_BUCKET_NS	100
+
+struct jailhouse_latency_report {
+	/* can be set before the cell starts, 0 selects the default */
+	__u32 period_us;
+	__u32 signature;
+	__u32 bucket_ns;
+	__u32 num_buckets;
+	__u64 samples;
+	/* samples beyond the last bucket */
+	__u64 overflows;
+	__u64 min_ns;
+	__u64 max_ns;
+	__u64 histogram[JAILHOUSE_LATENCY_BUCKETS];
+};
+
+#endif /* !_JAILHOUSE_LATENCY_REPORT_H */
@@ -0,0 +1,97 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_LOCK_STATS_H
+#define _JAILHOUSE_LOCK_STATS_H
+
+#include <asm/processor.h>
+#include <asm/types.h>
+
+/*
+ * Define CONFIG_LOCK_STATS in include/jailhouse/config.h to account wait and
+ * hold times of all locks in cycles of read_tsc(). Without it, the structure
+ * is empty and the hooks vanish.
+ */
+struct lock_stats {
+#ifdef CONFIG_LOCK_STATS
+	/* locks register on first acquisition */
+	struct lock_stats *next;
+	unsigned long acquired;
+	unsigned long contended;
+	unsigned long wait_cycles;
+	unsigned long max_wait;
+	unsigned long hold_cycles;
+	unsigned long max_hold;
+	unsigned long hold_start;
+#endif
+};
+
+#ifdef CONFIG_LOCK_STATS
+
+void lock_stats_register(struct lock_stats *stats);
+void lock_stats_dump(const char *when);
+
+static inline unsigned long lock_stats_now(void)
+{
+	return read_tsc();
+}
+
+/* called with the lock held */
+static inline void lock_stats_acquired(struct lock_stats *stats,
+				       unsigned long wait_start, bool contended)
+{
+	unsigned long now = read_tsc();
+	unsigned long wait = now - wait_start;
+
+	if (stats->acquired++ == 0)
+		lock_stats_register(stats);
+	if (contended)
+		stats->contended++;
+	stats->wait_cycles += wait;
+	if (wait > stats->max_wait)
+		stats->max_wait = wait;
+	stats->hold_start = now;
+}
+
+/* called with the lock still held */
+static inline void lock_stats_release(struct lock_stats *stats)
+{
+	unsigned long hold = read_tsc() - stats->hold_start;
+
+	stats->hold_cycles += hold;
+	if (hold > stats->max_hold)
+		stats->max_hold = hold;
+}
+
+#else /* !CONFIG_LOCK_STATS */
+
+static inline void lock_stats_dump(const char *when)
+{
+}
+
+static inline unsigned long lock_stats_now(void)
+{
+	return 0;
+}
+
+static inline void lock_stats_acquired(struct lock_stats *stats,
+				       unsigned long wait_start, bool contended)
+{
+}
+
+static inline void lock_stats_release(struct lock_stats *stats)
+{
+}
+
+#endif /* !CONFIG_LOCK_STATS */
+
+#endif /* !_JAILHOUSE_LOCK_STATS_H */
@@ -0,0 +1,72 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_MCS_LOCK_H
+#define _JAILHOUSE_MCS_LOCK_H
+
+#include <jailhouse/lock-stats.h>
+#include <asm/spinlock.h>
+
+/*
+ * Queued lock for heavily contended paths: like the ticket lock, CPUs are
+ * served in order, but each one spins on its own node instead of the shared
+ * lock word. The node is provided by the caller for the duration of the
+ * critical section, typically on the stack as all CPUs can access it there.
+ */
+struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile bool waiting;
+};
+
+typedef struct {
+	struct mcs_node *tail;
+	struct lock_stats stats;
+} mcs_lock_t;
+
+#define DEFINE_MCS_LOCK(name)	mcs_lock_t (name)
+
+static inline void mcs_lock(mcs_lock_t *lock, struct mcs_node *node)
+{
+	unsigned long start = lock_stats_now();
+	struct mcs_node *prev;
+
+	node->next = NULL;
+	node->waiting = true;
+
+	prev = atomic_xchg_ptr((void **)&lock->tail, node);
+	if (prev) {
+		prev->next = node;
+		while (node->waiting)
+			cpu_relax();
+		memory_barrier();
+	}
+
+	lock_stats_acquired(&lock->stats, start, prev != NULL);
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, struct mcs_node *node)
+{
+	lock_stats_release(&lock->stats);
+	memory_barrier();
+
+	if (!node->next) {
+		if (atomic_cmpxchg_ptr((void **)&lock->tail, node, NULL) ==
+		    node)
+			return;
+		/* a successor is about to link itself */
+		while (!node->next)
+			cpu_relax();
+	}
+	node->next->waiting = false;
+}
+
+#endif /* !_JAILHOUSE_MCS_LOCK_H */
@@ -11,13 +11,37 @@
  */
 
 #include <asm/percpu.h>
+#include <asm/processor.h>
 
-struct mmio_access {
-	unsigned int inst_len;
-	unsigned int size;
-	unsigned int reg;
+/*
+ * Called with the offset into the region. Reads store the result in
+ * *value. Returning false makes the access fail fatally.
+ */
+typedef bool (*mmio_handler)(struct per_cpu *cpu_data, void *arg,
+			     unsigned long offset, unsigned int size,
+			     bool is_write, unsigned long *value);
+
+/*
+ * Emulated guest-physical range of a cell. The range must not be mapped
+ * in the cell's memory configuration so that accesses trap.
+ */
+struct mmio_region {
+	unsigned long start;
+	unsigned long size;
+	mmio_handler handler;
+	void *arg;
 };
 
+static inline u8 mmio_read8(void *address)
+{
+	return *(volatile u8 *)address;
+}
+
+static inline u16 mmio_read16(void *address)
+{
+	return *(volatile u16 *)address;
+}
+
 static inline u32 mmio_read32(void *address)
 {
 	return *(volatile u32 *)address;
@@ -28,6 +52,16 @@ static inline u64 mmio_read64(void *address)
 	return *(volatile u64 *)address;
 }
 
+static inline void mmio_write8(void *address, u8 value)
+{
+	*(volatile u8 *)address = value;
+}
+
+static inline void mmio_write16(void *address, u16 value)
+{
+	*(volatile u16 *)address = value;
+}
+
 static inline void mmio_write32(void *address, u32 value)
 {
 	*(volatile u32 *)address = value;
@@ -40,3 +74,30 @@ static inline void mmio_write64(void *address, u64 value)
 
 struct mmio_access mmio_parse(struct per_cpu *cpu_data, unsigned long pc,
 			      unsigned long page_table_addr, bool is_write);
+
+/*
+ * Performs the register and flag side of a decoded access. mem_val is the
+ * content of the accessed location if access->does_read is set, the
+ * return value is to be written to it if access->does_write is set.
+ */
+unsigned long mmio_execute(struct registers *guest_regs,
+			   unsigned long *rflags,
+			   const struct mmio_access *access,
+			   unsigned long mem_val);
+void mmio_cache_flush(struct per_cpu *cpu_data);
+
+/*
+ * The region list of a cell may only be modified while none of its CPUs
+ * runs, i.e. during cell creation and destruction.
+ */
+int mmio_region_register(struct cell *cell, unsigned long start,
+			 unsigned long size, mmio_handler handler, void *arg);
+void mmio_region_unregister(struct cell *cell, unsigned long start);
+struct mmio_region *mmio_find_region(struct cell *cell, unsigned long addr);
+void mmio_cell_exit(struct cell *cell);
+
+unsigned int mmio_handle_access(struct registers *guest_regs,
+				struct per_cpu *cpu_data,
+				unsigned long phys_addr, unsigned long pc,
+				unsigned long page_table_addr, bool is_write,
+				unsigned long *rflags);
@@ -11,26 +11,58 @@
  */
 
 #include <jailhouse/entry.h>
+#include <jailhouse/pool-stats.h>
 #include <asm/types.h>
 #include <asm/paging.h>
+#include <asm/spinlock.h>
 
 #define PAGE_ALIGN(s)		((s + PAGE_SIZE-1) & PAGE_MASK)
 
+/* leaf sizes beyond PAGE_SIZE page_map_create may use, if suitably aligned */
+#define PAGE_MAP_NO_HUGE	0
+#define PAGE_MAP_HUGE_2M	0x1
+#define PAGE_MAP_HUGE_1G	0x2
+/* the table is walked without snooping CPU caches, write back changes */
+#define PAGE_MAP_COHERENT	0
+#define PAGE_MAP_NON_COHERENT	0x4
+/* JAILHOUSE_POOL_USER_* the page table is accounted to */
+#define PAGE_MAP_USER(user)	((user) << 8)
+#define PAGE_MAP_USER_MASK	0xff00
+/* NUMA node to allocate the page tables from, if it has a pool */
+#define PAGE_MAP_NODE(node)	(((node) + 1) << 16)
+#define PAGE_MAP_NODE_MASK	0xff0000
+
+#define NUMA_NO_NODE		-1
+
 struct page_pool {
 	void *base_address;
 	unsigned long pages;
 	unsigned long used_pages;
+	unsigned long peak_pages;
+	unsigned long user_pages[JAILHOUSE_NUM_POOL_USERS];
+	unsigned long user_peak_pages[JAILHOUSE_NUM_POOL_USERS];
+	/* no free page below this one */
+	unsigned long free_hint;
 	unsigned long *used_bitmap;
+	/* freed pages that still need to be scrubbed before reuse */
+	unsigned long *dirty_bitmap;
 	unsigned long flags;
+	spinlock_t lock;
 };
 
 extern struct page_pool mem_pool;
 extern struct page_pool remap_pool;
+extern struct page_pool node_pools[JAILHOUSE_MAX_NUMA_NODES];
 
 extern pgd_t *hv_page_table;
 
-void *page_alloc(struct page_pool *pool, unsigned int num);
-void page_free(struct page_pool *pool, void *first_page, unsigned int num);
+void *page_alloc(struct page_pool *pool, unsigned int num, unsigned int user);
+void page_free(struct page_pool *pool, void *first_page, unsigned int num,
+	       unsigned int user);
+void *page_alloc_node(int node, unsigned int num, unsigned int user);
+void page_free_node(void *first_page, unsigned int num, unsigned int user);
+long page_pool_get_stat(struct per_cpu *cpu_data, unsigned long pool,
+			unsigned long stat);
 
 static inline unsigned long page_map_hvirt2phys(void *hvirt)
 {
@@ -48,15 +80,28 @@ unsigned long page_map_virt2phys(pgd_t *page_table,
 
 int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
 		    unsigned long virt, unsigned long flags,
-		    unsigned long table_flags, unsigned int levels);
+		    unsigned long table_flags, unsigned int levels,
+		    unsigned int map_flags);
 void page_map_destroy(pgd_t *page_table, unsigned long virt,
-		      unsigned long size, unsigned int levels);
+		      unsigned long size, unsigned int levels,
+		      unsigned int map_flags);
+
+/*
+ * Clear the given flag in the leaves of [virt, virt + size) and set bit n of
+ * the bitmap if page n of the range was covered by a leaf that had it. The
+ * caller has to flush TLBs that may cache the entries.
+ */
+void page_map_test_and_clear(pgd_t *page_table, unsigned long virt,
+			     unsigned long size, unsigned int levels,
+			     unsigned long flag, unsigned long *bitmap);
 
 void *page_map_get_foreign_page(unsigned int mapping_region,
 				unsigned long page_table_paddr,
 				unsigned long page_table_offset,
 				unsigned long virt, unsigned long flags);
-void page_map_release_foreign_page(unsigned int mapping_region);
+
+int numa_node_of_cpu(unsigned int cpu);
+int numa_node_of_cell(struct jailhouse_cell_desc *config);
 
 int paging_init(void);
 void page_map_dump_stats(const char *when);
@@ -0,0 +1,43 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_POOL_STATS_H
+#define _JAILHOUSE_POOL_STATS_H
+
+#define JAILHOUSE_POOL_MEM			0
+#define JAILHOUSE_POOL_REMAP			1
+/* page pool of NUMA node n, one per JAILHOUSE_MAX_NUMA_NODES */
+#define JAILHOUSE_POOL_NODE(n)			(2 + (n))
+#define JAILHOUSE_NUM_POOLS			JAILHOUSE_POOL_NODE(4)
+
+/* owners pages are accounted to */
+#define JAILHOUSE_POOL_USER_HYPERVISOR		0
+#define JAILHOUSE_POOL_USER_EPT			1
+#define JAILHOUSE_POOL_USER_VTD			2
+#define JAILHOUSE_POOL_USER_CELL		3
+#define JAILHOUSE_POOL_USER_CPU_SET		4
+#define JAILHOUSE_POOL_USER_REMAP		5
+#define JAILHOUSE_NUM_POOL_USERS		6
+
+#define JAILHOUSE_POOL_STAT_PAGES		0
+#define JAILHOUSE_POOL_STAT_USED		1
+#define JAILHOUSE_POOL_STAT_PEAK		2
+/* longest run of free pages, i.e. the largest possible allocation */
+#define JAILHOUSE_POOL_STAT_LARGEST_FREE	3
+#define JAILHOUSE_POOL_STAT_USER_USED		4
+#define JAILHOUSE_POOL_STAT_USER_PEAK		\
+	(JAILHOUSE_POOL_STAT_USER_USED + JAILHOUSE_NUM_POOL_USERS)
+
+#define JAILHOUSE_NUM_POOL_STATS		\
+	(JAILHOUSE_POOL_STAT_USER_PEAK + JAILHOUSE_NUM_POOL_USERS)
+
+#endif /* !_JAILHOUSE_POOL_STATS_H */
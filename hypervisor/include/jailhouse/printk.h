@@ -19,5 +19,12 @@ void printk(const char *fmt, ...);
 
 void panic_printk(const char *fmt, ...);
 
+/* Cheap replacement for printk on hot paths, see jailhouse/trace.h */
+struct per_cpu;
+
+void trace_init(void);
+void trace_event(struct per_cpu *cpu_data, unsigned int event,
+		 unsigned long arg0, unsigned long arg1);
+
 void arch_dbg_write_init(void);
 void arch_dbg_write(const char *msg);
@@ -13,3 +13,18 @@
 #include <asm/processor.h>
 
 int phys_processor_id(void);
+
+/*
+ * Waits while cond holds. Where the CPU supports it, it sleeps until the
+ * cache line of addr is written, so every update that can end the wait has
+ * to come with a store to that line.
+ */
+#define cpu_wait_while(cond, addr)			\
+	do {						\
+		while (cond) {				\
+			cpu_monitor(addr);		\
+			if (!(cond))			\
+				break;			\
+			cpu_wait();			\
+		}					\
+	} while (0)
@@ -0,0 +1,30 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_PROFILE_H
+#define _JAILHOUSE_PROFILE_H
+
+/* sampling period in unhalted cycles, the minimum bounds the overhead */
+#define JAILHOUSE_PROFILE_MIN_PERIOD	10000
+#define JAILHOUSE_PROFILE_MAX_PERIOD	0x7fffffff
+
+/* exit reason of a sample taken while the guest was running */
+#define JAILHOUSE_PROFILE_IN_GUEST	0xffffffff
+
+struct jailhouse_profile_sample {
+	/* interrupted RIP as offset into hypervisor.o */
+	__u32 offset;
+	/* basic reason of the VM exit being handled */
+	__u32 reason;
+};
+
+#endif /* !_JAILHOUSE_PROFILE_H */
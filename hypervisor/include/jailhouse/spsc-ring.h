@@ -0,0 +1,180 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_SPSC_RING_H
+#define _JAILHOUSE_SPSC_RING_H
+
+/*
+ * Single-producer/single-consumer ring for shared memory between cells.
+ * Usable by inmates, the Linux driver and Linux user space, it only
+ * requires __u8 and __u32 to be defined.
+ *
+ * head and tail are free-running slot counters. Each is written by one
+ * side only and lives in its own cache line, together with that side's
+ * private copy of the other counter. This way, a side only touches the
+ * line of its peer when its cached view is exhausted.
+ */
+
+#define JAILHOUSE_SPSC_CACHE_LINE	64
+
+struct jailhouse_spsc_ring {
+	/* read-only after jailhouse_spsc_init */
+	__u32 num_slots;	/* power of two */
+	__u32 slot_size;
+	__u8 padding0[JAILHOUSE_SPSC_CACHE_LINE - 2 * sizeof(__u32)];
+
+	/* written by the producer */
+	__u32 head;
+	__u32 cached_tail;
+	__u8 padding1[JAILHOUSE_SPSC_CACHE_LINE - 2 * sizeof(__u32)];
+
+	/* written by the consumer */
+	__u32 tail;
+	__u32 cached_head;
+	__u8 padding2[JAILHOUSE_SPSC_CACHE_LINE - 2 * sizeof(__u32)];
+
+	__u8 slots[];
+} __attribute__((aligned(JAILHOUSE_SPSC_CACHE_LINE)));
+
+#define jailhouse_spsc_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define jailhouse_spsc_store_release(p, v) \
+	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static inline unsigned long
+jailhouse_spsc_ring_size(__u32 num_slots, __u32 slot_size)
+{
+	return sizeof(struct jailhouse_spsc_ring) +
+		(unsigned long)num_slots * slot_size;
+}
+
+/* Must be called before the peer starts to access the ring. */
+static inline void jailhouse_spsc_init(struct jailhouse_spsc_ring *ring,
+				       __u32 num_slots, __u32 slot_size)
+{
+	ring->num_slots = num_slots;
+	ring->slot_size = slot_size;
+	ring->head = ring->cached_tail = 0;
+	ring->tail = ring->cached_head = 0;
+}
+
+static inline void *jailhouse_spsc_slot(struct jailhouse_spsc_ring *ring,
+					__u32 n)
+{
+	return ring->slots +
+		(unsigned long)(n & (ring->num_slots - 1)) * ring->slot_size;
+}
+
+/*
+ * Producer: reserve up to max contiguous free slots for in-place filling.
+ * Returns the first slot and stores the number reserved in *num, which is
+ * 0 if the ring is full.
+ */
+static inline void *jailhouse_spsc_reserve(struct jailhouse_spsc_ring *ring,
+					   __u32 max, __u32 *num)
+{
+	__u32 head = ring->head;
+	__u32 free = ring->num_slots - (head - ring->cached_tail);
+	__u32 to_end = ring->num_slots - (head & (ring->num_slots - 1));
+
+	if (free < max) {
+		ring->cached_tail = jailhouse_spsc_load_acquire(&ring->tail);
+		free = ring->num_slots - (head - ring->cached_tail);
+	}
+	if (max > free)
+		max = free;
+	if (max > to_end)
+		max = to_end;
+
+	*num = max;
+	return jailhouse_spsc_slot(ring, head);
+}
+
+/* Producer: publish num slots filled after jailhouse_spsc_reserve. */
+static inline void jailhouse_spsc_commit(struct jailhouse_spsc_ring *ring,
+					 __u32 num)
+{
+	jailhouse_spsc_store_release(&ring->head, ring->head + num);
+}
+
+/*
+ * Consumer: look at up to max contiguous filled slots without copying.
+ * Returns the first slot and stores the number available in *num, which
+ * is 0 if the ring is empty.
+ */
+static inline void *jailhouse_spsc_peek(struct jailhouse_spsc_ring *ring,
+					__u32 max, __u32 *num)
+{
+	__u32 tail = ring->tail;
+	__u32 used = ring->cached_head - tail;
+	__u32 to_end = ring->num_slots - (tail & (ring->num_slots - 1));
+
+	if (used < max) {
+		ring->cached_head = jailhouse_spsc_load_acquire(&ring->head);
+		used = ring->cached_head - tail;
+	}
+	if (max > used)
+		max = used;
+	if (max > to_end)
+		max = to_end;
+
+	*num = max;
+	return jailhouse_spsc_slot(ring, tail);
+}
+
+/* Consumer: hand num slots obtained by jailhouse_spsc_peek back. */
+static inline void jailhouse_spsc_release(struct jailhouse_spsc_ring *ring,
+					  __u32 num)
+{
+	jailhouse_spsc_store_release(&ring->tail, ring->tail + num);
+}
+
+/* Producer: copy up to num slots in, returns the number enqueued. */
+static inline __u32 jailhouse_spsc_enqueue(struct jailhouse_spsc_ring *ring,
+					   const void *data, __u32 num)
+{
+	__u32 done = 0, n;
+	void *slot;
+
+	while (done < num) {
+		slot = jailhouse_spsc_reserve(ring, num - done, &n);
+		if (n == 0)
+			break;
+		__builtin_memcpy(slot, (const __u8 *)data +
+				 (unsigned long)done * ring->slot_size,
+				 (unsigned long)n * ring->slot_size);
+		jailhouse_spsc_commit(ring, n);
+		done += n;
+	}
+	return done;
+}
+
+/* Consumer: copy up to num slots out, returns the number dequeued. */
+static inline __u32 jailhouse_spsc_dequeue(struct jailhouse_spsc_ring *ring,
+					   void *data, __u32 num)
+{
+	__u32 done = 0, n;
+	void *slot;
+
+	while (done < num) {
+		slot = jailhouse_spsc_peek(ring, num - done, &n);
+		if (n == 0)
+			break;
+		__builtin_memcpy((__u8 *)data +
+				 (unsigned long)done * ring->slot_size, slot,
+				 (unsigned long)n * ring->slot_size);
+		jailhouse_spsc_release(ring, n);
+		done += n;
+	}
+	return done;
+}
+
+#endif /* !_JAILHOUSE_SPSC_RING_H */
@@ -12,3 +12,4 @@
 
 void *memcpy(void *d, const void *s, unsigned long n);
 void *memset(void *s, int c, unsigned long n);
+int memcmp(const void *s1, const void *s2, unsigned long n);
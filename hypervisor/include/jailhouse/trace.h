@@ -0,0 +1,49 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_TRACE_H
+#define _JAILHOUSE_TRACE_H
+
+/* arg[0], arg[1] */
+#define JAILHOUSE_TRACE_VMEXIT			1	/* reason, RIP */
+#define JAILHOUSE_TRACE_HYPERCALL		2	/* code, 1st argument */
+#define JAILHOUSE_TRACE_UNKNOWN_HYPERCALL	3	/* code, RIP */
+#define JAILHOUSE_TRACE_SIPI			4	/* vector */
+#define JAILHOUSE_TRACE_CELL_SUSPEND		5	/* cell ID */
+#define JAILHOUSE_TRACE_CELL_RESUME		6	/* cell ID */
+#define JAILHOUSE_TRACE_IPI_OUTSIDE_CELL	7	/* ICR.hi, ICR.lo */
+#define JAILHOUSE_TRACE_DOORBELL		9	/* cell ID, target CPU */
+
+#define JAILHOUSE_TRACE_NUM_ARGS		2
+
+struct jailhouse_trace_event {
+	__u64 timestamp;
+	__u32 event;
+	__u32 padding;
+	__u64 arg[JAILHOUSE_TRACE_NUM_ARGS];
+};
+
+/*
+ * Written only by the owning CPU, read by the root cell without any
+ * locking. Event number n is stored in event[n % num_events], old events
+ * are overwritten. head is the number of events written so far and is
+ * only updated after the event slot. A reader has to discard its copy of
+ * event n if head - n >= num_events after the copy.
+ */
+struct jailhouse_trace_ring {
+	__u64 head;
+	__u32 num_events;
+	__u32 padding[5];
+	struct jailhouse_trace_event event[];
+};
+
+#endif /* !_JAILHOUSE_TRACE_H */
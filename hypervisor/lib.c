@@ -21,3 +21,23 @@ void *memset(void *s, int c, unsigned long n)
 		*p++ = c;
 	return s;
 }
+
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	const u8 *s = src;
+	u8 *d = dest;
+
+	while (n-- > 0)
+		*d++ = *s++;
+	return dest;
+}
+
+int memcmp(const void *s1, const void *s2, unsigned long n)
+{
+	const u8 *p1 = s1, *p2 = s2;
+
+	for (; n > 0; n--, p1++, p2++)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/lock-stats.h>
+#include <jailhouse/printk.h>
+#include <asm/spinlock.h>
+
+#ifdef CONFIG_LOCK_STATS
+
+extern u8 __start[];
+
+static struct lock_stats *lock_stats_list;
+
+void lock_stats_register(struct lock_stats *stats)
+{
+	struct lock_stats *head;
+
+	do {
+		head = lock_stats_list;
+		stats->next = head;
+	} while (atomic_cmpxchg_ptr((void **)&lock_stats_list, head,
+				    stats) != head);
+}
+
+/* locks are identified by their offset in hypervisor.o */
+void lock_stats_dump(const char *when)
+{
+	struct lock_stats *stats;
+
+	printk("Lock statistics %s, in cycles:\n", when);
+	for (stats = lock_stats_list; stats; stats = stats->next)
+		printk("  %x: acquired %lu, contended %lu, wait avg %lu "
+		       "max %lu, hold avg %lu max %lu\n",
+		       (u8 *)stats - __start, stats->acquired,
+		       stats->contended, stats->wait_cycles / stats->acquired,
+		       stats->max_wait, stats->hold_cycles / stats->acquired,
+		       stats->max_hold);
+}
+
+#endif /* CONFIG_LOCK_STATS */
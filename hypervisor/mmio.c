@@ -0,0 +1,94 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+
+#define MMIO_MAX_REGIONS	(PAGE_SIZE / sizeof(struct mmio_region))
+
+int mmio_region_register(struct cell *cell, unsigned long start,
+			 unsigned long size, mmio_handler handler, void *arg)
+{
+	struct mmio_region *regions = cell->mmio_regions;
+	unsigned int n, i;
+
+	if (size == 0 || start + size < start)
+		return -EINVAL;
+
+	if (!regions) {
+		regions = page_alloc_node(cell->numa_node, 1,
+					  JAILHOUSE_POOL_USER_CELL);
+		if (!regions)
+			return -ENOMEM;
+		cell->mmio_regions = regions;
+	}
+	if (cell->num_mmio_regions == MMIO_MAX_REGIONS)
+		return -ENOMEM;
+
+	/* find the insertion point, rejecting overlaps with the neighbours */
+	for (n = cell->num_mmio_regions; n > 0; n--)
+		if (regions[n - 1].start < start)
+			break;
+	if (n < cell->num_mmio_regions && regions[n].start - start < size)
+		return -EINVAL;
+	if (n > 0 && start - regions[n - 1].start < regions[n - 1].size)
+		return -EINVAL;
+
+	for (i = cell->num_mmio_regions; i > n; i--)
+		regions[i] = regions[i - 1];
+
+	regions[n].start = start;
+	regions[n].size = size;
+	regions[n].handler = handler;
+	regions[n].arg = arg;
+	cell->num_mmio_regions++;
+
+	return 0;
+}
+
+void mmio_region_unregister(struct cell *cell, unsigned long start)
+{
+	struct mmio_region *region = mmio_find_region(cell, start);
+	struct mmio_region *end = cell->mmio_regions + cell->num_mmio_regions;
+
+	if (!region || region->start != start)
+		return;
+
+	for (; region + 1 < end; region++)
+		*region = *(region + 1);
+	cell->num_mmio_regions--;
+}
+
+struct mmio_region *mmio_find_region(struct cell *cell, unsigned long addr)
+{
+	struct mmio_region *regions = cell->mmio_regions;
+	unsigned int lower = 0, upper = cell->num_mmio_regions, n;
+
+	while (lower < upper) {
+		n = (lower + upper) / 2;
+		if (addr < regions[n].start)
+			upper = n;
+		else if (addr - regions[n].start >= regions[n].size)
+			lower = n + 1;
+		else
+			return &regions[n];
+	}
+	return NULL;
+}
+
+void mmio_cell_exit(struct cell *cell)
+{
+	page_free_node(cell->mmio_regions, 1, JAILHOUSE_POOL_USER_CELL);
+	cell->mmio_regions = NULL;
+	cell->num_mmio_regions = 0;
+}
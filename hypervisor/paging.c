@@ -12,13 +12,16 @@
 
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
-#include <jailhouse/string.h>
 #include <jailhouse/control.h>
+#include <jailhouse/string.h>
 #include <asm/bitops.h>
 
 #define BITS_PER_PAGE		(PAGE_SIZE * 8)
 
-#define PAGE_SCRUB_ON_FREE	0x1
+#define PAGE_SCRUB_ON_ALLOC	0x1
+
+/* beyond this, flushing the whole TLB is cheaper than page-wise invlpg */
+#define FLUSH_TLB_PAGE_LIMIT	16
 
 extern u8 __start[], __page_pool[];
 
@@ -27,70 +30,193 @@ struct page_pool remap_pool = {
 	.base_address = (void *)REMAP_BASE_ADDR,
 	.pages = BITS_PER_PAGE * NUM_REMAP_BITMAP_PAGES,
 };
+struct page_pool node_pools[JAILHOUSE_MAX_NUMA_NODES];
 
 pgd_t *hv_page_table;
 
-static void *page_alloc_one(struct page_pool *pool)
-{
-	unsigned long word, page_nr;
+/* serializes updates of the page table structures */
+static DEFINE_SPINLOCK(page_table_lock);
+
+/* index into a foreign mapping region */
+#define FOREIGN_PAGE_SLOT	0
+#define FOREIGN_PAGE_TABLE_SLOT	1
+
+struct foreign_page {
+	unsigned long phys;
+	unsigned long flags;
+};
 
-	for (word = 0; word < pool->pages / BITS_PER_LONG; word++)
-		if (pool->used_bitmap[word] != ~0UL) {
-			page_nr = ffz(pool->used_bitmap[word]) +
-				word * BITS_PER_LONG;
-			if (page_nr >= pool->pages)
-				break;
-			set_bit(page_nr, pool->used_bitmap);
-			pool->used_pages++;
-			return pool->base_address + page_nr * PAGE_SIZE;
+/* mappings currently installed in the foreign mapping regions */
+static struct foreign_page *foreign_pages;
+
+/*
+ * Return the first page in [start, limit) that is free, or used if @used is
+ * set. Returns @limit if there is none. Full words are skipped at once.
+ */
+static unsigned long find_next_page(struct page_pool *pool,
+				    unsigned long start, unsigned long limit,
+				    bool used)
+{
+	unsigned long word;
+
+	while (start < limit) {
+		word = pool->used_bitmap[start / BITS_PER_LONG];
+		if (used)
+			word = ~word;
+		/* ignore the bits below start */
+		word |= (1UL << (start % BITS_PER_LONG)) - 1;
+		if (word != ~0UL) {
+			start = (start & ~(BITS_PER_LONG - 1)) + ffz(word);
+			return start < limit ? start : limit;
 		}
+		start = (start | (BITS_PER_LONG - 1)) + 1;
+	}
+	return limit;
+}
 
-	return NULL;
+static void account_pages(struct page_pool *pool, unsigned int user,
+			  long num)
+{
+	pool->used_pages += num;
+	if (pool->used_pages > pool->peak_pages)
+		pool->peak_pages = pool->used_pages;
+
+	pool->user_pages[user] += num;
+	if (pool->user_pages[user] > pool->user_peak_pages[user])
+		pool->user_peak_pages[user] = pool->user_pages[user];
 }
 
-void *page_alloc(struct page_pool *pool, unsigned int num)
+void *page_alloc(struct page_pool *pool, unsigned int num, unsigned int user)
 {
-	void *start, *last, *next;
-	unsigned int allocated;
+	unsigned long start, end, n;
 
-	start = page_alloc_one(pool);
-	if (!start)
+	if (num == 0)
 		return NULL;
 
-	for (allocated = 1, last = start; allocated < num;
-	     allocated++, last = next) {
-		next = page_alloc_one(pool);
-		if (next != last + PAGE_SIZE) {
-			page_free(pool, start, allocated);
-			return NULL;
+	spin_lock(&pool->lock);
+
+	/* first fit: look for a free run of num pages, starting at the hint */
+	start = find_next_page(pool, pool->free_hint, pool->pages, false);
+	if (start > pool->free_hint)
+		pool->free_hint = start;
+
+	while (start + num <= pool->pages) {
+		end = find_next_page(pool, start, start + num, true);
+		if (end == start + num) {
+			for (n = start; n < end; n++) {
+				set_bit(n, pool->used_bitmap);
+				if (pool->flags & PAGE_SCRUB_ON_ALLOC &&
+				    test_bit(n, pool->dirty_bitmap)) {
+					clear_page(pool->base_address +
+						   n * PAGE_SIZE);
+					clear_bit(n, pool->dirty_bitmap);
+				}
+			}
+			account_pages(pool, user, num);
+			if (start == pool->free_hint)
+				pool->free_hint = end;
+			spin_unlock(&pool->lock);
+			return pool->base_address + start * PAGE_SIZE;
 		}
+		start = find_next_page(pool, end, pool->pages, false);
 	}
 
-	return start;
+	spin_unlock(&pool->lock);
+	return NULL;
 }
 
-void page_free(struct page_pool *pool, void *page, unsigned int num)
+void page_free(struct page_pool *pool, void *page, unsigned int num,
+	       unsigned int user)
 {
 	unsigned long page_nr;
 
 	if (!page)
 		return;
 
+	spin_lock(&pool->lock);
 	while (num-- > 0) {
-		if (pool->flags & PAGE_SCRUB_ON_FREE)
-			memset(page, 0, PAGE_SIZE);
 		page_nr = (page - pool->base_address) / PAGE_SIZE;
+		/* defer scrubbing to the next allocation of this page */
+		if (pool->flags & PAGE_SCRUB_ON_ALLOC)
+			set_bit(page_nr, pool->dirty_bitmap);
 		clear_bit(page_nr, pool->used_bitmap);
-		pool->used_pages--;
+		account_pages(pool, user, -1);
+		if (page_nr < pool->free_hint)
+			pool->free_hint = page_nr;
 		page += PAGE_SIZE;
 	}
+	spin_unlock(&pool->lock);
+}
+
+static struct page_pool *page_pool_of(void *page)
+{
+	struct page_pool *pool;
+
+	for (pool = node_pools; pool < node_pools + JAILHOUSE_MAX_NUMA_NODES;
+	     pool++)
+		if (page >= pool->base_address &&
+		    page < pool->base_address + pool->pages * PAGE_SIZE)
+			return pool;
+	return &mem_pool;
+}
+
+/* falls back to mem_pool if the node has no pool or it is exhausted */
+void *page_alloc_node(int node, unsigned int num, unsigned int user)
+{
+	void *page = NULL;
+
+	if (node != NUMA_NO_NODE && node_pools[node].pages > 0)
+		page = page_alloc(&node_pools[node], num, user);
+	if (!page)
+		page = page_alloc(&mem_pool, num, user);
+	return page;
+}
+
+void page_free_node(void *page, unsigned int num, unsigned int user)
+{
+	page_free(page_pool_of(page), page, num, user);
+}
+
+int numa_node_of_cpu(unsigned int cpu)
+{
+	struct jailhouse_numa_node *node = system_config->numa_nodes;
+	unsigned int n;
+
+	if (cpu < sizeof(node->cpu_set) * 8)
+		for (n = 0; n < system_config->num_numa_nodes; n++, node++)
+			if (test_bit(cpu, (unsigned long *)node->cpu_set))
+				return n;
+	return NUMA_NO_NODE;
+}
+
+/* the node all CPUs of the cell are on, NUMA_NO_NODE if they are not */
+int numa_node_of_cell(struct jailhouse_cell_desc *config)
+{
+	unsigned long *cpu_set = (unsigned long *)((void *)config +
+		sizeof(struct jailhouse_cell_desc));
+	int node = NUMA_NO_NODE;
+	bool first = true;
+	unsigned int cpu;
+
+	for (cpu = 0; cpu < config->cpu_set_size * 8; cpu++) {
+		if (!test_bit(cpu, cpu_set))
+			continue;
+		if (first)
+			node = numa_node_of_cpu(cpu);
+		else if (numa_node_of_cpu(cpu) != node)
+			return NUMA_NO_NODE;
+		first = false;
+	}
+	return node;
 }
 
 unsigned long page_map_virt2phys(pgd_t *page_table,
 				 unsigned long page_table_offset,
 				 unsigned long virt)
 {
+#if PAGE_DIR_LEVELS == 4
 	pgd_t *pgd;
+#endif
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
@@ -102,15 +228,18 @@ unsigned long page_map_virt2phys(pgd_t *page_table,
 
 	pud = pud4l_offset(pgd, page_table_offset, virt);
 #elif PAGE_DIR_LEVELS == 3
-	pud = pud3l_offset(pgd, page_table_offset, virt);
+	pud = pud3l_offset(page_table, virt);
 #else
 # error Unsupported paging level
 #endif
 	if (!pud_valid(pud))
 		return INVALID_PHYS_ADDR;
 
+	if (pud_is_hugepage(pud))
+		return phys_address_hugepage_1g(pud, virt);
+
 	pmd = pmd_offset(pud, page_table_offset, virt);
-	if (!pmd_valid(pud))
+	if (!pmd_valid(pmd))
 		return INVALID_PHYS_ADDR;
 
 	if (pmd_is_hugepage(pmd))
@@ -123,27 +252,99 @@ unsigned long page_map_virt2phys(pgd_t *page_table,
 	return phys_address(pte, virt);
 }
 
-int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
-		    unsigned long virt, unsigned long flags,
-		    unsigned long table_flags, unsigned int levels)
+static bool hugepage_fits(unsigned long phys, unsigned long virt,
+			  unsigned long size, unsigned long page_size)
+{
+	return size >= page_size && ((phys | virt) & (page_size - 1)) == 0;
+}
+
+/* write back entries the table walker does not snoop from the CPU caches */
+static void flush_pt_entries(void *entry, unsigned long size,
+			     unsigned int map_flags)
+{
+	if (map_flags & PAGE_MAP_NON_COHERENT)
+		flush_cache_range(entry, size);
+}
+
+static void *page_table_alloc(unsigned int map_flags)
+{
+	return page_alloc_node(
+		(int)((map_flags & PAGE_MAP_NODE_MASK) >> 16) - 1, 1,
+		(map_flags & PAGE_MAP_USER_MASK) >> 8);
+}
+
+static void page_table_free(void *table, unsigned int map_flags)
+{
+	page_free_node(table, 1, (map_flags & PAGE_MAP_USER_MASK) >> 8);
+}
+
+/* replace a 1G leaf with a table of 2M leaves covering the same range */
+static int split_pud_hugepage(pud_t *pud, unsigned int map_flags)
+{
+	unsigned long phys = phys_address_hugepage_1g(pud, 0);
+	unsigned long flags = hugepage_flags(*pud);
+	pmd_t *pmd;
+	int n;
+
+	pmd = page_table_alloc(map_flags);
+	if (!pmd)
+		return -ENOMEM;
+	for (n = 0; n < PAGE_SIZE / sizeof(pmd_t); n++)
+		set_pmd_hugepage(&pmd[n], phys + n * HUGEPAGE_SIZE, flags);
+	flush_pt_entries(pmd, PAGE_SIZE, map_flags);
+	set_pud(pud, page_map_hvirt2phys(pmd), flags & PAGE_TABLE_FLAGS_MASK);
+	flush_pt_entries(pud, sizeof(pud_t), map_flags);
+
+	return 0;
+}
+
+/* replace a 2M leaf with a table of 4K pages covering the same range */
+static int split_pmd_hugepage(pmd_t *pmd, unsigned int map_flags)
+{
+	unsigned long phys = phys_address_hugepage(pmd, 0);
+	unsigned long flags = hugepage_flags(*pmd);
+	pte_t *pte;
+	int n;
+
+	pte = page_table_alloc(map_flags);
+	if (!pte)
+		return -ENOMEM;
+	for (n = 0; n < PAGE_SIZE / sizeof(pte_t); n++)
+		set_pte(&pte[n], phys + n * PAGE_SIZE, flags);
+	flush_pt_entries(pte, PAGE_SIZE, map_flags);
+	set_pmd(pmd, page_map_hvirt2phys(pte), flags & PAGE_TABLE_FLAGS_MASK);
+	flush_pt_entries(pmd, sizeof(pmd_t), map_flags);
+
+	return 0;
+}
+
+static int __page_map_create(pgd_t *page_table, unsigned long phys,
+			     unsigned long size, unsigned long virt,
+			     unsigned long flags, unsigned long table_flags,
+			     unsigned int levels, unsigned int map_flags)
 {
 	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long page_size;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
+	int err;
 
 	for (size = PAGE_ALIGN(size); size > 0;
-	     phys += PAGE_SIZE, virt += PAGE_SIZE, size -= PAGE_SIZE) {
+	     phys += page_size, virt += page_size, size -= page_size) {
 		switch (levels) {
 		case 4:
 			pgd = pgd_offset(page_table, virt);
 			if (!pgd_valid(pgd)) {
-				pud = page_alloc(&mem_pool, 1);
+				pud = page_table_alloc(map_flags);
 				if (!pud)
 					return -ENOMEM;
+				flush_pt_entries(pud, PAGE_SIZE, map_flags);
 				set_pgd(pgd, page_map_hvirt2phys(pud),
 					table_flags);
+				flush_pt_entries(pgd, sizeof(pgd_t),
+						 map_flags);
 			}
 			pud = pud4l_offset(pgd, offs, virt);
 			break;
@@ -154,46 +355,127 @@ int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
 			return -EINVAL;
 		}
 
+		/* a huge leaf may only replace an empty entry or another
+		 * leaf, existing tables are reused */
+		if (map_flags & PAGE_MAP_HUGE_1G &&
+		    hugepage_fits(phys, virt, size, HUGEPAGE_1G_SIZE) &&
+		    (!pud_valid(pud) || pud_is_hugepage(pud))) {
+			set_pud_hugepage(pud, phys, flags);
+			flush_pt_entries(pud, sizeof(pud_t), map_flags);
+			page_size = HUGEPAGE_1G_SIZE;
+			continue;
+		}
+
 		if (!pud_valid(pud)) {
-			pmd = page_alloc(&mem_pool, 1);
+			pmd = page_table_alloc(map_flags);
 			if (!pmd)
 				return -ENOMEM;
+			flush_pt_entries(pmd, PAGE_SIZE, map_flags);
 			set_pud(pud, page_map_hvirt2phys(pmd), table_flags);
+			flush_pt_entries(pud, sizeof(pud_t), map_flags);
+		} else if (pud_is_hugepage(pud)) {
+			err = split_pud_hugepage(pud, map_flags);
+			if (err)
+				return err;
 		}
 
 		pmd = pmd_offset(pud, offs, virt);
+		if (map_flags & PAGE_MAP_HUGE_2M &&
+		    hugepage_fits(phys, virt, size, HUGEPAGE_SIZE) &&
+		    (!pmd_valid(pmd) || pmd_is_hugepage(pmd))) {
+			set_pmd_hugepage(pmd, phys, flags);
+			flush_pt_entries(pmd, sizeof(pmd_t), map_flags);
+			page_size = HUGEPAGE_SIZE;
+			continue;
+		}
+
 		if (!pmd_valid(pmd)) {
-			pte = page_alloc(&mem_pool, 1);
+			pte = page_table_alloc(map_flags);
 			if (!pte)
 				return -ENOMEM;
+			flush_pt_entries(pte, PAGE_SIZE, map_flags);
 			set_pmd(pmd, page_map_hvirt2phys(pte), table_flags);
+			flush_pt_entries(pmd, sizeof(pmd_t), map_flags);
+		} else if (pmd_is_hugepage(pmd)) {
+			err = split_pmd_hugepage(pmd, map_flags);
+			if (err)
+				return err;
 		}
 
 		pte = pte_offset(pmd, offs, virt);
 		set_pte(pte, phys, flags);
+		flush_pt_entries(pte, sizeof(pte_t), map_flags);
+		page_size = PAGE_SIZE;
 	}
 
-	flush_tlb();
-
 	return 0;
 }
 
-void page_map_destroy(pgd_t *page_table, unsigned long virt,
-		      unsigned long size, unsigned int levels)
+/*
+ * Only the hypervisor's own page table is cached in the TLB of this CPU.
+ * Users of guest tables (EPT, VT-d) have to invalidate them on their own.
+ */
+static void flush_page_map_range(pgd_t *page_table, unsigned long virt,
+				 unsigned long size)
+{
+	unsigned long end = PAGE_ALIGN(virt + size);
+
+	if (page_table != hv_page_table)
+		return;
+
+	if (end - (virt & PAGE_MASK) > FLUSH_TLB_PAGE_LIMIT * PAGE_SIZE) {
+		flush_tlb();
+		return;
+	}
+	for (virt &= PAGE_MASK; virt < end; virt += PAGE_SIZE)
+		flush_tlb_page(virt);
+}
+
+int page_map_create(pgd_t *page_table, unsigned long phys, unsigned long size,
+		    unsigned long virt, unsigned long flags,
+		    unsigned long table_flags, unsigned int levels,
+		    unsigned int map_flags)
+{
+	int err;
+
+	spin_lock(&page_table_lock);
+	err = __page_map_create(page_table, phys, size, virt, flags,
+				table_flags, levels, map_flags);
+	spin_unlock(&page_table_lock);
+	flush_page_map_range(page_table, virt, size);
+
+	return err;
+}
+
+/* distance from addr to the next boundary of the given size, capped */
+static unsigned long range_step(unsigned long addr, unsigned long size,
+				unsigned long boundary)
+{
+	unsigned long step = boundary - (addr & (boundary - 1));
+
+	return step < size ? step : size;
+}
+
+static void __page_map_destroy(pgd_t *page_table, unsigned long virt,
+			       unsigned long size, unsigned int levels,
+			       unsigned int map_flags)
 {
 	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long page_size;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
 
 	for (size = PAGE_ALIGN(size); size > 0;
-	     virt += PAGE_SIZE, size -= PAGE_SIZE) {
+	     virt += page_size, size -= page_size) {
 		switch (levels) {
 		case 4:
 			pgd = pgd_offset(page_table, virt);
-			if (!pgd_valid(pgd))
+			if (!pgd_valid(pgd)) {
+				page_size = range_step(virt, size, PGD_SIZE);
 				continue;
+			}
 
 			pud = pud4l_offset(pgd, offs, virt);
 			break;
@@ -204,33 +486,188 @@ void page_map_destroy(pgd_t *page_table, unsigned long virt,
 		default:
 			return;
 		}
-		if (!pud_valid(pud))
+		if (!pud_valid(pud)) {
+			page_size = range_step(virt, size, HUGEPAGE_1G_SIZE);
 			continue;
+		}
+
+		if (pud_is_hugepage(pud)) {
+			page_size = range_step(virt, size, HUGEPAGE_1G_SIZE);
+			if (page_size == HUGEPAGE_1G_SIZE) {
+				clear_pud(pud);
+				flush_pt_entries(pud, sizeof(pud_t),
+						 map_flags);
+				goto pud_released;
+			}
+			/* On failure, we leave the complete leaf in place.
+			 * This can only happen in an out-of-memory situation
+			 * which the caller cannot recover from anyway. */
+			if (split_pud_hugepage(pud, map_flags))
+				continue;
+		}
 
 		pmd = pmd_offset(pud, offs, virt);
-		if (!pmd_valid(pmd))
+		if (!pmd_valid(pmd)) {
+			page_size = range_step(virt, size, HUGEPAGE_SIZE);
 			continue;
+		}
 
+		if (pmd_is_hugepage(pmd)) {
+			page_size = range_step(virt, size, HUGEPAGE_SIZE);
+			if (page_size == HUGEPAGE_SIZE) {
+				clear_pmd(pmd);
+				flush_pt_entries(pmd, sizeof(pmd_t),
+						 map_flags);
+				goto pmd_released;
+			}
+			if (split_pmd_hugepage(pmd, map_flags))
+				continue;
+		}
+
+		page_size = PAGE_SIZE;
 		pte = pte_offset(pmd, offs, virt);
 		clear_pte(pte);
+		flush_pt_entries(pte, sizeof(pte_t), map_flags);
 
 		if (!pt_empty(pmd, offs))
 			continue;
-		page_free(&mem_pool, pte_offset(pmd, offs, 0), 1);
+		page_table_free(pte_offset(pmd, offs, 0), map_flags);
 		clear_pmd(pmd);
+		flush_pt_entries(pmd, sizeof(pmd_t), map_flags);
 
+pmd_released:
 		if (!pmd_empty(pud, offs))
 			continue;
-		page_free(&mem_pool, pmd_offset(pud, offs, 0), 1);
+		page_table_free(pmd_offset(pud, offs, 0), map_flags);
 		clear_pud(pud);
+		flush_pt_entries(pud, sizeof(pud_t), map_flags);
 
+pud_released:
 		if (levels < 4 || !pud_empty(pgd, offs))
 			continue;
-		page_free(&mem_pool, pud4l_offset(pgd, offs, 0), 1);
+		page_table_free(pud4l_offset(pgd, offs, 0), map_flags);
 		clear_pgd(pgd);
+		flush_pt_entries(pgd, sizeof(pgd_t), map_flags);
 	}
+}
+
+void page_map_destroy(pgd_t *page_table, unsigned long virt,
+		      unsigned long size, unsigned int levels,
+		      unsigned int map_flags)
+{
+	spin_lock(&page_table_lock);
+	__page_map_destroy(page_table, virt, size, levels, map_flags);
+	flush_page_map_range(page_table, virt, size);
+	spin_unlock(&page_table_lock);
+}
+
+/* sets the bits of the pages in [virt, virt + size) relative to base */
+static void mark_pages(unsigned long *bitmap, unsigned long base,
+		       unsigned long virt, unsigned long size)
+{
+	unsigned long page;
+
+	for (page = (virt - base) / PAGE_SIZE;
+	     page < (virt - base + size) / PAGE_SIZE; page++)
+		set_bit(page, bitmap);
+}
+
+void page_map_test_and_clear(pgd_t *page_table, unsigned long virt,
+			     unsigned long size, unsigned int levels,
+			     unsigned long flag, unsigned long *bitmap)
+{
+	unsigned long offs = hypervisor_header.page_offset;
+	unsigned long base = virt;
+	unsigned long page_size;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	spin_lock(&page_table_lock);
+	for (size = PAGE_ALIGN(size); size > 0;
+	     virt += page_size, size -= page_size) {
+		switch (levels) {
+		case 4:
+			pgd = pgd_offset(page_table, virt);
+			if (!pgd_valid(pgd)) {
+				page_size = range_step(virt, size, PGD_SIZE);
+				continue;
+			}
+			pud = pud4l_offset(pgd, offs, virt);
+			break;
+		case 3:
+			pud = pud3l_offset(page_table, virt);
+			break;
+		default:
+			goto out;
+		}
+
+		page_size = range_step(virt, size, HUGEPAGE_1G_SIZE);
+		if (!pud_valid(pud))
+			continue;
+		if (pud_is_hugepage(pud)) {
+			if (*pud & flag) {
+				*pud &= ~flag;
+				mark_pages(bitmap, base, virt, page_size);
+			}
+			continue;
+		}
 
-	flush_tlb();
+		page_size = range_step(virt, size, HUGEPAGE_SIZE);
+		pmd = pmd_offset(pud, offs, virt);
+		if (!pmd_valid(pmd))
+			continue;
+		if (pmd_is_hugepage(pmd)) {
+			if (*pmd & flag) {
+				*pmd &= ~flag;
+				mark_pages(bitmap, base, virt, page_size);
+			}
+			continue;
+		}
+
+		page_size = PAGE_SIZE;
+		pte = pte_offset(pmd, offs, virt);
+		if (pte_valid(pte) && *pte & flag) {
+			*pte &= ~flag;
+			mark_pages(bitmap, base, virt, PAGE_SIZE);
+		}
+	}
+out:
+	spin_unlock(&page_table_lock);
+}
+
+/*
+ * Map the given physical page into a slot of a foreign mapping region. The
+ * mappings stay in place after use so that repeated lookups only need to
+ * compare the cached target instead of remapping and flushing the TLB.
+ */
+static void *map_foreign_page(unsigned int mapping_region, unsigned int slot,
+			      unsigned long phys, unsigned long flags)
+{
+	unsigned int page_nr = mapping_region * NUM_FOREIGN_PAGES + slot;
+	struct foreign_page *cached = &foreign_pages[page_nr];
+	unsigned long virt = FOREIGN_MAPPING_BASE + page_nr * PAGE_SIZE;
+	int err;
+
+	if (cached->phys == phys && cached->flags == flags)
+		return (void *)virt;
+
+	/* Only this CPU uses the region, but intermediate tables of
+	 * hv_page_table may be shared with other mappings. */
+	spin_lock(&page_table_lock);
+	err = __page_map_create(hv_page_table, phys, PAGE_SIZE, virt, flags,
+				PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS,
+				PAGE_MAP_NO_HUGE);
+	spin_unlock(&page_table_lock);
+	if (err)
+		return NULL;
+	flush_tlb_page(virt);
+
+	cached->phys = phys;
+	cached->flags = flags;
+
+	return (void *)virt;
 }
 
 void *page_map_get_foreign_page(unsigned int mapping_region,
@@ -238,106 +675,151 @@ void *page_map_get_foreign_page(unsigned int mapping_region,
 				unsigned long page_table_offset,
 				unsigned long virt, unsigned long flags)
 {
-	unsigned long page_virt, pt_virt, phys;
+	unsigned int slot = FOREIGN_PAGE_TABLE_SLOT;
+	unsigned long pt_virt, phys;
 #if PAGE_DIR_LEVELS == 4
 	pgd_t *pgd;
 #endif
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
-	int err;
 
-	page_virt = FOREIGN_MAPPING_BASE +
-		mapping_region * PAGE_SIZE * NUM_FOREIGN_PAGES;
-
-	pt_virt = page_virt + PAGE_SIZE;
+	/* The guest page tables are walked on every call, only the
+	 * hypervisor mappings of the visited pages are cached. */
 	phys = page_table_paddr + page_table_offset;
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, pt_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS);
-	if (err)
-		goto error_release;
+	pt_virt = (unsigned long)map_foreign_page(mapping_region, slot++, phys,
+						  PAGE_READONLY_FLAGS);
+	if (!pt_virt)
+		return NULL;
 
 #if PAGE_DIR_LEVELS == 4
 	pgd = pgd_offset((pgd_t *)pt_virt, virt);
 	if (!pgd_valid(pgd))
-		goto error_release;
-	pt_virt += PAGE_SIZE;
+		return NULL;
 	phys = (unsigned long)pud4l_offset(pgd, page_table_offset, 0);
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, pt_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS);
-	if (err)
-		goto error_release;
+	pt_virt = (unsigned long)map_foreign_page(mapping_region, slot++, phys,
+						  PAGE_READONLY_FLAGS);
+	if (!pt_virt)
+		return NULL;
 
-	pud = pud4l_offset((pgd_t *)&pt_virt, page_table_offset, virt);
+	pud = pud4l_offset((pgd_t *)&pt_virt, 0, virt);
 #elif PAGE_DIR_LEVELS == 3
 	pud = pud3l_offset((pgd_t *)pt_virt, virt);
 #else
 # error Unsupported paging level
 #endif
 	if (!pud_valid(pud))
-		goto error_release;
-	pt_virt += PAGE_SIZE;
+		return NULL;
+	if (pud_is_hugepage(pud)) {
+		phys = phys_address_hugepage_1g(pud, virt) + page_table_offset;
+		goto map_page;
+	}
 	phys = (unsigned long)pmd_offset(pud, page_table_offset, 0);
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, pt_virt,
-			      PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-			      PAGE_DIR_LEVELS);
-	if (err)
-		goto error_release;
+	pt_virt = (unsigned long)map_foreign_page(mapping_region, slot++, phys,
+						  PAGE_READONLY_FLAGS);
+	if (!pt_virt)
+		return NULL;
 
-	pmd = pmd_offset((pud_t *)&pt_virt, page_table_offset, virt);
+	pmd = pmd_offset((pud_t *)&pt_virt, 0, virt);
 	if (!pmd_valid(pmd))
-		goto error_release;
+		return NULL;
 	if (pmd_is_hugepage(pmd))
-		phys = phys_address_hugepage(pmd, virt);
+		phys = phys_address_hugepage(pmd, virt) + page_table_offset;
 	else {
-		pt_virt += PAGE_SIZE;
 		phys = (unsigned long)pte_offset(pmd, page_table_offset, 0);
-		err = page_map_create(hv_page_table, phys, PAGE_SIZE, pt_virt,
-				      PAGE_READONLY_FLAGS,
-				      PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS);
-		if (err)
-			goto error_release;
+		pt_virt = (unsigned long)map_foreign_page(mapping_region,
+							  slot++, phys,
+							  PAGE_READONLY_FLAGS);
+		if (!pt_virt)
+			return NULL;
 
-		pte = pte_offset((pmd_t *)&pt_virt, page_table_offset, virt);
+		pte = pte_offset((pmd_t *)&pt_virt, 0, virt);
 		if (!pte_valid(pte))
-			goto error_release;
+			return NULL;
 		phys = phys_address(pte, 0) + page_table_offset;
 	}
 
-	err = page_map_create(hv_page_table, phys, PAGE_SIZE, page_virt,
-			      flags, PAGE_DEFAULT_FLAGS, PAGE_DIR_LEVELS);
-	if (err)
-		goto error_release;
-
-	return (void *)page_virt;
+map_page:
+	return map_foreign_page(mapping_region, FOREIGN_PAGE_SLOT,
+				phys & PAGE_MASK, flags);
+}
 
-error_release:
-	page_map_release_foreign_page(mapping_region);
-	return NULL;
+static bool node_memory_valid(struct jailhouse_numa_node *node)
+{
+	unsigned long hv_phys = page_map_hvirt2phys(__start);
+	unsigned long virt = (unsigned long)page_map_phys2hvirt(
+		node->phys_start);
+
+	if ((node->phys_start | node->size) & ~PAGE_MASK)
+		return false;
+	/* the linear mapping must neither wrap nor hit the hypervisor or the
+	 * remapping region */
+	return virt + node->size > virt &&
+		(node->phys_start >= hv_phys + hypervisor_header.size ||
+		 node->phys_start + node->size <= hv_phys) &&
+		(virt >= REMAP_BASE_ADDR + remap_pool.pages * PAGE_SIZE ||
+		 virt + node->size <= REMAP_BASE_ADDR);
 }
 
-void page_map_release_foreign_page(unsigned int mapping_region)
+static int node_pools_init(void)
 {
-	page_map_destroy(hv_page_table,
-			 FOREIGN_MAPPING_BASE +
-			 mapping_region * PAGE_SIZE * NUM_FOREIGN_PAGES,
-			 NUM_FOREIGN_PAGES * PAGE_SIZE, PAGE_DIR_LEVELS);
+	struct jailhouse_numa_node *node = system_config->numa_nodes;
+	unsigned long bitmap_pages;
+	struct page_pool *pool;
+	unsigned int n;
+	int err;
+
+	if (system_config->num_numa_nodes > JAILHOUSE_MAX_NUMA_NODES)
+		return -EINVAL;
+
+	for (n = 0; n < system_config->num_numa_nodes; n++, node++) {
+		if (node->size == 0)
+			continue;
+		if (!node_memory_valid(node))
+			return -EINVAL;
+
+		pool = &node_pools[n];
+		bitmap_pages = (node->size / PAGE_SIZE + BITS_PER_PAGE - 1) /
+			BITS_PER_PAGE;
+		pool->used_bitmap = page_alloc(&mem_pool, 2 * bitmap_pages,
+					       JAILHOUSE_POOL_USER_HYPERVISOR);
+		if (!pool->used_bitmap)
+			return -ENOMEM;
+		pool->dirty_bitmap = pool->used_bitmap +
+			bitmap_pages * PAGE_SIZE / sizeof(unsigned long);
+		/* like the pool in hypervisor_memory, the driver leaves it */
+		memset(pool->dirty_bitmap, 0xff, bitmap_pages * PAGE_SIZE);
+		pool->flags = PAGE_SCRUB_ON_ALLOC;
+
+		/* keep the linear mapping page_map_hvirt2phys relies on */
+		err = page_map_create(hv_page_table, node->phys_start,
+				node->size,
+				(unsigned long)page_map_phys2hvirt(
+					node->phys_start),
+				PAGE_DEFAULT_FLAGS, PAGE_DEFAULT_FLAGS,
+				PAGE_DIR_LEVELS, PAGE_MAP_HUGE_2M);
+		if (err)
+			return err;
+
+		pool->base_address = page_map_phys2hvirt(node->phys_start);
+		pool->pages = node->size / PAGE_SIZE;
+	}
+	return 0;
 }
 
 int paging_init(void)
 {
 	unsigned long per_cpu_pages, config_pages, bitmap_pages;
 	unsigned long n;
-	u8 *addr;
 	int err;
 
 	mem_pool.pages =
 		(hypervisor_header.size - (__page_pool - __start)) / PAGE_SIZE;
 	per_cpu_pages = hypervisor_header.possible_cpus *
 		sizeof(struct per_cpu) / PAGE_SIZE;
-	bitmap_pages = (mem_pool.pages + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+	/* used and dirty bitmap */
+	bitmap_pages = 2 * ((mem_pool.pages + BITS_PER_PAGE - 1) /
+			    BITS_PER_PAGE);
 
 	system_config = (struct jailhouse_system *)
 		(__page_pool + per_cpu_pages * PAGE_SIZE);
@@ -351,30 +833,51 @@ int paging_init(void)
 	mem_pool.used_bitmap =
 		(unsigned long *)(__page_pool + per_cpu_pages * PAGE_SIZE +
 				  config_pages * PAGE_SIZE);
-	mem_pool.used_pages = per_cpu_pages + config_pages + bitmap_pages;
+	mem_pool.dirty_bitmap = mem_pool.used_bitmap +
+		bitmap_pages / 2 * PAGE_SIZE / sizeof(unsigned long);
+	/* the driver leaves all of the pool untouched, scrub pages on use */
+	memset(mem_pool.used_bitmap, 0, bitmap_pages / 2 * PAGE_SIZE);
+	memset(mem_pool.dirty_bitmap, 0xff, bitmap_pages / 2 * PAGE_SIZE);
+	account_pages(&mem_pool, JAILHOUSE_POOL_USER_HYPERVISOR,
+		      per_cpu_pages + config_pages + bitmap_pages);
 	for (n = 0; n < mem_pool.used_pages; n++)
 		set_bit(n, mem_pool.used_bitmap);
-	mem_pool.flags = PAGE_SCRUB_ON_FREE;
+	mem_pool.free_hint = mem_pool.used_pages;
+	mem_pool.flags = PAGE_SCRUB_ON_ALLOC;
 
-	remap_pool.used_bitmap = page_alloc(&mem_pool, NUM_REMAP_BITMAP_PAGES);
-	remap_pool.used_pages =
-		hypervisor_header.possible_cpus * NUM_FOREIGN_PAGES;
+	remap_pool.used_bitmap = page_alloc(&mem_pool, NUM_REMAP_BITMAP_PAGES,
+					    JAILHOUSE_POOL_USER_HYPERVISOR);
+	if (!remap_pool.used_bitmap)
+		goto error_nomem;
+	account_pages(&remap_pool, JAILHOUSE_POOL_USER_HYPERVISOR,
+		      hypervisor_header.possible_cpus * NUM_FOREIGN_PAGES);
 	for (n = 0; n < remap_pool.used_pages; n++)
 		set_bit(n, remap_pool.used_bitmap);
+	remap_pool.free_hint = remap_pool.used_pages;
 
-	hv_page_table = page_alloc(&mem_pool, 1);
+	foreign_pages = page_alloc(&mem_pool,
+		PAGE_ALIGN(remap_pool.used_pages * sizeof(struct foreign_page)) /
+		PAGE_SIZE, JAILHOUSE_POOL_USER_HYPERVISOR);
+	if (!foreign_pages)
+		goto error_nomem;
+
+	hv_page_table = page_alloc(&mem_pool, 1,
+				   JAILHOUSE_POOL_USER_HYPERVISOR);
 	if (!hv_page_table)
 		goto error_nomem;
 
 	/* Replicate hypervisor mapping of Linux */
-	for (addr = __start; addr < __start + hypervisor_header.size;
-	     addr += PAGE_SIZE) {
-		err = page_map_create(hv_page_table, page_map_hvirt2phys(addr),
-				      PAGE_SIZE, (unsigned long)addr,
-				      PAGE_DEFAULT_FLAGS, PAGE_DEFAULT_FLAGS,
-				      PAGE_DIR_LEVELS);
-		if (err)
-			goto error_nomem;
+	err = page_map_create(hv_page_table, page_map_hvirt2phys(__start),
+			      hypervisor_header.size, (unsigned long)__start,
+			      PAGE_DEFAULT_FLAGS, PAGE_DEFAULT_FLAGS,
+			      PAGE_DIR_LEVELS, PAGE_MAP_HUGE_2M);
+	if (err)
+		goto error_nomem;
+
+	err = node_pools_init();
+	if (err) {
+		printk("FATAL: invalid NUMA node memory\n");
+		return err;
 	}
 
 	return 0;
@@ -384,9 +887,68 @@ error_nomem:
 	return -ENOMEM;
 }
 
+static unsigned long largest_free_run(struct page_pool *pool)
+{
+	unsigned long start, end, largest = 0;
+
+	spin_lock(&pool->lock);
+	for (start = find_next_page(pool, 0, pool->pages, false);
+	     start < pool->pages;
+	     start = find_next_page(pool, end, pool->pages, false)) {
+		end = find_next_page(pool, start, pool->pages, true);
+		if (end - start > largest)
+			largest = end - start;
+	}
+	spin_unlock(&pool->lock);
+
+	return largest;
+}
+
+long page_pool_get_stat(struct per_cpu *cpu_data, unsigned long pool_id,
+			unsigned long stat)
+{
+	struct page_pool *pool;
+
+	if (cpu_data->cell != cell_list)
+		return -EPERM;
+
+	if (pool_id == JAILHOUSE_POOL_MEM)
+		pool = &mem_pool;
+	else if (pool_id == JAILHOUSE_POOL_REMAP)
+		pool = &remap_pool;
+	else if (pool_id < JAILHOUSE_NUM_POOLS)
+		pool = &node_pools[pool_id - JAILHOUSE_POOL_NODE(0)];
+	else
+		return -EINVAL;
+
+	switch (stat) {
+	case JAILHOUSE_POOL_STAT_PAGES:
+		return pool->pages;
+	case JAILHOUSE_POOL_STAT_USED:
+		return pool->used_pages;
+	case JAILHOUSE_POOL_STAT_PEAK:
+		return pool->peak_pages;
+	case JAILHOUSE_POOL_STAT_LARGEST_FREE:
+		return largest_free_run(pool);
+	}
+	if (stat < JAILHOUSE_POOL_STAT_USER_PEAK)
+		return pool->user_pages[stat - JAILHOUSE_POOL_STAT_USER_USED];
+	if (stat < JAILHOUSE_NUM_POOL_STATS)
+		return pool->user_peak_pages[stat -
+					     JAILHOUSE_POOL_STAT_USER_PEAK];
+	return -EINVAL;
+}
+
 void page_map_dump_stats(const char *when)
 {
-	printk("Page pool usage %s: mem %d/%d, remap %d/%d\n", when,
-	       mem_pool.used_pages, mem_pool.pages,
+	unsigned int n;
+
+	printk("Page pool usage %s: mem %d/%d (peak %d), remap %d/%d\n", when,
+	       mem_pool.used_pages, mem_pool.pages, mem_pool.peak_pages,
 	       remap_pool.used_pages, remap_pool.pages);
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++)
+		if (node_pools[n].pages > 0)
+			printk("  node %d %d/%d (peak %d)\n", n,
+			       node_pools[n].used_pages, node_pools[n].pages,
+			       node_pools[n].peak_pages);
 }
@@ -63,10 +63,13 @@ static void init_early(unsigned int cpu_id)
 	if (error)
 		return;
 
+	trace_init();
+
 	if (system_config->config_memory.size > 0) {
 		size = PAGE_ALIGN(system_config->config_memory.size);
 
-		config_memory = page_alloc(&remap_pool, size / PAGE_SIZE);
+		config_memory = page_alloc(&remap_pool, size / PAGE_SIZE,
+					   JAILHOUSE_POOL_USER_REMAP);
 		if (!config_memory) {
 			error = -ENOMEM;
 			return;
@@ -76,15 +79,20 @@ static void init_early(unsigned int cpu_id)
 				system_config->config_memory.phys_start,
 				size, (unsigned long)config_memory,
 				PAGE_READONLY_FLAGS, PAGE_DEFAULT_FLAGS,
-				PAGE_DIR_LEVELS);
+				PAGE_DIR_LEVELS, PAGE_MAP_NO_HUGE);
 		if (error)
 			return;
 	}
 
-	error = check_mem_regions(&system_config->system);
+	error = check_cell_config(&system_config->system,
+				  system_config->system.total_size);
 	if (error)
 		return;
 
+	/* node pools are only mapped in the hypervisor page table, which is
+	 * not active yet, and the root cell spans all nodes anyway */
+	linux_cell.numa_node = NUMA_NO_NODE;
+
 	error = arch_init_early(&linux_cell, &system_config->system);
 	if (error)
 		return;
@@ -96,15 +104,21 @@ static void init_early(unsigned int cpu_id)
 	cell_list = &linux_cell;
 
 	page_map_dump_stats("after early setup");
-	printk("Initializing first processor:\n");
+	printk("Initializing processors:\n");
+}
+
+static void set_error(int err)
+{
+	spin_lock(&init_lock);
+	if (!error)
+		error = err;
+	spin_unlock(&init_lock);
 }
 
 static void cpu_init(struct per_cpu *cpu_data)
 {
 	int err;
 
-	printk(" CPU %d... ", cpu_data->cpu_id);
-
 	err = register_linux_cpu(cpu_data);
 	if (err)
 		goto failed;
@@ -113,42 +127,41 @@ static void cpu_init(struct per_cpu *cpu_data)
 	if (err)
 		goto failed;
 
-	printk("OK\n");
-
-	/* If this CPU is last, make sure everything was committed before we
-	 * signal the other CPUs spinning on initialized_cpus that they can
-	 * continue. */
-	memory_barrier();
-	initialized_cpus++;
+	printk(" CPU %d... OK\n", cpu_data->cpu_id);
 	return;
 
 failed:
-	printk("FAILED\n");
-	if (!error)
-		error = err;
+	printk(" CPU %d... FAILED\n", cpu_data->cpu_id);
+	set_error(err);
 }
 
 static void init_late(void)
 {
-	error = arch_init_late(&linux_cell, &system_config->system);
-	if (error)
+	int err;
+
+	err = arch_init_late(&linux_cell, &system_config->system);
+	if (err) {
+		set_error(err);
 		return;
+	}
 
 	page_map_dump_stats("after late setup");
-	printk("Initializing remaining processors:\n");
 }
 
 int entry(struct per_cpu *cpu_data)
 {
+	unsigned long start = read_tsc();
 	bool master = false;
 
 	spin_lock(&init_lock);
-
 	if (master_cpu_id == -1) {
 		master = true;
 		init_early(cpu_data->cpu_id);
 	}
+	spin_unlock(&init_lock);
 
+	/* The early setup is complete at this point, all CPUs continue in
+	 * parallel. */
 	if (!error) {
 		cpu_init(cpu_data);
 
@@ -156,10 +169,18 @@ int entry(struct per_cpu *cpu_data)
 			init_late();
 	}
 
+	/* If this CPU is last, make sure everything was committed before we
+	 * signal the other CPUs spinning on initialized_cpus that they can
+	 * continue. */
+	memory_barrier();
+	spin_lock(&init_lock);
+	initialized_cpus++;
 	spin_unlock(&init_lock);
 
-	while (!error && initialized_cpus < hypervisor_header.online_cpus)
-		cpu_relax();
+	/* errors are set before the failing CPU increments initialized_cpus */
+	cpu_wait_while(!error &&
+		       initialized_cpus < hypervisor_header.online_cpus,
+		       &initialized_cpus);
 
 	if (error) {
 		arch_cpu_restore(cpu_data);
@@ -167,7 +188,8 @@ int entry(struct per_cpu *cpu_data)
 	}
 
 	if (master)
-		printk("Activating hypervisor\n");
+		printk("Activating hypervisor (setup took %lu cycles)\n",
+		       read_tsc() - start);
 
 	/* point of no return */
 	arch_cpu_activate_vmm(cpu_data);
@@ -179,5 +201,6 @@ hypervisor_header = {
 	.bss_start = (unsigned long)__bss_start,
 	.bss_end = (unsigned long)__bss_end,
 	.percpu_size = sizeof(struct per_cpu),
+	.percpu_trace_offset = __builtin_offsetof(struct per_cpu, trace_ring),
 	.entry = (unsigned long)arch_entry,
 };
@@ -0,0 +1,52 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/entry.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/processor.h>
+#include <asm/percpu.h>
+
+#define TRACE_RING_EVENTS					\
+	((PERCPU_TRACE_RING_SIZE -				\
+	  sizeof(struct jailhouse_trace_ring)) /		\
+	 sizeof(struct jailhouse_trace_event))
+
+static inline struct jailhouse_trace_ring *
+trace_ring(struct per_cpu *cpu_data)
+{
+	return (struct jailhouse_trace_ring *)cpu_data->trace_ring;
+}
+
+void trace_init(void)
+{
+	unsigned int cpu;
+
+	for (cpu = 0; cpu < hypervisor_header.possible_cpus; cpu++)
+		trace_ring(per_cpu(cpu))->num_events = TRACE_RING_EVENTS;
+}
+
+void trace_event(struct per_cpu *cpu_data, unsigned int event,
+		 unsigned long arg0, unsigned long arg1)
+{
+	struct jailhouse_trace_ring *ring = trace_ring(cpu_data);
+	struct jailhouse_trace_event *entry =
+		&ring->event[ring->head % TRACE_RING_EVENTS];
+
+	entry->timestamp = read_tsc();
+	entry->event = event;
+	entry->arg[0] = arg0;
+	entry->arg[1] = arg1;
+
+	/* publish the event only after the slot is complete */
+	memory_barrier();
+	ring->head++;
+}
@@ -24,10 +24,17 @@
 #define X2APIC_TMCCT		0x839
 #define X2APIC_TDCR		0x83e
 
+#define MSR_IA32_TSC_DEADLINE	0x6e0
+
 #define APIC_EOI_ACK		0
+#define APIC_LVTT_TSC_DEADLINE	(2 << 17)
+
+#define X86_FEATURE_TSC_DEADLINE_TIMER	(1 << 24)
 
 static u32 idt[NUM_IDT_DESC * 4];
+static bool tsc_deadline;
 static unsigned long apic_frequency;
+static unsigned long tsc_frequency;
 static unsigned long expected_time;
 static unsigned long min = -1, max;
 
@@ -52,6 +59,25 @@ static inline void write_msr(unsigned int msr, unsigned long val)
 		: "memory");
 }
 
+static inline u32 cpuid_ecx(u32 leaf)
+{
+	u32 eax = leaf, ebx, ecx = 0, edx;
+
+	asm volatile("cpuid"
+		: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+	return ecx;
+}
+
+static void arm_timer(unsigned long ns)
+{
+	/* IA32_TSC_DEADLINE never traps, TMICT only passes through on x2APIC */
+	if (tsc_deadline)
+		write_msr(MSR_IA32_TSC_DEADLINE,
+			  read_tsc() + ns * tsc_frequency / NS_PER_SEC);
+	else
+		write_msr(X2APIC_TMICT, ns * apic_frequency / NS_PER_SEC);
+}
+
 static inline void write_idtr(struct desc_table_reg *val)
 {
 	asm volatile("lidtq %0" : "=m" (*val));
@@ -63,7 +89,7 @@ void irq_handler(void)
 
 	write_msr(X2APIC_EOI, APIC_EOI_ACK);
 
-	delta = read_pm_timer() - expected_time;
+	delta = read_time_ns() - expected_time;
 	if (delta < min)
 		min = delta;
 	if (delta > max)
@@ -72,8 +98,7 @@ void irq_handler(void)
 	       delta, min, max);
 
 	expected_time += 100 * NS_PER_MSEC;
-	write_msr(X2APIC_TMICT,
-		  (expected_time - read_pm_timer()) * apic_frequency / NS_PER_SEC);
+	arm_timer(expected_time - read_time_ns());
 }
 
 static void init_apic(void)
@@ -83,21 +108,27 @@ static void init_apic(void)
 	unsigned long start, end;
 	unsigned long tmr;
 
+	tsc_deadline = !!(cpuid_ecx(1) & X86_FEATURE_TSC_DEADLINE_TIMER);
+	tsc_frequency = tsc_read_frequency();
+
 	write_msr(X2APIC_TDCR, 3);
 
-	start = read_pm_timer();
+	start = read_time_ns();
 	write_msr(X2APIC_TMICT, 0xffffffff);
 
-	while (read_pm_timer() - start < 100 * NS_PER_MSEC)
+	while (read_time_ns() - start < 100 * NS_PER_MSEC)
 		cpu_relax();
 
-	end = read_pm_timer();
+	end = read_time_ns();
 	tmr = read_msr(X2APIC_TMCCT);
+	write_msr(X2APIC_TMICT, 0);
 
 	apic_frequency = (0xffffffff - tmr) * NS_PER_SEC / (end - start);
 
 	printk("Calibrated APIC frequency: %lu kHz\n",
 	       (apic_frequency * 16 + 500) / 1000);
+	printk("Using %s timer mode\n", tsc_deadline ? "TSC deadline" :
+						       "one-shot");
 
 	idt[APIC_TIMER_VECTOR * 4] = (entry & 0xffff) | (INMATE_CS << 16);
 	idt[APIC_TIMER_VECTOR * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
@@ -107,16 +138,20 @@ static void init_apic(void)
 	dtr.base = (u64)&idt;
 	write_idtr(&dtr);
 
-	write_msr(X2APIC_LVTT, APIC_TIMER_VECTOR);
-	expected_time = read_pm_timer();
-	write_msr(X2APIC_TMICT, 1);
+	write_msr(X2APIC_LVTT, APIC_TIMER_VECTOR |
+		  (tsc_deadline ? APIC_LVTT_TSC_DEADLINE : 0));
+	expected_time = read_time_ns();
+	if (tsc_deadline)
+		write_msr(MSR_IA32_TSC_DEADLINE, 1);
+	else
+		write_msr(X2APIC_TMICT, 1);
 
 	asm volatile("sti");
 }
 
 void inmate_main(void)
 {
-	if (init_pm_timer())
+	if (init_time())
 		init_apic();
 
 	while (1) {
@@ -0,0 +1,25 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-info.h>
+
+struct jailhouse_cell_info *get_cell_info(void)
+{
+	struct jailhouse_cell_info *info =
+		(struct jailhouse_cell_info *)JAILHOUSE_CELL_INFO_ADDR;
+
+	if (memcmp(info->signature, JAILHOUSE_CELL_INFO_SIGNATURE,
+		   sizeof(info->signature)) != 0)
+		return NULL;
+	return info;
+}
@@ -0,0 +1,331 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-info.h>
+#include <jailhouse/cpu-stats.h>
+#include <jailhouse/exit-bench.h>
+#include <jailhouse/hypercall.h>
+
+#define ITERATIONS		JAILHOUSE_EXIT_BENCH_MAX_ITERATIONS
+/* fill caches and the hypervisor's MMIO decoding cache first */
+#define WARMUP_ITERATIONS	64
+
+#define NUM_IDT_DESC		33
+#define IPI_VECTOR		32
+
+#define MSR_IA32_APICBASE	0x1b
+#define APICBASE_EXTD		(1 << 10)
+
+#define X2APIC_BASE		0x800
+#define X2APIC_ID		0x802
+#define X2APIC_EOI		0x80b
+#define X2APIC_ICR		0x830
+
+#define XAPIC_BASE		0xfee00000UL
+#define XAPIC_ID		0x020
+#define XAPIC_EOI		0x0b0
+#define XAPIC_ICR		0x300
+#define XAPIC_ICR_HI		0x310
+/* in the APIC page, but above the last register with a stats slot */
+#define XAPIC_RESERVED		0x400
+
+#define APIC_EOI_ACK		0
+#define APIC_ICR_FIXED_ASSERT	0x00004000
+
+/* 2 MB page, uncached */
+#define PAGE_FLAGS_APIC		0x9b
+#define PAGE_FLAGS_TABLE	0x03
+#define PAGE_ADDR_MASK		0x000ffffffffff000UL
+
+struct desc_table_reg {
+	u16 limit;
+	u64 base;
+} __attribute__((packed));
+
+static const char *test_names[JAILHOUSE_EXIT_BENCH_NUM] = {
+	[JAILHOUSE_EXIT_BENCH_CPUID] = "cpuid",
+	[JAILHOUSE_EXIT_BENCH_HYPERCALL] = "hypercall",
+	[JAILHOUSE_EXIT_BENCH_X2APIC_READ] = "x2apic read",
+	[JAILHOUSE_EXIT_BENCH_X2APIC_WRITE] = "x2apic write",
+	[JAILHOUSE_EXIT_BENCH_XAPIC_READ] = "xapic read",
+	[JAILHOUSE_EXIT_BENCH_XAPIC_WRITE] = "xapic write",
+	[JAILHOUSE_EXIT_BENCH_IPI] = "ipi",
+	[JAILHOUSE_EXIT_BENCH_PIO] = "pio",
+};
+
+static u32 samples[ITERATIONS];
+static u64 apic_pd[512] __attribute__((aligned(4096)));
+static u32 idt[NUM_IDT_DESC * 4];
+
+static bool x2apic;
+static u32 apic_id;
+/* cycles of two back-to-back TSC reads */
+static unsigned long tsc_overhead;
+static volatile unsigned long ipis_received;
+
+static inline unsigned long read_msr(unsigned int msr)
+{
+	u32 low, high;
+
+	asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+	return low | ((unsigned long)high << 32);
+}
+
+static inline void write_msr(unsigned int msr, unsigned long val)
+{
+	asm volatile("wrmsr"
+		: /* no output */
+		: "c" (msr), "a" (val), "d" (val >> 32)
+		: "memory");
+}
+
+static inline u32 read_xapic(unsigned int reg)
+{
+	return *(volatile u32 *)(XAPIC_BASE + reg);
+}
+
+static inline void write_xapic(unsigned int reg, u32 val)
+{
+	*(volatile u32 *)(XAPIC_BASE + reg) = val;
+}
+
+static inline unsigned long read_cr3(void)
+{
+	unsigned long cr3;
+
+	asm volatile("mov %%cr3,%0" : "=r" (cr3));
+	return cr3;
+}
+
+static inline void write_cr3(unsigned long val)
+{
+	asm volatile("mov %0,%%cr3" : : "r" (val) : "memory");
+}
+
+static inline void write_idtr(struct desc_table_reg *val)
+{
+	asm volatile("lidtq %0" : "=m" (*val));
+}
+
+void irq_handler(void)
+{
+	if (x2apic)
+		write_msr(X2APIC_EOI, APIC_EOI_ACK);
+	else
+		write_xapic(XAPIC_EOI, APIC_EOI_ACK);
+	ipis_received++;
+}
+
+/* the boot page tables only cover the first 2 MB */
+static void map_xapic(void)
+{
+	u64 *pml4 = (u64 *)(read_cr3() & PAGE_ADDR_MASK);
+	u64 *pdpt = (u64 *)(pml4[0] & PAGE_ADDR_MASK);
+
+	apic_pd[(XAPIC_BASE >> 21) & 0x1ff] =
+		(XAPIC_BASE & ~0x1fffffUL) | PAGE_FLAGS_APIC;
+	pdpt[XAPIC_BASE >> 30] = (unsigned long)apic_pd | PAGE_FLAGS_TABLE;
+	write_cr3(read_cr3());
+}
+
+static void init_ipi(void)
+{
+	unsigned long entry = (unsigned long)irq_entry + FSEGMENT_BASE;
+	struct desc_table_reg dtr;
+
+	idt[IPI_VECTOR * 4] = (entry & 0xffff) | (INMATE_CS << 16);
+	idt[IPI_VECTOR * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
+	idt[IPI_VECTOR * 4 + 2] = entry >> 32;
+
+	dtr.limit = NUM_IDT_DESC * 16 - 1;
+	dtr.base = (u64)&idt;
+	write_idtr(&dtr);
+}
+
+static void run_operation(unsigned int test)
+{
+	u32 eax, ebx, ecx, edx;
+
+	switch (test) {
+	case JAILHOUSE_EXIT_BENCH_CPUID:
+		eax = 0;
+		ecx = 0;
+		asm volatile("cpuid"
+			: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+		break;
+	case JAILHOUSE_EXIT_BENCH_HYPERCALL:
+		jailhouse_call0(JAILHOUSE_HC_NOP);
+		break;
+	case JAILHOUSE_EXIT_BENCH_X2APIC_READ:
+		read_msr(X2APIC_BASE + JAILHOUSE_EXIT_BENCH_APIC_REG);
+		break;
+	case JAILHOUSE_EXIT_BENCH_X2APIC_WRITE:
+		write_msr(X2APIC_BASE + JAILHOUSE_EXIT_BENCH_APIC_REG, 0);
+		break;
+	case JAILHOUSE_EXIT_BENCH_XAPIC_READ:
+		read_xapic(JAILHOUSE_EXIT_BENCH_APIC_REG << 4);
+		break;
+	case JAILHOUSE_EXIT_BENCH_XAPIC_WRITE:
+		write_xapic(JAILHOUSE_EXIT_BENCH_APIC_REG << 4, 0);
+		break;
+	case JAILHOUSE_EXIT_BENCH_IPI:
+		/* pending IPIs coalesce until interrupts are enabled again */
+		if (x2apic)
+			write_msr(X2APIC_ICR, (unsigned long)apic_id << 32 |
+				  APIC_ICR_FIXED_ASSERT | IPI_VECTOR);
+		else
+			write_xapic(XAPIC_ICR,
+				    APIC_ICR_FIXED_ASSERT | IPI_VECTOR);
+		break;
+	case JAILHOUSE_EXIT_BENCH_PIO:
+		inl(JAILHOUSE_EXIT_BENCH_PIO_PORT);
+		break;
+	}
+}
+
+static void sort_samples(unsigned int num)
+{
+	unsigned int n, m;
+	u32 val;
+
+	for (n = 1; n < num; n++) {
+		val = samples[n];
+		for (m = n; m > 0 && samples[m - 1] > val; m--)
+			samples[m] = samples[m - 1];
+		samples[m] = val;
+	}
+}
+
+static void measure(unsigned int test,
+		    struct jailhouse_exit_bench_result *result)
+{
+	unsigned long start, cycles;
+	unsigned int n;
+
+	for (n = 0; n < WARMUP_ITERATIONS + ITERATIONS; n++) {
+		/* ICR_HI is also written by the hypervisor's own IPIs */
+		if (test == JAILHOUSE_EXIT_BENCH_IPI && !x2apic)
+			write_xapic(XAPIC_ICR_HI, apic_id << 24);
+		start = read_tsc();
+		run_operation(test);
+		cycles = read_tsc() - start;
+		if (n >= WARMUP_ITERATIONS)
+			samples[n - WARMUP_ITERATIONS] = cycles > tsc_overhead ?
+				cycles - tsc_overhead : 0;
+	}
+
+	sort_samples(ITERATIONS);
+	result->iterations = ITERATIONS;
+	result->min = samples[0];
+	result->median = samples[ITERATIONS / 2];
+	result->p99 = samples[ITERATIONS * 99 / 100];
+	result->max = samples[ITERATIONS - 1];
+}
+
+static void measure_tsc_overhead(void)
+{
+	unsigned long start, cycles;
+	unsigned int n;
+
+	tsc_overhead = -1UL;
+	for (n = 0; n < WARMUP_ITERATIONS; n++) {
+		start = read_tsc();
+		cycles = read_tsc() - start;
+		if (cycles < tsc_overhead)
+			tsc_overhead = cycles;
+	}
+}
+
+/* an access above 0x3f0 is an exit, but not one of the register slots */
+static void check_xapic_stats(void)
+{
+	struct jailhouse_cell_info *info = get_cell_info();
+	unsigned long exits, regs[JAILHOUSE_CPU_STAT_NUM_APIC_REGS];
+	unsigned int cpu, n;
+	bool ok = true;
+
+	if (!info)
+		return;
+	for (n = 0; n < info->num_cpus; n++)
+		if (info->cpus[n].phys_id == apic_id)
+			break;
+	if (n == info->num_cpus)
+		return;
+	cpu = info->cpus[n].cpu_id;
+
+	exits = jailhouse_call2(JAILHOUSE_HC_CPU_GET_STAT, cpu,
+				JAILHOUSE_CPU_STAT_VMEXITS_XAPIC);
+	for (n = 0; n < JAILHOUSE_CPU_STAT_NUM_APIC_REGS; n++)
+		regs[n] = jailhouse_call2(JAILHOUSE_HC_CPU_GET_STAT, cpu,
+					  JAILHOUSE_CPU_STAT_APIC_REG + n);
+
+	write_xapic(XAPIC_RESERVED, 0);
+
+	if (jailhouse_call2(JAILHOUSE_HC_CPU_GET_STAT, cpu,
+			    JAILHOUSE_CPU_STAT_VMEXITS_XAPIC) != exits + 1)
+		ok = false;
+	for (n = 0; n < JAILHOUSE_CPU_STAT_NUM_APIC_REGS; n++)
+		if (jailhouse_call2(JAILHOUSE_HC_CPU_GET_STAT, cpu,
+				    JAILHOUSE_CPU_STAT_APIC_REG + n) != regs[n])
+			ok = false;
+
+	printk("xAPIC access above 0x3f0: stats %s\n", ok ? "ok" : "FAILED");
+}
+
+void inmate_main(void)
+{
+	struct jailhouse_exit_bench_result result;
+	unsigned long start;
+	unsigned int test;
+
+	x2apic = !!(read_msr(MSR_IA32_APICBASE) & APICBASE_EXTD);
+	if (x2apic) {
+		apic_id = read_msr(X2APIC_ID);
+	} else {
+		map_xapic();
+		apic_id = read_xapic(XAPIC_ID) >> 24;
+	}
+	init_ipi();
+	measure_tsc_overhead();
+
+	printk("Exit round trips in TSC cycles, %d iterations, "
+	       "%s mode, TSC overhead %lu\n", ITERATIONS,
+	       x2apic ? "x2APIC" : "xAPIC", tsc_overhead);
+
+	for (test = 0; test < JAILHOUSE_EXIT_BENCH_NUM; test++) {
+		/* only reachable in the mode the APIC is in */
+		if ((test == JAILHOUSE_EXIT_BENCH_XAPIC_READ ||
+		     test == JAILHOUSE_EXIT_BENCH_XAPIC_WRITE) && x2apic)
+			continue;
+
+		measure(test, &result);
+		printk("  %s: min %lu, median %lu, p99 %lu, max %lu\n",
+		       test_names[test], result.min, result.median,
+		       result.p99, result.max);
+	}
+
+	if (!x2apic)
+		check_xapic_stats();
+
+	/* take the coalesced IPI */
+	asm volatile("sti");
+	start = read_tsc();
+	while (ipis_received == 0 && read_tsc() - start < 1000000)
+		cpu_relax();
+	asm volatile("cli");
+	if (ipis_received == 0)
+		printk("IPI was not received\n");
+
+	printk("Done\n");
+	asm volatile("hlt");
+}
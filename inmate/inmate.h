@@ -28,8 +28,17 @@ typedef unsigned int u32;
 typedef signed long s64;
 typedef unsigned long u64;
 
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+
+typedef s64 __s64;
+
 typedef enum { true=1, false=0 } bool;
 
+#define NULL		((void *)0)
+
 static inline void cpu_relax(void)
 {
 	asm volatile("rep; nop");
@@ -54,9 +63,20 @@ static inline u32 inl(u16 port)
 	return v;
 }
 
+static inline unsigned long read_tsc(void)
+{
+	u32 low, high;
+
+	asm volatile("rdtsc" : "=a" (low), "=d" (high));
+	return low | ((unsigned long)high << 32);
+}
+
 void printk(const char *fmt, ...);
+void console_flush(void);
 
 void *memset(void *s, int c, unsigned long n);
+void *memcpy(void *dest, const void *src, unsigned long n);
+int memcmp(const void *s1, const void *s2, unsigned long n);
 
 extern u8 irq_entry[];
 void irq_handler(void);
@@ -65,4 +85,14 @@ void inmate_main(void);
 
 bool init_pm_timer(void);
 unsigned long read_pm_timer(void);
+
+struct jailhouse_cell_info *get_cell_info(void);
+
+bool init_time(void);
+unsigned long read_time_ns(void);
+unsigned long tsc_to_ns(unsigned long cycles);
+unsigned long tsc_read_frequency(void);
+
+void ring_bench(bool initiator);
+void latency_bench(bool shared);
 #endif
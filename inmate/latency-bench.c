@@ -0,0 +1,255 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/latency-report.h>
+
+#define NS_PER_USEC		1000UL
+#define NS_PER_MSEC		1000000UL
+#define NS_PER_SEC		1000000000UL
+
+/* default timer period, can be overridden at build time */
+#ifndef LATENCY_PERIOD_US
+#define LATENCY_PERIOD_US	100
+#endif
+#define MIN_PERIOD_US		10
+
+#define SUMMARY_INTERVAL_SEC	10
+
+/* has to match the communication region of the cell config */
+#define COMM_REGION_BASE	0x100000
+
+#define NUM_IDT_DESC		33
+#define APIC_TIMER_VECTOR	32
+
+#define X2APIC_EOI		0x80b
+#define X2APIC_LVTT		0x832
+#define X2APIC_TMICT		0x838
+#define X2APIC_TMCCT		0x839
+#define X2APIC_TDCR		0x83e
+
+#define MSR_IA32_TSC_DEADLINE	0x6e0
+
+#define APIC_EOI_ACK		0
+#define APIC_LVTT_TSC_DEADLINE	(2 << 17)
+
+#define X86_FEATURE_TSC_DEADLINE_TIMER	(1 << 24)
+
+struct desc_table_reg {
+	u16 limit;
+	u64 base;
+} __attribute__((packed));
+
+static u32 idt[NUM_IDT_DESC * 4];
+static bool tsc_deadline;
+static unsigned long apic_frequency;
+static unsigned long tsc_frequency;
+static unsigned long period_tsc;
+static unsigned long expected_tsc;
+
+static struct jailhouse_latency_report local_report;
+static struct jailhouse_latency_report *report = &local_report;
+
+/* parts per million */
+static const unsigned long percentiles[] = {
+	500000, 900000, 990000, 999000, 999900,
+};
+
+static inline unsigned long read_msr(unsigned int msr)
+{
+	u32 low, high;
+
+	asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+	return low | ((unsigned long)high << 32);
+}
+
+static inline void write_msr(unsigned int msr, unsigned long val)
+{
+	asm volatile("wrmsr"
+		: /* no output */
+		: "c" (msr), "a" (val), "d" (val >> 32)
+		: "memory");
+}
+
+static inline u32 cpuid_ecx(u32 leaf)
+{
+	u32 eax = leaf, ebx, ecx = 0, edx;
+
+	asm volatile("cpuid"
+		: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+	return ecx;
+}
+
+static inline void write_idtr(struct desc_table_reg *val)
+{
+	asm volatile("lidtq %0" : "=m" (*val));
+}
+
+static void arm_timer(unsigned long deadline)
+{
+	unsigned long now, ticks;
+
+	if (tsc_deadline) {
+		write_msr(MSR_IA32_TSC_DEADLINE, deadline);
+		return;
+	}
+
+	now = read_tsc();
+	ticks = deadline > now ?
+		(deadline - now) * apic_frequency / tsc_frequency : 0;
+	write_msr(X2APIC_TMICT, ticks > 0 ? ticks : 1);
+}
+
+void irq_handler(void)
+{
+	unsigned long now = read_tsc();
+	unsigned long ns, bucket;
+
+	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+
+	ns = tsc_to_ns(now - expected_tsc);
+	bucket = ns / JAILHOUSE_LATENCY_BUCKET_NS;
+	if (bucket < JAILHOUSE_LATENCY_BUCKETS)
+		report->histogram[bucket]++;
+	else
+		report->overflows++;
+	if (ns < report->min_ns)
+		report->min_ns = ns;
+	if (ns > report->max_ns)
+		report->max_ns = ns;
+	report->samples++;
+
+	expected_tsc += period_tsc;
+	arm_timer(expected_tsc);
+}
+
+static void calibrate_apic_timer(void)
+{
+	unsigned long start, end;
+	unsigned long tmr;
+
+	write_msr(X2APIC_TDCR, 3);
+
+	start = read_time_ns();
+	write_msr(X2APIC_TMICT, 0xffffffff);
+
+	while (read_time_ns() - start < 10 * NS_PER_MSEC)
+		cpu_relax();
+
+	end = read_time_ns();
+	tmr = read_msr(X2APIC_TMCCT);
+	write_msr(X2APIC_TMICT, 0);
+
+	apic_frequency = (0xffffffff - tmr) * NS_PER_SEC / (end - start);
+}
+
+/* upper bound of the bucket containing the given share of samples */
+static unsigned long percentile_ns(unsigned long samples, unsigned long ppm)
+{
+	unsigned long threshold = (samples * ppm + 999999) / 1000000;
+	unsigned long sum = 0, n;
+
+	for (n = 0; n < JAILHOUSE_LATENCY_BUCKETS; n++) {
+		sum += report->histogram[n];
+		if (sum >= threshold)
+			return (n + 1) * JAILHOUSE_LATENCY_BUCKET_NS;
+	}
+	return report->max_ns;
+}
+
+static void print_summary(void)
+{
+	unsigned long samples = report->samples;
+	unsigned int n;
+
+	if (samples == 0)
+		return;
+
+	printk("%lu samples, min %lu ns, max %lu ns, %lu above %lu ns\n",
+	       samples, report->min_ns, report->max_ns, report->overflows,
+	       (unsigned long)JAILHOUSE_LATENCY_BUCKETS *
+	       JAILHOUSE_LATENCY_BUCKET_NS);
+	for (n = 0; n < sizeof(percentiles) / sizeof(percentiles[0]); n++)
+		printk("  %2lu.%04lu percentile: <= %lu ns\n",
+		       percentiles[n] / 10000, percentiles[n] % 10000,
+		       percentile_ns(samples, percentiles[n]));
+}
+
+static void init_timer(unsigned long period_us)
+{
+	unsigned long entry = (unsigned long)irq_entry + FSEGMENT_BASE;
+	struct desc_table_reg dtr;
+
+	tsc_deadline = !!(cpuid_ecx(1) & X86_FEATURE_TSC_DEADLINE_TIMER);
+	if (!tsc_deadline)
+		calibrate_apic_timer();
+	printk("Using %s timer mode, period %lu us\n",
+	       tsc_deadline ? "TSC deadline" : "one-shot", period_us);
+
+	idt[APIC_TIMER_VECTOR * 4] = (entry & 0xffff) | (INMATE_CS << 16);
+	idt[APIC_TIMER_VECTOR * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
+	idt[APIC_TIMER_VECTOR * 4 + 2] = entry >> 32;
+
+	dtr.limit = NUM_IDT_DESC * 16 - 1;
+	dtr.base = (u64)&idt;
+	write_idtr(&dtr);
+
+	write_msr(X2APIC_LVTT, APIC_TIMER_VECTOR |
+		  (tsc_deadline ? APIC_LVTT_TSC_DEADLINE : 0));
+
+	period_tsc = period_us * NS_PER_USEC * tsc_frequency / NS_PER_SEC;
+	expected_tsc = read_tsc() + period_tsc;
+	arm_timer(expected_tsc);
+
+	asm volatile("sti");
+}
+
+void latency_bench(bool shared)
+{
+	unsigned long period_us = LATENCY_PERIOD_US;
+	unsigned long last_summary;
+
+	if (!init_time())
+		goto out;
+	tsc_frequency = tsc_read_frequency();
+
+	if (shared) {
+		report = (struct jailhouse_latency_report *)COMM_REGION_BASE;
+		if (report->period_us != 0)
+			period_us = report->period_us;
+	}
+	if (period_us < MIN_PERIOD_US)
+		period_us = MIN_PERIOD_US;
+
+	memset(report, 0, sizeof(*report));
+	report->period_us = period_us;
+	report->bucket_ns = JAILHOUSE_LATENCY_BUCKET_NS;
+	report->num_buckets = JAILHOUSE_LATENCY_BUCKETS;
+	report->min_ns = -1;
+	report->signature = JAILHOUSE_LATENCY_SIGNATURE;
+
+	init_timer(period_us);
+
+	/* reporting is done here, the interrupt handler only counts */
+	last_summary = read_tsc();
+	while (1) {
+		asm volatile("hlt");
+		if (read_tsc() - last_summary >=
+		    SUMMARY_INTERVAL_SEC * tsc_frequency) {
+			last_summary = read_tsc();
+			print_summary();
+		}
+	}
+
+out:
+	asm volatile("hlt");
+}
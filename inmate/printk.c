@@ -12,6 +12,8 @@
 
 #include <stdarg.h>
 #include <inmate.h>
+#include <jailhouse/cell-console.h>
+#include <jailhouse/hypercall.h>
 
 #ifdef CONFIG_UART_OXPCIE952
 #define UART_BASE		0xe010
@@ -36,7 +38,38 @@ static void uart_write(const char *msg)
 	}
 }
 
-#define console_write(msg)	uart_write(msg)
+static struct jailhouse_cell_console *console;
+static bool console_probed;
+
+/* no exit, the root cell picks the output up from the ring */
+static void console_ring_write(const char *msg)
+{
+	u32 head = console->head;
+
+	while (*msg)
+		console->data[head++ % JAILHOUSE_CELL_CONSOLE_SIZE] = *msg++;
+	/* stores are not reordered on x86, just keep the compiler in line */
+	asm volatile("" : : : "memory");
+	*(volatile u32 *)&console->head = head;
+}
+
+static void console_write(const char *msg)
+{
+	if (!console_probed) {
+		console = (void *)JAILHOUSE_CELL_CONSOLE_ADDR;
+		if (memcmp(console->signature,
+			   JAILHOUSE_CELL_CONSOLE_SIGNATURE,
+			   sizeof(console->signature)) != 0)
+			console = NULL;
+		console_probed = true;
+	}
+
+	if (console)
+		console_ring_write(msg);
+	else
+		uart_write(msg);
+}
+
 #include "../hypervisor/printk-core.c"
 
 void printk(const char *fmt, ...)
@@ -49,3 +82,17 @@ void printk(const char *fmt, ...)
 
 	va_end(ap);
 }
+
+/* copies pending output also to the hypervisor's debug port, one exit per
+ * bounded part */
+void console_flush(void)
+{
+	long pending;
+
+	if (!console)
+		return;
+
+	do
+		pending = jailhouse_call0(JAILHOUSE_HC_CONSOLE_FLUSH);
+	while (pending > 0);
+}
@@ -0,0 +1,189 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/spsc-ring.h>
+
+#define NS_PER_SEC		1000000000UL
+
+/* has to match the communication region of both cell configs */
+#define COMM_REGION_BASE	0x100000
+#define RING_OFFSET_REQUEST	0x1000
+#define RING_OFFSET_REPLY	0x8000
+
+#define RING_SLOTS		64
+#define BATCH_SIZE		16
+
+#define LATENCY_ROUNDS		100000
+#define THROUGHPUT_MESSAGES	(1 << 22)
+
+#define BENCH_READY		0x52494e47
+
+#define MSG_PING		1
+#define MSG_DATA		2
+#define MSG_DONE		3
+
+struct bench_msg {
+	u32 type;
+	u32 seq;
+	u64 tsc;
+	u8 payload[JAILHOUSE_SPSC_CACHE_LINE - 16];
+};
+
+struct bench_ctrl {
+	u32 state;
+};
+
+static struct bench_ctrl *ctrl = (void *)COMM_REGION_BASE;
+static struct jailhouse_spsc_ring *request =
+	(void *)(COMM_REGION_BASE + RING_OFFSET_REQUEST);
+static struct jailhouse_spsc_ring *reply =
+	(void *)(COMM_REGION_BASE + RING_OFFSET_REPLY);
+
+static void send_msg(struct jailhouse_spsc_ring *ring, struct bench_msg *msg)
+{
+	while (jailhouse_spsc_enqueue(ring, msg, 1) == 0)
+		cpu_relax();
+}
+
+static void receive_msg(struct jailhouse_spsc_ring *ring,
+			struct bench_msg *msg)
+{
+	while (jailhouse_spsc_dequeue(ring, msg, 1) == 0)
+		cpu_relax();
+}
+
+static void responder(void)
+{
+	struct bench_msg *msg, ack;
+	unsigned long received = 0;
+	u32 n, i;
+
+	jailhouse_spsc_init(request, RING_SLOTS, sizeof(struct bench_msg));
+	jailhouse_spsc_init(reply, RING_SLOTS, sizeof(struct bench_msg));
+	jailhouse_spsc_store_release(&ctrl->state, BENCH_READY);
+
+	printk("Ring responder ready\n");
+
+	while (1) {
+		msg = jailhouse_spsc_peek(request, BATCH_SIZE, &n);
+		if (n == 0) {
+			cpu_relax();
+			continue;
+		}
+		for (i = 0; i < n; i++, msg++)
+			switch (msg->type) {
+			case MSG_PING:
+				send_msg(reply, msg);
+				break;
+			case MSG_DATA:
+				received++;
+				break;
+			case MSG_DONE:
+				ack.type = MSG_DONE;
+				ack.seq = received;
+				send_msg(reply, &ack);
+				received = 0;
+				break;
+			}
+		jailhouse_spsc_release(request, n);
+	}
+}
+
+static void measure_latency(void)
+{
+	unsigned long rtt, min = -1, max = 0, sum = 0;
+	struct bench_msg msg;
+	u32 seq;
+
+	for (seq = 0; seq < LATENCY_ROUNDS; seq++) {
+		msg.type = MSG_PING;
+		msg.seq = seq;
+		msg.tsc = read_tsc();
+		send_msg(request, &msg);
+		receive_msg(reply, &msg);
+		rtt = read_tsc() - msg.tsc;
+
+		if (msg.seq != seq) {
+			printk("Unexpected reply %d, expected %d\n",
+			       msg.seq, seq);
+			return;
+		}
+		if (rtt < min)
+			min = rtt;
+		if (rtt > max)
+			max = rtt;
+		sum += rtt;
+	}
+
+	printk("Round trip: min %lu ns, avg %lu ns, max %lu ns\n",
+	       tsc_to_ns(min), tsc_to_ns(sum / LATENCY_ROUNDS),
+	       tsc_to_ns(max));
+}
+
+static void measure_throughput(void)
+{
+	unsigned long start, ns;
+	struct bench_msg *msg, done;
+	u32 sent = 0, n, i;
+
+	start = read_tsc();
+	while (sent < THROUGHPUT_MESSAGES) {
+		/* fill the slots in place, no intermediate copy */
+		msg = jailhouse_spsc_reserve(request, BATCH_SIZE, &n);
+		if (n == 0) {
+			cpu_relax();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			msg[i].type = MSG_DATA;
+			msg[i].seq = sent + i;
+		}
+		jailhouse_spsc_commit(request, n);
+		sent += n;
+	}
+	done.type = MSG_DONE;
+	send_msg(request, &done);
+	receive_msg(reply, &done);
+	ns = tsc_to_ns(read_tsc() - start);
+
+	if (done.seq != sent) {
+		printk("Responder received %d of %d messages\n",
+		       done.seq, sent);
+		return;
+	}
+
+	printk("Throughput: %lu messages/s, %lu MB/s\n",
+	       sent * NS_PER_SEC / ns,
+	       sent * sizeof(struct bench_msg) * 1000 / ns);
+}
+
+void ring_bench(bool initiator)
+{
+	if (!initiator) {
+		responder();
+		return;
+	}
+
+	if (!init_time())
+		goto out;
+
+	printk("Waiting for ring responder\n");
+	while (jailhouse_spsc_load_acquire(&ctrl->state) != BENCH_READY)
+		cpu_relax();
+
+	measure_latency();
+	measure_throughput();
+
+out:
+	asm volatile("hlt");
+}
@@ -0,0 +1,45 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+
+void *memset(void *s, int c, unsigned long n)
+{
+	void *d = s;
+
+	asm volatile("rep stosb"
+		: "+D" (d), "+c" (n)
+		: "a" (c)
+		: "memory");
+	return s;
+}
+
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	void *d = dest;
+
+	asm volatile("rep movsb"
+		: "+D" (d), "+S" (src), "+c" (n)
+		: /* no input */
+		: "memory");
+	return dest;
+}
+
+int memcmp(const void *s1, const void *s2, unsigned long n)
+{
+	const u8 *p1 = s1, *p2 = s2;
+
+	for (; n > 0; n--, p1++, p2++)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2013
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <inmate.h>
+#include <jailhouse/cell-info.h>
+
+#define NS_PER_MSEC		1000000UL
+#define NS_PER_SEC		1000000000UL
+
+#define CALIBRATION_NS		(100 * NS_PER_MSEC)
+
+/* ns = tsc * tsc_mult >> TSC_SHIFT */
+#define TSC_SHIFT		32
+
+#define X86_FEATURE_INVARIANT_TSC	(1 << 8)
+
+static unsigned long tsc_frequency;
+static unsigned long tsc_mult;
+static unsigned long tsc_base;
+
+static inline u32 cpuid_edx(u32 leaf)
+{
+	u32 eax = leaf, ebx, ecx = 0, edx;
+
+	asm volatile("cpuid"
+		: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+	return edx;
+}
+
+static unsigned long calibrate_tsc(void)
+{
+	unsigned long start, end, tsc_start, tsc_end;
+
+	if (!init_pm_timer())
+		return 0;
+
+	start = read_pm_timer();
+	tsc_start = read_tsc();
+	while (read_pm_timer() - start < CALIBRATION_NS)
+		cpu_relax();
+	end = read_pm_timer();
+	tsc_end = read_tsc();
+
+	return (tsc_end - tsc_start) * NS_PER_SEC / (end - start);
+}
+
+bool init_time(void)
+{
+	struct jailhouse_cell_info *info = get_cell_info();
+	const char *how = "Calibrated";
+
+	if (!(cpuid_edx(0x80000007) & X86_FEATURE_INVARIANT_TSC))
+		printk("WARNING: TSC is not invariant\n");
+
+	if (info && info->tsc_khz != 0) {
+		tsc_frequency = info->tsc_khz * 1000UL;
+		how = "Reported";
+	} else
+		tsc_frequency = calibrate_tsc();
+	if (tsc_frequency == 0)
+		return false;
+
+	tsc_mult = (NS_PER_SEC << TSC_SHIFT) / tsc_frequency;
+	tsc_base = read_tsc();
+
+	printk("%s TSC frequency: %lu kHz\n", how,
+	       (tsc_frequency + 500) / 1000);
+	return true;
+}
+
+unsigned long tsc_read_frequency(void)
+{
+	return tsc_frequency;
+}
+
+unsigned long tsc_to_ns(unsigned long cycles)
+{
+	return ((unsigned __int128)cycles * tsc_mult) >> TSC_SHIFT;
+}
+
+/* time since init_time */
+unsigned long read_time_ns(void)
+{
+	return tsc_to_ns(read_tsc() - tsc_base);
+}
@@ -11,6 +11,31 @@
  */
 
 #include <inmate.h>
+#include <jailhouse/cell-info.h>
+
+static void print_cell_info(void)
+{
+	struct jailhouse_cell_info *info = get_cell_info();
+	struct jailhouse_memory *mem;
+	unsigned int n;
+
+	if (!info)
+		return;
+
+	printk("Cell \"%s\" (ID %d), CPUs:", info->name, info->cell_id);
+	for (n = 0; n < info->num_cpus; n++)
+		printk(" %d (APIC %d)", info->cpus[n].cpu_id,
+		       info->cpus[n].phys_id);
+	printk("\n");
+
+	for (n = 0; n < info->num_memory_regions; n++) {
+		mem = &info->memory[n];
+		printk("Memory: 0x%08lx-0x%08lx -> 0x%08lx\n",
+		       (unsigned long)mem->virt_start,
+		       (unsigned long)(mem->virt_start + mem->size - 1),
+		       (unsigned long)mem->phys_start);
+	}
+}
 
 void inmate_main(void)
 {
@@ -18,6 +43,7 @@ void inmate_main(void)
 	int n;
 
 	printk("Hello from this tiny cell!\n");
+	print_cell_info();
 
 	if (init_pm_timer()) {
 		start = read_pm_timer();
@@ -13,6 +13,12 @@
 #include <linux/ioctl.h>
 #include <linux/types.h>
 #include <jailhouse/cell-config.h>
+#include <jailhouse/cpu-stats.h>
+#include <jailhouse/exit-bench.h>
+#include <jailhouse/pool-stats.h>
+#include <jailhouse/profile.h>
+#include <jailhouse/spsc-ring.h>
+#include <jailhouse/trace.h>
 
 struct jailhouse_preload_image {
 	__u64 source_address;
@@ -28,7 +34,125 @@ struct jailhouse_new_cell {
 	struct jailhouse_preload_image image[];
 };
 
+struct jailhouse_new_cell_async {
+	/* signaled when the creation is done, -1 for none */
+	__s32 eventfd;
+	__u32 padding;
+	/* struct jailhouse_new_cell */
+	__u64 new_cell;
+};
+
+struct jailhouse_cell_load {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	__u32 num_preload_images;
+	__u32 padding;
+	struct jailhouse_preload_image image[];
+};
+
+/*
+ * JAILHOUSE_CELL_SAVE reports the sizes the cell needs and fails with ENOSPC
+ * if the buffers are smaller. JAILHOUSE_CELL_RESTORE takes the reported sizes.
+ */
+struct jailhouse_cell_snapshot {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	__u32 num_cpus;
+	/* of one entry in cpu_states */
+	__u32 cpu_state_size;
+	/* of the first memory region */
+	__u64 ram_size;
+	/* one CPU state per CPU of the cell, in ascending CPU order */
+	__u64 cpu_states;
+	__u64 ram;
+};
+
+/*
+ * JAILHOUSE_CELL_DIRTY_LOG_FETCH reports the size of the region and fails
+ * with ENOSPC, without fetching anything, if the bitmap is smaller.
+ */
+struct jailhouse_cell_dirty_log {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	/* index into the memory regions of the cell's configuration */
+	__u32 region;
+	__u32 padding;
+	/* in: capacity of bitmap in pages, out: pages of the region */
+	__u64 num_pages;
+	/* __u64 array, bit n set if page n was written since the last fetch */
+	__u64 bitmap;
+};
+
+struct jailhouse_cpu_stats {
+	__u32 cpu_id;
+	__u32 padding;
+	__u64 value[JAILHOUSE_NUM_CPU_STATS];
+};
+
+struct jailhouse_pool_stats {
+	__u32 pool_id;
+	__u32 padding;
+	__u64 value[JAILHOUSE_NUM_POOL_STATS];
+};
+
+struct jailhouse_trace_read {
+	__u32 cpu_id;
+	/* in: capacity of buffer, out: number of events returned */
+	__u32 num_events;
+	/* in/out: number of the next event to read */
+	__u64 next_event;
+	/* out: events overwritten before they could be read */
+	__u64 lost_events;
+	/* struct jailhouse_trace_event array */
+	__u64 buffer;
+};
+
+struct jailhouse_profile_samples {
+	__u32 cpu_id;
+	/* in: capacity of buffer, out: number of samples returned */
+	__u32 num_samples;
+	/* out: samples lost to a full ring since the last read */
+	__u32 dropped;
+	__u32 padding;
+	/* struct jailhouse_profile_sample array */
+	__u64 buffer;
+};
+
+struct jailhouse_exit_bench {
+	/* in: round trips per operation */
+	__u32 iterations;
+	__u32 padding;
+	/* out: results of the calling CPU */
+	struct jailhouse_exit_bench_result result[JAILHOUSE_EXIT_BENCH_NUM];
+};
+
+struct jailhouse_cell_cpu {
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	__u32 cpu_id;
+};
+
 #define JAILHOUSE_ENABLE		_IOW(0, 0, struct jailhouse_system)
 #define JAILHOUSE_DISABLE		_IO(0, 1)
 #define JAILHOUSE_CELL_CREATE		_IOW(0, 2, struct jailhouse_new_cell)
 #define JAILHOUSE_CELL_DESTROY		_IOW(0, 3, const char *)
+#define JAILHOUSE_CPU_STATS		_IOWR(0, 4, struct jailhouse_cpu_stats)
+#define JAILHOUSE_TRACE_READ		_IOWR(0, 5, struct jailhouse_trace_read)
+#define JAILHOUSE_CELL_DOORBELL		_IO(0, 6)
+#define JAILHOUSE_CELL_LOAD		_IOW(0, 7, struct jailhouse_cell_load)
+#define JAILHOUSE_CELL_START		_IOW(0, 8, const char *)
+#define JAILHOUSE_CELL_STOP		_IOW(0, 9, const char *)
+#define JAILHOUSE_POOL_STATS	_IOWR(0, 10, struct jailhouse_pool_stats)
+#define JAILHOUSE_CELL_CREATE_ASYNC \
+	_IOW(0, 11, struct jailhouse_new_cell_async)
+/* takes the handle, -EAGAIN while the creation is still running */
+#define JAILHOUSE_CELL_CREATE_RESULT	_IO(0, 12)
+#define JAILHOUSE_CELL_SAVE	_IOWR(0, 13, struct jailhouse_cell_snapshot)
+#define JAILHOUSE_CELL_RESTORE	_IOW(0, 14, struct jailhouse_cell_snapshot)
+#define JAILHOUSE_CELL_DIRTY_LOG_START	_IOW(0, 15, const char *)
+#define JAILHOUSE_CELL_DIRTY_LOG_STOP	_IOW(0, 16, const char *)
+#define JAILHOUSE_CELL_DIRTY_LOG_FETCH \
+	_IOWR(0, 17, struct jailhouse_cell_dirty_log)
+/* takes the sampling period, 0 stops sampling */
+#define JAILHOUSE_PROFILE_SET		_IO(0, 18)
+#define JAILHOUSE_PROFILE_READ \
+	_IOWR(0, 19, struct jailhouse_profile_samples)
+#define JAILHOUSE_EXIT_BENCH	_IOWR(0, 20, struct jailhouse_exit_bench)
+#define JAILHOUSE_CELL_ADD_CPU	_IOW(0, 21, struct jailhouse_cell_cpu)
+#define JAILHOUSE_CELL_REMOVE_CPU	_IOW(0, 22, struct jailhouse_cell_cpu)
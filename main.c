@@ -11,34 +11,98 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/module.h>
 #include <linux/cpu.h>
+#include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/err.h>
+#include <linux/eventfd.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/miscdevice.h>
 #include <linux/firmware.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/smp.h>
+#include <linux/sort.h>
 #include <linux/uaccess.h>
+#include <linux/workqueue.h>
 #include <asm/smp.h>
+#ifdef CONFIG_X86
+#include <asm/apic.h>
+#include <asm/tsc.h>
+#endif
 #include <asm/cacheflush.h>
 
 #include "jailhouse.h"
+#include <jailhouse/cell-console.h>
 #include <jailhouse/header.h>
 #include <jailhouse/hypercall.h>
 
 #define JAILHOUSE_FW_NAME	"jailhouse.bin"
 
+#define CONSOLE_NAME_PREFIX	"jailhouse-console-"
+/* how often a blocking reader looks for new console output */
+#define CONSOLE_POLL_MS		20
+
 MODULE_DESCRIPTION("Loader for Jailhouse partitioning hypervisor");
 MODULE_LICENSE("GPL");
 MODULE_FIRMWARE(JAILHOUSE_FW_NAME);
 
+struct cell {
+	struct list_head entry;
+	unsigned int id;
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+	cpumask_t cpus_assigned;
+	/* first memory region, receives the images */
+	struct jailhouse_memory ram;
+	/* stopped, the image memory is mapped for the root cell */
+	bool loadable;
+	/* drains the console ring of the cell */
+	struct miscdevice console_dev;
+	char console_name[sizeof(CONSOLE_NAME_PREFIX) +
+			  JAILHOUSE_CELL_NAME_MAXLEN];
+	bool console_registered;
+	/* of the console ring into hypervisor_mem */
+	unsigned long console_offset;
+};
+
+/* a cell creation, prepared in the caller, possibly completed in a worker */
+struct cell_request {
+	struct list_head entry;
+	int handle;
+	/* -EINPROGRESS until the worker is done */
+	int result;
+	/* handed over to the cells list on success */
+	struct cell *new_cell;
+	struct jailhouse_cell_desc *config;
+	unsigned long config_size;
+	void *cell_mem;
+	struct work_struct offline_work;
+	int offline_err;
+	struct work_struct submit_work;
+	struct eventfd_ctx *eventfd;
+};
+
+struct console_reader {
+	unsigned int cell_id;
+	bool started;
+	/* next byte to read */
+	u32 tail;
+};
+
 static struct device *jailhouse_dev;
 static DEFINE_MUTEX(lock);
 static bool enabled;
 static void *hypervisor_mem;
 static cpumask_t offlined_cpus;
+static LIST_HEAD(cells);
+/* asynchronous cell creations until their result is picked up */
+static LIST_HEAD(requests);
+static DEFINE_SPINLOCK(requests_lock);
+static int next_request_handle = 1;
 static atomic_t call_done;
 static int error_code;
 
@@ -54,15 +118,95 @@ static void *jailhouse_ioremap(phys_addr_t start, unsigned long size)
 	return addr;
 }
 
+/* caches are coherent with all consumers */
+static void jailhouse_flush_dcache(void *addr, unsigned long size)
+{
+}
+
+static bool jailhouse_arch_supported(void)
+{
+	return true;
+}
+
+/*
+ * The root cell keeps its PIO ports, an unhandled trap would stop it. APIC
+ * reads that are not intercepted in the current mode still give the
+ * baseline of a direct access.
+ */
+static bool exit_bench_available(unsigned int test)
+{
+	switch (test) {
+	case JAILHOUSE_EXIT_BENCH_X2APIC_READ:
+	case JAILHOUSE_EXIT_BENCH_X2APIC_WRITE:
+		return x2apic_enabled();
+	case JAILHOUSE_EXIT_BENCH_XAPIC_READ:
+	case JAILHOUSE_EXIT_BENCH_XAPIC_WRITE:
+		return !x2apic_enabled();
+	case JAILHOUSE_EXIT_BENCH_PIO:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* called with interrupts disabled */
+static void exit_bench_operation(unsigned int test)
+{
+	switch (test) {
+	case JAILHOUSE_EXIT_BENCH_CPUID:
+		cpuid_eax(0);
+		break;
+	case JAILHOUSE_EXIT_BENCH_HYPERCALL:
+		jailhouse_call0(JAILHOUSE_HC_NOP);
+		break;
+	case JAILHOUSE_EXIT_BENCH_X2APIC_READ:
+	case JAILHOUSE_EXIT_BENCH_XAPIC_READ:
+		apic_read(JAILHOUSE_EXIT_BENCH_APIC_REG << 4);
+		break;
+	case JAILHOUSE_EXIT_BENCH_X2APIC_WRITE:
+	case JAILHOUSE_EXIT_BENCH_XAPIC_WRITE:
+		apic_write(JAILHOUSE_EXIT_BENCH_APIC_REG << 4, 0);
+		break;
+	case JAILHOUSE_EXIT_BENCH_IPI:
+		/* coalesces until interrupts are enabled again */
+		apic->send_IPI_mask(cpumask_of(smp_processor_id()),
+				    RESCHEDULE_VECTOR);
+		break;
+	}
+}
+
 #elif defined(CONFIG_ARM)
 
 #include <asm/mach/map.h>
+#include <asm/virt.h>
 
 static void *jailhouse_ioremap(phys_addr_t start, unsigned long size)
 {
 	return (__force void *)__arm_ioremap(start, size, MT_MEMORY);
 }
 
+/* HYP mode and cells start with their MMU, thus their caches, disabled */
+static void jailhouse_flush_dcache(void *addr, unsigned long size)
+{
+	__cpuc_flush_dcache_area(addr, size);
+}
+
+/* the hypervisor takes over from the stub installed by the kernel */
+static bool jailhouse_arch_supported(void)
+{
+	return is_hyp_mode_available();
+}
+
+/* the operations are those intercepted on x86 */
+static bool exit_bench_available(unsigned int test)
+{
+	return false;
+}
+
+static void exit_bench_operation(unsigned int test)
+{
+}
+
 #else
 #error Unsupported architecture
 #endif
@@ -83,6 +227,16 @@ static void enter_hypervisor(void *info)
 	atomic_inc(&call_done);
 }
 
+/* header and section sizes have to be consistent before anything is parsed */
+static bool config_valid(struct jailhouse_cell_desc *config, u64 size)
+{
+	return memcmp(config->signature, JAILHOUSE_CELL_DESC_SIGNATURE,
+		      sizeof(config->signature)) == 0 &&
+		config->revision == JAILHOUSE_CELL_DESC_REVISION &&
+		config->total_size == size &&
+		jailhouse_cell_config_size(config) == size;
+}
+
 static int jailhouse_enable(struct jailhouse_system __user *arg)
 {
 	unsigned long hv_core_size, percpu_size, config_size;
@@ -90,11 +244,16 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 	struct jailhouse_system config_header;
 	struct jailhouse_memory *hv_mem = &config_header.hypervisor_memory;
 	struct jailhouse_header *header;
+	ktime_t start = ktime_get(), prepared;
 	int err;
 
 	if (copy_from_user(&config_header, arg, sizeof(config_header)))
 		return -EFAULT;
 
+	if (!config_valid(&config_header.system,
+			  config_header.system.total_size))
+		return -EINVAL;
+
 	if (mutex_lock_interruptible(&lock) != 0)
 		return -EINTR;
 
@@ -102,6 +261,10 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 	if (enabled || !try_module_get(THIS_MODULE))
 		goto error_unlock;
 
+	err = -ENODEV;
+	if (!jailhouse_arch_supported())
+		goto error_put_module;
+
 	err = request_firmware(&hypervisor, JAILHOUSE_FW_NAME, jailhouse_dev);
 	if (err)
 		goto error_put_module;
@@ -124,21 +287,29 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 	if (!hypervisor_mem)
 		goto error_release_fw;
 
+	/* only clear BSS and per-CPU data, the page pool is scrubbed by the
+	 * hypervisor when allocating from it */
 	memcpy(hypervisor_mem, hypervisor->data, hypervisor->size);
 	memset(hypervisor_mem + hypervisor->size, 0,
-	       hv_mem->size - hypervisor->size);
+	       hv_core_size + percpu_size - hypervisor->size);
 
 	header = (struct jailhouse_header *)hypervisor_mem;
 	header->size = hv_mem->size;
 	header->page_offset =
 		(unsigned long)hypervisor_mem - hv_mem->phys_start;
 	header->possible_cpus = num_possible_cpus();
+#ifdef CONFIG_X86
+	header->tsc_khz = tsc_khz;
+#endif
 
 	if (copy_from_user(hypervisor_mem + hv_core_size + percpu_size, arg,
 			   config_size)) {
 		err = -EFAULT;
 		goto error_unmap;
 	}
+	jailhouse_flush_dcache(hypervisor_mem,
+			       hv_core_size + percpu_size + config_size);
+	prepared = ktime_get();
 
 	error_code = 0;
 
@@ -164,7 +335,9 @@ static int jailhouse_enable(struct jailhouse_system __user *arg)
 
 	mutex_unlock(&lock);
 
-	printk("The Jailhouse is opening.\n");
+	printk("The Jailhouse is opening (enabling took %lld us, %lld us of "
+	       "them for loading).\n", ktime_us_delta(ktime_get(), start),
+	       ktime_us_delta(prepared, start));
 
 	return 0;
 
@@ -196,6 +369,7 @@ static void leave_hypervisor(void *info)
 
 static int jailhouse_disable(void)
 {
+	struct cell *cell, *tmp;
 	unsigned int cpu;
 	int err;
 
@@ -229,6 +403,12 @@ static int jailhouse_disable(void)
 			printk("Jailhouse: failed to bring CPU %d back "
 			       "online\n", cpu);
 
+	list_for_each_entry_safe(cell, tmp, &cells, entry) {
+		unregister_console(cell);
+		list_del(&cell->entry);
+		kfree(cell);
+	}
+
 	enabled = false;
 	module_put(THIS_MODULE);
 
@@ -240,156 +420,1474 @@ unlock_out:
 	return err;
 }
 
-static int jailhouse_cell_create(struct jailhouse_new_cell __user *arg)
+/* must be called with lock held */
+static struct cell *find_cell_by_id(unsigned int id)
+{
+	struct cell *cell;
+
+	list_for_each_entry(cell, &cells, entry)
+		if (cell->id == id)
+			return cell;
+	return NULL;
+}
+
+static int jailhouse_console_open(struct inode *inode, struct file *file)
+{
+	struct cell *cell = container_of(file->private_data, struct cell,
+					 console_dev);
+	struct console_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	/* the cell may be destroyed while we are open, look it up again on
+	 * each read */
+	reader->cell_id = cell->id;
+	file->private_data = reader;
+
+	return nonseekable_open(inode, file);
+}
+
+static int jailhouse_console_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t jailhouse_console_read(struct file *file, char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	struct console_reader *reader = file->private_data;
+	struct jailhouse_cell_console *console;
+	char chunk[256];
+	struct cell *cell;
+	u32 head, len, n;
+
+	if (count == 0)
+		return 0;
+
+	while (1) {
+		if (mutex_lock_interruptible(&lock) != 0)
+			return -EINTR;
+
+		cell = enabled ? find_cell_by_id(reader->cell_id) : NULL;
+		if (!cell) {
+			mutex_unlock(&lock);
+			return 0;
+		}
+		console = hypervisor_mem + cell->console_offset;
+
+		head = ACCESS_ONCE(console->head);
+		smp_rmb();
+
+		if (!reader->started) {
+			reader->tail = head -
+				min_t(u32, head, JAILHOUSE_CELL_CONSOLE_SIZE);
+			reader->started = true;
+		}
+		/* skip what the cell already overwrote */
+		if (head - reader->tail > JAILHOUSE_CELL_CONSOLE_SIZE)
+			reader->tail = head - JAILHOUSE_CELL_CONSOLE_SIZE;
+
+		len = min_t(u32, head - reader->tail,
+			    min_t(size_t, count, sizeof(chunk)));
+		for (n = 0; n < len; n++)
+			chunk[n] = console->data[(reader->tail + n) %
+						 JAILHOUSE_CELL_CONSOLE_SIZE];
+		smp_rmb();
+		/* the cell may have wrapped around while we copied */
+		if (ACCESS_ONCE(console->head) - reader->tail >
+		    JAILHOUSE_CELL_CONSOLE_SIZE) {
+			mutex_unlock(&lock);
+			continue;
+		}
+		reader->tail += len;
+
+		mutex_unlock(&lock);
+
+		if (len > 0)
+			return copy_to_user(buf, chunk, len) ? -EFAULT : len;
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (msleep_interruptible(CONSOLE_POLL_MS))
+			return -ERESTARTSYS;
+	}
+}
+
+static const struct file_operations jailhouse_console_fops = {
+	.owner = THIS_MODULE,
+	.open = jailhouse_console_open,
+	.release = jailhouse_console_release,
+	.read = jailhouse_console_read,
+	.llseek = no_llseek,
+};
+
+/* must be called with lock held, the cell works without the device */
+static void register_console(struct cell *cell)
+{
+	long offset;
+
+	offset = jailhouse_call1(JAILHOUSE_HC_CELL_GET_CONSOLE, cell->id);
+	if (offset < 0)
+		return;
+	cell->console_offset = offset;
+
+	snprintf(cell->console_name, sizeof(cell->console_name),
+		 CONSOLE_NAME_PREFIX "%s", cell->name);
+	cell->console_dev.minor = MISC_DYNAMIC_MINOR;
+	cell->console_dev.name = cell->console_name;
+	cell->console_dev.fops = &jailhouse_console_fops;
+	if (misc_register(&cell->console_dev) == 0)
+		cell->console_registered = true;
+	else
+		printk("Jailhouse: failed to register console of cell "
+		       "\"%s\"\n", cell->name);
+}
+
+static void unregister_console(struct cell *cell)
+{
+	if (cell->console_registered)
+		misc_deregister(&cell->console_dev);
+}
+
+static struct jailhouse_preload_image *
+copy_images(const struct jailhouse_preload_image __user *src,
+	    unsigned int num_images)
+{
+	struct jailhouse_preload_image *images;
+
+	if (num_images == 0)
+		return ERR_PTR(-EINVAL);
+
+	images = kcalloc(num_images, sizeof(*images), GFP_KERNEL);
+	if (!images)
+		return ERR_PTR(-ENOMEM);
+
+	if (copy_from_user(images, src, sizeof(*images) * num_images)) {
+		kfree(images);
+		return ERR_PTR(-EFAULT);
+	}
+
+	return images;
+}
+
+static int compare_images(const void *a, const void *b)
+{
+	const struct jailhouse_preload_image *image_a = a, *image_b = b;
+
+	if (image_a->target_address < image_b->target_address)
+		return -1;
+	return image_a->target_address > image_b->target_address;
+}
+
+/* sorts the images by target address, they must not overlap */
+static int check_images(struct jailhouse_preload_image *images,
+			unsigned int num_images, unsigned long ram_size)
+{
+	unsigned long end = 0;
+	unsigned int n;
+
+	sort(images, num_images, sizeof(*images), compare_images, NULL);
+
+	for (n = 0; n < num_images; n++) {
+		if (images[n].target_address < end ||
+		    images[n].size > ram_size ||
+		    images[n].target_address > ram_size - images[n].size)
+			return -EINVAL;
+		end = images[n].target_address + images[n].size;
+	}
+	return 0;
+}
+
+/* takes the CPUs of the new cell from Linux while its memory is prepared */
+static void cell_request_offline_cpus(struct work_struct *work)
+{
+	struct cell_request *req =
+		container_of(work, struct cell_request, offline_work);
+	unsigned int cpu;
+	int err;
+
+	/* the kernel serializes CPU hotplug anyway, do one after the other */
+	for_each_cpu_mask(cpu, req->new_cell->cpus_assigned)
+		if (cpu_online(cpu)) {
+			err = cpu_down(cpu);
+			if (err) {
+				req->offline_err = err;
+				return;
+			}
+			cpu_set(cpu, offlined_cpus);
+		}
+}
+
+static void cell_request_free(struct cell_request *req)
+{
+	if (req->cell_mem)
+		iounmap((__force void __iomem *)req->cell_mem);
+	if (req->eventfd)
+		eventfd_ctx_put(req->eventfd);
+	kfree(req->config);
+	kfree(req->new_cell);
+	kfree(req);
+}
+
+/*
+ * Copies config and images from the caller, which has to be the process
+ * that issued the request. Offlining the CPUs of the cell overlaps with
+ * loading the images.
+ */
+static struct cell_request *
+cell_request_prepare(struct jailhouse_new_cell __user *arg)
 {
-	struct {
-		struct jailhouse_new_cell cell;
-		struct jailhouse_preload_image image;
-	} cell_buffer;
-	struct jailhouse_new_cell *cell = &cell_buffer.cell;
-	struct jailhouse_preload_image *image = &cell->image[0];
-	unsigned int mask_pos, bit_pos, cpu;
+	struct jailhouse_preload_image *images;
+	unsigned int mask_pos, bit_pos, n;
 	struct jailhouse_cell_desc *config;
+	struct jailhouse_new_cell cell;
+	struct cell_request *req;
 	struct jailhouse_memory *ram;
-	void *cell_mem;
+	unsigned long cleared = 0;
 	u8 *cpu_mask;
 	int err;
 
-	if (copy_from_user(cell, arg, sizeof(*cell)))
-		return -EFAULT;
+	if (copy_from_user(&cell, arg, sizeof(cell)))
+		return ERR_PTR(-EFAULT);
 
-	if (cell->num_preload_images != 1)
-		return -EINVAL;
+	if (cell.config_size < sizeof(*config))
+		return ERR_PTR(-EINVAL);
 
-	if (copy_from_user(cell->image, arg->image,
-			   sizeof(*cell->image) * cell->num_preload_images))
-		return -EFAULT;
+	images = copy_images(arg->image, cell.num_preload_images);
+	if (IS_ERR(images))
+		return ERR_CAST(images);
 
-	config = kmalloc(cell->config_size, GFP_KERNEL | GFP_DMA);
-	if (!config)
-		return -ENOMEM;
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req) {
+		err = -ENOMEM;
+		goto kfree_images_out;
+	}
+	INIT_WORK(&req->offline_work, cell_request_offline_cpus);
+	req->config_size = cell.config_size;
+
+	req->new_cell = kzalloc(sizeof(*req->new_cell), GFP_KERNEL);
+	if (!req->new_cell) {
+		err = -ENOMEM;
+		goto free_req_out;
+	}
+
+	config = kmalloc(cell.config_size, GFP_KERNEL | GFP_DMA);
+	if (!config) {
+		err = -ENOMEM;
+		goto free_req_out;
+	}
+	req->config = config;
 
-	if (copy_from_user(config, (void *)(unsigned long)cell->config_address,
-			   cell->config_size)) {
+	if (copy_from_user(config, (void *)(unsigned long)cell.config_address,
+			   cell.config_size)) {
 		err = -EFAULT;
-		goto kfree_config_out;
+		goto free_req_out;
 	}
-	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
 
-	cpu_mask = ((void *)config) + sizeof(struct jailhouse_cell_desc);
-	for (mask_pos = 0; mask_pos < config->cpu_set_size; mask_pos++)
-		for (bit_pos = 0; bit_pos < 8; bit_pos++) {
-			if (!(cpu_mask[mask_pos] & (1 << bit_pos)))
-				continue;
-			cpu = mask_pos * 8 + bit_pos;
-			if (cpu_online(cpu)) {
-				err = cpu_down(cpu);
-				if (err)
-					goto kfree_config_out;
-				cpu_set(cpu, offlined_cpus);
-			}
-		}
+	if (!config_valid(config, cell.config_size)) {
+		err = -EINVAL;
+		goto free_req_out;
+	}
+	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
 
-	ram = ((void *)config) + sizeof(struct jailhouse_cell_desc) +
-		config->cpu_set_size;
-	if (config->num_memory_regions < 1 || ram->size < 1024 * 1024 ||
-	    image->target_address + image->size > ram->size) {
+	ram = jailhouse_cell_mem_regions(config);
+	if (config->num_memory_regions < 1 || ram->size < 1024 * 1024) {
 		err = -EINVAL;
-		goto kfree_config_out;
+		goto free_req_out;
 	}
 
-	cell_mem = jailhouse_ioremap(ram->phys_start, ram->size);
-	if (!cell_mem) {
+	err = check_images(images, cell.num_preload_images, ram->size);
+	if (err)
+		goto free_req_out;
+
+	cpu_mask = jailhouse_cell_cpu_set(config);
+	for (mask_pos = 0; mask_pos < config->cpu_set_size; mask_pos++)
+		for (bit_pos = 0; bit_pos < 8; bit_pos++)
+			if (cpu_mask[mask_pos] & (1 << bit_pos))
+				cpu_set(mask_pos * 8 + bit_pos,
+					req->new_cell->cpus_assigned);
+
+	queue_work(system_unbound_wq, &req->offline_work);
+
+	req->cell_mem = jailhouse_ioremap(ram->phys_start, ram->size);
+	if (!req->cell_mem) {
 		err = -EBUSY;
-		goto kfree_config_out;
+		goto flush_out;
 	}
-	memset(cell_mem, 0, ram->size);
 
-	if (copy_from_user(cell_mem + image->target_address,
-			   (void *)(unsigned long)image->source_address,
-			   image->size)) {
-		err = -EFAULT;
-		goto iounmap_out;
+	/* only clear what the images do not overwrite anyway */
+	for (n = 0; n < cell.num_preload_images; n++) {
+		memset(req->cell_mem + cleared, 0,
+		       images[n].target_address - cleared);
+		if (copy_from_user(req->cell_mem + images[n].target_address,
+				   (void __user *)(unsigned long)
+				   images[n].source_address,
+				   images[n].size)) {
+			err = -EFAULT;
+			goto flush_out;
+		}
+		cleared = images[n].target_address + images[n].size;
 	}
+	memset(req->cell_mem + cleared, 0, ram->size - cleared);
+	jailhouse_flush_dcache(req->cell_mem, ram->size);
+
+	kfree(images);
+	return req;
+
+flush_out:
+	flush_work(&req->offline_work);
+free_req_out:
+	cell_request_free(req);
+kfree_images_out:
+	kfree(images);
+	return ERR_PTR(err);
+}
 
-	if (mutex_lock_interruptible(&lock) != 0) {
-		err = -EINTR;
-		goto kfree_config_out;
-	}
+/* hands the prepared cell to the hypervisor, may run in a worker */
+static int cell_request_submit(struct cell_request *req)
+{
+	struct jailhouse_cell_desc *config = req->config;
+	struct cell *new_cell = req->new_cell;
+	int err;
+
+	flush_work(&req->offline_work);
+	if (req->offline_err)
+		return req->offline_err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
 
 	if (!enabled) {
 		err = -EINVAL;
 		goto unlock_out;
 	}
 
-	err = jailhouse_call1(JAILHOUSE_HC_CELL_CREATE, __pa(config));
-	if (err)
+	/* returns the ID of the new cell on success, -EAGAIN when the
+	 * hypervisor wants to give Linux the CPU back in between */
+	while ((err = jailhouse_call2(JAILHOUSE_HC_CELL_CREATE, __pa(config),
+				      req->config_size)) == -EAGAIN) {
+		/* a killed requester must not leave the creation pending */
+		if (fatal_signal_pending(current)) {
+			jailhouse_call2(JAILHOUSE_HC_CELL_CREATE, __pa(config),
+					0);
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	if (err < 0)
 		goto unlock_out;
 
-	printk("Created Jailhouse cell \"%s\"\n", config->name);
+	new_cell->id = err;
+	memcpy(new_cell->name, config->name, sizeof(new_cell->name));
+	new_cell->ram = *jailhouse_cell_mem_regions(config);
+	list_add_tail(&new_cell->entry, &cells);
+	register_console(new_cell);
+
+	printk("Created Jailhouse cell \"%s\" (ID %d)\n", new_cell->name,
+	       new_cell->id);
+
+	req->new_cell = NULL;
+	err = 0;
 
 unlock_out:
 	mutex_unlock(&lock);
 
-iounmap_out:
-	iounmap((__force void __iomem *)cell_mem);
-kfree_config_out:
-	kfree(config);
+	return err;
+}
+
+static int jailhouse_cell_create(struct jailhouse_new_cell __user *arg)
+{
+	struct cell_request *req;
+	int err;
+
+	req = cell_request_prepare(arg);
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	err = cell_request_submit(req);
+	cell_request_free(req);
 
 	return err;
 }
 
-static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
-			    unsigned long arg)
+static void cell_request_run(struct work_struct *work)
 {
-	long err;
+	struct cell_request *req =
+		container_of(work, struct cell_request, submit_work);
+	struct eventfd_ctx *eventfd;
+	int result;
+
+	result = cell_request_submit(req);
+
+	/* what the orchestrator does not need anymore goes right away */
+	if (req->cell_mem)
+		iounmap((__force void __iomem *)req->cell_mem);
+	req->cell_mem = NULL;
+	kfree(req->config);
+	req->config = NULL;
+
+	/* req may be gone as soon as the result is visible */
+	spin_lock(&requests_lock);
+	eventfd = req->eventfd;
+	req->eventfd = NULL;
+	req->result = result;
+	spin_unlock(&requests_lock);
+
+	if (eventfd) {
+		eventfd_signal(eventfd, 1);
+		eventfd_ctx_put(eventfd);
+	}
+}
 
-	switch (ioctl) {
-	case JAILHOUSE_ENABLE:
-		err = jailhouse_enable(
-			(struct jailhouse_system __user *)arg);
-		break;
-	case JAILHOUSE_DISABLE:
-		err = jailhouse_disable();
-		break;
-	case JAILHOUSE_CELL_CREATE:
-		err = jailhouse_cell_create(
-			(struct jailhouse_new_cell __user *)arg);
-		break;
-	case JAILHOUSE_CELL_DESTROY:
-		err = -ENOSYS;
-		break;
-	default:
-		err = -EINVAL;
-		break;
+/* returns a handle for JAILHOUSE_CELL_CREATE_RESULT once the images are in */
+static long jailhouse_cell_create_async(struct jailhouse_new_cell_async
+					__user *arg)
+{
+	struct jailhouse_new_cell_async async;
+	struct eventfd_ctx *eventfd = NULL;
+	struct cell_request *req;
+
+	if (copy_from_user(&async, arg, sizeof(async)))
+		return -EFAULT;
+
+	if (async.eventfd >= 0) {
+		eventfd = eventfd_ctx_fdget(async.eventfd);
+		if (IS_ERR(eventfd))
+			return PTR_ERR(eventfd);
 	}
 
-	return err;
+	req = cell_request_prepare((struct jailhouse_new_cell __user *)
+				   (unsigned long)async.new_cell);
+	if (IS_ERR(req)) {
+		if (eventfd)
+			eventfd_ctx_put(eventfd);
+		return PTR_ERR(req);
+	}
+
+	req->eventfd = eventfd;
+	req->result = -EINPROGRESS;
+	INIT_WORK(&req->submit_work, cell_request_run);
+
+	spin_lock(&requests_lock);
+	/* positive to keep it apart from error codes */
+	req->handle = next_request_handle;
+	if (++next_request_handle <= 0)
+		next_request_handle = 1;
+	list_add_tail(&req->entry, &requests);
+	spin_unlock(&requests_lock);
+
+	queue_work(system_unbound_wq, &req->submit_work);
+
+	return req->handle;
 }
 
-static const struct file_operations jailhouse_fops = {
-	.owner = THIS_MODULE,
-	.unlocked_ioctl = jailhouse_ioctl,
-	.llseek = noop_llseek,
-};
+/* releases the handle of a finished request */
+static long jailhouse_cell_create_result(unsigned long handle)
+{
+	struct cell_request *req, *found = NULL;
+	long result = -ENOENT;
+
+	spin_lock(&requests_lock);
+	list_for_each_entry(req, &requests, entry)
+		if (req->handle == handle) {
+			result = req->result;
+			if (result == -EINPROGRESS)
+				result = -EAGAIN;
+			else {
+				list_del(&req->entry);
+				found = req;
+			}
+			break;
+		}
+	spin_unlock(&requests_lock);
 
-static struct miscdevice jailhouse_misc_dev = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "jailhouse",
-	.fops = &jailhouse_fops,
-};
+	if (found)
+		cell_request_free(found);
 
-static int __init jailhouse_init(void)
+	return result;
+}
+
+/* must be called with lock held */
+static struct cell *find_cell(const char *name)
 {
-	jailhouse_dev = root_device_register("jailhouse");
-	if (IS_ERR(jailhouse_dev))
-		return PTR_ERR(jailhouse_dev);
-	return misc_register(&jailhouse_misc_dev);
+	struct cell *cell;
+
+	list_for_each_entry(cell, &cells, entry)
+		if (strcmp(cell->name, name) == 0)
+			return cell;
+	return NULL;
 }
 
-static void __exit jailhouse_exit(void)
+/*
+ * Takes the lock and looks up the cell with the given name. On success,
+ * the caller has to release the lock.
+ */
+static int lock_cell(const char __user *arg, struct cell **cell_ptr)
 {
-	misc_deregister(&jailhouse_misc_dev);
+	char name[JAILHOUSE_CELL_NAME_MAXLEN+1];
+
+	if (strncpy_from_user(name, arg, sizeof(name)) < 0)
+		return -EFAULT;
+	name[sizeof(name) - 1] = 0;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (!enabled) {
+		mutex_unlock(&lock);
+		return -EINVAL;
+	}
+
+	*cell_ptr = find_cell(name);
+	if (!*cell_ptr) {
+		mutex_unlock(&lock);
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static int jailhouse_cell_destroy(const char __user *arg)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	err = lock_cell(arg, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call1(JAILHOUSE_HC_CELL_DESTROY, cell->id);
+	if (err)
+		goto unlock_out;
+
+	/* the hypervisor parked the CPUs, Linux can start them again */
+	for_each_cpu_mask(cpu, cell->cpus_assigned)
+		if (cpu_isset(cpu, offlined_cpus)) {
+			if (cpu_up(cpu) != 0)
+				printk("Jailhouse: failed to bring CPU %d "
+				       "back online\n", cpu);
+			else
+				cpu_clear(cpu, offlined_cpus);
+		}
+
+	printk("Destroyed Jailhouse cell \"%s\"\n", cell->name);
+
+	unregister_console(cell);
+	list_del(&cell->entry);
+	kfree(cell);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_cell_stop(const char __user *arg)
+{
+	struct cell *cell;
+	int err;
+
+	err = lock_cell(arg, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call1(JAILHOUSE_HC_CELL_STOP, cell->id);
+	if (!err)
+		cell->loadable = true;
+
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_cell_start(const char __user *arg)
+{
+	struct cell *cell;
+	int err;
+
+	err = lock_cell(arg, &cell);
+	if (err)
+		return err;
+
+	/* the image memory is gone for us once the cell runs again */
+	err = jailhouse_call1(JAILHOUSE_HC_CELL_START, cell->id);
+	if (!err)
+		cell->loadable = false;
+
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+/* the cell keeps running, the CPU waits there for INIT/SIPI afterwards */
+static int jailhouse_cell_add_cpu(struct jailhouse_cell_cpu __user *arg)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	if (get_user(cpu, &arg->cpu_id))
+		return -EFAULT;
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	err = lock_cell(arg->name, &cell);
+	if (err)
+		return err;
+
+	if (cpu_online(cpu)) {
+		err = cpu_down(cpu);
+		if (err)
+			goto unlock_out;
+		cpu_set(cpu, offlined_cpus);
+	}
+
+	err = jailhouse_call2(JAILHOUSE_HC_CELL_ADD_CPU, cell->id, cpu);
+	if (err) {
+		if (cpu_isset(cpu, offlined_cpus) && cpu_up(cpu) == 0)
+			cpu_clear(cpu, offlined_cpus);
+		goto unlock_out;
+	}
+
+	cpu_set(cpu, cell->cpus_assigned);
+
+	printk("Added CPU %d to Jailhouse cell \"%s\"\n", cpu, cell->name);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_cell_remove_cpu(struct jailhouse_cell_cpu __user *arg)
+{
+	struct cell *cell;
+	unsigned int cpu;
+	int err;
+
+	if (get_user(cpu, &arg->cpu_id))
+		return -EFAULT;
+
+	err = lock_cell(arg->name, &cell);
+	if (err)
+		return err;
+
+	if (cpu >= nr_cpu_ids || !cpu_isset(cpu, cell->cpus_assigned)) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	err = jailhouse_call2(JAILHOUSE_HC_CELL_REMOVE_CPU, cell->id, cpu);
+	if (err)
+		goto unlock_out;
+
+	cpu_clear(cpu, cell->cpus_assigned);
+
+	/* the hypervisor parked the CPU, Linux can start it again */
+	if (cpu_isset(cpu, offlined_cpus)) {
+		if (cpu_up(cpu) != 0)
+			printk("Jailhouse: failed to bring CPU %d "
+			       "back online\n", cpu);
+		else
+			cpu_clear(cpu, offlined_cpus);
+	}
+
+	printk("Removed CPU %d from Jailhouse cell \"%s\"\n", cpu,
+	       cell->name);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int load_image(struct cell *cell,
+		      struct jailhouse_preload_image *image)
+{
+	unsigned long page_offs = image->target_address & ~PAGE_MASK;
+	unsigned long size;
+	void *image_mem;
+	int err = 0;
+
+	/* only map what the image covers, the rest of the RAM is kept */
+	size = PAGE_ALIGN(page_offs + image->size);
+	image_mem = jailhouse_ioremap(cell->ram.phys_start +
+				      (image->target_address & PAGE_MASK),
+				      size);
+	if (!image_mem)
+		return -EBUSY;
+
+	if (copy_from_user(image_mem + page_offs,
+			   (void __user *)(unsigned long)image->source_address,
+			   image->size))
+		err = -EFAULT;
+	else
+		jailhouse_flush_dcache(image_mem, size);
+
+	iounmap((__force void __iomem *)image_mem);
+
+	return err;
+}
+
+static int jailhouse_cell_load(struct jailhouse_cell_load __user *arg)
+{
+	struct jailhouse_preload_image *images;
+	struct jailhouse_cell_load load;
+	struct cell *cell;
+	unsigned int n;
+	int err;
+
+	if (copy_from_user(&load, arg, sizeof(load)))
+		return -EFAULT;
+
+	images = copy_images(arg->image, load.num_preload_images);
+	if (IS_ERR(images))
+		return PTR_ERR(images);
+
+	err = lock_cell(arg->name, &cell);
+	if (err)
+		goto kfree_images_out;
+
+	if (!cell->loadable) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	err = check_images(images, load.num_preload_images, cell->ram.size);
+	for (n = 0; n < load.num_preload_images && !err; n++)
+		err = load_image(cell, &images[n]);
+
+unlock_out:
+	mutex_unlock(&lock);
+kfree_images_out:
+	kfree(images);
+
+	return err;
+}
+
+/*
+ * Saves or restores the image memory and the CPUs of a stopped cell. A
+ * restored cell continues where the snapshot was taken once it is started.
+ */
+static int jailhouse_cell_snapshot(struct jailhouse_cell_snapshot __user *arg,
+				   bool restore)
+{
+	struct jailhouse_cell_snapshot snapshot;
+	struct jailhouse_cpu_state *state;
+	struct jailhouse_cpu_state __user *user_state;
+	unsigned int cpu, num_cpus = 0;
+	struct cell *cell;
+	void *cell_mem;
+	int err;
+
+	if (copy_from_user(&snapshot, arg, sizeof(snapshot)))
+		return -EFAULT;
+
+	err = lock_cell(arg->name, &cell);
+	if (err)
+		return err;
+
+	if (!cell->loadable) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	for_each_cpu_mask(cpu, cell->cpus_assigned)
+		num_cpus++;
+
+	if (restore) {
+		/* only for the cell the snapshot was taken of */
+		if (snapshot.num_cpus != num_cpus ||
+		    snapshot.cpu_state_size != sizeof(*state) ||
+		    snapshot.ram_size != cell->ram.size)
+			err = -EINVAL;
+	} else {
+		if (put_user(num_cpus, &arg->num_cpus) ||
+		    put_user(sizeof(*state), &arg->cpu_state_size) ||
+		    put_user(cell->ram.size, &arg->ram_size))
+			err = -EFAULT;
+		else if (snapshot.num_cpus < num_cpus ||
+			 snapshot.ram_size < cell->ram.size)
+			err = -ENOSPC;
+	}
+	if (err)
+		goto unlock_out;
+
+	/* the hypercalls take a 32-bit physical address */
+	state = (void *)get_zeroed_page(GFP_KERNEL | GFP_DMA);
+	if (!state) {
+		err = -ENOMEM;
+		goto unlock_out;
+	}
+
+	cell_mem = jailhouse_ioremap(cell->ram.phys_start, cell->ram.size);
+	if (!cell_mem) {
+		err = -EBUSY;
+		goto free_page_out;
+	}
+
+	/* memory first, the CPUs would not start from a failed restore */
+	if (restore) {
+		if (copy_from_user(cell_mem,
+				   (void __user *)(unsigned long)snapshot.ram,
+				   cell->ram.size))
+			err = -EFAULT;
+		else
+			jailhouse_flush_dcache(cell_mem, cell->ram.size);
+	} else if (copy_to_user((void __user *)(unsigned long)snapshot.ram,
+				cell_mem, cell->ram.size))
+		err = -EFAULT;
+	if (err)
+		goto iounmap_out;
+
+	user_state = (void __user *)(unsigned long)snapshot.cpu_states;
+	for_each_cpu_mask(cpu, cell->cpus_assigned) {
+		if (restore) {
+			if (copy_from_user(state, user_state, sizeof(*state))) {
+				err = -EFAULT;
+				break;
+			}
+			err = jailhouse_call2(JAILHOUSE_HC_CPU_SET_STATE, cpu,
+					      __pa(state));
+		} else {
+			err = jailhouse_call2(JAILHOUSE_HC_CPU_GET_STATE, cpu,
+					      __pa(state));
+			if (!err &&
+			    copy_to_user(user_state, state, sizeof(*state)))
+				err = -EFAULT;
+		}
+		if (err)
+			break;
+		user_state++;
+	}
+
+iounmap_out:
+	iounmap((__force void __iomem *)cell_mem);
+free_page_out:
+	free_page((unsigned long)state);
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+/*
+ * Starts or stops logging the writes of a running cell to its memory, or
+ * fetches the pages of a region written since the last fetch.
+ */
+static int jailhouse_cell_dirty_log(void __user *arg, __u32 cmd)
+{
+	struct jailhouse_cell_dirty_log __user *user_req = arg;
+	struct jailhouse_cell_dirty_log req;
+	struct jailhouse_dirty_log *log;
+	__u64 __user *user_bitmap;
+	unsigned long done;
+	struct cell *cell;
+	int err;
+
+	if (cmd == JAILHOUSE_DIRTY_LOG_FETCH &&
+	    copy_from_user(&req, user_req, sizeof(req)))
+		return -EFAULT;
+
+	/* the name leads the fetch request as well */
+	err = lock_cell(arg, &cell);
+	if (err)
+		return err;
+
+	/* the hypercall takes a 32-bit physical address */
+	log = (void *)get_zeroed_page(GFP_KERNEL | GFP_DMA);
+	if (!log) {
+		err = -ENOMEM;
+		goto unlock_out;
+	}
+
+	log->cmd = cmd;
+	if (cmd == JAILHOUSE_DIRTY_LOG_FETCH)
+		log->region = req.region;
+
+	/* a fetch of no pages only reports the size of the region */
+	err = jailhouse_call2(JAILHOUSE_HC_CELL_DIRTY_LOG, cell->id,
+			      __pa(log));
+	if (err || cmd != JAILHOUSE_DIRTY_LOG_FETCH)
+		goto free_page_out;
+
+	if (put_user(log->region_pages, &user_req->num_pages)) {
+		err = -EFAULT;
+		goto free_page_out;
+	}
+	if (req.num_pages < log->region_pages) {
+		err = -ENOSPC;
+		goto free_page_out;
+	}
+
+	/* chunks fill the page and are multiples of 64 pages */
+	user_bitmap = (__u64 __user *)(unsigned long)req.bitmap;
+	for (done = 0; done < log->region_pages; done += log->num_pages) {
+		log->start_page = done;
+		log->num_pages = (PAGE_SIZE - sizeof(*log)) * 8;
+		err = jailhouse_call2(JAILHOUSE_HC_CELL_DIRTY_LOG, cell->id,
+				      __pa(log));
+		if (!err && log->num_pages == 0)
+			err = -EIO;
+		if (err)
+			break;
+		if (copy_to_user(user_bitmap + done / 64, log->bitmap,
+				 DIV_ROUND_UP(log->num_pages, 64) *
+				 sizeof(__u64))) {
+			err = -EFAULT;
+			break;
+		}
+	}
+
+free_page_out:
+	free_page((unsigned long)log);
+unlock_out:
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+/*
+ * Reads num counters of the given CPU or pool with a single hypercall.
+ * Must be called with lock held.
+ */
+static int get_stats(unsigned int code, unsigned int id, __u64 *value,
+		     unsigned int num)
+{
+	struct jailhouse_hc_batch *batch;
+	unsigned int n;
+	int err;
+
+	if (num > JAILHOUSE_HC_BATCH_MAX_OPS)
+		return -EINVAL;
+
+	/* the hypercall takes a 32-bit physical address */
+	batch = (void *)get_zeroed_page(GFP_KERNEL | GFP_DMA);
+	if (!batch)
+		return -ENOMEM;
+
+	batch->num_ops = num;
+	for (n = 0; n < num; n++) {
+		batch->op[n].code = code;
+		batch->op[n].arg1 = id;
+		batch->op[n].arg2 = n;
+	}
+
+	err = jailhouse_call1(JAILHOUSE_HC_BATCH, __pa(batch));
+	for (n = 0; !err && n < num; n++)
+		value[n] = batch->op[n].result;
+
+	free_page((unsigned long)batch);
+
+	return err;
+}
+
+static int jailhouse_cpu_stats(struct jailhouse_cpu_stats __user *arg)
+{
+	struct jailhouse_cpu_stats *stats;
+	int err = 0;
+
+	stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+
+	if (copy_from_user(&stats->cpu_id, &arg->cpu_id,
+			   sizeof(stats->cpu_id))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+
+	if (stats->cpu_id >= nr_cpu_ids || !cpu_possible(stats->cpu_id)) {
+		err = -EINVAL;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	err = get_stats(JAILHOUSE_HC_CPU_GET_STAT, stats->cpu_id,
+			stats->value, JAILHOUSE_NUM_CPU_STATS);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(arg, stats, sizeof(*stats)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(stats);
+
+	return err;
+}
+
+static int jailhouse_cell_doorbell(unsigned long cell_id)
+{
+	int err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (enabled)
+		err = jailhouse_call1(JAILHOUSE_HC_CELL_DOORBELL, cell_id);
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_profile_set(unsigned long period)
+{
+	int err;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (enabled)
+		err = jailhouse_call1(JAILHOUSE_HC_PROFILE_SET, period);
+	else
+		err = -EINVAL;
+
+	mutex_unlock(&lock);
+
+	return err;
+}
+
+static int jailhouse_profile_read(struct jailhouse_profile_samples __user *arg)
+{
+	struct jailhouse_profile_sample __user *buffer;
+	struct jailhouse_profile_samples req;
+	struct jailhouse_profile_read *read;
+	unsigned int copied = 0, max;
+	void *page;
+	long num;
+	int err = 0;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	buffer = (struct jailhouse_profile_sample __user *)
+		(unsigned long)req.buffer;
+
+	/* the hypercall takes a 32-bit physical address */
+	page = (void *)get_zeroed_page(GFP_KERNEL | GFP_DMA);
+	if (!page)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto free_page_out;
+	}
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	/*
+	 * Samples are moved out of the ring into the rest of the page. Shift
+	 * the request towards its end to take no more than the caller can.
+	 */
+	req.dropped = 0;
+	while (copied < req.num_samples) {
+		max = min_t(unsigned int, req.num_samples - copied,
+			    (PAGE_SIZE - sizeof(*read)) /
+			    sizeof(read->sample[0]));
+		read = page + PAGE_SIZE - sizeof(*read) -
+			max * sizeof(read->sample[0]);
+		num = jailhouse_call2(JAILHOUSE_HC_PROFILE_READ, req.cpu_id,
+				      __pa(read));
+		if (num < 0) {
+			err = num;
+			break;
+		}
+		req.dropped += read->dropped;
+		if (num == 0)
+			break;
+		if (copy_to_user(&buffer[copied], read->sample,
+				 num * sizeof(read->sample[0]))) {
+			err = -EFAULT;
+			break;
+		}
+		copied += num;
+	}
+	req.num_samples = copied;
+
+unlock_out:
+	mutex_unlock(&lock);
+free_page_out:
+	free_page((unsigned long)page);
+
+	if (!err && copy_to_user(arg, &req, sizeof(req)))
+		err = -EFAULT;
+
+	return err;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	u32 sample_a = *(const u32 *)a, sample_b = *(const u32 *)b;
+
+	return sample_a < sample_b ? -1 : sample_a > sample_b;
+}
+
+static void exit_bench_measure(unsigned int test, u32 *samples,
+			       unsigned int iterations,
+			       struct jailhouse_exit_bench_result *result)
+{
+	cycles_t start, cycles, overhead = ~(cycles_t)0;
+	unsigned long flags;
+	unsigned int n;
+
+	local_irq_save(flags);
+
+	for (n = 0; n < iterations; n++) {
+		start = get_cycles();
+		cycles = get_cycles() - start;
+		if (cycles < overhead)
+			overhead = cycles;
+	}
+	for (n = 0; n < iterations; n++) {
+		start = get_cycles();
+		exit_bench_operation(test);
+		cycles = get_cycles() - start;
+		samples[n] = cycles > overhead ? cycles - overhead : 0;
+	}
+
+	local_irq_restore(flags);
+
+	sort(samples, iterations, sizeof(*samples), compare_samples, NULL);
+	result->iterations = iterations;
+	result->min = samples[0];
+	result->median = samples[iterations / 2];
+	result->p99 = samples[(u64)iterations * 99 / 100];
+	result->max = samples[iterations - 1];
+}
+
+/* the root cell counterpart of the exit-bench inmate, on the calling CPU */
+static int jailhouse_exit_bench(struct jailhouse_exit_bench __user *arg)
+{
+	struct jailhouse_exit_bench *bench;
+	unsigned int test;
+	u32 *samples;
+	int err = 0;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	if (!bench)
+		return -ENOMEM;
+
+	if (copy_from_user(&bench->iterations, &arg->iterations,
+			   sizeof(bench->iterations))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+
+	if (bench->iterations == 0 ||
+	    bench->iterations > JAILHOUSE_EXIT_BENCH_MAX_ITERATIONS) {
+		err = -EINVAL;
+		goto kfree_out;
+	}
+
+	samples = kmalloc(bench->iterations * sizeof(*samples), GFP_KERNEL);
+	if (!samples) {
+		err = -ENOMEM;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_samples_out;
+	}
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	for (test = 0; test < JAILHOUSE_EXIT_BENCH_NUM; test++)
+		if (exit_bench_available(test))
+			exit_bench_measure(test, samples, bench->iterations,
+					   &bench->result[test]);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(arg, bench, sizeof(*bench)))
+		err = -EFAULT;
+
+kfree_samples_out:
+	kfree(samples);
+kfree_out:
+	kfree(bench);
+
+	return err;
+}
+
+static int jailhouse_pool_stats(struct jailhouse_pool_stats __user *arg)
+{
+	struct jailhouse_pool_stats *stats;
+	int err = 0;
+
+	stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+
+	if (copy_from_user(&stats->pool_id, &arg->pool_id,
+			   sizeof(stats->pool_id))) {
+		err = -EFAULT;
+		goto kfree_out;
+	}
+
+	if (stats->pool_id >= JAILHOUSE_NUM_POOLS) {
+		err = -EINVAL;
+		goto kfree_out;
+	}
+
+	if (mutex_lock_interruptible(&lock) != 0) {
+		err = -EINTR;
+		goto kfree_out;
+	}
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	err = get_stats(JAILHOUSE_HC_POOL_GET_STAT, stats->pool_id,
+			stats->value, JAILHOUSE_NUM_POOL_STATS);
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(arg, stats, sizeof(*stats)))
+		err = -EFAULT;
+
+kfree_out:
+	kfree(stats);
+
+	return err;
+}
+
+static int jailhouse_trace_read(struct jailhouse_trace_read __user *arg)
+{
+	struct jailhouse_trace_event __user *buffer;
+	struct jailhouse_trace_ring *ring;
+	struct jailhouse_trace_event event;
+	struct jailhouse_trace_read req;
+	struct jailhouse_header *header;
+	unsigned int copied = 0;
+	u64 head, seq, slot;
+	int err = 0;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	if (req.cpu_id >= nr_cpu_ids || !cpu_possible(req.cpu_id))
+		return -EINVAL;
+
+	buffer = (struct jailhouse_trace_event __user *)
+		(unsigned long)req.buffer;
+
+	if (mutex_lock_interruptible(&lock) != 0)
+		return -EINTR;
+
+	if (!enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	header = (struct jailhouse_header *)hypervisor_mem;
+	ring = hypervisor_mem + PAGE_ALIGN(header->bss_end) +
+		req.cpu_id * header->percpu_size + header->percpu_trace_offset;
+
+	req.lost_events = 0;
+	if (ring->num_events == 0)
+		goto done;
+
+	head = ACCESS_ONCE(ring->head);
+	smp_rmb();
+
+	seq = req.next_event;
+	if (seq > head || head - seq > ring->num_events) {
+		seq = head - min_t(u64, head, ring->num_events);
+		if (seq > req.next_event)
+			req.lost_events = seq - req.next_event;
+	}
+
+	while (seq < head && copied < req.num_events) {
+		slot = seq;
+		event = ring->event[do_div(slot, ring->num_events)];
+		smp_rmb();
+		/* the slot may have been recycled while we copied it */
+		if (ACCESS_ONCE(ring->head) - seq >= ring->num_events) {
+			req.lost_events++;
+			seq++;
+			continue;
+		}
+		if (copy_to_user(&buffer[copied], &event, sizeof(event))) {
+			err = -EFAULT;
+			goto unlock_out;
+		}
+		copied++;
+		seq++;
+	}
+	req.next_event = seq;
+
+done:
+	req.num_events = copied;
+
+unlock_out:
+	mutex_unlock(&lock);
+
+	if (!err && copy_to_user(arg, &req, sizeof(req)))
+		err = -EFAULT;
+
+	return err;
+}
+
+static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
+			    unsigned long arg)
+{
+	long err;
+
+	switch (ioctl) {
+	case JAILHOUSE_ENABLE:
+		err = jailhouse_enable(
+			(struct jailhouse_system __user *)arg);
+		break;
+	case JAILHOUSE_DISABLE:
+		err = jailhouse_disable();
+		break;
+	case JAILHOUSE_CELL_CREATE:
+		err = jailhouse_cell_create(
+			(struct jailhouse_new_cell __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CREATE_ASYNC:
+		err = jailhouse_cell_create_async(
+			(struct jailhouse_new_cell_async __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CREATE_RESULT:
+		err = jailhouse_cell_create_result(arg);
+		break;
+	case JAILHOUSE_CELL_SAVE:
+	case JAILHOUSE_CELL_RESTORE:
+		err = jailhouse_cell_snapshot(
+			(struct jailhouse_cell_snapshot __user *)arg,
+			ioctl == JAILHOUSE_CELL_RESTORE);
+		break;
+	case JAILHOUSE_CELL_DIRTY_LOG_START:
+		err = jailhouse_cell_dirty_log((void __user *)arg,
+					       JAILHOUSE_DIRTY_LOG_START);
+		break;
+	case JAILHOUSE_CELL_DIRTY_LOG_STOP:
+		err = jailhouse_cell_dirty_log((void __user *)arg,
+					       JAILHOUSE_DIRTY_LOG_STOP);
+		break;
+	case JAILHOUSE_CELL_DIRTY_LOG_FETCH:
+		err = jailhouse_cell_dirty_log((void __user *)arg,
+					       JAILHOUSE_DIRTY_LOG_FETCH);
+		break;
+	case JAILHOUSE_CELL_DESTROY:
+		err = jailhouse_cell_destroy((const char __user *)arg);
+		break;
+	case JAILHOUSE_CPU_STATS:
+		err = jailhouse_cpu_stats(
+			(struct jailhouse_cpu_stats __user *)arg);
+		break;
+	case JAILHOUSE_TRACE_READ:
+		err = jailhouse_trace_read(
+			(struct jailhouse_trace_read __user *)arg);
+		break;
+	case JAILHOUSE_CELL_LOAD:
+		err = jailhouse_cell_load(
+			(struct jailhouse_cell_load __user *)arg);
+		break;
+	case JAILHOUSE_CELL_START:
+		err = jailhouse_cell_start((const char __user *)arg);
+		break;
+	case JAILHOUSE_CELL_STOP:
+		err = jailhouse_cell_stop((const char __user *)arg);
+		break;
+	case JAILHOUSE_CELL_ADD_CPU:
+		err = jailhouse_cell_add_cpu(
+			(struct jailhouse_cell_cpu __user *)arg);
+		break;
+	case JAILHOUSE_CELL_REMOVE_CPU:
+		err = jailhouse_cell_remove_cpu(
+			(struct jailhouse_cell_cpu __user *)arg);
+		break;
+	case JAILHOUSE_CELL_DOORBELL:
+		err = jailhouse_cell_doorbell(arg);
+		break;
+	case JAILHOUSE_POOL_STATS:
+		err = jailhouse_pool_stats(
+			(struct jailhouse_pool_stats __user *)arg);
+		break;
+	case JAILHOUSE_PROFILE_SET:
+		err = jailhouse_profile_set(arg);
+		break;
+	case JAILHOUSE_PROFILE_READ:
+		err = jailhouse_profile_read(
+			(struct jailhouse_profile_samples __user *)arg);
+		break;
+	case JAILHOUSE_EXIT_BENCH:
+		err = jailhouse_exit_bench(
+			(struct jailhouse_exit_bench __user *)arg);
+		break;
+	default:
+		err = -EINVAL;
+		break;
+	}
+
+	return err;
+}
+
+static const struct file_operations jailhouse_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = jailhouse_ioctl,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice jailhouse_misc_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "jailhouse",
+	.fops = &jailhouse_fops,
+};
+
+static int __init jailhouse_init(void)
+{
+	jailhouse_dev = root_device_register("jailhouse");
+	if (IS_ERR(jailhouse_dev))
+		return PTR_ERR(jailhouse_dev);
+	return misc_register(&jailhouse_misc_dev);
+}
+
+static void __exit jailhouse_exit(void)
+{
+	struct cell_request *req, *tmp;
+
+	misc_deregister(&jailhouse_misc_dev);
+
+	/* no new requests can arrive, drop those nobody picked up */
+	list_for_each_entry_safe(req, tmp, &requests, entry) {
+		flush_work(&req->submit_work);
+		list_del(&req->entry);
+		cell_request_free(req);
+	}
+
 	root_device_unregister(jailhouse_dev);
 }
 
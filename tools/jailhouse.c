@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 
 #include <jailhouse.h>
@@ -28,8 +30,25 @@ static void help(const char *progname)
 	       "\nAvailable commands:\n"
 	       "   enable CONFIGFILE\n"
 	       "   disable\n"
-	       "   cell create CONFIGFILE PRELOADIMAGE [-l ADDRESS]\n"
-	       "   cell destroy NAME\n",
+	       "   cell create CONFIGFILE IMAGE [-l ADDRESS] "
+	       "[IMAGE [-l ADDRESS] ...]\n"
+	       "   cell load NAME IMAGE [-l ADDRESS] [IMAGE [-l ADDRESS] ...]\n"
+	       "   cell start NAME\n"
+	       "   cell stop NAME\n"
+	       "   cell save NAME FILE\n"
+	       "   cell restore NAME FILE\n"
+	       "   cell dirty start|stop NAME\n"
+	       "   cell dirty fetch NAME REGION\n"
+	       "   cell cpu add|remove NAME CPU\n"
+	       "   cell destroy NAME\n"
+	       "   cell doorbell ID\n"
+	       "   stats [CPU]\n"
+	       "   pools\n"
+	       "   trace CPU\n"
+	       "   profile start [PERIOD]\n"
+	       "   profile stop\n"
+	       "   profile report HYPERVISOR_O [SECONDS]\n"
+	       "   bench [ITERATIONS]\n",
 	       progname);
 }
 
@@ -81,6 +100,86 @@ static void *read_file(const char *name, size_t *size)
 	return buffer;
 }
 
+/* maps the file read-only so that the driver reads it straight from the
+ * page cache */
+static void *map_file(const char *name, size_t *size)
+{
+	struct stat stat;
+	void *buffer;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	buffer = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buffer == MAP_FAILED) {
+		fprintf(stderr, "mapping %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	close(fd);
+
+	*size = stat.st_size;
+
+	return buffer;
+}
+
+/*
+ * Parses IMAGE [-l ADDRESS] pairs from argv[arg] on. Returns the number
+ * of images filled into the array, which must have room for argc - arg
+ * entries.
+ */
+static unsigned int parse_images(int argc, char *argv[], int arg,
+				 struct jailhouse_preload_image *image)
+{
+	unsigned int num_images = 0;
+	size_t size;
+	char *endp;
+
+	while (arg < argc) {
+		image->source_address =
+			(unsigned long)map_file(argv[arg++], &size);
+		image->size = size;
+		image->target_address = 0;
+
+		if (arg < argc && strcmp(argv[arg], "-l") == 0) {
+			if (arg + 1 >= argc) {
+				help(argv[0]);
+				exit(1);
+			}
+			errno = 0;
+			image->target_address =
+				strtoll(argv[arg + 1], &endp, 0);
+			if (errno != 0 || *endp != 0) {
+				help(argv[0]);
+				exit(1);
+			}
+			arg += 2;
+		}
+		image++;
+		num_images++;
+	}
+	return num_images;
+}
+
+static void unmap_images(struct jailhouse_preload_image *image,
+			 unsigned int num_images)
+{
+	while (num_images-- > 0) {
+		munmap((void *)(unsigned long)image->source_address,
+		       image->size);
+		image++;
+	}
+}
+
 static int enable(int argc, char *argv[])
 {
 	void *config;
@@ -107,65 +206,400 @@ static int enable(int argc, char *argv[])
 
 static int cell_create(int argc, char *argv[])
 {
-	struct {
-		struct jailhouse_new_cell cell;
-		struct jailhouse_preload_image image;
-	} params;
-	struct jailhouse_new_cell *cell = &params.cell;
-	struct jailhouse_preload_image *image = params.cell.image;
+	struct jailhouse_new_cell *cell;
 	size_t size;
 	int err, fd;
-	char *endp;
 
-	if (argc != 5 && argc != 7) {
+	if (argc < 5) {
 		help(argv[0]);
 		exit(1);
 	}
 
+	cell = malloc(sizeof(*cell) +
+		      sizeof(struct jailhouse_preload_image) * (argc - 4));
+	if (!cell) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
 	cell->config_address = (unsigned long)read_file(argv[3], &size);
 	cell->config_size = size;
-	cell->num_preload_images = 1;
+	cell->num_preload_images = parse_images(argc, argv, 4, cell->image);
 
-	image->source_address = (unsigned long)read_file(argv[4], &size);
-	image->size = size;
-	image->target_address = 0;
+	fd = open_dev();
 
-	if (argc == 7) {
-		errno = 0;
-		image->target_address = strtoll(argv[6], &endp, 0);
-		if (errno != 0 || *endp != 0 || strcmp(argv[5], "-l") != 0) {
-			help(argv[0]);
+	err = ioctl(fd, JAILHOUSE_CELL_CREATE, cell);
+	if (err)
+		perror("JAILHOUSE_CELL_CREATE");
+
+	close(fd);
+	unmap_images(cell->image, cell->num_preload_images);
+	free((void *)(unsigned long)cell->config_address);
+	free(cell);
+
+	return err;
+}
+
+static int cell_load(int argc, char *argv[])
+{
+	struct jailhouse_cell_load *load;
+	int err, fd;
+
+	if (argc < 5 || strlen(argv[3]) > JAILHOUSE_CELL_NAME_MAXLEN) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	load = malloc(sizeof(*load) +
+		      sizeof(struct jailhouse_preload_image) * (argc - 4));
+	if (!load) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	memset(load, 0, sizeof(*load));
+	strcpy(load->name, argv[3]);
+	load->num_preload_images = parse_images(argc, argv, 4, load->image);
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_CELL_LOAD, load);
+	if (err)
+		perror("JAILHOUSE_CELL_LOAD");
+
+	close(fd);
+	unmap_images(load->image, load->num_preload_images);
+	free(load);
+
+	return err;
+}
+
+#define SNAPSHOT_SIGNATURE	"JHSNAP01"
+
+/* followed by the CPU states and the memory of the cell */
+struct snapshot_header {
+	char signature[8];
+	__u32 num_cpus;
+	__u32 cpu_state_size;
+	__u64 ram_size;
+};
+
+static void write_all(int fd, const void *data, size_t size,
+		      const char *name)
+{
+	const char *buffer = data;
+	ssize_t written;
+
+	while (size > 0) {
+		written = write(fd, buffer, size);
+		if (written < 0) {
+			fprintf(stderr, "writing %s: %s\n", name,
+				strerror(errno));
 			exit(1);
 		}
+		buffer += written;
+		size -= written;
+	}
+}
+
+static int cell_save(int argc, char *argv[])
+{
+	struct jailhouse_cell_snapshot snapshot;
+	struct snapshot_header header;
+	void *cpu_states, *ram;
+	int err, fd, out;
+
+	if (argc != 5 || strlen(argv[3]) > JAILHOUSE_CELL_NAME_MAXLEN) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&snapshot, 0, sizeof(snapshot));
+	strcpy(snapshot.name, argv[3]);
+
+	fd = open_dev();
+
+	/* the first call only reports the sizes */
+	err = ioctl(fd, JAILHOUSE_CELL_SAVE, &snapshot);
+	if (err && errno != ENOSPC) {
+		perror("JAILHOUSE_CELL_SAVE");
+		close(fd);
+		return err;
+	}
+
+	cpu_states = malloc(snapshot.num_cpus * snapshot.cpu_state_size);
+	ram = malloc(snapshot.ram_size);
+	if (!cpu_states || !ram) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	snapshot.cpu_states = (unsigned long)cpu_states;
+	snapshot.ram = (unsigned long)ram;
+
+	err = ioctl(fd, JAILHOUSE_CELL_SAVE, &snapshot);
+	if (err) {
+		perror("JAILHOUSE_CELL_SAVE");
+		goto free_out;
+	}
+
+	out = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		fprintf(stderr, "opening %s: %s\n", argv[4], strerror(errno));
+		exit(1);
+	}
+
+	memcpy(header.signature, SNAPSHOT_SIGNATURE, sizeof(header.signature));
+	header.num_cpus = snapshot.num_cpus;
+	header.cpu_state_size = snapshot.cpu_state_size;
+	header.ram_size = snapshot.ram_size;
+
+	write_all(out, &header, sizeof(header), argv[4]);
+	write_all(out, cpu_states, snapshot.num_cpus * snapshot.cpu_state_size,
+		  argv[4]);
+	write_all(out, ram, snapshot.ram_size, argv[4]);
+
+	close(out);
+
+free_out:
+	close(fd);
+	free(ram);
+	free(cpu_states);
+
+	return err;
+}
+
+static int cell_restore(int argc, char *argv[])
+{
+	struct jailhouse_cell_snapshot snapshot;
+	struct snapshot_header *header;
+	size_t size, states_size;
+	int err, fd;
+
+	if (argc != 5 || strlen(argv[3]) > JAILHOUSE_CELL_NAME_MAXLEN) {
+		help(argv[0]);
+		exit(1);
 	}
 
+	header = map_file(argv[4], &size);
+	if (size < sizeof(*header) ||
+	    memcmp(header->signature, SNAPSHOT_SIGNATURE,
+		   sizeof(header->signature)) != 0) {
+		fprintf(stderr, "%s: not a cell snapshot\n", argv[4]);
+		exit(1);
+	}
+	states_size = (size_t)header->num_cpus * header->cpu_state_size;
+	if (size != sizeof(*header) + states_size + header->ram_size) {
+		fprintf(stderr, "%s: truncated cell snapshot\n", argv[4]);
+		exit(1);
+	}
+
+	memset(&snapshot, 0, sizeof(snapshot));
+	strcpy(snapshot.name, argv[3]);
+	snapshot.num_cpus = header->num_cpus;
+	snapshot.cpu_state_size = header->cpu_state_size;
+	snapshot.ram_size = header->ram_size;
+	snapshot.cpu_states = (unsigned long)(header + 1);
+	snapshot.ram = snapshot.cpu_states + states_size;
+
 	fd = open_dev();
 
-	err = ioctl(fd, JAILHOUSE_CELL_CREATE, &params);
+	err = ioctl(fd, JAILHOUSE_CELL_RESTORE, &snapshot);
 	if (err)
-		perror("JAILHOUSE_CELL_CREATE");
+		perror("JAILHOUSE_CELL_RESTORE");
+
+	close(fd);
+	munmap(header, size);
+
+	return err;
+}
+
+static int cell_by_name(int argc, char *argv[], unsigned long request,
+			const char *request_name)
+{
+	int err, fd;
+
+	if (argc != 4) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, request, argv[3]);
+	if (err)
+		perror(request_name);
 
 	close(fd);
-	free((void *)(unsigned long)cell->config_address);
-	free((void *)(unsigned long)image->source_address);
 
 	return err;
 }
 
-static int cell_destroy(int argc, char *argv[])
+static int cell_doorbell(int argc, char *argv[])
 {
+	unsigned long id;
 	int err, fd;
+	char *endp;
 
 	if (argc != 4) {
 		help(argv[0]);
 		exit(1);
 	}
 
+	errno = 0;
+	id = strtoul(argv[3], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
 	fd = open_dev();
 
-	err = ioctl(fd, JAILHOUSE_CELL_DESTROY, argv[3]);
+	err = ioctl(fd, JAILHOUSE_CELL_DOORBELL, id);
 	if (err)
-		perror("JAILHOUSE_CELL_DESTROY");
+		perror("JAILHOUSE_CELL_DOORBELL");
+
+	close(fd);
+
+	return err;
+}
+
+/* prints the runs of pages of the region written since the last fetch */
+static int cell_dirty_fetch(int argc, char *argv[])
+{
+	struct jailhouse_cell_dirty_log req;
+	unsigned long long page, start, dirty = 0;
+	__u64 *bitmap;
+	int err, fd;
+	char *endp;
+
+	if (argc != 6 || strlen(argv[4]) > JAILHOUSE_CELL_NAME_MAXLEN) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	strcpy(req.name, argv[4]);
+	errno = 0;
+	req.region = strtoul(argv[5], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	/* the first call only reports the size of the region */
+	err = ioctl(fd, JAILHOUSE_CELL_DIRTY_LOG_FETCH, &req);
+	if (err && errno != ENOSPC) {
+		perror("JAILHOUSE_CELL_DIRTY_LOG_FETCH");
+		close(fd);
+		return err;
+	}
+
+	bitmap = calloc((req.num_pages + 63) / 64, sizeof(__u64));
+	if (!bitmap) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+	req.bitmap = (unsigned long)bitmap;
+
+	err = ioctl(fd, JAILHOUSE_CELL_DIRTY_LOG_FETCH, &req);
+	if (err) {
+		perror("JAILHOUSE_CELL_DIRTY_LOG_FETCH");
+		goto free_out;
+	}
+
+	for (page = 0; page < req.num_pages; page++) {
+		if (!(bitmap[page / 64] & (1ULL << (page % 64))))
+			continue;
+		start = page;
+		while (page + 1 < req.num_pages &&
+		       bitmap[(page + 1) / 64] & (1ULL << ((page + 1) % 64)))
+			page++;
+		printf("  pages 0x%llx-0x%llx\n", start, page);
+		dirty += page - start + 1;
+	}
+	printf("%llu of %llu pages dirty\n", dirty,
+	       (unsigned long long)req.num_pages);
+
+free_out:
+	close(fd);
+	free(bitmap);
+
+	return err;
+}
+
+static int cell_dirty_log(int argc, char *argv[])
+{
+	unsigned long request;
+	const char *name;
+	int err, fd;
+
+	if (argc >= 4 && strcmp(argv[3], "fetch") == 0)
+		return cell_dirty_fetch(argc, argv);
+
+	if (argc != 5) {
+		help(argv[0]);
+		exit(1);
+	}
+	if (strcmp(argv[3], "start") == 0) {
+		request = JAILHOUSE_CELL_DIRTY_LOG_START;
+		name = "JAILHOUSE_CELL_DIRTY_LOG_START";
+	} else if (strcmp(argv[3], "stop") == 0) {
+		request = JAILHOUSE_CELL_DIRTY_LOG_STOP;
+		name = "JAILHOUSE_CELL_DIRTY_LOG_STOP";
+	} else {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, request, argv[4]);
+	if (err)
+		perror(name);
+
+	close(fd);
+
+	return err;
+}
+
+static int cell_cpu(int argc, char *argv[])
+{
+	struct jailhouse_cell_cpu req;
+	unsigned long request;
+	const char *name;
+	char *endp;
+	int err, fd;
+
+	if (argc != 6 || strlen(argv[4]) > JAILHOUSE_CELL_NAME_MAXLEN) {
+		help(argv[0]);
+		exit(1);
+	}
+	if (strcmp(argv[3], "add") == 0) {
+		request = JAILHOUSE_CELL_ADD_CPU;
+		name = "JAILHOUSE_CELL_ADD_CPU";
+	} else if (strcmp(argv[3], "remove") == 0) {
+		request = JAILHOUSE_CELL_REMOVE_CPU;
+		name = "JAILHOUSE_CELL_REMOVE_CPU";
+	} else {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	strcpy(req.name, argv[4]);
+	req.cpu_id = strtoul(argv[5], &endp, 0);
+	if (*endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, request, &req);
+	if (err)
+		perror(name);
 
 	close(fd);
 
@@ -184,7 +618,26 @@ static int cell_management(int argc, char *argv[])
 	if (strcmp(argv[2], "create") == 0)
 		err = cell_create(argc, argv);
 	else if (strcmp(argv[2], "destroy") == 0)
-		err = cell_destroy(argc, argv);
+		err = cell_by_name(argc, argv, JAILHOUSE_CELL_DESTROY,
+				   "JAILHOUSE_CELL_DESTROY");
+	else if (strcmp(argv[2], "load") == 0)
+		err = cell_load(argc, argv);
+	else if (strcmp(argv[2], "start") == 0)
+		err = cell_by_name(argc, argv, JAILHOUSE_CELL_START,
+				   "JAILHOUSE_CELL_START");
+	else if (strcmp(argv[2], "stop") == 0)
+		err = cell_by_name(argc, argv, JAILHOUSE_CELL_STOP,
+				   "JAILHOUSE_CELL_STOP");
+	else if (strcmp(argv[2], "save") == 0)
+		err = cell_save(argc, argv);
+	else if (strcmp(argv[2], "restore") == 0)
+		err = cell_restore(argc, argv);
+	else if (strcmp(argv[2], "dirty") == 0)
+		err = cell_dirty_log(argc, argv);
+	else if (strcmp(argv[2], "cpu") == 0)
+		err = cell_cpu(argc, argv);
+	else if (strcmp(argv[2], "doorbell") == 0)
+		err = cell_doorbell(argc, argv);
 	else {
 		help(argv[0]);
 		exit(1);
@@ -193,6 +646,563 @@ static int cell_management(int argc, char *argv[])
 	return err;
 }
 
+static const char *pool_names[JAILHOUSE_NUM_POOLS] = {
+	[JAILHOUSE_POOL_MEM] = "memory",
+	[JAILHOUSE_POOL_REMAP] = "remapping",
+	[JAILHOUSE_POOL_NODE(0)] = "node 0",
+	[JAILHOUSE_POOL_NODE(1)] = "node 1",
+	[JAILHOUSE_POOL_NODE(2)] = "node 2",
+	[JAILHOUSE_POOL_NODE(3)] = "node 3",
+};
+
+static const char *pool_user_names[JAILHOUSE_NUM_POOL_USERS] = {
+	[JAILHOUSE_POOL_USER_HYPERVISOR] = "hypervisor",
+	[JAILHOUSE_POOL_USER_EPT] = "ept tables",
+	[JAILHOUSE_POOL_USER_VTD] = "vt-d tables",
+	[JAILHOUSE_POOL_USER_CELL] = "cells",
+	[JAILHOUSE_POOL_USER_CPU_SET] = "cpu sets",
+	[JAILHOUSE_POOL_USER_REMAP] = "remappings",
+};
+
+static int pool_stats(int argc, char *argv[])
+{
+	unsigned long long pages, used, peak, largest;
+	struct jailhouse_pool_stats stats;
+	unsigned int pool, n;
+	int err = 0, fd;
+
+	if (argc != 2) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	for (pool = 0; pool < JAILHOUSE_NUM_POOLS; pool++) {
+		stats.pool_id = pool;
+		err = ioctl(fd, JAILHOUSE_POOL_STATS, &stats);
+		if (err) {
+			perror("JAILHOUSE_POOL_STATS");
+			break;
+		}
+
+		pages = stats.value[JAILHOUSE_POOL_STAT_PAGES];
+		used = stats.value[JAILHOUSE_POOL_STAT_USED];
+		peak = stats.value[JAILHOUSE_POOL_STAT_PEAK];
+		largest = stats.value[JAILHOUSE_POOL_STAT_LARGEST_FREE];
+
+		/* NUMA nodes without hypervisor memory */
+		if (pages == 0)
+			continue;
+
+		printf("%s pool: %llu of %llu pages used, peak %llu\n",
+		       pool_names[pool], used, pages, peak);
+		/* share of free pages not usable by the largest allocation */
+		printf("  largest free run %llu pages, fragmentation %llu%%\n",
+		       largest,
+		       pages > used ? 100 - largest * 100 / (pages - used) : 0);
+		printf("  %-24s%12s%12s\n", "user", "used", "peak");
+		for (n = 0; n < JAILHOUSE_NUM_POOL_USERS; n++)
+			printf("  %-24s%12llu%12llu\n", pool_user_names[n],
+			       (unsigned long long)
+			       stats.value[JAILHOUSE_POOL_STAT_USER_USED + n],
+			       (unsigned long long)
+			       stats.value[JAILHOUSE_POOL_STAT_USER_PEAK + n]);
+	}
+
+	close(fd);
+
+	return err;
+}
+
+static const char *stat_names[JAILHOUSE_CPU_STAT_APIC_REG] = {
+	[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL] = "vmexits total",
+	[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT] = "vmexits management",
+	[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL] = "vmexits hypercall",
+	[JAILHOUSE_CPU_STAT_VMEXITS_CPUID] = "vmexits cpuid",
+	[JAILHOUSE_CPU_STAT_VMEXITS_CR] = "vmexits cr access",
+	[JAILHOUSE_CPU_STAT_VMEXITS_MSR] = "vmexits msr access",
+	[JAILHOUSE_CPU_STAT_VMEXITS_XAPIC] = "vmexits xapic access",
+	[JAILHOUSE_CPU_STAT_VMEXITS_CYCLES] = "cycles in vmexits",
+	[JAILHOUSE_CPU_STAT_VMEXITS_MMIO] = "vmexits mmio",
+	[JAILHOUSE_CPU_STAT_VMEXITS_PIO] = "vmexits pio",
+	[JAILHOUSE_CPU_STAT_VMEXITS_HLT] = "vmexits hlt",
+	[JAILHOUSE_CPU_STAT_IDLE_CYCLES] = "cycles idle",
+};
+
+static int print_cpu_stats(int fd, unsigned int cpu_id)
+{
+	struct jailhouse_cpu_stats stats;
+	unsigned int n;
+	int err;
+
+	stats.cpu_id = cpu_id;
+	err = ioctl(fd, JAILHOUSE_CPU_STATS, &stats);
+	if (err)
+		return err;
+
+	printf("CPU %d:\n", cpu_id);
+	for (n = 0; n < JAILHOUSE_CPU_STAT_APIC_REG; n++)
+		printf("  %-24s%llu\n", stat_names[n],
+		       (unsigned long long)stats.value[n]);
+	for (n = 0; n < JAILHOUSE_CPU_STAT_NUM_APIC_REGS; n++)
+		if (stats.value[JAILHOUSE_CPU_STAT_APIC_REG + n])
+			printf("  apic register 0x%02x     %llu\n", n,
+			       (unsigned long long)
+			       stats.value[JAILHOUSE_CPU_STAT_APIC_REG + n]);
+
+	return 0;
+}
+
+static int cpu_stats(int argc, char *argv[])
+{
+	unsigned int cpu_id;
+	int err = 0, fd;
+	char *endp;
+	long cpus;
+
+	if (argc > 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	if (argc == 3) {
+		errno = 0;
+		cpu_id = strtoul(argv[2], &endp, 0);
+		if (errno != 0 || *endp != 0) {
+			help(argv[0]);
+			exit(1);
+		}
+		err = print_cpu_stats(fd, cpu_id);
+		if (err)
+			perror("JAILHOUSE_CPU_STATS");
+	} else {
+		cpus = sysconf(_SC_NPROCESSORS_CONF);
+		for (cpu_id = 0; cpu_id < cpus; cpu_id++) {
+			err = print_cpu_stats(fd, cpu_id);
+			if (err) {
+				perror("JAILHOUSE_CPU_STATS");
+				break;
+			}
+		}
+	}
+
+	close(fd);
+
+	return err;
+}
+
+static const char *trace_names[] = {
+	[JAILHOUSE_TRACE_VMEXIT] = "vmexit",
+	[JAILHOUSE_TRACE_HYPERCALL] = "hypercall",
+	[JAILHOUSE_TRACE_UNKNOWN_HYPERCALL] = "unknown hypercall",
+	[JAILHOUSE_TRACE_SIPI] = "sipi",
+	[JAILHOUSE_TRACE_CELL_SUSPEND] = "cell suspend",
+	[JAILHOUSE_TRACE_CELL_RESUME] = "cell resume",
+	[JAILHOUSE_TRACE_IPI_OUTSIDE_CELL] = "ipi outside cell",
+	[JAILHOUSE_TRACE_DOORBELL] = "doorbell",
+};
+
+#define TRACE_BUFFER_EVENTS	64
+
+static int cpu_trace(int argc, char *argv[])
+{
+	struct jailhouse_trace_event events[TRACE_BUFFER_EVENTS];
+	struct jailhouse_trace_read req;
+	const char *name;
+	unsigned int n;
+	int err, fd;
+	char *endp;
+
+	if (argc != 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	errno = 0;
+	req.cpu_id = strtoul(argv[2], &endp, 0);
+	if (errno != 0 || *endp != 0) {
+		help(argv[0]);
+		exit(1);
+	}
+	req.buffer = (unsigned long)events;
+
+	fd = open_dev();
+
+	do {
+		req.num_events = TRACE_BUFFER_EVENTS;
+		err = ioctl(fd, JAILHOUSE_TRACE_READ, &req);
+		if (err) {
+			perror("JAILHOUSE_TRACE_READ");
+			break;
+		}
+		if (req.lost_events)
+			printf("(%llu events lost)\n",
+			       (unsigned long long)req.lost_events);
+		for (n = 0; n < req.num_events; n++) {
+			name = NULL;
+			if (events[n].event < sizeof(trace_names) /
+					      sizeof(trace_names[0]))
+				name = trace_names[events[n].event];
+			printf("%20llu %-20s %#18llx %#18llx\n",
+			       (unsigned long long)events[n].timestamp,
+			       name ? name : "unknown",
+			       (unsigned long long)events[n].arg[0],
+			       (unsigned long long)events[n].arg[1]);
+		}
+	} while (req.num_events == TRACE_BUFFER_EVENTS);
+
+	close(fd);
+
+	return err;
+}
+
+#define PROFILE_DEFAULT_PERIOD	1000000
+#define PROFILE_BUFFER_SAMPLES	4096
+/* drain the rings well before they overflow at the default period */
+#define PROFILE_POLL_US		10000
+
+struct profile_symbol {
+	unsigned long address;
+	char *name;
+	unsigned long samples;
+};
+
+struct profile_reason {
+	unsigned long reason;
+	unsigned long samples;
+};
+
+static struct profile_symbol *profile_symbols;
+static unsigned int num_profile_symbols;
+static struct profile_reason *profile_reasons;
+static unsigned int num_profile_reasons;
+
+/* text symbols of hypervisor.o by address, which is their offset */
+static void profile_load_symbols(const char *object)
+{
+	unsigned int capacity = 0;
+	char line[256], name[200];
+	unsigned long address;
+	char type;
+	FILE *nm;
+
+	snprintf(line, sizeof(line), "nm -n --defined-only %s", object);
+	nm = popen(line, "r");
+	if (!nm) {
+		perror("nm");
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), nm)) {
+		if (sscanf(line, "%lx %c %199s", &address, &type, name) != 3 ||
+		    (type != 't' && type != 'T'))
+			continue;
+		if (num_profile_symbols == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			profile_symbols = realloc(profile_symbols, capacity *
+						  sizeof(*profile_symbols));
+			if (!profile_symbols) {
+				fprintf(stderr, "insufficient memory\n");
+				exit(1);
+			}
+		}
+		profile_symbols[num_profile_symbols].address = address;
+		profile_symbols[num_profile_symbols].name = strdup(name);
+		profile_symbols[num_profile_symbols].samples = 0;
+		num_profile_symbols++;
+	}
+
+	if (pclose(nm) != 0 || num_profile_symbols == 0) {
+		fprintf(stderr, "no symbols found in %s\n", object);
+		exit(1);
+	}
+}
+
+static struct profile_symbol *profile_lookup(unsigned long offset)
+{
+	unsigned int low = 0, high = num_profile_symbols, mid;
+
+	if (offset < profile_symbols[0].address)
+		return NULL;
+	/* the last symbol starting at or below offset */
+	while (high - low > 1) {
+		mid = (low + high) / 2;
+		if (profile_symbols[mid].address <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+	return &profile_symbols[low];
+}
+
+static void profile_count_reason(unsigned long reason)
+{
+	unsigned int n;
+
+	for (n = 0; n < num_profile_reasons; n++)
+		if (profile_reasons[n].reason == reason)
+			break;
+	if (n == num_profile_reasons) {
+		profile_reasons = realloc(profile_reasons, (n + 1) *
+					  sizeof(*profile_reasons));
+		if (!profile_reasons) {
+			fprintf(stderr, "insufficient memory\n");
+			exit(1);
+		}
+		profile_reasons[n].reason = reason;
+		profile_reasons[n].samples = 0;
+		num_profile_reasons++;
+	}
+	profile_reasons[n].samples++;
+}
+
+static void profile_count_sample(const struct jailhouse_profile_sample *sample,
+				 unsigned long *guest, unsigned long *unknown)
+{
+	struct profile_symbol *symbol;
+
+	profile_count_reason(sample->reason);
+	if (sample->reason == JAILHOUSE_PROFILE_IN_GUEST) {
+		(*guest)++;
+		return;
+	}
+	symbol = profile_lookup(sample->offset);
+	if (symbol)
+		symbol->samples++;
+	else
+		(*unknown)++;
+}
+
+static int profile_compare_symbols(const void *a, const void *b)
+{
+	const struct profile_symbol *sa = a, *sb = b;
+
+	if (sa->samples != sb->samples)
+		return sa->samples < sb->samples ? 1 : -1;
+	return 0;
+}
+
+static int profile_compare_reasons(const void *a, const void *b)
+{
+	const struct profile_reason *ra = a, *rb = b;
+
+	if (ra->samples != rb->samples)
+		return ra->samples < rb->samples ? 1 : -1;
+	return 0;
+}
+
+static double profile_timestamp(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* drains the sample rings of all CPUs for a while, then prints a profile */
+static int profile_report(int argc, char *argv[])
+{
+	struct jailhouse_profile_sample samples[PROFILE_BUFFER_SAMPLES];
+	unsigned long total = 0, guest = 0, unknown = 0, dropped = 0;
+	struct jailhouse_profile_samples req;
+	double seconds = 1, end;
+	unsigned int cpu, n;
+	int err = 0, fd;
+	char *endp;
+	long cpus;
+
+	if (argc < 4 || argc > 5) {
+		help(argv[0]);
+		exit(1);
+	}
+	if (argc == 5) {
+		errno = 0;
+		seconds = strtod(argv[4], &endp);
+		if (errno != 0 || *endp != 0 || seconds <= 0) {
+			help(argv[0]);
+			exit(1);
+		}
+	}
+
+	profile_load_symbols(argv[3]);
+
+	fd = open_dev();
+	cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	end = profile_timestamp() + seconds;
+	do {
+		usleep(PROFILE_POLL_US);
+		for (cpu = 0; cpu < cpus; cpu++) {
+			memset(&req, 0, sizeof(req));
+			req.cpu_id = cpu;
+			req.buffer = (unsigned long)samples;
+			do {
+				req.num_samples = PROFILE_BUFFER_SAMPLES;
+				err = ioctl(fd, JAILHOUSE_PROFILE_READ, &req);
+				/* CPUs not handed to the hypervisor */
+				if (err && errno == ENODEV) {
+					err = 0;
+					break;
+				}
+				if (err) {
+					perror("JAILHOUSE_PROFILE_READ");
+					goto close_out;
+				}
+				dropped += req.dropped;
+				total += req.num_samples;
+				for (n = 0; n < req.num_samples; n++)
+					profile_count_sample(&samples[n],
+							     &guest, &unknown);
+			} while (req.num_samples == PROFILE_BUFFER_SAMPLES);
+		}
+	} while (profile_timestamp() < end);
+
+	if (total == 0) {
+		printf("no samples, is profiling started?\n");
+		goto close_out;
+	}
+
+	printf("%lu samples, %lu in guests (%.1f%%), %lu dropped\n\n",
+	       total, guest, 100.0 * guest / total, dropped);
+
+	qsort(profile_symbols, num_profile_symbols, sizeof(*profile_symbols),
+	      profile_compare_symbols);
+	printf("%10s %7s  %s\n", "samples", "%", "function");
+	for (n = 0; n < num_profile_symbols && profile_symbols[n].samples;
+	     n++)
+		printf("%10lu %6.2f%%  %s\n", profile_symbols[n].samples,
+		       100.0 * profile_symbols[n].samples / total,
+		       profile_symbols[n].name);
+	if (unknown)
+		printf("%10lu %6.2f%%  (unknown)\n", unknown,
+		       100.0 * unknown / total);
+
+	qsort(profile_reasons, num_profile_reasons, sizeof(*profile_reasons),
+	      profile_compare_reasons);
+	printf("\n%10s %7s  %s\n", "samples", "%", "exit reason");
+	for (n = 0; n < num_profile_reasons; n++) {
+		printf("%10lu %6.2f%%  ", profile_reasons[n].samples,
+		       100.0 * profile_reasons[n].samples / total);
+		if (profile_reasons[n].reason == JAILHOUSE_PROFILE_IN_GUEST)
+			printf("(guest)\n");
+		else
+			printf("%lu\n", profile_reasons[n].reason);
+	}
+
+close_out:
+	close(fd);
+
+	return err;
+}
+
+static int profile(int argc, char *argv[])
+{
+	unsigned long period = PROFILE_DEFAULT_PERIOD;
+	int err, fd;
+	char *endp;
+
+	if (argc < 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[2], "report") == 0)
+		return profile_report(argc, argv);
+
+	if (strcmp(argv[2], "start") == 0 && argc <= 4) {
+		if (argc == 4) {
+			errno = 0;
+			period = strtoul(argv[3], &endp, 0);
+			if (errno != 0 || *endp != 0 || period == 0) {
+				help(argv[0]);
+				exit(1);
+			}
+		}
+	} else if (strcmp(argv[2], "stop") == 0 && argc == 3) {
+		period = 0;
+	} else {
+		help(argv[0]);
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_PROFILE_SET, period);
+	if (err)
+		perror("JAILHOUSE_PROFILE_SET");
+
+	close(fd);
+
+	return err;
+}
+
+static const char *bench_names[JAILHOUSE_EXIT_BENCH_NUM] = {
+	[JAILHOUSE_EXIT_BENCH_CPUID] = "cpuid",
+	[JAILHOUSE_EXIT_BENCH_HYPERCALL] = "hypercall",
+	[JAILHOUSE_EXIT_BENCH_X2APIC_READ] = "x2apic read",
+	[JAILHOUSE_EXIT_BENCH_X2APIC_WRITE] = "x2apic write",
+	[JAILHOUSE_EXIT_BENCH_XAPIC_READ] = "xapic read",
+	[JAILHOUSE_EXIT_BENCH_XAPIC_WRITE] = "xapic write",
+	[JAILHOUSE_EXIT_BENCH_IPI] = "ipi",
+	[JAILHOUSE_EXIT_BENCH_PIO] = "pio",
+};
+
+static int exit_bench(int argc, char *argv[])
+{
+	struct jailhouse_exit_bench_result *result;
+	struct jailhouse_exit_bench bench;
+	unsigned int n;
+	int err, fd;
+	char *endp;
+
+	if (argc > 3) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	memset(&bench, 0, sizeof(bench));
+	bench.iterations = JAILHOUSE_EXIT_BENCH_MAX_ITERATIONS;
+	if (argc == 3) {
+		errno = 0;
+		bench.iterations = strtoul(argv[2], &endp, 0);
+		if (errno != 0 || *endp != 0) {
+			help(argv[0]);
+			exit(1);
+		}
+	}
+
+	fd = open_dev();
+
+	err = ioctl(fd, JAILHOUSE_EXIT_BENCH, &bench);
+	if (err) {
+		perror("JAILHOUSE_EXIT_BENCH");
+	} else {
+		printf("Round trips in TSC cycles, %u iterations\n",
+		       bench.iterations);
+		printf("  %-16s%12s%12s%12s%12s\n", "operation", "min",
+		       "median", "p99", "max");
+		for (n = 0; n < JAILHOUSE_EXIT_BENCH_NUM; n++) {
+			result = &bench.result[n];
+			if (result->iterations == 0)
+				continue;
+			printf("  %-16s%12llu%12llu%12llu%12llu\n",
+			       bench_names[n],
+			       (unsigned long long)result->min,
+			       (unsigned long long)result->median,
+			       (unsigned long long)result->p99,
+			       (unsigned long long)result->max);
+		}
+	}
+
+	close(fd);
+
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
@@ -213,6 +1223,16 @@ int main(int argc, char *argv[])
 		close(fd);
 	} else if (strcmp(argv[1], "cell") == 0) {
 		err = cell_management(argc, argv);
+	} else if (strcmp(argv[1], "stats") == 0) {
+		err = cpu_stats(argc, argv);
+	} else if (strcmp(argv[1], "pools") == 0) {
+		err = pool_stats(argc, argv);
+	} else if (strcmp(argv[1], "trace") == 0) {
+		err = cpu_trace(argc, argv);
+	} else if (strcmp(argv[1], "profile") == 0) {
+		err = profile(argc, argv);
+	} else if (strcmp(argv[1], "bench") == 0) {
+		err = exit_bench(argc, argv);
 	} else {
 		help(argv[0]);
 		exit(1);